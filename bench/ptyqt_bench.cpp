@@ -0,0 +1,476 @@
+#include <QTest>
+#include "ptyqt.h"
+#include "ptyrelay.h"
+#include <QProcessEnvironment>
+#include <QEventLoop>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+#include <QDateTime>
+#include <QSysInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <functional>
+#include <algorithm>
+#include <sys/resource.h>
+#include <unistd.h>
+
+//output of one throughput run
+#define THROUGHPUT_BYTES (64 * 1024 * 1024)
+#define LATENCY_SAMPLES 1000
+#define SPAWN_SAMPLES 50
+#define WAIT_TIMEOUT_MSEC 60000
+
+//markers are printed as 'ptyqt%s' with the suffix as argument,
+//so the echo of the command line never matches them
+#define BEGIN_MARKER "ptyqt_bench_begin\n"
+#define END_MARKER "ptyqt_bench_end\n"
+
+//machine readable results go to this file (ptyqt_bench.json in the working directory by default),
+//QBENCHMARK style results are available with the usual QTest options, e.g. -o bench.xml,xml
+#define JSON_OUTPUT_ENV "PTYQT_BENCH_JSON"
+
+static QStringList shellEnvironment()
+{
+    return QProcessEnvironment::systemEnvironment().toStringList();
+}
+
+static IPtyProcess *startShell(IPtyProcess::PtyType type)
+{
+    IPtyProcess *pty = PtyQt::createPtyProcess(type);
+    if (!pty)
+        return 0;
+
+    if (!pty->startProcess("/bin/sh", shellEnvironment(), 80, 24))
+    {
+        qWarning() << "start failed:" << pty->lastError();
+        delete pty;
+        return 0;
+    }
+    return pty;
+}
+
+//runs the event loop until 'done' returns true, it is checked on every readyRead
+static bool waitForOutput(IPtyProcess *pty, const std::function<bool()> &done, int timeoutMsec = WAIT_TIMEOUT_MSEC)
+{
+    if (done())
+        return true;
+
+    QEventLoop loop;
+    QTimer timer;
+    timer.setSingleShot(true);
+    QObject::connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    auto connection = QObject::connect(pty->notifier(), &QIODevice::readyRead, [&loop, &done]() {
+        if (done())
+            loop.quit();
+    });
+    timer.start(timeoutMsec);
+    loop.exec();
+    QObject::disconnect(connection);
+    return timer.isActive();
+}
+
+//reads output until 'marker' appears, output after it goes to 'rest'; false on timeout
+static bool waitForMarker(IPtyProcess *pty, const QByteArray &marker, QByteArray *rest = 0)
+{
+    QByteArray output;
+    bool found = waitForOutput(pty, [pty, &output, &marker]() {
+        output.append(pty->readAll());
+        return output.contains(marker);
+    });
+    if (found && rest)
+        *rest = output.mid(output.indexOf(marker) + marker.size());
+    return found;
+}
+
+//user + system CPU time of this process in microseconds
+static qint64 cpuTime()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static qint64 percentile(QVector<qint64> samples, int percent)
+{
+    if (samples.isEmpty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    return samples.at(qMin(samples.size() - 1, samples.size() * percent / 100));
+}
+
+//resident set of a process in bytes, -1 when unknown
+static qint64 residentMemory(qint64 pid)
+{
+    QFile statm(QString("/proc/%1/statm").arg(pid));
+    if (!statm.open(QIODevice::ReadOnly))
+        return -1;
+
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.size() < 2)
+        return -1;
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+}
+
+class PtyQtBench : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase()
+    {
+        //1000 sessions need more descriptors than the usual soft limit
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        QVERIFY(m_dataFile.open());
+        QByteArray line("0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ !\"#$%&'()*+,-./:;<=>?\n");
+        QByteArray block;
+        while (block.size() < 1024 * 1024)
+            block.append(line);
+        block.truncate(1024 * 1024);
+        for (qint64 i = 0; i < THROUGHPUT_BYTES / block.size(); i++)
+            QCOMPARE(m_dataFile.write(block), qint64(block.size()));
+        m_dataFile.flush();
+    }
+
+    void cleanupTestCase()
+    {
+        QJsonObject root;
+        root["library"] = "ptyqt";
+        root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+        root["kernel"] = QSysInfo::kernelType() + " " + QSysInfo::kernelVersion();
+        root["cpu"] = QSysInfo::currentCpuArchitecture();
+        root["results"] = m_results;
+
+        QString fileName = qEnvironmentVariable(JSON_OUTPUT_ENV, "ptyqt_bench.json");
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qWarning() << "unable to write" << fileName << file.errorString();
+            return;
+        }
+        file.write(QJsonDocument(root).toJson());
+        qDebug() << "results written to" << fileName;
+    }
+
+    void throughput_data()
+    {
+        QTest::addColumn<int>("ptyType");
+        QTest::addColumn<QString>("command");
+
+        foreach (IPtyProcess::PtyType type, ptyTypes())
+        {
+            QTest::newRow(qPrintable(typeName(type) + "/cat")) << static_cast<int>(type)
+                                                             << QString("cat '%1'").arg(m_dataFile.fileName());
+            QTest::newRow(qPrintable(typeName(type) + "/yes")) << static_cast<int>(type)
+                                                             << QString("yes | head -c %1").arg(THROUGHPUT_BYTES);
+        }
+    }
+
+    //MB/s of output from the child to readAll()
+    void throughput()
+    {
+        QFETCH(int, ptyType);
+        QFETCH(QString, command);
+
+        QScopedPointer<IPtyProcess> pty(startShell(static_cast<IPtyProcess::PtyType>(ptyType)));
+        QVERIFY(pty);
+
+        //raw mode: no \n -> \r\n translation, so the byte count is exact
+        QByteArray script = QString("stty raw -echo; printf 'ptyqt%s\\n' _bench_begin; %1; printf 'ptyqt%s\\n' _bench_end\n")
+                .arg(command).toUtf8();
+        pty->write(script);
+        QByteArray tail;
+        QVERIFY(waitForMarker(pty.data(), BEGIN_MARKER, &tail));
+
+        QElapsedTimer timer;
+        timer.start();
+        qint64 bytes = tail.size();
+        bool finished = waitForOutput(pty.data(), [&pty, &bytes, &tail]() {
+            QByteArray data = pty->readAll();
+            bytes += data.size();
+            tail = (tail + data.right(64)).right(64);
+            return tail.contains(END_MARKER);
+        });
+        qint64 elapsed = timer.nsecsElapsed();
+        QVERIFY(finished);
+        QVERIFY(bytes >= THROUGHPUT_BYTES);
+
+        double bytesPerSecond = bytes * 1e9 / elapsed;
+        QTest::setBenchmarkResult(bytesPerSecond, QTest::BytesPerSecond);
+
+        QJsonObject metrics;
+        metrics["bytes"] = bytes;
+        metrics["seconds"] = elapsed / 1e9;
+        metrics["mb_per_second"] = bytesPerSecond / (1024 * 1024);
+        report("throughput", metrics);
+
+        pty->kill();
+    }
+
+    void relay_data()
+    {
+        QTest::addColumn<bool>("binaryFrames");
+        QTest::newRow("text") << false;
+        QTest::newRow("relay") << true;
+    }
+
+    //output relayed as messages to a transport: frames/s and CPU per MB;
+    //"text" is the old example: message per readyRead with the QString round trip of sendTextMessage(),
+    //"relay" - PtyRelay binary frames, collected up to the default size and delay
+    void relay()
+    {
+        QFETCH(bool, binaryFrames);
+
+        QScopedPointer<IPtyProcess> pty(startShell(IPtyProcess::UnixPty));
+        QVERIFY(pty);
+
+        QByteArray script = QString("stty raw -echo; printf 'ptyqt%s\\n' _bench_begin; cat '%1'; printf 'ptyqt%s\\n' _bench_end\n")
+                .arg(m_dataFile.fileName()).toUtf8();
+        pty->write(script);
+        QByteArray tail;
+        QVERIFY(waitForMarker(pty.data(), BEGIN_MARKER, &tail));
+
+        QEventLoop loop;
+        QTimer timeout;
+        timeout.setSingleShot(true);
+        QObject::connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
+
+        qint64 frames = 0;
+        qint64 bytes = tail.size();
+        bool finished = false;
+        auto sendFrame = [&frames, &bytes, &tail, &finished, &loop](const QByteArray &frame) {
+            frames++;
+            bytes += frame.size();
+            tail = (tail + frame.right(64)).right(64);
+            finished = tail.contains(END_MARKER);
+            if (finished)
+                loop.quit();
+        };
+
+        QScopedPointer<PtyRelay> relay;
+        if (binaryFrames)
+        {
+            relay.reset(new PtyRelay(pty.data()));
+            relay->setMaxPendingBytes(0);
+            QObject::connect(relay.data(), &PtyRelay::frameReady, sendFrame);
+        }
+        else
+        {
+            QObject::connect(pty->notifier(), &QIODevice::readyRead, [&pty, &sendFrame]() {
+                QString message = QString::fromUtf8(pty->readAll());
+                sendFrame(message.toUtf8());
+            });
+        }
+
+        qint64 cpuStart = cpuTime();
+        QElapsedTimer timer;
+        timer.start();
+        timeout.start(WAIT_TIMEOUT_MSEC);
+        loop.exec();
+        qint64 elapsed = timer.nsecsElapsed();
+        qint64 cpu = cpuTime() - cpuStart;
+        QVERIFY(finished);
+        QVERIFY(bytes >= THROUGHPUT_BYTES);
+
+        double framesPerSecond = frames * 1e9 / elapsed;
+        double megabytes = bytes / (1024.0 * 1024.0);
+        QTest::setBenchmarkResult(framesPerSecond, QTest::Events);
+
+        QJsonObject metrics;
+        metrics["bytes"] = bytes;
+        metrics["frames"] = frames;
+        metrics["frames_per_second"] = framesPerSecond;
+        metrics["average_frame_bytes"] = static_cast<double>(bytes) / frames;
+        metrics["mb_per_second"] = megabytes * 1e9 / elapsed;
+        metrics["cpu_ms_per_mb"] = cpu / 1e3 / megabytes;
+        report("relay", metrics);
+
+        relay.reset();
+        pty->kill();
+    }
+
+    void latency_data()
+    {
+        QTest::addColumn<int>("ptyType");
+        foreach (IPtyProcess::PtyType type, ptyTypes())
+            QTest::newRow(qPrintable(typeName(type))) << static_cast<int>(type);
+    }
+
+    //keystroke round trip: write() -> cat echoes it -> readyRead -> readAll()
+    void latency()
+    {
+        QFETCH(int, ptyType);
+
+        QScopedPointer<IPtyProcess> pty(startShell(static_cast<IPtyProcess::PtyType>(ptyType)));
+        QVERIFY(pty);
+
+        pty->write("stty raw -echo; printf 'ptyqt%s\\n' _bench_begin; exec cat\n");
+        QVERIFY(waitForMarker(pty.data(), BEGIN_MARKER));
+
+        QVector<qint64> samples;
+        samples.reserve(LATENCY_SAMPLES);
+        for (int i = 0; i < LATENCY_SAMPLES; i++)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            pty->write("x");
+            bool echoed = waitForOutput(pty.data(), [&pty]() {
+                return !pty->readAll().isEmpty();
+            }, 5000);
+            QVERIFY(echoed);
+            samples.append(timer.nsecsElapsed());
+        }
+
+        qint64 sum = 0;
+        foreach (qint64 sample, samples)
+            sum += sample;
+
+        QTest::setBenchmarkResult(percentile(samples, 50) / 1e6, QTest::WalltimeMilliseconds);
+
+        QJsonObject metrics;
+        metrics["samples"] = samples.size();
+        metrics["p50_us"] = percentile(samples, 50) / 1e3;
+        metrics["p99_us"] = percentile(samples, 99) / 1e3;
+        metrics["max_us"] = percentile(samples, 100) / 1e3;
+        metrics["mean_us"] = sum / samples.size() / 1e3;
+        report("latency", metrics);
+
+        pty->kill();
+    }
+
+    void spawn_data()
+    {
+        QTest::addColumn<int>("ptyType");
+        foreach (IPtyProcess::PtyType type, ptyTypes())
+            QTest::newRow(qPrintable(typeName(type))) << static_cast<int>(type);
+    }
+
+    //time of createPtyProcess() + startProcess(), until the shell is running
+    void spawn()
+    {
+        QFETCH(int, ptyType);
+
+        QVector<qint64> samples;
+        for (int i = 0; i < SPAWN_SAMPLES; i++)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            IPtyProcess *pty = startShell(static_cast<IPtyProcess::PtyType>(ptyType));
+            qint64 elapsed = timer.nsecsElapsed();
+            QVERIFY(pty);
+            samples.append(elapsed);
+
+            pty->kill();
+            delete pty;
+        }
+
+        QTest::setBenchmarkResult(percentile(samples, 50) / 1e6, QTest::WalltimeMilliseconds);
+
+        QJsonObject metrics;
+        metrics["samples"] = samples.size();
+        metrics["p50_us"] = percentile(samples, 50) / 1e3;
+        metrics["p99_us"] = percentile(samples, 99) / 1e3;
+        report("spawn", metrics);
+    }
+
+    void idleSessionMemory_data()
+    {
+        QTest::addColumn<int>("ptyType");
+        QTest::addColumn<int>("sessions");
+
+        foreach (IPtyProcess::PtyType type, ptyTypes())
+        {
+            QList<int> counts;
+            counts << 1 << 100 << 1000;
+            foreach (int count, counts)
+                QTest::newRow(qPrintable(QString("%1/%2").arg(typeName(type)).arg(count))) << static_cast<int>(type) << count;
+        }
+    }
+
+    //resident memory per idle shell: in this process and in the shell itself
+    void idleSessionMemory()
+    {
+        QFETCH(int, ptyType);
+        QFETCH(int, sessions);
+
+        qint64 before = residentMemory(getpid());
+        if (before < 0)
+            QSKIP("resident memory is read from /proc");
+
+        QList<IPtyProcess *> ptys;
+        for (int i = 0; i < sessions; i++)
+        {
+            IPtyProcess *pty = startShell(static_cast<IPtyProcess::PtyType>(ptyType));
+            if (!pty)
+                break;
+            ptys.append(pty);
+        }
+
+        //shells print their prompts and go idle
+        QTest::qWait(1000);
+        foreach (IPtyProcess *pty, ptys)
+            pty->readAll();
+
+        qint64 after = residentMemory(getpid());
+        qint64 children = 0;
+        foreach (IPtyProcess *pty, ptys)
+            children += qMax<qint64>(residentMemory(pty->pid()), 0);
+
+        int started = ptys.size();
+        foreach (IPtyProcess *pty, ptys)
+        {
+            pty->kill();
+            delete pty;
+        }
+
+        if (started < sessions)
+            QSKIP(qPrintable(QString("only %1 sessions started, check ulimit -n and -u").arg(started)));
+
+        qint64 perSession = (after - before) / sessions;
+        QTest::setBenchmarkResult(perSession, QTest::BytesAllocated);
+
+        QJsonObject metrics;
+        metrics["sessions"] = sessions;
+        metrics["host_bytes_per_session"] = perSession;
+        metrics["child_bytes_per_session"] = children / sessions;
+        report("idle_session_memory", metrics);
+    }
+
+private:
+    static QList<IPtyProcess::PtyType> ptyTypes()
+    {
+        QList<IPtyProcess::PtyType> types;
+        types << IPtyProcess::UnixPty;
+#ifdef Q_OS_LINUX
+        types << IPtyProcess::ReactorPty;
+#endif
+        return types;
+    }
+
+    static QString typeName(IPtyProcess::PtyType type)
+    {
+        return type == IPtyProcess::ReactorPty ? QString("ReactorPty") : QString("UnixPty");
+    }
+
+    void report(const QString &benchmark, QJsonObject metrics)
+    {
+        metrics["benchmark"] = benchmark;
+        metrics["tag"] = QString(QTest::currentDataTag());
+        m_results.append(metrics);
+        qDebug() << benchmark << QTest::currentDataTag() << QJsonDocument(metrics).toJson(QJsonDocument::Compact).constData();
+    }
+
+private:
+    QTemporaryFile m_dataFile;
+    QJsonArray m_results;
+};
+
+QTEST_MAIN(PtyQtBench)
+#include "ptyqt_bench.moc"
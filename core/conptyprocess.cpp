@@ -69,6 +69,14 @@ void PtyBuffer::onReadyRead()
     emit readyRead();
 }
 
+void PtyBuffer::appendOutput(const char *data, qint64 size)
+{
+    m_readBuffer.append(data, static_cast<int>(size));
+    if (m_pty && size > 0)
+        m_pty->notifyOutput(data, size);
+    emitReadyRead();
+}
+
 HRESULT ConPtyProcess::createPseudoConsoleAndPipes(HPCON* phPC, HANDLE* phPipeIn, HANDLE* phPipeOut, qint16 cols, qint16 rows)
 {
     HRESULT hr{ E_UNEXPECTED };
@@ -142,7 +150,7 @@ ConPtyProcess::ConPtyProcess()
     , m_hPipeOut { INVALID_HANDLE_VALUE }
     , m_readThread(nullptr)
 {
-
+    m_buffer.m_pty = this;
 }
 
 ConPtyProcess::~ConPtyProcess()
@@ -237,8 +245,7 @@ bool ConPtyProcess::startProcess(const QString &shellPath, QStringList environme
 
             {
                 QMutexLocker locker(&m_bufferMutex);
-                m_buffer.m_readBuffer.append(szBuffer, dwBytesRead);
-                m_buffer.emitReadyRead();
+                m_buffer.appendOutput(szBuffer, dwBytesRead);
             }
 
             if (QThread::currentThread()->isInterruptionRequested())
@@ -278,6 +285,7 @@ bool ConPtyProcess::resize(qint16 cols, qint16 rows)
     if (res)
     {
         m_size = QPair<qint16, qint16>(cols, rows);
+        notifyResized(cols, rows);
     }
 
     return res;
@@ -349,6 +357,7 @@ qint64 ConPtyProcess::write(const QByteArray &byteArray)
 {
     DWORD dwBytesWritten{};
     WriteFile(m_hPipeOut, byteArray.data(), byteArray.size(), &dwBytesWritten, NULL);
+    notifyInput(byteArray.constData(), dwBytesWritten);
     return dwBytesWritten;
 }
 
@@ -108,13 +108,15 @@ private:
     QString m_lastError;
 };
 
+class ConPtyProcess;
+
 class PtyBuffer : public QIODevice
 {
     friend class ConPtyProcess;
     Q_OBJECT
 public:
 
-    PtyBuffer() {  }
+    PtyBuffer() : m_pty(nullptr) {  }
     ~PtyBuffer() { }
 
     //just empty realization, we need only 'readyRead' signal of this class
@@ -126,12 +128,17 @@ public:
     qint64 size() { return m_readBuffer.size(); }
 
     void emitReadyRead();
+    //output read from the pipe, under the buffer mutex: observers of the pty see it, then readyRead
+    void appendOutput(const char *data, qint64 size);
 
 private slots:
     void onReadyRead();
 
 public:
     QByteArray m_readBuffer;
+
+private:
+    ConPtyProcess *m_pty;
 };
 
 class ConPtyProcessThread : public QThread
@@ -166,8 +173,7 @@ public:
 
             {
                 QMutexLocker locker(m_bufferMutexPointer);
-                m_bufferPointer->m_readBuffer.append(szBuffer, dwBytesRead);
-                m_bufferPointer->emitReadyRead();
+                m_bufferPointer->appendOutput(szBuffer, dwBytesRead);
             }
 
             if (m_isInterruptionRequested)
@@ -203,6 +209,7 @@ private:
 
 class ConPtyProcess : public IPtyProcess
 {
+    friend class PtyBuffer;
     Q_OBJECT
 public:
     ConPtyProcess();
@@ -0,0 +1,523 @@
+#include "hostptyprocess.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define MAX_READ_CHUNK_SIZE (64 * 1024)
+
+HostPtyProcess::HostPtyProcess(const QString &socketPath)
+    : IPtyProcess()
+    , m_socketPath(socketPath.isEmpty() ? PtyHostProtocol::defaultSocketPath() : socketPath)
+    , m_control(-1)
+    , m_master(-1)
+    , m_sessionId(0)
+    , m_exitCode(0)
+    , m_readEof(false)
+    , m_finished(false)
+    , m_readNotify(0)
+    , m_writeNotify(0)
+    , m_controlNotify(0)
+{
+
+}
+
+HostPtyProcess::~HostPtyProcess()
+{
+    detach();
+}
+
+bool HostPtyProcess::startProcess(const QString &shellPath, QStringList environment, qint16 cols, qint16 rows)
+{
+    Q_UNUSED(environment); //daemon gives its shells the default environment, like UnixPty
+    if (m_sessionId != 0)
+    {
+        m_lastError = QString("HostPty Error: process is already running");
+        return false;
+    }
+
+    QElapsedTimer spawnTimer;
+    spawnTimer.start();
+    if (!connectToHost())
+        return false;
+
+    PtyHostMessage message;
+    message.type = PtyHostMessage::Spawn;
+    message.arg1 = cols;
+    message.arg2 = rows;
+    QByteArray payload = QFile::encodeName(shellPath) + '\0' + QFile::encodeName(m_workingDirectory);
+
+    PtyHostMessage reply;
+    int master = -1;
+    if (!request(message, payload, &reply, &master) || !takeSession(reply, master))
+    {
+        release();
+        return false;
+    }
+
+    m_shellPath = shellPath;
+    m_size = QPair<qint16, qint16>(cols, rows);
+    m_stats.setSpawnTime(spawnTimer.nsecsElapsed() / 1000);
+    return true;
+}
+
+bool HostPtyProcess::attach(quint32 sessionId)
+{
+    if (m_sessionId != 0)
+    {
+        m_lastError = QString("HostPty Error: process is already running");
+        return false;
+    }
+
+    if (!connectToHost())
+        return false;
+
+    PtyHostMessage message;
+    message.type = PtyHostMessage::Attach;
+    message.session = sessionId;
+
+    PtyHostMessage reply;
+    int master = -1;
+    if (!request(message, QByteArray(), &reply, &master) || !takeSession(reply, master))
+    {
+        release();
+        return false;
+    }
+
+    m_size = QPair<qint16, qint16>(static_cast<qint16>(reply.arg1), static_cast<qint16>(reply.arg2));
+    return true;
+}
+
+void HostPtyProcess::detach()
+{
+    release();
+}
+
+QList<quint32> HostPtyProcess::sessionIds(const QString &socketPath)
+{
+    QList<quint32> ids;
+
+    HostPtyProcess host(socketPath);
+    if (!host.connectToHost())
+        return ids;
+
+    PtyHostMessage message;
+    message.type = PtyHostMessage::List;
+    if (!PtyHostProtocol::send(host.m_control, message))
+        return ids;
+
+    PtyHostMessage reply;
+    QByteArray payload;
+    int fd = -1;
+    if (!PtyHostProtocol::receive(host.m_control, &reply, &payload, &fd) || reply.type != PtyHostMessage::Ok)
+        return ids;
+
+    QList<QByteArray> items = payload.split(',');
+    for (int i = 0; i < items.size(); i++)
+    {
+        bool ok = false;
+        quint32 id = items.at(i).toUInt(&ok);
+        if (ok)
+            ids.append(id);
+    }
+    return ids;
+}
+
+bool HostPtyProcess::connectToHost()
+{
+    m_control = PtyHostProtocol::connectToHost(m_socketPath, HOST_PTY_REPLY_TIMEOUT_MSEC, &m_lastError);
+    return m_control >= 0;
+}
+
+bool HostPtyProcess::request(const PtyHostMessage &message, const QByteArray &payload, PtyHostMessage *reply, int *fd)
+{
+    if (!PtyHostProtocol::send(m_control, message, payload))
+    {
+        m_lastError = QString("HostPty Error: unable to send request -> %1").arg(strerror(errno));
+        return false;
+    }
+
+    QByteArray replyPayload;
+    forever
+    {
+        if (!PtyHostProtocol::receive(m_control, reply, &replyPayload, fd))
+        {
+            m_lastError = QString("HostPty Error: no reply from %1").arg(m_socketPath);
+            return false;
+        }
+
+        if (reply->type == PtyHostMessage::Ok)
+            return true;
+
+        if (reply->type == PtyHostMessage::Error)
+        {
+            m_lastError = QString("HostPty Error: %1").arg(QString::fromUtf8(replyPayload));
+            return false;
+        }
+
+        //events may come ahead of the reply
+        handleEvent(*reply);
+        if (*fd >= 0)
+            ::close(*fd);
+    }
+}
+
+bool HostPtyProcess::takeSession(const PtyHostMessage &reply, int master)
+{
+    if (master < 0)
+    {
+        m_lastError = QString("HostPty Error: daemon did not pass the pty");
+        return false;
+    }
+
+    //open file description is shared with the daemon, it is non-blocking there too
+    m_master = master;
+    ::fcntl(m_master, F_SETFL, ::fcntl(m_master, F_GETFL) | O_NONBLOCK);
+    m_sessionId = reply.session;
+    m_pid = reply.pid;
+    m_readEof = false;
+    m_finished = false;
+    m_exitCode = 0;
+
+    m_readNotify = new QSocketNotifier(m_master, QSocketNotifier::Read, &m_notifier);
+    m_readNotify->setEnabled(!m_readingPaused);
+    QObject::connect(m_readNotify, SIGNAL(activated(int)), this, SLOT(onReadActivated(int)), Qt::DirectConnection);
+
+    m_writeNotify = new QSocketNotifier(m_master, QSocketNotifier::Write, &m_notifier);
+    m_writeNotify->setEnabled(false);
+    QObject::connect(m_writeNotify, SIGNAL(activated(int)), this, SLOT(onWriteActivated(int)), Qt::DirectConnection);
+
+    //exit of the shell is reported by the daemon, so is its own death (closed socket)
+    m_controlNotify = new QSocketNotifier(m_control, QSocketNotifier::Read, &m_notifier);
+    QObject::connect(m_controlNotify, SIGNAL(activated(int)), this, SLOT(onControlActivated(int)), Qt::DirectConnection);
+    return true;
+}
+
+void HostPtyProcess::onControlActivated(int socket)
+{
+    Q_UNUSED(socket);
+
+    PtyHostMessage message;
+    QByteArray payload;
+    int fd = -1;
+    if (PtyHostProtocol::receive(m_control, &message, &payload, &fd))
+    {
+        if (fd >= 0)
+            ::close(fd);
+        handleEvent(message);
+        return;
+    }
+
+    //daemon is gone, and with it the shell
+    message.type = PtyHostMessage::Exited;
+    message.arg1 = -1;
+    handleEvent(message);
+}
+
+void HostPtyProcess::handleEvent(const PtyHostMessage &message)
+{
+    if (message.type != PtyHostMessage::Exited || m_finished)
+        return;
+
+    m_finished = true;
+    m_exitCode = message.arg1;
+    if (m_controlNotify)
+        m_controlNotify->setEnabled(false);
+
+    //output written before the exit is still in the pty, take what fits
+    if (m_master >= 0 && !m_readEof)
+        readFromMaster();
+    m_notifier.emitReadChannelFinished();
+}
+
+void HostPtyProcess::onReadActivated(int socket)
+{
+    Q_UNUSED(socket);
+
+    m_stats.add(PtyStats::Wakeups);
+    readFromMaster();
+}
+
+void HostPtyProcess::readFromMaster()
+{
+    //same as UnixPty: straight into free space of the ring until EAGAIN or no room
+    qint64 total = 0;
+    while (total < MAX_READ_CHUNK_SIZE * 4)
+    {
+        qint64 room = readRoom();
+        if (room <= 0)
+            break;
+
+        PtyWritableSpan spans[2];
+        if (m_readBuffer.reserve(spans) == 0)
+            break;
+
+        qint64 wanted = qMin(qMin<qint64>(spans[0].size, MAX_READ_CHUNK_SIZE), room);
+        ssize_t len = ::read(m_master, spans[0].data, static_cast<size_t>(wanted));
+        m_stats.add(PtyStats::ReadCalls);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            //EIO: shell is gone, the daemon tells us its exit code
+            m_readEof = true;
+            break;
+        }
+        if (len == 0)
+        {
+            m_readEof = true;
+            break;
+        }
+
+        notifyOutput(spans[0].data, len);
+        m_readBuffer.commit(len);
+        total += len;
+    }
+
+    //on EOF level-triggered notifier would fire forever
+    if (m_readNotify && (readRoom() <= 0 || m_readEof))
+        m_readNotify->setEnabled(false);
+
+    if (total > 0)
+    {
+        m_stats.add(PtyStats::BytesRead, total);
+        m_stats.addReadyRead(m_readBuffer.size());
+        m_notifier.emitReadyRead();
+    }
+}
+
+void HostPtyProcess::onWriteActivated(int socket)
+{
+    Q_UNUSED(socket);
+
+    qint64 written = m_writeQueue.writeTo(m_master);
+    if (written < 0)
+    {
+        //shell is gone, nobody will read the rest
+        m_lastError = QString("HostPty Error: unable to write to master -> %1").arg(strerror(errno));
+        m_writeQueue.clear();
+        written = 0;
+    }
+
+    if (m_writeQueue.isEmpty())
+        m_writeNotify->setEnabled(false);
+
+    reportWriteProgress(written);
+}
+
+void HostPtyProcess::resumeAfterDrain()
+{
+    if (m_readNotify && !m_readNotify->isEnabled() && !m_readingPaused && readRoom() > 0 && !m_readEof)
+        m_readNotify->setEnabled(true);
+}
+
+qint64 HostPtyProcess::readRoom() const
+{
+    qint64 room = m_readBuffer.freeSpace();
+    if (m_readBufferLimit > 0)
+        room = qMin(room, m_readBufferLimit - m_readBuffer.size());
+    return room;
+}
+
+void HostPtyProcess::setReadBufferLimit(qint64 bytes)
+{
+    IPtyProcess::setReadBufferLimit(bytes);
+
+    if (m_readNotify && readRoom() <= 0)
+        m_readNotify->setEnabled(false);
+    resumeAfterDrain();
+}
+
+void HostPtyProcess::pauseReading()
+{
+    IPtyProcess::pauseReading();
+
+    if (m_readNotify)
+        m_readNotify->setEnabled(false);
+}
+
+void HostPtyProcess::resumeReading()
+{
+    IPtyProcess::resumeReading();
+    resumeAfterDrain();
+}
+
+bool HostPtyProcess::resize(qint16 cols, qint16 rows)
+{
+    if (m_master < 0)
+        return false;
+
+    //the pty is ours as much as the daemon's, no round trip needed
+    struct winsize winp;
+    winp.ws_col = cols;
+    winp.ws_row = rows;
+    winp.ws_xpixel = 0;
+    winp.ws_ypixel = 0;
+    if (ioctl(m_master, TIOCSWINSZ, &winp) == -1)
+        return false;
+
+    m_size = QPair<qint16, qint16>(cols, rows);
+    notifyResized(cols, rows);
+    return true;
+}
+
+bool HostPtyProcess::kill()
+{
+    if (m_control < 0 || m_sessionId == 0)
+    {
+        release();
+        return false;
+    }
+
+    bool killed = m_finished;
+    if (!m_finished)
+    {
+        PtyHostMessage message;
+        message.type = PtyHostMessage::Kill;
+        message.session = m_sessionId;
+
+        PtyHostMessage reply;
+        int fd = -1;
+        killed = request(message, QByteArray(), &reply, &fd);
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    release();
+    return killed;
+}
+
+void HostPtyProcess::release()
+{
+    if (m_readNotify)
+    {
+        m_readNotify->setEnabled(false);
+        m_readNotify->disconnect();
+        m_readNotify->deleteLater();
+        m_readNotify = 0;
+    }
+
+    if (m_writeNotify)
+    {
+        m_writeNotify->setEnabled(false);
+        m_writeNotify->disconnect();
+        m_writeNotify->deleteLater();
+        m_writeNotify = 0;
+    }
+    m_writeQueue.clear();
+
+    if (m_controlNotify)
+    {
+        m_controlNotify->setEnabled(false);
+        m_controlNotify->disconnect();
+        m_controlNotify->deleteLater();
+        m_controlNotify = 0;
+    }
+
+    //closed connection tells the daemon that the session is detached
+    if (m_master >= 0)
+    {
+        ::close(m_master);
+        m_master = -1;
+    }
+    if (m_control >= 0)
+    {
+        ::close(m_control);
+        m_control = -1;
+    }
+
+    m_sessionId = 0;
+    m_pid = 0;
+}
+
+IPtyProcess::PtyType HostPtyProcess::type() const
+{
+    return IPtyProcess::HostPty;
+}
+
+QString HostPtyProcess::dumpDebugInfo()
+{
+    return QString("PID: %1, Session: %2, Master: %3, Type: %4, Cols: %5, Rows: %6, Finished: %7, Shell: %8, Socket: %9, %10")
+            .arg(m_pid).arg(m_sessionId).arg(m_master).arg(type())
+            .arg(m_size.first).arg(m_size.second).arg(m_finished)
+            .arg(m_shellPath).arg(m_socketPath).arg(stats().toString());
+}
+
+QIODevice *HostPtyProcess::notifier()
+{
+    return &m_notifier;
+}
+
+QByteArray HostPtyProcess::readAll()
+{
+    QByteArray tmpBuffer = m_readBuffer.readAll();
+    resumeAfterDrain();
+    return tmpBuffer;
+}
+
+int HostPtyProcess::peek(PtySpan spans[2])
+{
+    return m_readBuffer.peek(spans);
+}
+
+void HostPtyProcess::consume(qint64 size)
+{
+    m_readBuffer.consume(size);
+    resumeAfterDrain();
+}
+
+qint64 HostPtyProcess::write(const QByteArray &byteArray)
+{
+    if (m_master < 0 || !m_writeNotify)
+        return -1;
+
+    //keep the order: while anything is queued, new data goes behind it
+    bool wasEmpty = m_writeQueue.isEmpty();
+    m_writeQueue.append(byteArray);
+
+    qint64 written = 0;
+    if (wasEmpty)
+    {
+        written = m_writeQueue.writeTo(m_master);
+        if (written < 0)
+        {
+            m_writeQueue.clear();
+            m_lastError = QString("HostPty Error: unable to write to master -> %1").arg(strerror(errno));
+            return -1;
+        }
+    }
+
+    if (!m_writeQueue.isEmpty())
+    {
+        if (wasEmpty)
+            m_stats.add(PtyStats::WriteStalls);
+        m_writeNotify->setEnabled(true);
+    }
+
+    m_stats.add(PtyStats::BytesWritten, byteArray.size());
+    notifyInput(byteArray.constData(), byteArray.size());
+    reportWriteProgress(written);
+    return byteArray.size();
+}
+
+qint64 HostPtyProcess::bytesToWrite() const
+{
+    return m_writeQueue.size();
+}
+
+bool HostPtyProcess::isAvailable()
+{
+    return true;
+}
+
+void HostPtyProcess::moveToThread(QThread *targetThread)
+{
+    //notifiers are children of the notifier device
+    m_notifier.moveToThread(targetThread);
+}
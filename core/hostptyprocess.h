@@ -0,0 +1,100 @@
+#ifndef HOSTPTYPROCESS_H
+#define HOSTPTYPROCESS_H
+
+#include "iptyprocess.h"
+#include "ptyringbuffer.h"
+#include "ptywritequeue.h"
+#include "ptyhostprotocol.h"
+#include <QIODevice>
+#include <QSocketNotifier>
+
+#define HOST_PTY_REPLY_TIMEOUT_MSEC 5000
+
+//readyRead emitter for host sessions, like ReactorPtyNotifier but on the thread of the session
+class HostPtyNotifier : public QIODevice
+{
+    Q_OBJECT
+public:
+    HostPtyNotifier() {  }
+
+    //just empty realization, we need only 'readyRead' signal of this class
+    qint64 readData(char *data, qint64 maxlen) { Q_UNUSED(data); Q_UNUSED(maxlen); return 0; }
+    qint64 writeData(const char *data, qint64 len) { Q_UNUSED(data); Q_UNUSED(len); return 0; }
+    bool isSequential() const { return true; }
+
+    void emitReadyRead() { emit readyRead(); }
+    void emitReadChannelFinished() { emit readChannelFinished(); }
+};
+
+//unix pty owned by ptyqt-hostd: the shell survives restarts of our process,
+//the daemon passes the master fd over its socket and we read/write it directly;
+//deleting the object only detaches from the session, kill() ends it,
+//attach() takes a running session over (ids come from startProcess() or sessionIds())
+class HostPtyProcess : public IPtyProcess
+{
+    Q_OBJECT
+public:
+    explicit HostPtyProcess(const QString &socketPath = QString()); //empty -> PtyHostProtocol::defaultSocketPath()
+    virtual ~HostPtyProcess();
+
+    virtual bool startProcess(const QString &shellPath, QStringList environment, qint16 cols, qint16 rows);
+    virtual bool resize(qint16 cols, qint16 rows);
+    virtual bool kill();
+    virtual PtyType type() const;
+    virtual QString dumpDebugInfo();
+    virtual QIODevice *notifier();
+    virtual QByteArray readAll();
+    virtual qint64 write(const QByteArray &byteArray);
+    virtual qint64 bytesToWrite() const;
+    virtual bool isAvailable();
+    virtual void moveToThread(QThread *targetThread);
+    virtual int peek(PtySpan spans[2]);
+    virtual void consume(qint64 size);
+    virtual void setReadBufferLimit(qint64 bytes);
+    virtual void pauseReading();
+    virtual void resumeReading();
+
+    QString socketPath() const { return m_socketPath; }
+    //id of the session in the daemon, 0 - none
+    quint32 sessionId() const { return m_sessionId; }
+    bool attach(quint32 sessionId);
+    //close our handles, the shell keeps running in the daemon
+    void detach();
+    //exit code of the shell, valid after readChannelFinished() of notifier()
+    int exitCode() const { return m_exitCode; }
+
+    //running sessions of the daemon
+    static QList<quint32> sessionIds(const QString &socketPath = QString());
+
+private slots:
+    void onReadActivated(int socket);
+    void onWriteActivated(int socket);
+    void onControlActivated(int socket);
+
+private:
+    bool connectToHost();
+    bool request(const PtyHostMessage &message, const QByteArray &payload, PtyHostMessage *reply, int *fd);
+    void handleEvent(const PtyHostMessage &message);
+    bool takeSession(const PtyHostMessage &reply, int master);
+    void readFromMaster();
+    void resumeAfterDrain();
+    qint64 readRoom() const;
+    void release();
+
+private:
+    QString m_socketPath;
+    int m_control;
+    int m_master;
+    quint32 m_sessionId;
+    int m_exitCode;
+    bool m_readEof;
+    bool m_finished;
+    QSocketNotifier *m_readNotify;
+    QSocketNotifier *m_writeNotify;
+    QSocketNotifier *m_controlNotify;
+    PtyRingBuffer m_readBuffer;
+    PtyWriteQueue m_writeQueue;
+    HostPtyNotifier m_notifier;
+};
+
+#endif // HOSTPTYPROCESS_H
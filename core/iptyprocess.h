@@ -3,12 +3,31 @@
 
 #include <QString>
 #include <QDebug>
+#include <QMutex>
+#include <QList>
+#include "ptyringbuffer.h"
+#include "ptystats.h"
 
 #ifdef Q_OS_WIN
 #include <QLocalSocket>
 #endif
 
 #define CONPTY_MINIMAL_WINDOWS_VERSION 18309
+#define DEFAULT_WRITE_HIGH_WATERMARK (1024 * 1024)
+
+//in-process consumer of the output stream (parser, screen model, recorder...),
+//called on the thread which reads the pty (for ReactorPty - reactor worker threads),
+//before the data is available to readAll()
+class IPtyStreamObserver
+{
+public:
+    virtual ~IPtyStreamObserver() { }
+    virtual void ptyOutput(const char *data, qint64 size) = 0;
+    //data accepted by IPtyProcess::write(), on the thread which called it
+    virtual void ptyInput(const char *data, qint64 size) { Q_UNUSED(data); Q_UNUSED(size); }
+    //called after successful IPtyProcess::resize(), on the thread of the process object
+    virtual void ptyResized(qint16 cols, qint16 rows) { Q_UNUSED(cols); Q_UNUSED(rows); }
+};
 
 class IPtyProcess : public QObject
 {
@@ -19,12 +38,22 @@ public:
         UnixPty = 0,
         WinPty = 1,
         ConPty = 2,
-        AutoPty = 3
+        AutoPty = 3,
+        ReactorPty = 4, //unix pty multiplexed by PtyReactor, Linux only
+        HostPty = 5 //unix pty owned by ptyqt-hostd, outlives our process
     };
 
     IPtyProcess()
         : m_pid(0)
         , m_trace(false)
+        , m_coalesceBytes(0)
+        , m_coalesceDelayUsec(0)
+        , m_readBufferLimit(0)
+        , m_readingPaused(false)
+        , m_writeHighWatermark(DEFAULT_WRITE_HIGH_WATERMARK)
+        , m_writeHighWatermarkHit(false)
+        , m_reportingWrites(false)
+        , m_unreportedWritten(0)
     {  }
     virtual ~IPtyProcess() { }
 
@@ -38,22 +67,203 @@ public:
     virtual qint64 write(const QByteArray &byteArray) = 0;
     virtual bool isAvailable() = 0;
     virtual void moveToThread(QThread *targetThread) = 0;
+
+    //non-blocking start: returns at once, result comes as started() or errorOccurred()
+    //default realization calls startProcess() from the event loop of this object,
+    //backends which can do the setup off the caller thread override it
+    virtual void startProcessAsync(const QString &shellPath, const QStringList &environment, qint16 cols, qint16 rows)
+    {
+        m_asyncShellPath = shellPath;
+        m_asyncEnvironment = environment;
+        m_asyncSize = QPair<qint16, qint16>(cols, rows);
+        QMetaObject::invokeMethod(this, "startProcessQueued", Qt::QueuedConnection);
+    }
+
+    //zero-copy access to buffered output, do not mix with readAll() in one read cycle
+    //default realization is based on readAll() for backends without own ring buffer
+    virtual int peek(PtySpan spans[2])
+    {
+        if (m_peekBuffer.isEmpty())
+            m_peekBuffer = readAll();
+        if (m_peekBuffer.isEmpty())
+            return 0;
+
+        spans[0].data = m_peekBuffer.constData();
+        spans[0].size = m_peekBuffer.size();
+        return 1;
+    }
+    virtual void consume(qint64 size)
+    {
+        m_peekBuffer.remove(0, static_cast<int>(size));
+    }
+
+    //output coalescing: emit readyRead when 'maxBytes' are pending or 'maxDelayUsec' passed
+    //since the first pending byte, whichever comes first; 0 for both disables coalescing,
+    //write() always flushes the next output immediately to keep interactive echo snappy
+    //backends without support just keep emitting readyRead on every read
+    virtual void setOutputCoalescing(qint64 maxBytes, int maxDelayUsec)
+    {
+        m_coalesceBytes = qMax<qint64>(maxBytes, 0);
+        m_coalesceDelayUsec = qMax(maxDelayUsec, 0);
+    }
+    qint64 coalesceBytes() const { return m_coalesceBytes; }
+    int coalesceDelayUsec() const { return m_coalesceDelayUsec; }
+    bool isOutputCoalescing() const { return m_coalesceBytes > 0 || m_coalesceDelayUsec > 0; }
+
+    //read-side flow control: stop taking output from the pty while 'bytes' of it wait
+    //in our buffer (0 -> whole buffer of the backend), so the kernel pty buffer fills up
+    //and the child process is throttled on its writes instead of our memory growing;
+    //pauseReading() stops reading regardless of the buffer, e.g. while a slow client catches up
+    //backends without support keep reading
+    virtual void setReadBufferLimit(qint64 bytes) { m_readBufferLimit = qMax<qint64>(bytes, 0); }
+    qint64 readBufferLimit() const { return m_readBufferLimit; }
+    virtual void pauseReading() { m_readingPaused = true; }
+    virtual void resumeReading() { m_readingPaused = false; }
+    bool isReadingPaused() const { return m_readingPaused; }
+
+    //write() never blocks: what the pty doesn't accept right away is queued and written
+    //when the master fd has room; bytesToWrite() is the size of that queue,
+    //writeHighWatermarkReached() is emitted once it grows over the watermark (0 disables),
+    //writeBufferDrained() when it is empty again, so producers can pause/resume
+    //backends without own queue write synchronously and report 0
+    virtual qint64 bytesToWrite() const { return 0; }
+    void setWriteHighWatermark(qint64 bytes) { m_writeHighWatermark = qMax<qint64>(bytes, 0); }
+    qint64 writeHighWatermark() const { return m_writeHighWatermark; }
+
+    //observers are not owned, remove them before they are destroyed
+    void addStreamObserver(IPtyStreamObserver *observer)
+    {
+        QMutexLocker locker(&m_observersMutex);
+        if (!m_observers.contains(observer))
+            m_observers.append(observer);
+    }
+    void removeStreamObserver(IPtyStreamObserver *observer)
+    {
+        QMutexLocker locker(&m_observersMutex);
+        m_observers.removeAll(observer);
+    }
+
+    //directory the shell starts in, home directory of the user by default
+    virtual void setWorkingDirectory(const QString &workingDirectory) { m_workingDirectory = workingDirectory; }
+    QString workingDirectory() const { return m_workingDirectory; }
+
     qint64 pid() { return m_pid; }
     QPair<qint16, qint16> size() { return m_size; }
     const QString lastError() { return m_lastError; }
     bool toggleTrace() { m_trace = !m_trace; return m_trace; }
 
+    //performance counters of this session, PtyStats::global() sums all sessions of the process
+    PtyStatsSnapshot stats() const { return m_stats.snapshot(); }
+
     inline uint qHash(const IPtyProcess & process)
     {
         return static_cast<int>(process.type());
     }
 
+public slots:
+    //emit readyRead right now for all pending output
+    virtual void flushOutput() { }
+
+signals:
+    void started();
+    void errorOccurred(const QString &error);
+    void bytesWritten(qint64 bytes);
+    void writeHighWatermarkReached(qint64 bytesToWrite);
+    void writeBufferDrained();
+
+protected:
+    //called by backends for every chunk of output as it is read
+    void notifyOutput(const char *data, qint64 size)
+    {
+        QMutexLocker locker(&m_observersMutex);
+        for (int i = 0; i < m_observers.size(); i++)
+            m_observers.at(i)->ptyOutput(data, size);
+    }
+
+    //backends which have to copy output for notifyOutput() skip it when nobody listens
+    bool hasStreamObservers()
+    {
+        QMutexLocker locker(&m_observersMutex);
+        return !m_observers.isEmpty();
+    }
+
+    void notifyInput(const char *data, qint64 size)
+    {
+        QMutexLocker locker(&m_observersMutex);
+        for (int i = 0; i < m_observers.size(); i++)
+            m_observers.at(i)->ptyInput(data, size);
+    }
+
+    void notifyResized(qint16 cols, qint16 rows)
+    {
+        QMutexLocker locker(&m_observersMutex);
+        for (int i = 0; i < m_observers.size(); i++)
+            m_observers.at(i)->ptyResized(cols, rows);
+    }
+
+    //called by backends from the thread of this object after data went to the pty,
+    //safe against write() called again from the slots of emitted signals
+    void reportWriteProgress(qint64 written)
+    {
+        m_unreportedWritten += written;
+        if (m_reportingWrites)
+            return;
+
+        m_reportingWrites = true;
+        while (m_unreportedWritten > 0)
+        {
+            qint64 bytes = m_unreportedWritten;
+            m_unreportedWritten = 0;
+            emit bytesWritten(bytes);
+        }
+
+        qint64 pending = bytesToWrite();
+        if (!m_writeHighWatermarkHit && m_writeHighWatermark > 0 && pending >= m_writeHighWatermark)
+        {
+            m_writeHighWatermarkHit = true;
+            emit writeHighWatermarkReached(pending);
+        }
+        else if (m_writeHighWatermarkHit && pending == 0)
+        {
+            m_writeHighWatermarkHit = false;
+            emit writeBufferDrained();
+        }
+        m_reportingWrites = false;
+    }
+
 protected:
     QString m_shellPath;
+    QString m_workingDirectory;
     QString m_lastError;
     qint64 m_pid;
     QPair<qint16, qint16> m_size; //cols / rows
     bool m_trace;
+    qint64 m_coalesceBytes;
+    int m_coalesceDelayUsec;
+    qint64 m_readBufferLimit;
+    bool m_readingPaused;
+    PtyStats m_stats;
+
+private slots:
+    void startProcessQueued()
+    {
+        if (startProcess(m_asyncShellPath, m_asyncEnvironment, m_asyncSize.first, m_asyncSize.second))
+            emit started();
+        else
+            emit errorOccurred(m_lastError);
+    }
+
+private:
+    QByteArray m_peekBuffer;
+    QMutex m_observersMutex;
+    QList<IPtyStreamObserver *> m_observers;
+    QString m_asyncShellPath;
+    QStringList m_asyncEnvironment;
+    QPair<qint16, qint16> m_asyncSize;
+    qint64 m_writeHighWatermark;
+    bool m_writeHighWatermarkHit;
+    bool m_reportingWrites;
+    qint64 m_unreportedWritten;
 };
 
 #endif // IPTYPROCESS_H
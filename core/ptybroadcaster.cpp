@@ -0,0 +1,224 @@
+#include "ptybroadcaster.h"
+#include "ptyscreen.h"
+#include "ptyscreenstream.h"
+
+#define DEFAULT_COLS 80
+#define DEFAULT_ROWS 24
+
+PtyBroadcaster::PtyBroadcaster(IPtyProcess *pty, SlowPolicy policy, QObject *parent)
+    : QObject(parent)
+    , m_pty(pty)
+    , m_policy(policy)
+    , m_screen(0)
+    , m_headOffset(0)
+    , m_bufferedBytes(0)
+    , m_maxBufferedBytes(PTY_BROADCASTER_DEFAULT_MAX_BUFFERED)
+    , m_windowBytes(PTY_BROADCASTER_DEFAULT_WINDOW)
+    , m_nextSubscriber(1)
+    , m_droppedCount(0)
+    , m_snapshotCount(0)
+{
+    if (m_policy == SnapshotSlow)
+    {
+        QPair<qint16, qint16> size = pty ? pty->size() : QPair<qint16, qint16>(0, 0);
+        m_screen = new PtyScreen(size.first > 0 ? size.first : DEFAULT_COLS, size.second > 0 ? size.second : DEFAULT_ROWS);
+        m_screen->setScrollbackLimit(0);
+    }
+
+    if (m_pty)
+    {
+        if (m_screen)
+            m_pty->addStreamObserver(this);
+        connect(m_pty->notifier(), &QIODevice::readyRead, this, &PtyBroadcaster::onReadyRead);
+    }
+}
+
+PtyBroadcaster::~PtyBroadcaster()
+{
+    if (m_pty)
+    {
+        m_pty->removeStreamObserver(this);
+        if (m_pty->notifier())
+            disconnect(m_pty->notifier(), 0, this, 0);
+    }
+    delete m_screen;
+}
+
+void PtyBroadcaster::setMaxBufferedBytes(qint64 bytes)
+{
+    m_maxBufferedBytes = qMax<qint64>(bytes, 1);
+    trim();
+}
+
+int PtyBroadcaster::subscribe()
+{
+    Subscriber subscriber;
+    subscriber.cursor = m_headOffset;
+    subscriber.inFlight = 0;
+    subscriber.needsSnapshot = m_screen != 0;
+
+    int id = m_nextSubscriber++;
+    m_subscribers.insert(id, subscriber);
+    if (subscriber.needsSnapshot)
+        QMetaObject::invokeMethod(this, "deliverAll", Qt::QueuedConnection);
+    return id;
+}
+
+void PtyBroadcaster::unsubscribe(int subscriber)
+{
+    if (m_subscribers.remove(subscriber) > 0)
+        trim();
+}
+
+qint64 PtyBroadcaster::lag(int subscriber) const
+{
+    QHash<int, Subscriber>::const_iterator it = m_subscribers.constFind(subscriber);
+    if (it == m_subscribers.constEnd() || it->needsSnapshot)
+        return 0;
+    return m_headOffset - it->cursor;
+}
+
+void PtyBroadcaster::ptyResized(qint16 cols, qint16 rows)
+{
+    if (m_screen)
+        m_screen->resize(cols, rows);
+}
+
+void PtyBroadcaster::written(int subscriber, qint64 bytes)
+{
+    QHash<int, Subscriber>::iterator it = m_subscribers.find(subscriber);
+    if (it == m_subscribers.end())
+        return;
+
+    //written bytes include frame headers
+    it->inFlight = qMax<qint64>(it->inFlight - bytes, 0);
+    deliver(subscriber);
+    trim();
+}
+
+void PtyBroadcaster::onReadyRead()
+{
+    if (!m_pty)
+        return;
+
+    //one copy out of the pty, shared by all subscribers from now on
+    QByteArray data = m_pty->readAll();
+    if (data.isEmpty())
+        return;
+
+    if (m_screen)
+        m_screen->feed(data.constData(), data.size());
+
+    Chunk chunk;
+    chunk.offset = m_headOffset;
+    chunk.data = data;
+    m_chunks.append(chunk);
+    m_headOffset += data.size();
+    m_bufferedBytes += data.size();
+
+    deliverAll();
+    trim();
+}
+
+void PtyBroadcaster::deliverAll()
+{
+    QList<int> ids = m_subscribers.keys();
+    for (int i = 0; i < ids.size(); i++)
+        deliver(ids.at(i));
+}
+
+void PtyBroadcaster::deliver(int subscriber)
+{
+    QHash<int, Subscriber>::iterator it = m_subscribers.find(subscriber);
+    if (it == m_subscribers.end())
+        return;
+
+    if (it->needsSnapshot)
+    {
+        if (m_windowBytes > 0 && it->inFlight >= m_windowBytes)
+            return;
+
+        //snapshot shows the screen as of the head, live output continues from there
+        it->needsSnapshot = false;
+        it->cursor = m_headOffset;
+        QByteArray snapshot = PtyScreenStream::snapshot(m_screen);
+        it->inFlight += snapshot.size();
+        m_snapshotCount++;
+        emit chunkReady(subscriber, snapshot);
+
+        //slots may have unsubscribed it
+        it = m_subscribers.find(subscriber);
+        if (it == m_subscribers.end())
+            return;
+    }
+
+    while (it->cursor < m_headOffset && (m_windowBytes == 0 || it->inFlight < m_windowBytes))
+    {
+        //chunks are immutable: the signal hands out a reference to the shared buffer
+        const QByteArray data = m_chunks.at(chunkIndex(it->cursor)).data;
+        it->cursor += data.size();
+        it->inFlight += data.size();
+        emit chunkReady(subscriber, data);
+
+        //slots may have unsubscribed it or trimmed the chunks
+        it = m_subscribers.find(subscriber);
+        if (it == m_subscribers.end())
+            return;
+    }
+}
+
+void PtyBroadcaster::trim()
+{
+    //subscribers behind the budget can't be served from the buffer any more
+    qint64 oldest = m_headOffset - m_maxBufferedBytes;
+    QList<int> ids = m_subscribers.keys();
+    for (int i = 0; i < ids.size(); i++)
+    {
+        QHash<int, Subscriber>::iterator it = m_subscribers.find(ids.at(i));
+        if (it == m_subscribers.end() || it->needsSnapshot || it->cursor >= oldest)
+            continue;
+
+        if (m_policy == DropSlow)
+        {
+            m_subscribers.erase(it);
+            m_droppedCount++;
+            emit subscriberDropped(ids.at(i));
+            continue;
+        }
+
+        //skips to the head, snapshot goes when its window has room
+        it->cursor = m_headOffset;
+        it->needsSnapshot = true;
+        deliver(ids.at(i));
+    }
+
+    //chunks nobody needs: all cursors are past them, waiting snapshots cover everything
+    qint64 needed = m_headOffset;
+    for (QHash<int, Subscriber>::const_iterator it = m_subscribers.constBegin(); it != m_subscribers.constEnd(); ++it)
+    {
+        if (!it->needsSnapshot)
+            needed = qMin(needed, it->cursor);
+    }
+
+    while (!m_chunks.isEmpty() && m_chunks.first().offset + m_chunks.first().data.size() <= needed)
+    {
+        m_bufferedBytes -= m_chunks.first().data.size();
+        m_chunks.removeFirst();
+    }
+}
+
+int PtyBroadcaster::chunkIndex(qint64 offset) const
+{
+    //cursors are always at chunk boundaries, binary search of the chunk starting there
+    int low = 0;
+    int high = m_chunks.size() - 1;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (m_chunks.at(middle).offset < offset)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
@@ -0,0 +1,130 @@
+#ifndef PTYBROADCASTER_H
+#define PTYBROADCASTER_H
+
+#include "iptyprocess.h"
+#include <QObject>
+#include <QPointer>
+#include <QHash>
+#include <QList>
+
+#define PTY_BROADCASTER_DEFAULT_MAX_BUFFERED (1024 * 1024)
+#define PTY_BROADCASTER_DEFAULT_WINDOW (256 * 1024)
+
+class PtyScreen;
+
+//fan-out of one pty session to many read-only subscribers (pairing, support...):
+//output is taken from the pty once per readyRead into a chunk, chunks are implicitly shared
+//QByteArrays, so all subscribers get the same buffer and nothing is copied per subscriber;
+//every subscriber has a cursor (offset in the output stream) and a window: at most
+//'windowBytes' of chunks are in flight until written() reports them sent;
+//chunks stay buffered while some cursor needs them, up to 'maxBufferedBytes': subscriber
+//which lags more is dropped (DropSlow) or skips to the head with a screen snapshot of the
+//session (SnapshotSlow, a PtyScreen of the output is kept for it, new subscribers get a
+//snapshot too); memory is bounded by 'maxBufferedBytes' whatever the subscribers do;
+//the broadcaster takes (consumes) the output of the pty, input goes to the pty directly;
+//not thread safe, use from the thread of the pty
+class PtyBroadcaster : public QObject, public IPtyStreamObserver
+{
+    Q_OBJECT
+public:
+    enum SlowPolicy
+    {
+        DropSlow,
+        SnapshotSlow
+    };
+
+    explicit PtyBroadcaster(IPtyProcess *pty, SlowPolicy policy = SnapshotSlow, QObject *parent = 0);
+    ~PtyBroadcaster();
+
+    SlowPolicy slowPolicy() const { return m_policy; }
+    void setMaxBufferedBytes(qint64 bytes);
+    qint64 maxBufferedBytes() const { return m_maxBufferedBytes; }
+    //0 - no window, everything goes at once
+    void setWindowBytes(qint64 bytes) { m_windowBytes = qMax<qint64>(bytes, 0); }
+    qint64 windowBytes() const { return m_windowBytes; }
+
+    //new subscriber starts at the head of the output (with a snapshot for SnapshotSlow),
+    //delivery starts from the event loop, so there is time to connect chunkReady()
+    int subscribe();
+    void unsubscribe(int subscriber);
+    int subscriberCount() const { return m_subscribers.size(); }
+
+    //output not delivered to the subscriber yet
+    qint64 lag(int subscriber) const;
+    qint64 bufferedBytes() const { return m_bufferedBytes; }
+    int chunkCount() const { return m_chunks.size(); }
+    qint64 droppedCount() const { return m_droppedCount; }
+    qint64 snapshotCount() const { return m_snapshotCount; }
+
+    //subscribes a QWebSocket (or a class with the same API): chunks go as binary messages,
+    //it is unsubscribed when it disconnects and closed when it is dropped (DropSlow);
+    //template keeps the library free of the WebSockets module
+    template <class WebSocket>
+    int subscribeWebSocket(WebSocket *socket)
+    {
+        int subscriber = subscribe();
+        connect(this, &PtyBroadcaster::chunkReady, socket, [socket, subscriber](int id, const QByteArray &chunk) {
+            if (id == subscriber)
+                socket->sendBinaryMessage(chunk);
+        });
+        //dropped subscriber gets no more chunks, an open socket would leave its client waiting
+        if (m_policy == DropSlow)
+            connect(this, &PtyBroadcaster::subscriberDropped, socket, [socket, subscriber](int id) {
+                if (id == subscriber)
+                    socket->close();
+            });
+        connect(socket, &WebSocket::bytesWritten, this, [this, subscriber](qint64 bytes) { written(subscriber, bytes); });
+        connect(socket, &WebSocket::disconnected, this, [this, subscriber]() { unsubscribe(subscriber); });
+        return subscriber;
+    }
+
+    //IPtyStreamObserver: the screen for snapshots follows resizes, output comes with readyRead
+    virtual void ptyOutput(const char *data, qint64 size) { Q_UNUSED(data); Q_UNUSED(size); }
+    virtual void ptyResized(qint16 cols, qint16 rows);
+
+public slots:
+    //transport sent 'bytes' of the subscriber's chunks (frame headers included)
+    void written(int subscriber, qint64 bytes);
+
+signals:
+    void chunkReady(int subscriber, const QByteArray &chunk);
+    void subscriberDropped(int subscriber);
+
+private slots:
+    void onReadyRead();
+    void deliverAll();
+
+private:
+    struct Chunk
+    {
+        qint64 offset; //of the first byte in the output stream
+        QByteArray data;
+    };
+
+    struct Subscriber
+    {
+        qint64 cursor;
+        qint64 inFlight;
+        bool needsSnapshot;
+    };
+
+    void deliver(int subscriber);
+    void trim();
+    int chunkIndex(qint64 offset) const;
+
+private:
+    QPointer<IPtyProcess> m_pty;
+    SlowPolicy m_policy;
+    PtyScreen *m_screen;
+    QList<Chunk> m_chunks;
+    qint64 m_headOffset; //end of the output taken so far
+    qint64 m_bufferedBytes;
+    qint64 m_maxBufferedBytes;
+    qint64 m_windowBytes;
+    QHash<int, Subscriber> m_subscribers;
+    int m_nextSubscriber;
+    qint64 m_droppedCount;
+    qint64 m_snapshotCount;
+};
+
+#endif // PTYBROADCASTER_H
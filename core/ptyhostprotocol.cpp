@@ -0,0 +1,255 @@
+#include "ptyhostprotocol.h"
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#define MAX_PAYLOAD_SIZE (1024 * 1024)
+#define SEND_TIMEOUT_MSEC 1000
+
+//macOS has no MSG_NOSIGNAL, SO_NOSIGPIPE is set on the socket instead
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace {
+
+bool waitFor(int socket, short events, int timeoutMsec)
+{
+    struct pollfd pfd;
+    pfd.fd = socket;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    int rc;
+    do
+    {
+        rc = ::poll(&pfd, 1, timeoutMsec);
+    } while (rc < 0 && errno == EINTR);
+    return rc > 0;
+}
+
+//read exactly 'size' bytes
+bool readFully(int socket, char *data, qint64 size)
+{
+    while (size > 0)
+    {
+        ssize_t len = ::recv(socket, data, static_cast<size_t>(size), 0);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return false;
+        data += len;
+        size -= len;
+    }
+    return true;
+}
+
+//uid of the process on the other end of the connected 'socket'
+bool peerUid(int socket, uid_t *uid)
+{
+#ifdef SO_PEERCRED
+    struct ucred credentials;
+    socklen_t len = sizeof(credentials);
+    if (::getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &len) != 0)
+        return false;
+    *uid = credentials.uid;
+    return true;
+#else
+    gid_t gid;
+    return ::getpeereid(socket, uid, &gid) == 0;
+#endif
+}
+
+}
+
+QString PtyHostProtocol::defaultSocketPath()
+{
+    QString path = QString::fromLocal8Bit(qgetenv("PTYQT_HOSTD_SOCKET"));
+    if (!path.isEmpty())
+        return path;
+
+    //runtime dir is private to the user, unlike the shared temp dir
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (dir.isEmpty())
+        dir = QDir::tempPath();
+    return QDir(dir).filePath(QString("ptyqt-hostd-%1").arg(getuid()));
+}
+
+int PtyHostProtocol::connectToHost(const QString &socketPath, int timeoutMsec, QString *error)
+{
+    QByteArray path = QFile::encodeName(socketPath);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (path.isEmpty() || static_cast<size_t>(path.size()) >= sizeof(address.sun_path))
+    {
+        *error = QString("HostPty Error: bad socket path -> %1").arg(socketPath);
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.constData(), static_cast<size_t>(path.size()));
+
+    int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket < 0)
+    {
+        *error = QString("HostPty Error: unable to create socket -> %1").arg(strerror(errno));
+        return -1;
+    }
+    ::fcntl(socket, F_SETFD, FD_CLOEXEC);
+
+    if (::connect(socket, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        *error = QString("HostPty Error: unable to connect to %1 -> %2").arg(socketPath).arg(strerror(errno));
+        ::close(socket);
+        return -1;
+    }
+
+    //anyone may bind a socket on a guessed path: shells must not be started by a foreign daemon
+    uid_t uid;
+    if (!peerUid(socket, &uid))
+    {
+        *error = QString("HostPty Error: unable to check owner of %1 -> %2").arg(socketPath).arg(strerror(errno));
+        ::close(socket);
+        return -1;
+    }
+    if (uid != ::getuid())
+    {
+        *error = QString("HostPty Error: %1 is served by uid %2, not by us").arg(socketPath).arg(uid);
+        ::close(socket);
+        return -1;
+    }
+
+    //replies of a daemon which hangs must not hang us
+    struct timeval tv;
+    tv.tv_sec = timeoutMsec / 1000;
+    tv.tv_usec = (timeoutMsec % 1000) * 1000;
+    ::setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    ::setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    return socket;
+}
+
+bool PtyHostProtocol::send(int socket, const PtyHostMessage &message, const QByteArray &payload, int fd)
+{
+    PtyHostMessage header = message;
+    header.size = static_cast<quint32>(payload.size());
+
+    struct iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = const_cast<char *>(payload.constData());
+    iov[1].iov_len = static_cast<size_t>(payload.size());
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = payload.isEmpty() ? 1 : 2;
+    if (fd >= 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    //socket may be non-blocking (QLocalSocket of the daemon), messages are small,
+    //so a short wait for room is enough; fd goes with the first sent byte
+    while (msg.msg_iovlen > 0)
+    {
+        ssize_t len = ::sendmsg(socket, &msg, MSG_NOSIGNAL);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && waitFor(socket, POLLOUT, SEND_TIMEOUT_MSEC))
+                continue;
+            return false;
+        }
+
+        msg.msg_control = 0;
+        msg.msg_controllen = 0;
+        while (msg.msg_iovlen > 0 && static_cast<size_t>(len) >= msg.msg_iov[0].iov_len)
+        {
+            len -= msg.msg_iov[0].iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov[0].iov_base = static_cast<char *>(msg.msg_iov[0].iov_base) + len;
+            msg.msg_iov[0].iov_len -= len;
+        }
+    }
+    return true;
+}
+
+bool PtyHostProtocol::receive(int socket, PtyHostMessage *message, QByteArray *payload, int *fd)
+{
+    *fd = -1;
+
+    struct iovec iov;
+    iov.iov_base = message;
+    iov.iov_len = sizeof(*message);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+    ssize_t len;
+    do
+    {
+        len = ::recvmsg(socket, &msg, flags);
+    } while (len < 0 && errno == EINTR);
+    if (len <= 0)
+        return false;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != 0; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+            ::fcntl(*fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+
+    //rest of the header and the payload come without descriptors
+    bool ok = readFully(socket, reinterpret_cast<char *>(message) + len, static_cast<qint64>(sizeof(*message)) - len)
+            && message->size <= MAX_PAYLOAD_SIZE;
+    if (ok)
+    {
+        payload->resize(static_cast<int>(message->size));
+        ok = readFully(socket, payload->data(), message->size);
+    }
+
+    if (!ok && *fd >= 0)
+    {
+        ::close(*fd);
+        *fd = -1;
+    }
+    return ok;
+}
@@ -0,0 +1,57 @@
+#ifndef PTYHOSTPROTOCOL_H
+#define PTYHOSTPROTOCOL_H
+
+#include <QString>
+#include <QByteArray>
+
+//wire format between ptyqt-hostd and HostPtyProcess: one connection per client session,
+//each message is a fixed header followed by 'size' bytes of payload; master fd of the pty
+//rides on the header as SCM_RIGHTS, so the client reads and writes the pty itself
+//and the daemon never copies session data; both ends are on one host, header is in host byte order
+struct PtyHostMessage
+{
+    enum Type
+    {
+        //client -> daemon
+        Spawn = 1,   //cols/rows in arg1/arg2, payload: shell path '\0' working directory
+        Attach = 2,  //'session' to take over after a restart of the client
+        Kill = 3,    //kill the session of this connection
+        List = 4,    //ids of running sessions
+
+        //daemon -> client
+        Ok = 100,    //reply: 'session', 'pid', master fd for Spawn/Attach, ids as text for List
+        Error = 101, //reply: payload is the error text
+        Exited = 102 //event: shell of the session exited, exit code in arg1
+    };
+
+    PtyHostMessage()
+        : type(0), session(0), pid(0), arg1(0), arg2(0), size(0)
+    {  }
+
+    quint32 type;
+    quint32 session;
+    qint64 pid;
+    qint32 arg1;
+    qint32 arg2;
+    quint32 size;
+};
+
+class PtyHostProtocol
+{
+public:
+    //socket of the daemon of this user: $PTYQT_HOSTD_SOCKET or ptyqt-hostd-<uid> in the runtime dir
+    //($XDG_RUNTIME_DIR), the temp dir only if there is none
+    static QString defaultSocketPath();
+
+    //blocking connect to the daemon, returns close-on-exec socket or -1 (and 'error');
+    //a daemon which runs as another user is refused
+    static int connectToHost(const QString &socketPath, int timeoutMsec, QString *error);
+
+    //'fd' >= 0 is passed to the peer along with the header
+    static bool send(int socket, const PtyHostMessage &message, const QByteArray &payload = QByteArray(), int fd = -1);
+    //blocking read of one message, 'fd' gets the passed descriptor or -1,
+    //returns false on error, timeout of the socket or closed connection
+    static bool receive(int socket, PtyHostMessage *message, QByteArray *payload, int *fd);
+};
+
+#endif // PTYHOSTPROTOCOL_H
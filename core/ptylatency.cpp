@@ -0,0 +1,219 @@
+#include "ptylatency.h"
+#include <QElapsedTimer>
+
+#define SUB_BUCKETS (1 << PTY_HISTOGRAM_SUB_BUCKET_BITS)
+#define PROMETHEUS_MIN_BITS 10 //first bucket of the export: 1.024us
+
+std::atomic<bool> PtyLatency::s_enabled(false);
+
+static PtyHistogram g_latencyHistograms[PtyLatency::MetricCount];
+
+static const char *g_latencyNames[PtyLatency::MetricCount] = {
+    "ptyqt_write_to_output_seconds",
+    "ptyqt_ready_to_emit_seconds",
+    "ptyqt_emit_to_read_seconds"
+};
+
+static const char *g_latencyHelp[PtyLatency::MetricCount] = {
+    "Time from IPtyProcess::write() to the next byte read from the pty.",
+    "Time from pty readiness to readyRead emission.",
+    "Time from readyRead emission to readAll() by the consumer."
+};
+
+//shard of the calling thread, threads are spread round robin
+static int currentShard()
+{
+    static std::atomic<int> nextShard(0);
+    static thread_local int shard = nextShard.fetch_add(1, std::memory_order_relaxed) % PTY_HISTOGRAM_SHARDS;
+    return shard;
+}
+
+static inline int highestBit(quint64 value)
+{
+    int bit = 0;
+    while (value >>= 1)
+        bit++;
+    return bit;
+}
+
+PtyHistogramSnapshot::PtyHistogramSnapshot()
+    : count(0)
+    , sum(0)
+    , max(0)
+{
+
+}
+
+int PtyHistogramSnapshot::bucketCount()
+{
+    return (PTY_HISTOGRAM_MAX_BITS - PTY_HISTOGRAM_SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+}
+
+int PtyHistogramSnapshot::bucketIndex(quint64 value)
+{
+    if (value < SUB_BUCKETS)
+        return static_cast<int>(value);
+
+    int bit = highestBit(value);
+    if (bit >= PTY_HISTOGRAM_MAX_BITS)
+        return bucketCount() - 1;
+
+    int sub = static_cast<int>((value >> (bit - PTY_HISTOGRAM_SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return (bit - PTY_HISTOGRAM_SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+quint64 PtyHistogramSnapshot::bucketUpperBound(int index)
+{
+    if (index < SUB_BUCKETS)
+        return static_cast<quint64>(index);
+
+    int shift = index / SUB_BUCKETS - 1;
+    quint64 lower = static_cast<quint64>(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    return lower + (quint64(1) << shift) - 1;
+}
+
+quint64 PtyHistogramSnapshot::percentile(double percent) const
+{
+    if (count == 0)
+        return 0;
+
+    quint64 rank = static_cast<quint64>(count * qBound(0.0, percent, 100.0) / 100.0 + 0.5);
+    rank = qBound<quint64>(1, rank, count);
+    quint64 seen = 0;
+    for (int i = 0; i < counts.size(); i++)
+    {
+        seen += counts.at(i);
+        if (seen >= rank)
+            return qMin(bucketUpperBound(i), max);
+    }
+    return max;
+}
+
+quint64 PtyHistogramSnapshot::countAtOrBelow(quint64 value) const
+{
+    quint64 result = 0;
+    for (int i = 0; i < counts.size() && bucketUpperBound(i) <= value; i++)
+        result += counts.at(i);
+    return result;
+}
+
+PtyHistogram::PtyHistogram()
+{
+    int buckets = PtyHistogramSnapshot::bucketCount();
+    for (int i = 0; i < PTY_HISTOGRAM_SHARDS; i++)
+    {
+        m_shards[i].buckets = new std::atomic<quint64>[buckets];
+        for (int j = 0; j < buckets; j++)
+            m_shards[i].buckets[j].store(0, std::memory_order_relaxed);
+        m_shards[i].count.store(0, std::memory_order_relaxed);
+        m_shards[i].sum.store(0, std::memory_order_relaxed);
+        m_shards[i].max.store(0, std::memory_order_relaxed);
+    }
+}
+
+PtyHistogram::~PtyHistogram()
+{
+    for (int i = 0; i < PTY_HISTOGRAM_SHARDS; i++)
+        delete [] m_shards[i].buckets;
+}
+
+void PtyHistogram::record(quint64 nsecs)
+{
+    Shard &shard = m_shards[currentShard()];
+    shard.buckets[PtyHistogramSnapshot::bucketIndex(nsecs)].fetch_add(1, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(nsecs, std::memory_order_relaxed);
+    quint64 max = shard.max.load(std::memory_order_relaxed);
+    while (nsecs > max && !shard.max.compare_exchange_weak(max, nsecs, std::memory_order_relaxed))
+        ;
+}
+
+PtyHistogramSnapshot PtyHistogram::snapshot() const
+{
+    PtyHistogramSnapshot result;
+    int buckets = PtyHistogramSnapshot::bucketCount();
+    result.counts.fill(0, buckets);
+    for (int i = 0; i < PTY_HISTOGRAM_SHARDS; i++)
+    {
+        const Shard &shard = m_shards[i];
+        for (int j = 0; j < buckets; j++)
+            result.counts[j] += shard.buckets[j].load(std::memory_order_relaxed);
+        result.sum += shard.sum.load(std::memory_order_relaxed);
+        result.max = qMax(result.max, shard.max.load(std::memory_order_relaxed));
+    }
+
+    //shards are read while threads keep recording, count of the buckets is consistent with them
+    for (int j = 0; j < buckets; j++)
+        result.count += result.counts.at(j);
+    return result;
+}
+
+void PtyHistogram::reset()
+{
+    int buckets = PtyHistogramSnapshot::bucketCount();
+    for (int i = 0; i < PTY_HISTOGRAM_SHARDS; i++)
+    {
+        for (int j = 0; j < buckets; j++)
+            m_shards[i].buckets[j].store(0, std::memory_order_relaxed);
+        m_shards[i].count.store(0, std::memory_order_relaxed);
+        m_shards[i].sum.store(0, std::memory_order_relaxed);
+        m_shards[i].max.store(0, std::memory_order_relaxed);
+    }
+}
+
+void PtyLatency::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+static QElapsedTimer startedClock()
+{
+    QElapsedTimer clock;
+    clock.start();
+    return clock;
+}
+
+qint64 PtyLatency::now()
+{
+    static const QElapsedTimer clock = startedClock();
+    return clock.nsecsElapsed();
+}
+
+void PtyLatency::record(PtyLatency::Metric metric, qint64 nsecs)
+{
+    g_latencyHistograms[metric].record(static_cast<quint64>(qMax<qint64>(nsecs, 0)));
+}
+
+PtyHistogramSnapshot PtyLatency::histogram(PtyLatency::Metric metric)
+{
+    return g_latencyHistograms[metric].snapshot();
+}
+
+void PtyLatency::reset()
+{
+    for (int i = 0; i < MetricCount; i++)
+        g_latencyHistograms[i].reset();
+}
+
+QByteArray PtyLatency::toPrometheus()
+{
+    QByteArray out;
+    for (int i = 0; i < MetricCount; i++)
+    {
+        PtyHistogramSnapshot snapshot = histogram(static_cast<Metric>(i));
+        QByteArray name(g_latencyNames[i]);
+
+        out.append("# HELP " + name + " " + g_latencyHelp[i] + "\n");
+        out.append("# TYPE " + name + " histogram\n");
+        for (int bit = PROMETHEUS_MIN_BITS; bit <= PTY_HISTOGRAM_MAX_BITS; bit++)
+        {
+            quint64 bound = quint64(1) << bit;
+            out.append(name + "_bucket{le=\"" + QByteArray::number(bound / 1e9, 'g', 6) + "\"} "
+                       + QByteArray::number(snapshot.countAtOrBelow(bound - 1)) + "\n");
+        }
+        out.append(name + "_bucket{le=\"+Inf\"} " + QByteArray::number(snapshot.count) + "\n");
+        out.append(name + "_sum " + QByteArray::number(snapshot.sum / 1e9, 'g', 9) + "\n");
+        out.append(name + "_count " + QByteArray::number(snapshot.count) + "\n");
+    }
+    return out;
+}
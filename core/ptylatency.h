@@ -0,0 +1,95 @@
+#ifndef PTYLATENCY_H
+#define PTYLATENCY_H
+
+#include <QVector>
+#include <QByteArray>
+#include <atomic>
+
+#define PTY_HISTOGRAM_SUB_BUCKET_BITS 4 //16 linear sub-buckets per power of two: < 6.25% error
+#define PTY_HISTOGRAM_MAX_BITS 37 //values up to ~137 s in nanoseconds, bigger ones go to the last bucket
+#define PTY_HISTOGRAM_SHARDS 16
+
+//merged counts of a PtyHistogram
+struct PtyHistogramSnapshot
+{
+    QVector<quint64> counts; //by bucket
+    quint64 count;
+    quint64 sum; //nanoseconds
+    quint64 max;
+
+    PtyHistogramSnapshot();
+    //upper bound of the bucket where 'percent' of values are, 0 for empty histogram
+    quint64 percentile(double percent) const;
+    quint64 mean() const { return count > 0 ? sum / count : 0; }
+    //count of values <= 'value', exact when 'value' + 1 is a power of two
+    quint64 countAtOrBelow(quint64 value) const;
+
+    static int bucketCount();
+    static int bucketIndex(quint64 value);
+    static quint64 bucketUpperBound(int index);
+};
+
+//log-bucketed latency histogram (HDR style): bucket of a value is found with a few shifts,
+//every power of two is split into linear sub-buckets, so relative error is bounded;
+//lock-free: threads record into their own shard with relaxed atomic adds,
+//snapshot() merges the shards
+class PtyHistogram
+{
+public:
+    PtyHistogram();
+    ~PtyHistogram();
+
+    void record(quint64 nsecs);
+    PtyHistogramSnapshot snapshot() const;
+    void reset();
+
+private:
+    PtyHistogram(const PtyHistogram &);
+    PtyHistogram &operator=(const PtyHistogram &);
+
+    struct Shard
+    {
+        alignas(64) std::atomic<quint64> count;
+        std::atomic<quint64> sum;
+        std::atomic<quint64> max;
+        std::atomic<quint64> *buckets;
+    };
+
+    Shard m_shards[PTY_HISTOGRAM_SHARDS];
+};
+
+//where interactive latency goes, measured by UnixPtyProcess for all sessions of the process:
+//WriteToOutput - write() to the next byte read from the master fd (echo round trip through the child),
+//ReadyToEmit - master fd readiness (notifier activation) to readyRead emission (includes coalescing),
+//EmitToRead - readyRead emission to readAll()/consume() by the consumer;
+//disabled by default, the hot path checks one relaxed flag then
+class PtyLatency
+{
+public:
+    enum Metric
+    {
+        WriteToOutput,
+        ReadyToEmit,
+        EmitToRead,
+        MetricCount
+    };
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    //monotonic clock of the measurements, nanoseconds
+    static qint64 now();
+    static void record(Metric metric, qint64 nsecs);
+
+    static PtyHistogramSnapshot histogram(Metric metric);
+    static void reset();
+
+    //all metrics in Prometheus text exposition format: histograms in seconds
+    //with power-of-two buckets from 1us, e.g. ptyqt_write_to_output_seconds_bucket{le="..."}
+    static QByteArray toPrometheus();
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+#endif // PTYLATENCY_H
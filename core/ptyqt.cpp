@@ -10,6 +10,11 @@
 
 #ifdef Q_OS_UNIX
 #include "unixptyprocess.h"
+#include "hostptyprocess.h"
+#endif
+
+#ifdef Q_OS_LINUX
+#include "reactorptyprocess.h"
 #endif
 
 IPtyProcess *PtyQt::createPtyProcess(IPtyProcess::PtyType ptyType)
@@ -44,6 +49,22 @@ IPtyProcess *PtyQt::createPtyProcess(IPtyProcess::PtyType ptyType)
 #endif
         return new UnixPtyProcess();
         break;
+#if __cplusplus >= 201103L
+    case IPtyProcess::PtyType::HostPty:
+#else
+    case IPtyProcess::HostPty:
+#endif
+        return new HostPtyProcess();
+        break;
+#endif
+#ifdef Q_OS_LINUX
+#if __cplusplus >= 201103L
+    case IPtyProcess::PtyType::ReactorPty:
+#else
+    case IPtyProcess::ReactorPty:
+#endif
+        return new ReactorPtyProcess();
+        break;
 #endif
 #if __cplusplus >= 201103L
     case IPtyProcess::PtyType::AutoPty:
@@ -0,0 +1,552 @@
+#include "ptyreactor.h"
+#include <QThread>
+#include <QMutexLocker>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define MAX_EPOLL_EVENTS 256
+#define READ_BUFFER_SIZE (64 * 1024)
+#define DEFAULT_MAX_BYTES_PER_TURN (64 * 1024)
+
+class PtyReactorThread : public QThread
+{
+public:
+    PtyReactorThread(const std::function<void()> &body)
+        : QThread()
+        , m_body(body)
+    {
+    }
+
+protected:
+    void run()
+    {
+        m_body();
+    }
+
+private:
+    std::function<void()> m_body;
+};
+
+class PtyReactorSession
+{
+public:
+    PtyReactorSession()
+        : id(0)
+        , fd(-1)
+        , worker(0)
+        , readEnabled(true)
+        , writeEnabled(false)
+        , maxBytesPerTurn(DEFAULT_MAX_BYTES_PER_TURN)
+        , inFlight(false)
+        , hangupPending(false)
+        , closed(false)
+    {
+    }
+
+    quint64 id;
+    int fd;
+    std::atomic<int> worker; //written by workers, read by the poller
+    PtyReactor::Callbacks callbacks;
+
+    std::atomic<bool> readEnabled;
+    std::atomic<bool> writeEnabled;
+    std::atomic<qint64> maxBytesPerTurn; //fairness cap of one worker turn
+
+    //guards epoll registration state, session is armed in epoll only when !inFlight
+    QMutex stateMutex;
+    bool inFlight;
+    bool hangupPending;
+    std::atomic<bool> closed;
+
+    //held while callbacks of the session are running
+    QMutex callbackMutex;
+};
+
+//session which callbacks run on this thread right now
+static thread_local quint64 t_currentSessionId = 0;
+
+Q_GLOBAL_STATIC(PtyReactor, globalReactor)
+static QMutex g_globalReactorMutex;
+
+PtyReactor *PtyReactor::instance()
+{
+    QMutexLocker locker(&g_globalReactorMutex);
+    PtyReactor *reactor = globalReactor();
+    if (!reactor->isRunning())
+        reactor->start();
+    return reactor;
+}
+
+PtyReactor::PtyReactor(int workerCount)
+    : m_epollFd(-1)
+    , m_wakeupFd(-1)
+    , m_workerCount(workerCount > 0 ? workerCount : qMax(1, QThread::idealThreadCount()))
+    , m_running(false)
+    , m_maxBytesPerTurn(DEFAULT_MAX_BYTES_PER_TURN)
+    , m_nextSessionId(1)
+    , m_pollThread(0)
+    , m_pendingItems(0)
+    , m_stealCount(0)
+    , m_requeueCount(0)
+{
+}
+
+PtyReactor::~PtyReactor()
+{
+    stop();
+}
+
+bool PtyReactor::start()
+{
+    if (m_running)
+        return true;
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0)
+    {
+        m_lastError = QString("PtyReactor Error: unable to create epoll -> %1").arg(strerror(errno));
+        return false;
+    }
+
+    m_wakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeupFd < 0)
+    {
+        m_lastError = QString("PtyReactor Error: unable to create eventfd -> %1").arg(strerror(errno));
+        ::close(m_epollFd);
+        m_epollFd = -1;
+        return false;
+    }
+
+    //id 0 is reserved for wakeups
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = 0;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeupFd, &event);
+
+    m_running = true;
+
+    for (int i = 0; i < m_workerCount; i++)
+    {
+        Worker *worker = new Worker();
+        worker->thread = new PtyReactorThread([this, i]() { workerLoop(i); });
+        worker->thread->setObjectName(QString("PtyReactor worker %1").arg(i));
+        m_workers.append(worker);
+    }
+    foreach (Worker *worker, m_workers)
+        worker->thread->start();
+
+    m_pollThread = new PtyReactorThread([this]() { pollLoop(); });
+    m_pollThread->setObjectName(QString("PtyReactor poller"));
+    m_pollThread->start();
+
+    return true;
+}
+
+void PtyReactor::stop()
+{
+    if (!m_running)
+        return;
+
+    m_running = false;
+
+    quint64 value = 1;
+    ssize_t rc = ::write(m_wakeupFd, &value, sizeof(value));
+    Q_UNUSED(rc)
+
+    m_pollThread->wait();
+    delete m_pollThread;
+    m_pollThread = 0;
+
+    {
+        QMutexLocker locker(&m_idleMutex);
+        m_idleCondition.wakeAll();
+    }
+    foreach (Worker *worker, m_workers)
+        worker->thread->wait();
+    foreach (Worker *worker, m_workers)
+    {
+        delete worker->thread;
+        delete worker;
+    }
+    m_workers.clear();
+    m_pendingItems = 0;
+
+    {
+        QMutexLocker locker(&m_sessionsMutex);
+        m_sessions.clear();
+    }
+
+    ::close(m_wakeupFd);
+    ::close(m_epollFd);
+    m_wakeupFd = -1;
+    m_epollFd = -1;
+}
+
+bool PtyReactor::isRunning() const
+{
+    return m_running;
+}
+
+int PtyReactor::workerCount() const
+{
+    return m_workerCount;
+}
+
+QString PtyReactor::lastError() const
+{
+    return m_lastError;
+}
+
+quint64 PtyReactor::registerFd(int fd, const Callbacks &callbacks)
+{
+    if (!m_running)
+    {
+        m_lastError = QString("PtyReactor Error: reactor is not running");
+        return 0;
+    }
+
+    QSharedPointer<PtyReactorSession> session(new PtyReactorSession());
+    session->fd = fd;
+    session->callbacks = callbacks;
+    session->maxBytesPerTurn = m_maxBytesPerTurn.load();
+
+    {
+        QMutexLocker locker(&m_sessionsMutex);
+        session->id = m_nextSessionId++;
+        //initial home worker, later it's the one which served the session last
+        session->worker = static_cast<int>(session->id % m_workerCount);
+        m_sessions.insert(session->id, session);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u64 = session->id;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        m_lastError = QString("PtyReactor Error: unable to add fd -> %1").arg(strerror(errno));
+        QMutexLocker locker(&m_sessionsMutex);
+        m_sessions.remove(session->id);
+        return 0;
+    }
+
+    return session->id;
+}
+
+void PtyReactor::unregisterFd(quint64 sessionId)
+{
+    QSharedPointer<PtyReactorSession> session;
+    {
+        QMutexLocker locker(&m_sessionsMutex);
+        session = m_sessions.take(sessionId);
+    }
+    if (session.isNull())
+        return;
+
+    {
+        QMutexLocker locker(&session->stateMutex);
+        session->closed = true;
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, session->fd, 0);
+    }
+
+    //wait for running callbacks, unless we are called from one of them
+    if (t_currentSessionId != sessionId)
+    {
+        session->callbackMutex.lock();
+        session->callbackMutex.unlock();
+    }
+}
+
+void PtyReactor::setReadEnabled(quint64 sessionId, bool enabled)
+{
+    QSharedPointer<PtyReactorSession> s = session(sessionId);
+    if (s.isNull() || s->readEnabled == enabled)
+        return;
+
+    s->readEnabled = enabled;
+    updateInterest(s);
+}
+
+void PtyReactor::setWriteEnabled(quint64 sessionId, bool enabled)
+{
+    QSharedPointer<PtyReactorSession> s = session(sessionId);
+    if (s.isNull() || s->writeEnabled == enabled)
+        return;
+
+    s->writeEnabled = enabled;
+    updateInterest(s);
+}
+
+void PtyReactor::setMaxBytesPerTurn(qint64 maxBytes)
+{
+    m_maxBytesPerTurn = qMax<qint64>(maxBytes, 1);
+}
+
+qint64 PtyReactor::maxBytesPerTurn() const
+{
+    return m_maxBytesPerTurn;
+}
+
+void PtyReactor::setSessionMaxBytesPerTurn(quint64 sessionId, qint64 maxBytes)
+{
+    QSharedPointer<PtyReactorSession> s = session(sessionId);
+    if (!s.isNull())
+        s->maxBytesPerTurn = qMax<qint64>(maxBytes, 1);
+}
+
+quint64 PtyReactor::stealCount() const
+{
+    return m_stealCount.load(std::memory_order_relaxed);
+}
+
+quint64 PtyReactor::requeueCount() const
+{
+    return m_requeueCount.load(std::memory_order_relaxed);
+}
+
+int PtyReactor::sessionCount() const
+{
+    QMutexLocker locker(&m_sessionsMutex);
+    return m_sessions.size();
+}
+
+QSharedPointer<PtyReactorSession> PtyReactor::session(quint64 sessionId) const
+{
+    QMutexLocker locker(&m_sessionsMutex);
+    return m_sessions.value(sessionId);
+}
+
+void PtyReactor::updateInterest(const QSharedPointer<PtyReactorSession> &session)
+{
+    QMutexLocker locker(&session->stateMutex);
+
+    //in-flight session is re-armed by its worker at the end of the turn
+    if (session->closed || session->inFlight)
+        return;
+
+    quint32 events = EPOLLONESHOT;
+    if (session->readEnabled)
+        events |= EPOLLIN;
+    if (session->writeEnabled)
+        events |= EPOLLOUT;
+
+    //hangup is reported regardless of the mask: keep it parked until reading is enabled again,
+    //unless writes are queued, they still get turns to drain or fail
+    if (session->hangupPending && !session->readEnabled)
+    {
+        if (!session->writeEnabled)
+            return;
+    }
+    else
+        session->hangupPending = false;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.u64 = session->id;
+    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, session->fd, &event);
+}
+
+void PtyReactor::pollLoop()
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    while (m_running)
+    {
+        int count = epoll_wait(m_epollFd, events, MAX_EPOLL_EVENTS, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            quint64 sessionId = events[i].data.u64;
+            if (sessionId == 0)
+            {
+                quint64 value = 0;
+                ssize_t rc = ::read(m_wakeupFd, &value, sizeof(value));
+                Q_UNUSED(rc)
+                continue;
+            }
+
+            QSharedPointer<PtyReactorSession> s = session(sessionId);
+            if (s.isNull())
+                continue;
+
+            int workerIndex = 0;
+            {
+                QMutexLocker locker(&s->stateMutex);
+                if (s->closed)
+                    continue;
+                s->inFlight = true;
+                workerIndex = s->worker;
+            }
+
+            dispatch(workerIndex, sessionId, events[i].events);
+        }
+    }
+}
+
+void PtyReactor::dispatch(int workerIndex, quint64 sessionId, quint32 events, bool requeued)
+{
+    Worker *worker = m_workers.at(workerIndex);
+
+    WorkItem item;
+    item.sessionId = sessionId;
+    item.events = events;
+    item.requeued = requeued;
+    {
+        QMutexLocker locker(&worker->mutex);
+        worker->deque.append(item);
+    }
+
+    //any idle worker may take it, not only the owner of the deque
+    m_pendingItems.fetch_add(1);
+    QMutexLocker idleLocker(&m_idleMutex);
+    m_idleCondition.wakeOne();
+}
+
+bool PtyReactor::takeWork(int workerIndex, WorkItem *item)
+{
+    //own deque first, from the front: sessions are served in order of readiness
+    Worker *worker = m_workers.at(workerIndex);
+    {
+        QMutexLocker locker(&worker->mutex);
+        if (!worker->deque.isEmpty())
+        {
+            *item = worker->deque.takeFirst();
+            m_pendingItems.fetch_sub(1);
+            return true;
+        }
+    }
+
+    //then steal from the back of other deques, starting from the next worker
+    for (int i = 1; i < m_workerCount; i++)
+    {
+        Worker *victim = m_workers.at((workerIndex + i) % m_workerCount);
+        QMutexLocker locker(&victim->mutex);
+        if (!victim->deque.isEmpty())
+        {
+            *item = victim->deque.takeLast();
+            m_pendingItems.fetch_sub(1);
+            m_stealCount.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PtyReactor::workerLoop(int workerIndex)
+{
+    forever
+    {
+        WorkItem item;
+        while (!takeWork(workerIndex, &item))
+        {
+            QMutexLocker locker(&m_idleMutex);
+            if (!m_running)
+                return;
+            if (m_pendingItems.load() == 0)
+                m_idleCondition.wait(&m_idleMutex);
+        }
+
+        if (!m_running)
+            return;
+
+        QSharedPointer<PtyReactorSession> s = session(item.sessionId);
+        if (s.isNull())
+            continue;
+
+        //session stays with the worker which served it last, its data is hot in our cache
+        s->worker = workerIndex;
+
+        if (processSession(s, item.events, item.requeued))
+        {
+            //budget of the turn is spent but fd still has data: go to the back of the line,
+            //so noisy sessions can't delay interactive ones
+            m_requeueCount.fetch_add(1, std::memory_order_relaxed);
+            dispatch(workerIndex, item.sessionId, EPOLLIN, true);
+        }
+    }
+}
+
+bool PtyReactor::processSession(const QSharedPointer<PtyReactorSession> &session, quint32 events, bool requeued)
+{
+    static thread_local char buffer[READ_BUFFER_SIZE];
+
+    bool hangup = false;
+    bool budgetSpent = false;
+    {
+        QMutexLocker callbackLocker(&session->callbackMutex);
+        t_currentSessionId = session->id;
+
+        //after a hangup EPOLLOUT may never come, queued writes are tried anyway and fail
+        bool writable = (events & EPOLLOUT) != 0
+                || ((events & (EPOLLHUP | EPOLLERR)) != 0 && session->writeEnabled);
+        if (!session->closed && writable && session->callbacks.onWritable)
+            session->callbacks.onWritable();
+
+        bool readable = (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+        if (readable && !session->readEnabled)
+        {
+            //reading was paused after the fd got ready or after the previous turn of a requeued session:
+            //that's no hangup; a real one is processed when reading is enabled again
+            hangup = !requeued && (events & (EPOLLHUP | EPOLLERR)) != 0;
+            readable = false;
+        }
+
+        qint64 budget = session->maxBytesPerTurn;
+        qint64 total = 0;
+        while (readable && !session->closed && session->readEnabled)
+        {
+            if (total >= budget)
+            {
+                budgetSpent = true;
+                break;
+            }
+
+            size_t readSize = static_cast<size_t>(qMin<qint64>(sizeof(buffer), budget - total));
+            ssize_t len = ::read(session->fd, buffer, readSize);
+            if (len > 0)
+            {
+                total += len;
+                if (session->callbacks.onData)
+                    session->callbacks.onData(buffer, len);
+                continue;
+            }
+
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            //EOF or EIO: slave side is closed
+            session->closed = true;
+            if (session->callbacks.onClosed)
+                session->callbacks.onClosed();
+        }
+
+        t_currentSessionId = 0;
+    }
+
+    if (budgetSpent && !session->closed && m_running)
+        return true; //still in flight, caller queues the next turn
+
+    QMutexLocker locker(&session->stateMutex);
+    session->inFlight = false;
+    if (hangup)
+        session->hangupPending = true;
+    locker.unlock();
+
+    updateInterest(session);
+    return false;
+}
@@ -0,0 +1,119 @@
+#ifndef PTYREACTOR_H
+#define PTYREACTOR_H
+
+#include <QString>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSharedPointer>
+#include <QHash>
+#include <QList>
+#include <functional>
+#include <atomic>
+
+class PtyReactorThread;
+class PtyReactorSession;
+
+//multiplexes master fds of many ptys in one epoll set:
+//one poller thread waits for readiness, small pool of worker threads does the reads/writes
+//and delivers the results via callbacks (called on worker threads)
+//ready sessions are queued to per-worker deques, idle workers steal from the others,
+//one turn of a session reads at most maxBytesPerTurn, then the session goes back to the queue
+//available only on Linux
+class PtyReactor
+{
+public:
+    typedef std::function<void(const char *data, qint64 size)> DataCallback;
+    typedef std::function<void()> EventCallback;
+
+    struct Callbacks
+    {
+        DataCallback onData;      //new output from the master fd
+        EventCallback onWritable; //master fd is ready for writes (see setWriteEnabled)
+        EventCallback onClosed;   //EOF/EIO on master fd, session is done
+    };
+
+    //process-wide reactor with default count of workers, started on first use
+    static PtyReactor *instance();
+
+    explicit PtyReactor(int workerCount = 0); //0 -> ideal thread count
+    ~PtyReactor();
+
+    bool start();
+    void stop();
+    bool isRunning() const;
+    int workerCount() const;
+    QString lastError() const;
+
+    //add master fd (must be non-blocking) to the reactor, returns session id or 0 on error,
+    //fd must stay open until unregisterFd()
+    quint64 registerFd(int fd, const Callbacks &callbacks);
+    //remove session, after return no callback of it is running or will be called
+    //(except if called from the callback of this session itself)
+    void unregisterFd(quint64 sessionId);
+
+    //interest in read/write readiness of the session
+    void setReadEnabled(quint64 sessionId, bool enabled);
+    void setWriteEnabled(quint64 sessionId, bool enabled);
+
+    //fairness cap: default for new sessions and per-session override
+    void setMaxBytesPerTurn(qint64 maxBytes);
+    qint64 maxBytesPerTurn() const;
+    void setSessionMaxBytesPerTurn(quint64 sessionId, qint64 maxBytes);
+
+    int sessionCount() const;
+    quint64 stealCount() const;
+    quint64 requeueCount() const;
+
+private:
+    Q_DISABLE_COPY(PtyReactor)
+
+    friend class PtyReactorThread;
+
+    QSharedPointer<PtyReactorSession> session(quint64 sessionId) const;
+    void updateInterest(const QSharedPointer<PtyReactorSession> &session);
+    void pollLoop();
+    void workerLoop(int workerIndex);
+
+private:
+    struct WorkItem
+    {
+        quint64 sessionId;
+        quint32 events;
+        bool requeued; //next turn of a session which spent its budget, not a readiness from epoll
+    };
+
+    struct Worker
+    {
+        QMutex mutex;
+        QList<WorkItem> deque;
+        PtyReactorThread *thread;
+    };
+
+    void dispatch(int workerIndex, quint64 sessionId, quint32 events, bool requeued = false);
+    bool takeWork(int workerIndex, WorkItem *item);
+    bool processSession(const QSharedPointer<PtyReactorSession> &session, quint32 events, bool requeued);
+
+    int m_epollFd;
+    int m_wakeupFd;
+    int m_workerCount;
+    std::atomic<bool> m_running;
+    std::atomic<qint64> m_maxBytesPerTurn;
+    QString m_lastError;
+
+    mutable QMutex m_sessionsMutex;
+    QHash<quint64, QSharedPointer<PtyReactorSession> > m_sessions;
+    quint64 m_nextSessionId;
+
+    PtyReactorThread *m_pollThread;
+    QList<Worker *> m_workers;
+
+    //idle workers sleep here until anything is queued to any deque
+    QMutex m_idleMutex;
+    QWaitCondition m_idleCondition;
+    std::atomic<int> m_pendingItems;
+
+    std::atomic<quint64> m_stealCount;
+    std::atomic<quint64> m_requeueCount;
+};
+
+#endif // PTYREACTOR_H
@@ -0,0 +1,565 @@
+#include "ptyrecorder.h"
+#include "ptyscreen.h"
+#include <QThread>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <functional>
+#include <string.h>
+
+#define RECORDER_WRITER_INTERVAL_MSEC 20
+#define RECORDER_FLUSH_SIZE (64 * 1024)
+
+class PtyRecorderThread : public QThread
+{
+public:
+    PtyRecorderThread(const std::function<void()> &body)
+        : QThread()
+        , m_body(body)
+    {
+    }
+
+protected:
+    void run()
+    {
+        m_body();
+    }
+
+private:
+    std::function<void()> m_body;
+};
+
+static inline void appendVarint(QByteArray &out, quint64 value)
+{
+    while (value >= 0x80)
+    {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+static inline void appendLittleEndian(QByteArray &out, quint64 value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out.append(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+//length of a valid UTF-8 sequence at 'data', 0 if invalid, -1 if valid so far but cut by 'end'
+static int utf8SequenceLength(const uchar *data, const uchar *end)
+{
+    uchar lead = data[0];
+    int length;
+    uchar min = 0x80;
+    uchar max = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf)
+        length = 2;
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        length = 3;
+        if (lead == 0xe0)
+            min = 0xa0; //overlong
+        else if (lead == 0xed)
+            max = 0x9f; //surrogates
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        length = 4;
+        if (lead == 0xf0)
+            min = 0x90;
+        else if (lead == 0xf4)
+            max = 0x8f;
+    }
+    else
+        return 0;
+
+    for (int i = 1; i < length; i++)
+    {
+        if (data + i >= end)
+            return -1;
+        uchar c = data[i];
+        if (c < (i == 1 ? min : 0x80) || c > (i == 1 ? max : 0xbf))
+            return 0;
+    }
+    return length;
+}
+
+PtyRecorder::PtyRecorder(qint64 queueSize)
+    : m_ring(0)
+    , m_ringSize(64 * 1024)
+    , m_writePos(0)
+    , m_readPos(0)
+    , m_recording(false)
+    , m_writerSleeping(false)
+    , m_stopping(false)
+    , m_droppedBytes(0)
+    , m_writtenBytes(0)
+    , m_overflowPolicy(WaitForSpace)
+    , m_format(AsciicastFormat)
+    , m_startTime(0)
+    , m_cols(0)
+    , m_rows(0)
+    , m_thread(0)
+    , m_lastRecordTime(0)
+    , m_keyframeInterval(PTY_RECORDER_DEFAULT_KEYFRAME_INTERVAL)
+    , m_keyframeScreen(0)
+    , m_keyframeGeneration(0)
+    , m_lastKeyframeTime(0)
+{
+    while (m_ringSize < static_cast<quint64>(queueSize))
+        m_ringSize <<= 1;
+    m_ring = new char[m_ringSize];
+}
+
+PtyRecorder::~PtyRecorder()
+{
+    stop();
+    delete [] m_ring;
+}
+
+bool PtyRecorder::start(IPtyProcess *pty, const QString &fileName, PtyRecorder::Format format)
+{
+    if (!pty)
+    {
+        m_lastError = QString("PtyRecorder Error: no pty to record");
+        return false;
+    }
+
+    if (!start(fileName, pty->size().first, pty->size().second, format))
+        return false;
+
+    m_pty = pty;
+    pty->addStreamObserver(this);
+    return true;
+}
+
+bool PtyRecorder::start(const QString &fileName, qint16 cols, qint16 rows, PtyRecorder::Format format)
+{
+    if (m_recording || m_thread)
+    {
+        m_lastError = QString("PtyRecorder Error: already recording");
+        return false;
+    }
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        m_lastError = QString("PtyRecorder Error: unable to open file -> %1").arg(m_file.errorString());
+        return false;
+    }
+
+    m_format = format;
+    m_cols = cols;
+    m_rows = rows;
+    m_writePos = 0;
+    m_readPos = 0;
+    m_droppedBytes = 0;
+    m_writtenBytes = 0;
+    m_stopping = false;
+    m_out.clear();
+    m_pendingOutput.clear();
+    m_pendingInput.clear();
+    m_lastRecordTime = 0;
+    m_lastError.clear();
+
+    m_keyframes.clear();
+    m_lastKeyframeTime = 0;
+    if (m_format == BinaryFormat && m_keyframeInterval > 0)
+    {
+        //keyframes hold the screen only, shadow screen needs no scrollback
+        m_keyframeScreen = new PtyScreen(cols, rows);
+        m_keyframeScreen->setScrollbackLimit(0);
+        m_keyframeGeneration = m_keyframeScreen->generation();
+    }
+
+    m_startTime = QDateTime::currentMSecsSinceEpoch();
+    m_clock.start();
+    writeHeader();
+    flushOutput();
+
+    m_thread = new PtyRecorderThread([this]() { writerLoop(); });
+    m_thread->start();
+    m_recording = true;
+    return true;
+}
+
+void PtyRecorder::stop()
+{
+    if (!m_thread)
+        return;
+
+    m_recording = false;
+
+    //after this no pty thread is inside the observer methods
+    if (m_pty)
+        m_pty->removeStreamObserver(this);
+    m_pty = 0;
+
+    m_stopping = true;
+    {
+        QMutexLocker locker(&m_wakeMutex);
+        m_wakeCondition.wakeOne();
+    }
+    m_thread->wait();
+    delete m_thread;
+    m_thread = 0;
+
+    delete m_keyframeScreen;
+    m_keyframeScreen = 0;
+
+    m_file.close();
+}
+
+void PtyRecorder::ptyOutput(const char *data, qint64 size)
+{
+    push(OutputRecord, data, size);
+}
+
+void PtyRecorder::ptyInput(const char *data, qint64 size)
+{
+    push(InputRecord, data, size);
+}
+
+void PtyRecorder::ptyResized(qint16 cols, qint16 rows)
+{
+    char data[4];
+    data[0] = static_cast<char>(cols & 0xff);
+    data[1] = static_cast<char>((cols >> 8) & 0xff);
+    data[2] = static_cast<char>(rows & 0xff);
+    data[3] = static_cast<char>((rows >> 8) & 0xff);
+    push(ResizeRecord, data, sizeof(data));
+}
+
+void PtyRecorder::push(PtyRecorder::RecordType type, const char *data, qint64 size)
+{
+    if (!m_recording)
+        return;
+
+    //big chunks are split, so a record always fits into the ring
+    qint64 time = m_clock.nsecsElapsed();
+    qint64 maxChunk = static_cast<qint64>(m_ringSize / 4);
+    do
+    {
+        quint32 chunk = static_cast<quint32>(qMin(size, maxChunk));
+        if (!pushRecord(type, time, data, chunk))
+            m_droppedBytes += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    while (size > 0);
+}
+
+bool PtyRecorder::pushRecord(PtyRecorder::RecordType type, qint64 time, const char *data, quint32 size)
+{
+    quint64 need = (sizeof(RecordHeader) + size + 7) & ~quint64(7);
+    quint64 writePos = m_writePos.load(std::memory_order_relaxed);
+
+    //writer is woken only when the ring fills up, otherwise it batches on its own interval
+    while (m_ringSize - (writePos - m_readPos.load(std::memory_order_acquire)) < need)
+    {
+        if (m_overflowPolicy == DropRecords)
+            return false;
+
+        if (m_writerSleeping)
+        {
+            QMutexLocker locker(&m_wakeMutex);
+            m_wakeCondition.wakeOne();
+        }
+        QThread::yieldCurrentThread();
+    }
+
+    RecordHeader header;
+    header.time = time;
+    header.size = size;
+    header.type = type;
+    copyToRing(writePos, reinterpret_cast<const char *>(&header), sizeof(header));
+    copyToRing(writePos + sizeof(header), data, size);
+    m_writePos.store(writePos + need, std::memory_order_release);
+
+    if (writePos + need - m_readPos.load(std::memory_order_relaxed) > m_ringSize / 2 && m_writerSleeping)
+    {
+        QMutexLocker locker(&m_wakeMutex);
+        m_wakeCondition.wakeOne();
+    }
+    return true;
+}
+
+void PtyRecorder::copyToRing(quint64 position, const char *data, quint32 size)
+{
+    quint64 offset = position & (m_ringSize - 1);
+    quint64 first = qMin<quint64>(size, m_ringSize - offset);
+    memcpy(m_ring + offset, data, first);
+    if (first < size)
+        memcpy(m_ring, data + first, size - first);
+}
+
+void PtyRecorder::copyFromRing(quint64 position, char *data, quint32 size) const
+{
+    quint64 offset = position & (m_ringSize - 1);
+    quint64 first = qMin<quint64>(size, m_ringSize - offset);
+    memcpy(data, m_ring + offset, first);
+    if (first < size)
+        memcpy(data + first, m_ring, size - first);
+}
+
+void PtyRecorder::writerLoop()
+{
+    forever
+    {
+        if (drain())
+            continue;
+
+        if (m_stopping)
+            break;
+
+        QMutexLocker locker(&m_wakeMutex);
+        m_writerSleeping = true;
+        if (m_writePos.load() == m_readPos.load() && !m_stopping)
+            m_wakeCondition.wait(&m_wakeMutex, RECORDER_WRITER_INTERVAL_MSEC);
+        m_writerSleeping = false;
+    }
+
+    //sequences still cut when the recording ends are invalid, so they become U+FFFD
+    if (m_format == AsciicastFormat)
+    {
+        if (!m_pendingOutput.isEmpty())
+            writeAsciicastEvent(m_lastRecordTime * 1000, OutputRecord, QByteArray(), m_pendingOutput);
+        if (!m_pendingInput.isEmpty())
+            writeAsciicastEvent(m_lastRecordTime * 1000, InputRecord, QByteArray(), m_pendingInput);
+    }
+    else if (m_keyframeScreen)
+        writeIndex();
+    flushOutput();
+}
+
+bool PtyRecorder::drain()
+{
+    quint64 readPos = m_readPos.load(std::memory_order_relaxed);
+    quint64 writePos = m_writePos.load(std::memory_order_acquire);
+    if (readPos == writePos)
+        return false;
+
+    QByteArray data;
+    while (readPos != writePos)
+    {
+        RecordHeader header;
+        copyFromRing(readPos, reinterpret_cast<char *>(&header), sizeof(header));
+        data.resize(header.size);
+        copyFromRing(readPos + sizeof(header), data.data(), header.size);
+        readPos += (sizeof(RecordHeader) + header.size + 7) & ~quint64(7);
+        m_readPos.store(readPos, std::memory_order_release);
+
+        writeRecord(header, data);
+        if (m_out.size() >= RECORDER_FLUSH_SIZE)
+            flushOutput();
+    }
+
+    flushOutput();
+    return true;
+}
+
+void PtyRecorder::writeHeader()
+{
+    if (m_format == AsciicastFormat)
+    {
+        m_out.append(QString("{\"version\": 2, \"width\": %1, \"height\": %2, \"timestamp\": %3}\n")
+                     .arg(m_cols).arg(m_rows).arg(m_startTime / 1000).toUtf8());
+        return;
+    }
+
+    m_out.append(PTY_RECORDER_BINARY_MAGIC);
+    m_out.append(static_cast<char>(PTY_RECORDER_BINARY_VERSION));
+    appendLittleEndian(m_out, static_cast<quint16>(m_cols), 2);
+    appendLittleEndian(m_out, static_cast<quint16>(m_rows), 2);
+    appendLittleEndian(m_out, static_cast<quint64>(m_startTime), 8);
+}
+
+void PtyRecorder::writeRecord(const PtyRecorder::RecordHeader &header, const QByteArray &data)
+{
+    qint64 micros = header.time / 1000;
+
+    if (m_format == BinaryFormat)
+    {
+        m_out.append(static_cast<char>(header.type));
+        appendVarint(m_out, static_cast<quint64>(qMax<qint64>(micros - m_lastRecordTime, 0)));
+        appendVarint(m_out, header.size);
+        m_out.append(data);
+        m_lastRecordTime = qMax(micros, m_lastRecordTime);
+
+        if (m_keyframeScreen)
+        {
+            if (header.type == OutputRecord)
+                m_keyframeScreen->feed(data.constData(), data.size());
+            else if (header.type == ResizeRecord)
+            {
+                const uchar *size = reinterpret_cast<const uchar *>(data.constData());
+                m_keyframeScreen->resize(static_cast<qint16>(size[0] | (size[1] << 8)),
+                                         static_cast<qint16>(size[2] | (size[3] << 8)));
+            }
+
+            if (m_lastRecordTime - m_lastKeyframeTime >= static_cast<qint64>(m_keyframeInterval) * 1000)
+                writeKeyframe(m_lastRecordTime);
+        }
+        return;
+    }
+
+    m_lastRecordTime = qMax(micros, m_lastRecordTime);
+    switch (header.type)
+    {
+    case OutputRecord:
+        writeAsciicastEvent(header.time, OutputRecord, data, m_pendingOutput);
+        break;
+    case InputRecord:
+        writeAsciicastEvent(header.time, InputRecord, data, m_pendingInput);
+        break;
+    case ResizeRecord:
+    {
+        const uchar *size = reinterpret_cast<const uchar *>(data.constData());
+        int cols = size[0] | (size[1] << 8);
+        int rows = size[2] | (size[3] << 8);
+        writeAsciicastEvent(header.time, ResizeRecord, QString("%1x%2").arg(cols).arg(rows).toLatin1(), m_pendingInput);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void PtyRecorder::writeAsciicastEvent(qint64 time, char type, const QByteArray &data, QByteArray &pending)
+{
+    //JSON strings must be valid UTF-8: sequences cut between chunks wait for the next chunk,
+    //invalid bytes become U+FFFD
+    QByteArray text = (type == ResizeRecord) ? data : pending + data;
+    if (type != ResizeRecord)
+        pending.clear();
+
+    const uchar *begin = reinterpret_cast<const uchar *>(text.constData());
+    const uchar *end = begin + text.size();
+    bool last = data.isEmpty(); //writer stops: nothing will complete the sequence
+
+    int eventStart = m_out.size();
+    m_out.append('[');
+    m_out.append(QByteArray::number(time / 1e9, 'f', 6));
+    m_out.append(", \"");
+    m_out.append(type);
+    m_out.append("\", \"");
+
+    static const char hex[] = "0123456789abcdef";
+    for (const uchar *p = begin; p < end; )
+    {
+        uchar c = *p;
+        if (c < 0x80)
+        {
+            switch (c)
+            {
+            case '"': m_out.append("\\\""); break;
+            case '\\': m_out.append("\\\\"); break;
+            case '\n': m_out.append("\\n"); break;
+            case '\r': m_out.append("\\r"); break;
+            case '\t': m_out.append("\\t"); break;
+            case '\b': m_out.append("\\b"); break;
+            case '\f': m_out.append("\\f"); break;
+            default:
+                if (c < 0x20)
+                {
+                    m_out.append("\\u00");
+                    m_out.append(hex[c >> 4]);
+                    m_out.append(hex[c & 0xf]);
+                }
+                else
+                    m_out.append(static_cast<char>(c));
+                break;
+            }
+            p++;
+            continue;
+        }
+
+        int length = utf8SequenceLength(p, end);
+        if (length < 0 && !last)
+        {
+            pending = QByteArray(reinterpret_cast<const char *>(p), static_cast<int>(end - p));
+            break;
+        }
+        if (length <= 0)
+        {
+            m_out.append("\\ufffd");
+            p++;
+            continue;
+        }
+        m_out.append(reinterpret_cast<const char *>(p), length);
+        p += length;
+    }
+
+    //chunk was only the start of a sequence
+    if (type != ResizeRecord && !pending.isEmpty() && pending.size() == text.size())
+    {
+        m_out.truncate(eventStart);
+        return;
+    }
+
+    m_out.append("\"]\n");
+}
+
+void PtyRecorder::writeKeyframe(qint64 micros)
+{
+    //nothing changed since the last one
+    quint64 generation = m_keyframeScreen->generation();
+    if (generation == m_keyframeGeneration)
+    {
+        m_lastKeyframeTime = micros;
+        return;
+    }
+
+    //output stopped inside a sequence, try again after the next record
+    QByteArray state = m_keyframeScreen->saveState();
+    if (state.isEmpty())
+        return;
+
+    QByteArray payload;
+    appendVarint(payload, static_cast<quint64>(micros));
+    payload.append(state);
+
+    m_keyframes.append(qMakePair(micros, m_writtenBytes.load() + m_out.size()));
+    m_out.append(static_cast<char>(KeyframeRecord));
+    appendVarint(m_out, 0);
+    appendVarint(m_out, static_cast<quint64>(payload.size()));
+    m_out.append(payload);
+
+    m_keyframeGeneration = generation;
+    m_lastKeyframeTime = micros;
+}
+
+void PtyRecorder::writeIndex()
+{
+    QByteArray payload;
+    appendVarint(payload, static_cast<quint64>(m_keyframes.size()));
+    appendVarint(payload, static_cast<quint64>(m_lastRecordTime));
+    qint64 lastTime = 0;
+    qint64 lastOffset = 0;
+    for (int i = 0; i < m_keyframes.size(); i++)
+    {
+        appendVarint(payload, static_cast<quint64>(m_keyframes[i].first - lastTime));
+        appendVarint(payload, static_cast<quint64>(m_keyframes[i].second - lastOffset));
+        lastTime = m_keyframes[i].first;
+        lastOffset = m_keyframes[i].second;
+    }
+
+    qint64 indexOffset = m_writtenBytes.load() + m_out.size();
+    m_out.append(static_cast<char>(IndexRecord));
+    appendVarint(m_out, 0);
+    appendVarint(m_out, static_cast<quint64>(payload.size()));
+    m_out.append(payload);
+    appendLittleEndian(m_out, static_cast<quint64>(indexOffset), 8);
+    m_out.append(PTY_RECORDER_INDEX_MAGIC);
+}
+
+void PtyRecorder::flushOutput()
+{
+    if (m_out.isEmpty())
+        return;
+
+    qint64 written = m_file.write(m_out);
+    if (written > 0)
+        m_writtenBytes += written;
+    m_file.flush();
+    m_out.clear();
+}
@@ -0,0 +1,150 @@
+#ifndef PTYRECORDER_H
+#define PTYRECORDER_H
+
+#include "iptyprocess.h"
+#include <QFile>
+#include <QPointer>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QPair>
+#include <atomic>
+
+#define PTY_RECORDER_DEFAULT_QUEUE_SIZE (4 * 1024 * 1024)
+#define PTY_RECORDER_DEFAULT_KEYFRAME_INTERVAL 10000
+#define PTY_RECORDER_BINARY_MAGIC "PTYQTREC"
+#define PTY_RECORDER_BINARY_VERSION 1
+#define PTY_RECORDER_INDEX_MAGIC "PTYQTIDX"
+
+class PtyRecorderThread;
+class PtyScreen;
+
+//session recorder for audit: output, input and resizes of a pty with timestamps;
+//attached as IPtyStreamObserver, the pty threads only copy records into a lock-free
+//single-producer/single-consumer ring (observer calls of a pty are serialized), a background
+//thread formats and writes them, so recording costs a memcpy on the hot path;
+//formats: asciicast v2 (JSON lines with "o"/"i"/"r" events) or compact binary:
+//"PTYQTREC" magic, version byte, cols and rows (quint16 LE), start time (qint64 LE msecs since epoch),
+//then records: type byte, time since the previous record in microseconds (varint), size (varint), data;
+//binary recordings also get keyframes: the writer thread keeps a PtyScreen of the output and every
+//keyframe interval writes a 'k' record (absolute time in microseconds as varint, PtyScreen::saveState()),
+//at stop an 'x' record indexes them (count, duration, then time and file offset deltas, all varints),
+//followed by its file offset (qint64 LE) and "PTYQTIDX", so PtyReplayer seeks without reading everything
+class PtyRecorder : public IPtyStreamObserver
+{
+public:
+    enum Format
+    {
+        AsciicastFormat,
+        BinaryFormat
+    };
+
+    //what producers do when the ring is full
+    enum OverflowPolicy
+    {
+        WaitForSpace, //nothing is lost, the pty thread waits for the writer
+        DropRecords   //records are dropped and counted
+    };
+
+    enum RecordType
+    {
+        OutputRecord = 'o',
+        InputRecord = 'i',
+        ResizeRecord = 'r',
+        KeyframeRecord = 'k',
+        IndexRecord = 'x'
+    };
+
+    explicit PtyRecorder(qint64 queueSize = PTY_RECORDER_DEFAULT_QUEUE_SIZE);
+    virtual ~PtyRecorder();
+
+    //records 'pty' until stop(), initial size is taken from it
+    bool start(IPtyProcess *pty, const QString &fileName, Format format = AsciicastFormat);
+    //records what comes to the observer methods
+    bool start(const QString &fileName, qint16 cols, qint16 rows, Format format = AsciicastFormat);
+    //detaches, writes everything queued and closes the file
+    void stop();
+
+    bool isRecording() const { return m_recording; }
+    QString lastError() const { return m_lastError; }
+
+    void setOverflowPolicy(OverflowPolicy policy) { m_overflowPolicy = policy; }
+    OverflowPolicy overflowPolicy() const { return m_overflowPolicy; }
+    qint64 droppedBytes() const { return m_droppedBytes; }
+    qint64 writtenBytes() const { return m_writtenBytes; }
+
+    //msecs between keyframes of binary recordings, 0 disables them; set before start()
+    void setKeyframeInterval(int msecs) { m_keyframeInterval = msecs; }
+    int keyframeInterval() const { return m_keyframeInterval; }
+
+    virtual void ptyOutput(const char *data, qint64 size);
+    virtual void ptyInput(const char *data, qint64 size);
+    virtual void ptyResized(qint16 cols, qint16 rows);
+
+private:
+    Q_DISABLE_COPY(PtyRecorder)
+
+    //record in the ring: header, then 'size' bytes of data
+    struct RecordHeader
+    {
+        qint64 time; //nanoseconds since start
+        quint32 size;
+        quint32 type;
+    };
+
+    void push(RecordType type, const char *data, qint64 size);
+    bool pushRecord(RecordType type, qint64 time, const char *data, quint32 size);
+    void copyToRing(quint64 position, const char *data, quint32 size);
+    void copyFromRing(quint64 position, char *data, quint32 size) const;
+
+    //writer thread
+    void writerLoop();
+    bool drain();
+    void writeHeader();
+    void writeRecord(const RecordHeader &header, const QByteArray &data);
+    void writeAsciicastEvent(qint64 time, char type, const QByteArray &data, QByteArray &pending);
+    void writeKeyframe(qint64 micros);
+    void writeIndex();
+    void flushOutput();
+
+private:
+    char *m_ring;
+    quint64 m_ringSize; //power of two
+    alignas(64) std::atomic<quint64> m_writePos;
+    alignas(64) std::atomic<quint64> m_readPos;
+    alignas(64) std::atomic<bool> m_recording;
+    std::atomic<bool> m_writerSleeping;
+    std::atomic<bool> m_stopping;
+    std::atomic<qint64> m_droppedBytes;
+    std::atomic<qint64> m_writtenBytes;
+    OverflowPolicy m_overflowPolicy;
+
+    QPointer<IPtyProcess> m_pty;
+    QString m_lastError;
+    Format m_format;
+    QFile m_file;
+    QElapsedTimer m_clock;
+    qint64 m_startTime; //msecs since epoch
+    qint16 m_cols;
+    qint16 m_rows;
+
+    PtyRecorderThread *m_thread;
+    QMutex m_wakeMutex;
+    QWaitCondition m_wakeCondition;
+
+    //writer state
+    QByteArray m_out;
+    QByteArray m_pendingOutput; //incomplete UTF-8 sequence at the end of the last output
+    QByteArray m_pendingInput;
+    qint64 m_lastRecordTime;
+
+    //keyframes of binary recordings
+    int m_keyframeInterval;
+    PtyScreen *m_keyframeScreen;
+    quint64 m_keyframeGeneration;
+    qint64 m_lastKeyframeTime;
+    QVector<QPair<qint64, qint64> > m_keyframes; //time in microseconds, file offset
+};
+
+#endif // PTYRECORDER_H
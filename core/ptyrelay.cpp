@@ -0,0 +1,180 @@
+#include "ptyrelay.h"
+
+PtyRelay::PtyRelay(IPtyProcess *pty, QObject *parent)
+    : QObject(parent)
+    , m_pty(pty)
+    , m_maxFrameBytes(PTY_RELAY_DEFAULT_FRAME_SIZE)
+    , m_maxDelayUsec(PTY_RELAY_DEFAULT_FRAME_DELAY_USEC)
+    , m_maxPendingBytes(PTY_RELAY_DEFAULT_MAX_PENDING)
+    , m_pendingBytes(0)
+    , m_echoPending(false)
+    , m_readsPty(false)
+    , m_throttled(false)
+    , m_pausedPty(false)
+    , m_framesSent(0)
+    , m_bytesSent(0)
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &PtyRelay::flush);
+
+    //reserved capacity survives resize(0), so frames are built in one buffer
+    m_frame.reserve(static_cast<int>(m_maxFrameBytes));
+
+    setReadsPty(true);
+}
+
+PtyRelay::~PtyRelay()
+{
+    if (m_pty && m_pty->notifier())
+        disconnect(m_pty->notifier(), 0, this, 0);
+    resumePty();
+}
+
+void PtyRelay::setFrameLimits(qint64 maxFrameBytes, int maxDelayUsec)
+{
+    flush();
+    m_maxFrameBytes = qMax<qint64>(maxFrameBytes, 1);
+    m_maxDelayUsec = qMax(maxDelayUsec, 0);
+    m_frame.reserve(static_cast<int>(m_maxFrameBytes));
+}
+
+void PtyRelay::setReadsPty(bool enabled)
+{
+    if (!m_pty || enabled == m_readsPty)
+        return;
+
+    m_readsPty = enabled;
+    if (enabled)
+    {
+        connect(m_pty->notifier(), &QIODevice::readyRead, this, &PtyRelay::onReadyRead);
+    }
+    else
+    {
+        disconnect(m_pty->notifier(), &QIODevice::readyRead, this, &PtyRelay::onReadyRead);
+        resumePty();
+    }
+}
+
+void PtyRelay::writeInput(const QByteArray &data)
+{
+    if (!m_pty)
+        return;
+
+    //next output is most likely echo of this input, send it without delay
+    m_echoPending = true;
+    m_pty->write(data);
+}
+
+void PtyRelay::writeTextInput(const QString &text)
+{
+    writeInput(text.toUtf8());
+}
+
+void PtyRelay::framesWritten(qint64 bytes)
+{
+    //written bytes include frame headers
+    m_pendingBytes = qMax<qint64>(m_pendingBytes - bytes, 0);
+    if (m_throttled && m_pendingBytes <= m_maxPendingBytes / 2)
+    {
+        m_throttled = false;
+        resumePty();
+        emit throttled(false);
+    }
+}
+
+void PtyRelay::flush()
+{
+    m_timer.stop();
+    if (!m_frame.isEmpty())
+        sendFrame();
+}
+
+void PtyRelay::relayOutput(const QByteArray &data)
+{
+    appendOutput(data.constData(), data.size());
+    scheduleFrame();
+}
+
+void PtyRelay::onReadyRead()
+{
+    if (!m_pty)
+        return;
+
+    //copy straight from the pty buffer into the frame
+    PtySpan spans[2];
+    int count;
+    while ((count = m_pty->peek(spans)) > 0)
+    {
+        qint64 taken = 0;
+        for (int i = 0; i < count; i++)
+        {
+            appendOutput(spans[i].data, spans[i].size);
+            taken += spans[i].size;
+        }
+        m_pty->consume(taken);
+    }
+
+    scheduleFrame();
+}
+
+void PtyRelay::appendOutput(const char *data, qint64 size)
+{
+    while (size > 0)
+    {
+        qint64 chunk = qMin(size, m_maxFrameBytes - m_frame.size());
+        m_frame.append(data, static_cast<int>(chunk));
+        data += chunk;
+        size -= chunk;
+        if (m_frame.size() >= m_maxFrameBytes)
+            sendFrame();
+    }
+}
+
+void PtyRelay::scheduleFrame()
+{
+    if (m_frame.isEmpty())
+        return;
+
+    if (m_maxDelayUsec == 0 || m_echoPending)
+    {
+        flush();
+        return;
+    }
+
+    //QTimer has millisecond resolution, so delay is rounded up
+    if (!m_timer.isActive())
+        m_timer.start((m_maxDelayUsec + 999) / 1000);
+}
+
+void PtyRelay::sendFrame()
+{
+    m_echoPending = false;
+    m_framesSent++;
+    m_bytesSent += m_frame.size();
+    m_pendingBytes += m_frame.size();
+    emit frameReady(m_frame);
+    m_frame.resize(0);
+
+    if (m_throttled || m_maxPendingBytes == 0 || m_pendingBytes <= m_maxPendingBytes)
+        return;
+
+    //in relayOutput() mode the reader of the pty pauses it on throttled()
+    m_throttled = true;
+    if (m_readsPty && m_pty && !m_pty->isReadingPaused())
+    {
+        m_pty->pauseReading();
+        m_pausedPty = true;
+    }
+    emit throttled(true);
+}
+
+void PtyRelay::resumePty()
+{
+    if (!m_pausedPty)
+        return;
+
+    m_pausedPty = false;
+    if (m_pty)
+        m_pty->resumeReading();
+}
@@ -0,0 +1,101 @@
+#ifndef PTYRELAY_H
+#define PTYRELAY_H
+
+#include "iptyprocess.h"
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+#define PTY_RELAY_DEFAULT_FRAME_SIZE (64 * 1024)
+#define PTY_RELAY_DEFAULT_FRAME_DELAY_USEC 2000
+#define PTY_RELAY_DEFAULT_MAX_PENDING (256 * 1024)
+
+//relays a pty to a message transport (WebSocket, usually) with binary frames:
+//output is taken zero-copy from the pty and collected into frames of up to 'maxFrameBytes',
+//a frame is sent when it is full or 'maxDelayUsec' after its first byte (output right after
+//input goes at once, so echo is not delayed), no QString round trips in either direction;
+//flow control: reading of the pty is paused while more than 'maxPendingBytes' of sent frames
+//are not written by the transport yet (framesWritten()), so a slow client throttles the shell;
+//a relay which reads the pty itself pauses it (and resumes it when deleted), otherwise throttled()
+//asks the reader to do it (PtySessionManager::setAttachedPaused())
+//not thread safe, use from the thread of the pty
+class PtyRelay : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PtyRelay(IPtyProcess *pty, QObject *parent = 0);
+    ~PtyRelay();
+
+    //0 delay - frame per readyRead
+    void setFrameLimits(qint64 maxFrameBytes, int maxDelayUsec);
+    qint64 maxFrameBytes() const { return m_maxFrameBytes; }
+    int maxDelayUsec() const { return m_maxDelayUsec; }
+
+    //0 disables flow control
+    void setMaxPendingBytes(qint64 bytes) { m_maxPendingBytes = qMax<qint64>(bytes, 0); }
+    qint64 maxPendingBytes() const { return m_maxPendingBytes; }
+    qint64 pendingBytes() const { return m_pendingBytes; }
+
+    //output is read from the pty by the relay (default), or comes only through relayOutput()
+    //when something else reads the pty (PtySessionManager...)
+    void setReadsPty(bool enabled);
+    bool readsPty() const { return m_readsPty; }
+
+    qint64 framesSent() const { return m_framesSent; }
+    qint64 bytesSent() const { return m_bytesSent; }
+
+    //connects frames, input and flow control to a QWebSocket (or a class with the same API),
+    //template keeps the library itself free of the WebSockets module
+    template <class WebSocket>
+    void attachWebSocket(WebSocket *socket)
+    {
+        connect(this, &PtyRelay::frameReady, socket, [socket](const QByteArray &frame) { socket->sendBinaryMessage(frame); });
+        connect(socket, &WebSocket::binaryMessageReceived, this, &PtyRelay::writeInput);
+        connect(socket, &WebSocket::textMessageReceived, this, &PtyRelay::writeTextInput);
+        connect(socket, &WebSocket::bytesWritten, this, &PtyRelay::framesWritten);
+    }
+
+public slots:
+    //input from the client to the pty
+    void writeInput(const QByteArray &data);
+    //for clients which send text frames
+    void writeTextInput(const QString &text);
+    //output of the pty read by someone else
+    void relayOutput(const QByteArray &data);
+    //transport wrote 'bytes' of frames (frame headers included)
+    void framesWritten(qint64 bytes);
+    //send collected output now
+    void flush();
+
+signals:
+    //send 'frame' as one binary message; the buffer is reused after the signal returns
+    void frameReady(const QByteArray &frame);
+    //transport fell 'maxPendingBytes' behind (true) or caught up to a half of it (false)
+    void throttled(bool paused);
+
+private slots:
+    void onReadyRead();
+
+private:
+    void appendOutput(const char *data, qint64 size);
+    void scheduleFrame();
+    void sendFrame();
+    void resumePty(); //undo our pauseReading()
+
+private:
+    QPointer<IPtyProcess> m_pty;
+    QTimer m_timer;
+    QByteArray m_frame;
+    qint64 m_maxFrameBytes;
+    int m_maxDelayUsec;
+    qint64 m_maxPendingBytes;
+    qint64 m_pendingBytes;
+    bool m_echoPending;
+    bool m_readsPty;
+    bool m_throttled; //pending bytes are over the limit
+    bool m_pausedPty; //reading is paused by us
+    qint64 m_framesSent;
+    qint64 m_bytesSent;
+};
+
+#endif // PTYRELAY_H
@@ -0,0 +1,304 @@
+#include "ptyreplayer.h"
+#include "ptyscrollback.h"
+#include <string.h>
+
+#define REPLAYER_HEADER_SIZE (8 + 1 + 2 + 2 + 8)
+#define REPLAYER_TRAILER_SIZE (8 + 8)
+
+static inline bool readVarint(const uchar *&data, const uchar *end, quint64 &value)
+{
+    value = 0;
+    int shift = 0;
+    while (data < end && shift < 64)
+    {
+        uchar byte = *data++;
+        value |= static_cast<quint64>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+        shift += 7;
+    }
+    return false;
+}
+
+static inline quint64 readLittleEndian(const uchar *data, int bytes)
+{
+    quint64 value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= static_cast<quint64>(data[i]) << (8 * i);
+    return value;
+}
+
+PtyReplayer::PtyReplayer()
+    : m_data(0)
+    , m_end(0)
+    , m_cols(0)
+    , m_rows(0)
+    , m_startTime(0)
+    , m_duration(0)
+    , m_screen(0)
+    , m_offset(0)
+    , m_time(0)
+    , m_position(0)
+{
+
+}
+
+PtyReplayer::~PtyReplayer()
+{
+    close();
+}
+
+bool PtyReplayer::open(const QString &fileName)
+{
+    close();
+
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        m_lastError = QString("PtyReplayer Error: unable to open file -> %1").arg(m_file.errorString());
+        return false;
+    }
+
+    qint64 fileSize = m_file.size();
+    if (fileSize >= REPLAYER_HEADER_SIZE)
+        m_data = m_file.map(0, fileSize);
+    if (!m_data || memcmp(m_data, PTY_RECORDER_BINARY_MAGIC, 8) != 0
+            || m_data[8] != PTY_RECORDER_BINARY_VERSION)
+    {
+        m_lastError = QString("PtyReplayer Error: not a binary recording");
+        close();
+        return false;
+    }
+
+    m_cols = static_cast<qint16>(readLittleEndian(m_data + 9, 2));
+    m_rows = static_cast<qint16>(readLittleEndian(m_data + 11, 2));
+    m_startTime = static_cast<qint64>(readLittleEndian(m_data + 13, 8));
+    m_end = fileSize;
+
+    //no index when the recorder did not stop cleanly
+    if (!readIndex() && !scanIndex())
+    {
+        close();
+        return false;
+    }
+
+    m_screen = new PtyScreen(m_cols, m_rows);
+    rewind();
+    m_lastError.clear();
+    return true;
+}
+
+void PtyReplayer::close()
+{
+    if (m_data)
+        m_file.unmap(const_cast<uchar *>(m_data));
+    m_data = 0;
+    m_file.close();
+
+    delete m_screen;
+    m_screen = 0;
+    m_keyframes.clear();
+    m_end = 0;
+    m_duration = 0;
+    m_offset = 0;
+    m_time = 0;
+    m_position = 0;
+}
+
+bool PtyReplayer::seek(qint64 msecs)
+{
+    if (!m_data)
+    {
+        m_lastError = QString("PtyReplayer Error: no recording open");
+        return false;
+    }
+
+    qint64 target = qMax<qint64>(msecs, 0) * 1000;
+
+    //last keyframe at or before the target
+    int low = 0;
+    int high = m_keyframes.size();
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (m_keyframes[middle].time <= target)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    const Keyframe *keyframe = (low > 0) ? &m_keyframes[low - 1] : 0;
+
+    //playing forward from the current state is cheaper unless a keyframe is ahead of it
+    if (target < m_position || (keyframe && keyframe->offset > m_offset))
+    {
+        if (keyframe)
+        {
+            if (!restoreKeyframe(*keyframe))
+                return false;
+        }
+        else
+            rewind();
+    }
+
+    Record record;
+    while (m_offset < m_end)
+    {
+        if (!readRecord(m_offset, record))
+        {
+            m_lastError = QString("PtyReplayer Error: broken record at offset %1").arg(m_offset);
+            return false;
+        }
+        if (m_time + record.delta > target)
+            break;
+
+        if (record.type == PtyRecorder::OutputRecord)
+            m_screen->feed(record.data, record.size);
+        else if (record.type == PtyRecorder::ResizeRecord && record.size >= 4)
+        {
+            const uchar *size = reinterpret_cast<const uchar *>(record.data);
+            m_screen->resize(static_cast<qint16>(readLittleEndian(size, 2)),
+                             static_cast<qint16>(readLittleEndian(size + 2, 2)));
+        }
+
+        m_time += record.delta;
+        m_offset = record.next;
+    }
+
+    m_position = target;
+    return true;
+}
+
+bool PtyReplayer::readRecord(qint64 offset, PtyReplayer::Record &record) const
+{
+    const uchar *data = m_data + offset;
+    const uchar *end = m_data + m_end;
+    quint64 delta, size;
+    if (data >= end)
+        return false;
+
+    record.type = static_cast<char>(*data++);
+    if (!readVarint(data, end, delta) || !readVarint(data, end, size)
+            || size > static_cast<quint64>(end - data))
+        return false;
+
+    record.delta = static_cast<qint64>(delta);
+    record.data = reinterpret_cast<const char *>(data);
+    record.size = static_cast<qint64>(size);
+    record.next = (data - m_data) + record.size;
+    return true;
+}
+
+bool PtyReplayer::readIndex()
+{
+    if (m_end < REPLAYER_HEADER_SIZE + REPLAYER_TRAILER_SIZE
+            || memcmp(m_data + m_end - 8, PTY_RECORDER_INDEX_MAGIC, 8) != 0)
+        return false;
+
+    qint64 indexOffset = static_cast<qint64>(readLittleEndian(m_data + m_end - REPLAYER_TRAILER_SIZE, 8));
+    if (indexOffset < REPLAYER_HEADER_SIZE || indexOffset >= m_end - REPLAYER_TRAILER_SIZE)
+        return false;
+
+    //records end where the index starts
+    qint64 fileSize = m_end;
+    m_end = m_end - REPLAYER_TRAILER_SIZE;
+    Record record;
+    if (!readRecord(indexOffset, record) || record.type != PtyRecorder::IndexRecord)
+    {
+        m_end = fileSize;
+        return false;
+    }
+
+    const uchar *data = reinterpret_cast<const uchar *>(record.data);
+    const uchar *end = data + record.size;
+    quint64 count, duration;
+    if (!readVarint(data, end, count) || !readVarint(data, end, duration))
+    {
+        m_end = fileSize;
+        return false;
+    }
+
+    Keyframe keyframe;
+    keyframe.time = 0;
+    keyframe.offset = 0;
+    m_keyframes.clear();
+    for (quint64 i = 0; i < count; i++)
+    {
+        quint64 time, offset;
+        if (!readVarint(data, end, time) || !readVarint(data, end, offset))
+        {
+            m_keyframes.clear();
+            m_end = fileSize;
+            return false;
+        }
+        keyframe.time += static_cast<qint64>(time);
+        keyframe.offset += static_cast<qint64>(offset);
+        m_keyframes.append(keyframe);
+    }
+
+    m_duration = static_cast<qint64>(duration);
+    m_end = indexOffset;
+    return true;
+}
+
+bool PtyReplayer::scanIndex()
+{
+    m_keyframes.clear();
+    m_duration = 0;
+
+    qint64 offset = REPLAYER_HEADER_SIZE;
+    Record record;
+    while (offset < m_end)
+    {
+        //a record cut by a crash ends the recording
+        if (!readRecord(offset, record) || record.type == PtyRecorder::IndexRecord)
+            break;
+
+        m_duration += record.delta;
+        if (record.type == PtyRecorder::KeyframeRecord)
+        {
+            Keyframe keyframe;
+            keyframe.time = m_duration;
+            keyframe.offset = offset;
+            m_keyframes.append(keyframe);
+        }
+        offset = record.next;
+    }
+
+    m_end = offset;
+    return true;
+}
+
+bool PtyReplayer::restoreKeyframe(const PtyReplayer::Keyframe &keyframe)
+{
+    Record record;
+    if (!readRecord(keyframe.offset, record) || record.type != PtyRecorder::KeyframeRecord)
+    {
+        m_lastError = QString("PtyReplayer Error: broken keyframe at offset %1").arg(keyframe.offset);
+        return false;
+    }
+
+    const uchar *data = reinterpret_cast<const uchar *>(record.data);
+    const uchar *end = data + record.size;
+    quint64 time;
+    if (!readVarint(data, end, time)
+            || !m_screen->restoreState(QByteArray::fromRawData(reinterpret_cast<const char *>(data),
+                                                               static_cast<int>(end - data))))
+    {
+        m_lastError = QString("PtyReplayer Error: broken keyframe at offset %1").arg(keyframe.offset);
+        return false;
+    }
+
+    m_offset = record.next;
+    m_time = keyframe.time;
+    return true;
+}
+
+void PtyReplayer::rewind()
+{
+    m_screen->reset();
+    m_screen->resize(m_cols, m_rows);
+    m_screen->scrollback()->clear();
+    m_offset = REPLAYER_HEADER_SIZE;
+    m_time = 0;
+    m_position = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef PTYREPLAYER_H
+#define PTYREPLAYER_H
+
+#include "ptyscreen.h"
+#include "ptyrecorder.h"
+#include <QFile>
+#include <QVector>
+
+//plays binary recordings of PtyRecorder into a PtyScreen;
+//seek() restores the nearest keyframe at or before the position and replays only the records
+//after it, so reaching minute 90 of a long session costs one keyframe and a few seconds of output;
+//keyframes come from the index at the end of the file, or from a scan when the recording was cut;
+//the file is memory mapped, scrollback has only lines replayed since the last restored keyframe
+class PtyReplayer
+{
+public:
+    PtyReplayer();
+    ~PtyReplayer();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const { return m_data != 0; }
+    QString lastError() const { return m_lastError; }
+
+    //msecs since epoch when the recording started
+    qint64 startTime() const { return m_startTime; }
+    //msecs, rounded up: seek(duration()) shows the end of the recording
+    qint64 duration() const { return (m_duration + 999) / 1000; }
+    qint64 position() const { return m_position / 1000; }
+    int keyframeCount() const { return m_keyframes.size(); }
+
+    //brings the screen to 'msecs' from the start of the recording, forwards or backwards
+    bool seek(qint64 msecs);
+
+    PtyScreen *screen() const { return m_screen; }
+
+private:
+    Q_DISABLE_COPY(PtyReplayer)
+
+    struct Keyframe
+    {
+        qint64 time; //microseconds
+        qint64 offset;
+    };
+
+    struct Record
+    {
+        char type;
+        qint64 delta; //microseconds since the previous record
+        const char *data;
+        qint64 size;
+        qint64 next; //offset of the next record
+    };
+
+    bool readRecord(qint64 offset, Record &record) const;
+    bool readIndex();
+    bool scanIndex();
+    bool restoreKeyframe(const Keyframe &keyframe);
+    void rewind();
+
+private:
+    QString m_lastError;
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_end; //end of records
+    qint16 m_cols;
+    qint16 m_rows;
+    qint64 m_startTime;
+    qint64 m_duration;
+    QVector<Keyframe> m_keyframes;
+
+    PtyScreen *m_screen;
+    qint64 m_offset; //next record to replay
+    qint64 m_time; //of the last replayed record
+    qint64 m_position;
+};
+
+#endif // PTYREPLAYER_H
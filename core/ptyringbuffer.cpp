@@ -0,0 +1,154 @@
+#include "ptyringbuffer.h"
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef Q_OS_WIN
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+
+static qint64 pageSize()
+{
+#ifdef Q_OS_WIN
+    return 4096;
+#else
+    long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? size : 4096;
+#endif
+}
+
+PtyRingBuffer::PtyRingBuffer(qint64 capacity)
+    : m_data(0)
+    , m_capacity(pageSize())
+    , m_mask(0)
+    , m_readPos(0)
+    , m_writePos(0)
+{
+    //page size is always power of two, so capacity keeps both properties
+    while (m_capacity < capacity)
+        m_capacity <<= 1;
+    m_mask = static_cast<quint64>(m_capacity - 1);
+
+#ifdef Q_OS_WIN
+    m_data = static_cast<char *>(_aligned_malloc(m_capacity, pageSize()));
+#else
+    void *memory = 0;
+    if (posix_memalign(&memory, pageSize(), m_capacity) == 0)
+        m_data = static_cast<char *>(memory);
+#endif
+    Q_CHECK_PTR(m_data);
+}
+
+PtyRingBuffer::~PtyRingBuffer()
+{
+#ifdef Q_OS_WIN
+    _aligned_free(m_data);
+#else
+    free(m_data);
+#endif
+}
+
+int PtyRingBuffer::peek(PtySpan spans[2]) const
+{
+    qint64 available = size();
+    if (available == 0)
+        return 0;
+
+    qint64 offset = static_cast<qint64>(m_readPos & m_mask);
+    qint64 firstSize = qMin(available, m_capacity - offset);
+
+    spans[0].data = m_data + offset;
+    spans[0].size = firstSize;
+    if (firstSize == available)
+        return 1;
+
+    spans[1].data = m_data;
+    spans[1].size = available - firstSize;
+    return 2;
+}
+
+void PtyRingBuffer::consume(qint64 size)
+{
+    Q_ASSERT(size >= 0 && size <= this->size());
+    m_readPos += static_cast<quint64>(qBound(Q_INT64_C(0), size, this->size()));
+
+    //rewind to the start of the memory block to keep next reads in one span
+    if (m_readPos == m_writePos)
+        m_readPos = m_writePos = 0;
+}
+
+int PtyRingBuffer::reserve(PtyWritableSpan spans[2])
+{
+    qint64 available = freeSpace();
+    if (available == 0)
+        return 0;
+
+    qint64 offset = static_cast<qint64>(m_writePos & m_mask);
+    qint64 firstSize = qMin(available, m_capacity - offset);
+
+    spans[0].data = m_data + offset;
+    spans[0].size = firstSize;
+    if (firstSize == available)
+        return 1;
+
+    spans[1].data = m_data;
+    spans[1].size = available - firstSize;
+    return 2;
+}
+
+void PtyRingBuffer::commit(qint64 size)
+{
+    Q_ASSERT(size >= 0 && size <= freeSpace());
+    m_writePos += static_cast<quint64>(qBound(Q_INT64_C(0), size, freeSpace()));
+}
+
+qint64 PtyRingBuffer::write(const char *data, qint64 size)
+{
+    PtyWritableSpan spans[2];
+    int count = reserve(spans);
+
+    qint64 written = 0;
+    for (int i = 0; i < count && written < size; i++)
+    {
+        qint64 chunk = qMin(spans[i].size, size - written);
+        memcpy(spans[i].data, data + written, chunk);
+        written += chunk;
+    }
+
+    commit(written);
+    return written;
+}
+
+qint64 PtyRingBuffer::read(char *data, qint64 maxSize)
+{
+    PtySpan spans[2];
+    int count = peek(spans);
+
+    qint64 readed = 0;
+    for (int i = 0; i < count && readed < maxSize; i++)
+    {
+        qint64 chunk = qMin(spans[i].size, maxSize - readed);
+        memcpy(data + readed, spans[i].data, chunk);
+        readed += chunk;
+    }
+
+    consume(readed);
+    return readed;
+}
+
+QByteArray PtyRingBuffer::readAll()
+{
+    QByteArray result;
+    if (isEmpty())
+        return result;
+
+    result.resize(static_cast<int>(size()));
+    read(result.data(), result.size());
+    return result;
+}
+
+void PtyRingBuffer::clear()
+{
+    m_readPos = m_writePos = 0;
+}
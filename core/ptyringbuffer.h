@@ -0,0 +1,65 @@
+#ifndef PTYRINGBUFFER_H
+#define PTYRINGBUFFER_H
+
+#include <QByteArray>
+
+//contiguous read-only view into pty output
+struct PtySpan
+{
+    const char *data;
+    qint64 size;
+};
+
+//contiguous writable view into free space of the ring
+struct PtyWritableSpan
+{
+    char *data;
+    qint64 size;
+};
+
+//fixed-capacity, page-aligned byte ring owned by a pty
+//readers can use peek()/consume() to forward bytes without intermediate copies,
+//writers can use reserve()/commit() to read() from a fd straight into the ring
+//not thread safe, all calls must come from the thread which owns the pty
+class PtyRingBuffer
+{
+public:
+    static const qint64 DefaultCapacity = 1024 * 1024;
+
+    explicit PtyRingBuffer(qint64 capacity = DefaultCapacity);
+    ~PtyRingBuffer();
+
+    qint64 capacity() const { return m_capacity; }
+    qint64 size() const { return static_cast<qint64>(m_writePos - m_readPos); }
+    qint64 freeSpace() const { return m_capacity - size(); }
+    bool isEmpty() const { return m_writePos == m_readPos; }
+    bool isFull() const { return size() == m_capacity; }
+
+    //fill 'spans' with up to two contiguous views of buffered data, returns count of used spans
+    int peek(PtySpan spans[2]) const;
+    //drop 'size' bytes from the head of the buffer
+    void consume(qint64 size);
+
+    //fill 'spans' with up to two contiguous views of free space, returns count of used spans
+    int reserve(PtyWritableSpan spans[2]);
+    //mark 'size' bytes of reserved space as written
+    void commit(qint64 size);
+
+    //copy helpers, return count of processed bytes
+    qint64 write(const char *data, qint64 size);
+    qint64 read(char *data, qint64 maxSize);
+    QByteArray readAll();
+
+    void clear();
+
+private:
+    Q_DISABLE_COPY(PtyRingBuffer)
+
+    char *m_data;
+    qint64 m_capacity;
+    quint64 m_mask;
+    quint64 m_readPos;
+    quint64 m_writePos;
+};
+
+#endif // PTYRINGBUFFER_H
@@ -0,0 +1,1209 @@
+#include "ptyscreen.h"
+#include "ptyscrollback.h"
+#include <QMutexLocker>
+
+#define TAB_WIDTH 8
+#define STATE_VERSION 1
+
+static inline void writeVarint(QByteArray &out, quint32 value)
+{
+    while (value >= 0x80)
+    {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+static inline bool readVarint(const char *&data, const char *end, quint32 &value)
+{
+    value = 0;
+    int shift = 0;
+    while (data < end && shift < 35)
+    {
+        uchar byte = static_cast<uchar>(*data++);
+        value |= static_cast<quint32>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+        shift += 7;
+    }
+    return false;
+}
+
+void PtyScreen::Grid::init(int columns, int rowCount)
+{
+    cols = columns;
+    rows = rowCount;
+    int size = cols * rows;
+    codepoints.fill(0, size);
+    attributes.fill(0, size);
+    foreground.fill(0, size);
+    background.fill(0, size);
+    rowMap.resize(rows);
+    for (int i = 0; i < rows; i++)
+        rowMap[i] = i;
+    wrapped.fill(false, rows);
+}
+
+PtyScreen::PtyScreen(qint16 cols, qint16 rows)
+    : m_parser(this)
+    , m_grid(&m_main)
+    , m_generation(0)
+    , m_scrollback(new PtyScrollback())
+{
+    m_scrollback->setMaxLines(PTY_SCREEN_DEFAULT_SCROLLBACK);
+    m_main.init(qMax<int>(cols, 1), qMax<int>(rows, 1));
+    m_alternate.init(m_main.cols, m_main.rows);
+    m_rowGeneration.fill(0, m_main.rows);
+    resetLocked();
+}
+
+PtyScreen::~PtyScreen()
+{
+    delete m_scrollback;
+}
+
+void PtyScreen::feed(const char *data, qint64 size)
+{
+    QMutexLocker locker(&m_mutex);
+    m_parser.feed(data, size);
+}
+
+void PtyScreen::resize(qint16 cols, qint16 rows)
+{
+    QMutexLocker locker(&m_mutex);
+    int newCols = qMax<int>(cols, 1);
+    int newRows = qMax<int>(rows, 1);
+    if (newCols == m_main.cols && newRows == m_main.rows)
+        return;
+
+    //alternate screen is for full screen apps: they redraw it, no reflow there
+    resizeAlternate(newCols, newRows);
+    reflow(newCols, newRows);
+
+    m_scrollTop = 0;
+    m_scrollBottom = newRows - 1;
+    m_saved.x = qMin(m_saved.x, newCols - 1);
+    m_saved.y = qMin(m_saved.y, newRows - 1);
+    m_savedMain.x = qMin(m_savedMain.x, newCols - 1);
+    m_savedMain.y = qMin(m_savedMain.y, newRows - 1);
+
+    m_rowGeneration.fill(0, newRows);
+    markDirty(0, newRows - 1);
+}
+
+void PtyScreen::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_parser.reset();
+    resetLocked();
+}
+
+int PtyScreen::columns() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_grid->cols;
+}
+
+int PtyScreen::rows() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_grid->rows;
+}
+
+int PtyScreen::cursorColumn() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_x;
+}
+
+int PtyScreen::cursorRow() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_y;
+}
+
+bool PtyScreen::isCursorVisible() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cursorVisible;
+}
+
+bool PtyScreen::isAlternateScreen() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_grid == &m_alternate;
+}
+
+QString PtyScreen::title() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_title;
+}
+
+PtyScreenCell PtyScreen::cell(int row, int column) const
+{
+    QMutexLocker locker(&m_mutex);
+    PtyScreenCell result;
+    result.codepoint = 0;
+    result.attributes = 0;
+    result.foreground = 0;
+    result.background = 0;
+    if (row < 0 || row >= m_grid->rows || column < 0 || column >= m_grid->cols)
+        return result;
+
+    int index = cellIndex(row, column);
+    result.codepoint = m_grid->codepoints[index];
+    result.attributes = m_grid->attributes[index];
+    result.foreground = m_grid->foreground[index];
+    result.background = m_grid->background[index];
+    return result;
+}
+
+PtyScreenLine PtyScreen::line(int row) const
+{
+    QMutexLocker locker(&m_mutex);
+    if (row < 0 || row >= m_grid->rows)
+        return PtyScreenLine();
+    return lineAt(row, false);
+}
+
+QString PtyScreen::rowText(int row) const
+{
+    return lineText(line(row));
+}
+
+quint64 PtyScreen::generation() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generation;
+}
+
+QList<int> PtyScreen::dirtyRows(quint64 sinceGeneration) const
+{
+    QMutexLocker locker(&m_mutex);
+    QList<int> result;
+    for (int i = 0; i < m_rowGeneration.size(); i++)
+    {
+        if (m_rowGeneration[i] > sinceGeneration)
+            result.append(i);
+    }
+    return result;
+}
+
+QByteArray PtyScreen::saveState() const
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_parser.isGround())
+        return QByteArray();
+
+    QByteArray out;
+    writeVarint(out, STATE_VERSION);
+    writeVarint(out, m_main.cols);
+    writeVarint(out, m_main.rows);
+    writeVarint(out, (m_grid == &m_alternate ? 1 : 0) | (m_pendingWrap ? 2 : 0)
+                | (m_autoWrap ? 4 : 0) | (m_cursorVisible ? 8 : 0));
+    writeVarint(out, m_x);
+    writeVarint(out, m_y);
+    writeVarint(out, m_attributes);
+    writeVarint(out, m_foreground);
+    writeVarint(out, m_background);
+    const SavedCursor *saved[] = { &m_saved, &m_savedMain };
+    for (int i = 0; i < 2; i++)
+    {
+        writeVarint(out, saved[i]->x);
+        writeVarint(out, saved[i]->y);
+        writeVarint(out, saved[i]->attributes);
+        writeVarint(out, saved[i]->foreground);
+        writeVarint(out, saved[i]->background);
+    }
+    writeVarint(out, m_scrollTop);
+    writeVarint(out, m_scrollBottom);
+    QByteArray title = m_title.toUtf8();
+    writeVarint(out, title.size());
+    out.append(title);
+
+    //rows in visible order, so the row indirection is not part of the state
+    const Grid *grids[] = { &m_main, &m_alternate };
+    for (int g = 0; g < 2; g++)
+    {
+        const Grid &grid = *grids[g];
+        for (int row = 0; row < grid.rows; row++)
+        {
+            int base = grid.rowMap[row] * grid.cols;
+            out.append(grid.wrapped[grid.rowMap[row]] ? '\1' : '\0');
+            for (int col = 0; col < grid.cols; col++)
+            {
+                writeVarint(out, grid.codepoints[base + col]);
+                writeVarint(out, grid.attributes[base + col]);
+                writeVarint(out, grid.foreground[base + col]);
+                writeVarint(out, grid.background[base + col]);
+            }
+        }
+    }
+
+    return qCompress(out);
+}
+
+bool PtyScreen::restoreState(const QByteArray &state)
+{
+    QByteArray raw = qUncompress(state);
+    const char *data = raw.constData();
+    const char *end = data + raw.size();
+
+    quint32 header[9];
+    for (int i = 0; i < 9; i++)
+    {
+        if (!readVarint(data, end, header[i]))
+            return false;
+    }
+    int cols = static_cast<int>(header[1]);
+    int rows = static_cast<int>(header[2]);
+    if (header[0] != STATE_VERSION || cols < 1 || rows < 1 || cols > 0x7fff || rows > 0x7fff
+            || static_cast<int>(header[4]) >= cols || static_cast<int>(header[5]) >= rows)
+        return false;
+
+    quint32 saved[10];
+    quint32 scrollTop, scrollBottom, titleSize;
+    for (int i = 0; i < 10; i++)
+    {
+        if (!readVarint(data, end, saved[i]))
+            return false;
+    }
+    if (!readVarint(data, end, scrollTop) || !readVarint(data, end, scrollBottom)
+            || !readVarint(data, end, titleSize) || titleSize > static_cast<quint32>(end - data)
+            || scrollTop > scrollBottom || static_cast<int>(scrollBottom) >= rows)
+        return false;
+    QString title = QString::fromUtf8(data, static_cast<int>(titleSize));
+    data += titleSize;
+
+    Grid main;
+    Grid alternate;
+    main.init(cols, rows);
+    alternate.init(cols, rows);
+    Grid *grids[] = { &main, &alternate };
+    for (int g = 0; g < 2; g++)
+    {
+        Grid &grid = *grids[g];
+        for (int row = 0; row < rows; row++)
+        {
+            if (data >= end)
+                return false;
+            grid.wrapped[row] = (*data++ != 0);
+            for (int col = 0; col < cols; col++)
+            {
+                quint32 cell[4];
+                for (int i = 0; i < 4; i++)
+                {
+                    if (!readVarint(data, end, cell[i]))
+                        return false;
+                }
+                int index = row * cols + col;
+                grid.codepoints[index] = cell[0];
+                grid.attributes[index] = static_cast<quint16>(cell[1]);
+                grid.foreground[index] = cell[2];
+                grid.background[index] = cell[3];
+            }
+        }
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_parser.reset();
+    m_scrollback->clear();
+    m_main = main;
+    m_alternate = alternate;
+    m_grid = (header[3] & 1) ? &m_alternate : &m_main;
+    m_pendingWrap = (header[3] & 2) != 0;
+    m_autoWrap = (header[3] & 4) != 0;
+    m_cursorVisible = (header[3] & 8) != 0;
+    m_x = static_cast<int>(header[4]);
+    m_y = static_cast<int>(header[5]);
+    m_attributes = static_cast<quint16>(header[6]);
+    m_foreground = header[7];
+    m_background = header[8];
+    SavedCursor *savedCursors[] = { &m_saved, &m_savedMain };
+    for (int i = 0; i < 2; i++)
+    {
+        savedCursors[i]->x = qMin(static_cast<int>(saved[i * 5]), cols - 1);
+        savedCursors[i]->y = qMin(static_cast<int>(saved[i * 5 + 1]), rows - 1);
+        savedCursors[i]->attributes = static_cast<quint16>(saved[i * 5 + 2]);
+        savedCursors[i]->foreground = saved[i * 5 + 3];
+        savedCursors[i]->background = saved[i * 5 + 4];
+    }
+    m_scrollTop = static_cast<int>(scrollTop);
+    m_scrollBottom = static_cast<int>(scrollBottom);
+    m_title = title;
+
+    m_rowGeneration.fill(0, rows);
+    markDirty(0, rows - 1);
+    return true;
+}
+
+void PtyScreen::setScrollbackLimit(int lines)
+{
+    m_scrollback->setMaxLines(qMax(lines, 0));
+}
+
+int PtyScreen::scrollbackLimit() const
+{
+    return m_scrollback->maxLines();
+}
+
+int PtyScreen::scrollbackSize() const
+{
+    return m_scrollback->size();
+}
+
+PtyScreenLine PtyScreen::scrollbackLine(int index) const
+{
+    return m_scrollback->line(index);
+}
+
+QString PtyScreen::scrollbackText(int index) const
+{
+    return lineText(scrollbackLine(index));
+}
+
+int PtyScreen::characterWidth(uint codepoint)
+{
+    //combining marks and zero width characters
+    if ((codepoint >= 0x0300 && codepoint <= 0x036f) || (codepoint >= 0x200b && codepoint <= 0x200f)
+            || (codepoint >= 0xfe00 && codepoint <= 0xfe0f))
+        return 0;
+
+    //east asian wide and emoji
+    if ((codepoint >= 0x1100 && codepoint <= 0x115f) || (codepoint >= 0x2e80 && codepoint <= 0xa4cf && codepoint != 0x303f)
+            || (codepoint >= 0xac00 && codepoint <= 0xd7a3) || (codepoint >= 0xf900 && codepoint <= 0xfaff)
+            || (codepoint >= 0xfe30 && codepoint <= 0xfe4f) || (codepoint >= 0xff00 && codepoint <= 0xff60)
+            || (codepoint >= 0xffe0 && codepoint <= 0xffe6) || (codepoint >= 0x1f300 && codepoint <= 0x1f64f)
+            || (codepoint >= 0x1f900 && codepoint <= 0x1f9ff) || (codepoint >= 0x20000 && codepoint <= 0x3fffd))
+        return 2;
+
+    return 1;
+}
+
+QString PtyScreen::lineText(const PtyScreenLine &line)
+{
+    //trailing never written cells are not part of the text
+    int size = line.size();
+    while (size > 0 && line.codepoints[size - 1] == 0)
+        size--;
+
+    QString text;
+    text.reserve(size);
+    for (int i = 0; i < size; i++)
+    {
+        //tail of a double width character, or a blank if its head was overwritten
+        if ((line.attributes[i] & WideTail) && i > 0 && (line.attributes[i - 1] & WideChar))
+            continue;
+
+        uint codepoint = line.codepoints[i];
+        if (codepoint == 0)
+            text.append(QChar(' '));
+        else if (codepoint > 0xffff)
+        {
+            text.append(QChar(QChar::highSurrogate(codepoint)));
+            text.append(QChar(QChar::lowSurrogate(codepoint)));
+        }
+        else
+            text.append(QChar(codepoint));
+    }
+    return text;
+}
+
+void PtyScreen::vtPrint(const char *text, int size)
+{
+    //plain text run: copied row by row straight into the arrays
+    while (size > 0)
+    {
+        wrapIfPending();
+
+        int cols = m_grid->cols;
+        int count = qMin(size, cols - m_x);
+        int index = cellIndex(m_y, m_x);
+        for (int i = 0; i < count; i++)
+        {
+            m_grid->codepoints[index + i] = static_cast<uchar>(text[i]);
+            m_grid->attributes[index + i] = m_attributes;
+            m_grid->foreground[index + i] = m_foreground;
+            m_grid->background[index + i] = m_background;
+        }
+        markDirty(m_y);
+
+        text += count;
+        size -= count;
+        m_x += count;
+        if (m_x >= cols)
+        {
+            m_x = cols - 1;
+            if (m_autoWrap)
+                m_pendingWrap = true;
+            else
+            {
+                //no wrap: the rest overwrites the last column, only the last char stays
+                if (size > 0)
+                    m_grid->codepoints[cellIndex(m_y, m_x)] = static_cast<uchar>(text[size - 1]);
+                return;
+            }
+        }
+    }
+}
+
+void PtyScreen::vtPrintCodepoint(uint codepoint)
+{
+    //C1 controls in UTF-8 form are not printed
+    if (codepoint >= 0x80 && codepoint < 0xa0)
+        return;
+
+    int width = characterWidth(codepoint);
+    if (width == 0)
+        return;
+
+    if (width == 1)
+    {
+        putCell(codepoint, 0);
+        return;
+    }
+
+    wrapIfPending();
+    if (m_x == m_grid->cols - 1)
+    {
+        //doesn't fit in the rest of the row
+        if (!m_autoWrap || m_grid->cols < 2)
+            return;
+        clearCells(m_y, m_x, m_x);
+        m_pendingWrap = true;
+        wrapIfPending();
+    }
+
+    int index = cellIndex(m_y, m_x);
+    m_grid->codepoints[index] = codepoint;
+    m_grid->attributes[index] = m_attributes | WideChar;
+    m_grid->foreground[index] = m_foreground;
+    m_grid->background[index] = m_background;
+    m_grid->codepoints[index + 1] = 0;
+    m_grid->attributes[index + 1] = m_attributes | WideTail;
+    m_grid->foreground[index + 1] = m_foreground;
+    m_grid->background[index + 1] = m_background;
+    markDirty(m_y);
+
+    m_x += 2;
+    if (m_x >= m_grid->cols)
+    {
+        m_x = m_grid->cols - 1;
+        m_pendingWrap = m_autoWrap;
+    }
+}
+
+void PtyScreen::vtExecute(char control)
+{
+    switch (control)
+    {
+    case '\b':
+        if (m_x > 0)
+            m_x--;
+        m_pendingWrap = false;
+        break;
+    case '\t':
+        m_x = qMin((m_x / TAB_WIDTH + 1) * TAB_WIDTH, m_grid->cols - 1);
+        m_pendingWrap = false;
+        break;
+    case '\n':
+    case '\v':
+    case '\f':
+        lineFeed();
+        break;
+    case '\r':
+        m_x = 0;
+        m_pendingWrap = false;
+        break;
+    default:
+        break;
+    }
+}
+
+void PtyScreen::vtCsi(char prefix, const PtyVtParams &params, const char *intermediates, int intermediateCount, char final)
+{
+    Q_UNUSED(intermediates)
+
+    int cols = m_grid->cols;
+    int rows = m_grid->rows;
+
+    if (prefix == '?' || (prefix == 0 && (final == 'h' || final == 'l')))
+    {
+        if (final == 'h' || final == 'l')
+            setMode(prefix, params, final == 'h');
+        return;
+    }
+
+    //sequences with other private markers or intermediates are not screen changes for us
+    if (prefix != 0 || intermediateCount > 0)
+        return;
+
+    int n = qMax(params.value(0, 1), 1);
+    switch (final)
+    {
+    case 'A':
+        moveCursor(m_x, qMax(m_y - n, m_y >= m_scrollTop ? m_scrollTop : 0));
+        break;
+    case 'B':
+    case 'e':
+        moveCursor(m_x, qMin(m_y + n, m_y <= m_scrollBottom ? m_scrollBottom : rows - 1));
+        break;
+    case 'C':
+    case 'a':
+        moveCursor(m_x + n, m_y);
+        break;
+    case 'D':
+        moveCursor(m_x - n, m_y);
+        break;
+    case 'E':
+        moveCursor(0, m_y + n);
+        break;
+    case 'F':
+        moveCursor(0, m_y - n);
+        break;
+    case 'G':
+    case '`':
+        moveCursor(n - 1, m_y);
+        break;
+    case 'd':
+        moveCursor(m_x, n - 1);
+        break;
+    case 'H':
+    case 'f':
+        moveCursor(qMax(params.value(1, 1), 1) - 1, n - 1);
+        break;
+    case 'J':
+        switch (params.value(0, 0))
+        {
+        case 0:
+            clearCells(m_y, m_x, cols - 1);
+            clearRows(m_y + 1, rows - 1);
+            break;
+        case 1:
+            clearRows(0, m_y - 1);
+            clearCells(m_y, 0, m_x);
+            break;
+        case 2:
+            clearRows(0, rows - 1);
+            break;
+        case 3:
+            m_scrollback->clear();
+            break;
+        }
+        break;
+    case 'K':
+        switch (params.value(0, 0))
+        {
+        case 0:
+            clearCells(m_y, m_x, cols - 1);
+            break;
+        case 1:
+            clearCells(m_y, 0, m_x);
+            break;
+        case 2:
+            clearCells(m_y, 0, cols - 1);
+            break;
+        }
+        break;
+    case 'X':
+        clearCells(m_y, m_x, qMin(m_x + n, cols) - 1);
+        break;
+    case 'P':
+    case '@':
+    {
+        //delete/insert chars: shift the rest of the row
+        n = qMin(n, cols - m_x);
+        int index = cellIndex(m_y, 0);
+        int moved = cols - m_x - n;
+        int from = (final == 'P') ? m_x + n : m_x;
+        int to = (final == 'P') ? m_x : m_x + n;
+        memmove(m_grid->codepoints.data() + index + to, m_grid->codepoints.constData() + index + from, moved * sizeof(uint));
+        memmove(m_grid->attributes.data() + index + to, m_grid->attributes.constData() + index + from, moved * sizeof(quint16));
+        memmove(m_grid->foreground.data() + index + to, m_grid->foreground.constData() + index + from, moved * sizeof(quint32));
+        memmove(m_grid->background.data() + index + to, m_grid->background.constData() + index + from, moved * sizeof(quint32));
+        if (final == 'P')
+            clearCells(m_y, cols - n, cols - 1);
+        else
+            clearCells(m_y, m_x, m_x + n - 1);
+        markDirty(m_y);
+        break;
+    }
+    case 'L':
+        if (m_y >= m_scrollTop && m_y <= m_scrollBottom)
+            scrollDown(m_y, m_scrollBottom, n);
+        m_x = 0;
+        break;
+    case 'M':
+        if (m_y >= m_scrollTop && m_y <= m_scrollBottom)
+            scrollUp(m_y, m_scrollBottom, n);
+        m_x = 0;
+        break;
+    case 'S':
+        scrollUp(m_scrollTop, m_scrollBottom, n);
+        break;
+    case 'T':
+        scrollDown(m_scrollTop, m_scrollBottom, n);
+        break;
+    case 'm':
+        selectGraphicRendition(params);
+        break;
+    case 'r':
+    {
+        int top = qMax(params.value(0, 1), 1) - 1;
+        int bottom = qMin(qMax(params.value(1, rows), 1), rows) - 1;
+        if (top < bottom)
+        {
+            m_scrollTop = top;
+            m_scrollBottom = bottom;
+            moveCursor(0, 0);
+        }
+        break;
+    }
+    case 's':
+        vtEsc(0, 0, '7');
+        break;
+    case 'u':
+        vtEsc(0, 0, '8');
+        break;
+    default:
+        break;
+    }
+}
+
+void PtyScreen::vtEsc(const char *intermediates, int intermediateCount, char final)
+{
+    Q_UNUSED(intermediates)
+    if (intermediateCount > 0)
+        return; //charsets, DECALN...
+
+    switch (final)
+    {
+    case '7':
+        m_saved.x = m_x;
+        m_saved.y = m_y;
+        m_saved.attributes = m_attributes;
+        m_saved.foreground = m_foreground;
+        m_saved.background = m_background;
+        break;
+    case '8':
+        moveCursor(m_saved.x, m_saved.y);
+        m_attributes = m_saved.attributes;
+        m_foreground = m_saved.foreground;
+        m_background = m_saved.background;
+        break;
+    case 'D':
+        lineFeed();
+        break;
+    case 'E':
+        lineFeed();
+        m_x = 0;
+        break;
+    case 'M':
+        reverseIndex();
+        break;
+    case 'c':
+        m_scrollback->clear();
+        resetLocked();
+        break;
+    default:
+        break;
+    }
+}
+
+void PtyScreen::vtOsc(const QByteArray &data)
+{
+    int separator = data.indexOf(';');
+    if (separator < 0)
+        return;
+
+    QByteArray command = data.left(separator);
+    if (command == "0" || command == "2")
+        m_title = QString::fromUtf8(data.mid(separator + 1));
+}
+
+void PtyScreen::resetLocked()
+{
+    m_main.init(m_main.cols, m_main.rows);
+    m_alternate.init(m_main.cols, m_main.rows);
+    m_grid = &m_main;
+
+    m_x = 0;
+    m_y = 0;
+    m_pendingWrap = false;
+    m_attributes = 0;
+    m_foreground = DefaultColor;
+    m_background = DefaultColor;
+    m_saved.x = 0;
+    m_saved.y = 0;
+    m_saved.attributes = 0;
+    m_saved.foreground = DefaultColor;
+    m_saved.background = DefaultColor;
+    m_savedMain = m_saved;
+
+    m_scrollTop = 0;
+    m_scrollBottom = m_main.rows - 1;
+    m_autoWrap = true;
+    m_cursorVisible = true;
+    m_title.clear();
+
+    markDirty(0, m_main.rows - 1);
+}
+
+void PtyScreen::markDirty(int row)
+{
+    m_rowGeneration[row] = ++m_generation;
+}
+
+void PtyScreen::markDirty(int fromRow, int toRow)
+{
+    ++m_generation;
+    for (int i = fromRow; i <= toRow; i++)
+        m_rowGeneration[i] = m_generation;
+}
+
+void PtyScreen::clearCells(int row, int fromCol, int toCol)
+{
+    if (fromCol > toCol)
+        return;
+
+    //erased cells keep current background, like xterm does
+    int index = cellIndex(row, fromCol);
+    int count = toCol - fromCol + 1;
+    for (int i = 0; i < count; i++)
+    {
+        m_grid->codepoints[index + i] = 0;
+        m_grid->attributes[index + i] = 0;
+        m_grid->foreground[index + i] = DefaultColor;
+        m_grid->background[index + i] = m_background;
+    }
+    if (toCol == m_grid->cols - 1)
+        m_grid->wrapped[m_grid->rowMap[row]] = false;
+    markDirty(row);
+}
+
+void PtyScreen::clearRows(int fromRow, int toRow)
+{
+    for (int row = fromRow; row <= toRow; row++)
+        clearCells(row, 0, m_grid->cols - 1);
+}
+
+void PtyScreen::putCell(uint codepoint, quint16 extraAttributes)
+{
+    wrapIfPending();
+
+    int index = cellIndex(m_y, m_x);
+    m_grid->codepoints[index] = codepoint;
+    m_grid->attributes[index] = m_attributes | extraAttributes;
+    m_grid->foreground[index] = m_foreground;
+    m_grid->background[index] = m_background;
+    markDirty(m_y);
+
+    if (m_x == m_grid->cols - 1)
+        m_pendingWrap = m_autoWrap;
+    else
+        m_x++;
+}
+
+void PtyScreen::wrapIfPending()
+{
+    if (!m_pendingWrap)
+        return;
+
+    m_pendingWrap = false;
+    m_grid->wrapped[m_grid->rowMap[m_y]] = true;
+    m_x = 0;
+    lineFeed();
+}
+
+void PtyScreen::lineFeed()
+{
+    m_pendingWrap = false;
+    if (m_y == m_scrollBottom)
+        scrollUp(m_scrollTop, m_scrollBottom, 1);
+    else if (m_y < m_grid->rows - 1)
+        m_y++;
+}
+
+void PtyScreen::reverseIndex()
+{
+    m_pendingWrap = false;
+    if (m_y == m_scrollTop)
+        scrollDown(m_scrollTop, m_scrollBottom, 1);
+    else if (m_y > 0)
+        m_y--;
+}
+
+void PtyScreen::scrollUp(int top, int bottom, int count)
+{
+    count = qMin(count, bottom - top + 1);
+    for (int n = 0; n < count; n++)
+    {
+        //only what leaves the whole main screen goes to scrollback
+        if (top == 0 && m_grid == &m_main)
+            pushScrollback(lineAt(top, true));
+
+        int row = m_grid->rowMap[top];
+        for (int i = top; i < bottom; i++)
+            m_grid->rowMap[i] = m_grid->rowMap[i + 1];
+        m_grid->rowMap[bottom] = row;
+        m_grid->wrapped[row] = false;
+        clearCells(bottom, 0, m_grid->cols - 1);
+    }
+    markDirty(top, bottom);
+}
+
+void PtyScreen::scrollDown(int top, int bottom, int count)
+{
+    count = qMin(count, bottom - top + 1);
+    for (int n = 0; n < count; n++)
+    {
+        int row = m_grid->rowMap[bottom];
+        for (int i = bottom; i > top; i--)
+            m_grid->rowMap[i] = m_grid->rowMap[i - 1];
+        m_grid->rowMap[top] = row;
+        m_grid->wrapped[row] = false;
+        clearCells(top, 0, m_grid->cols - 1);
+    }
+    markDirty(top, bottom);
+}
+
+void PtyScreen::moveCursor(int x, int y)
+{
+    m_x = qBound(0, x, m_grid->cols - 1);
+    m_y = qBound(0, y, m_grid->rows - 1);
+    m_pendingWrap = false;
+}
+
+void PtyScreen::setAlternateScreen(bool enabled, bool saveCursor)
+{
+    if (enabled == (m_grid == &m_alternate))
+        return;
+
+    if (enabled)
+    {
+        if (saveCursor)
+        {
+            m_savedMain.x = m_x;
+            m_savedMain.y = m_y;
+            m_savedMain.attributes = m_attributes;
+            m_savedMain.foreground = m_foreground;
+            m_savedMain.background = m_background;
+        }
+        m_grid = &m_alternate;
+        clearRows(0, m_grid->rows - 1);
+    }
+    else
+    {
+        m_grid = &m_main;
+        if (saveCursor)
+        {
+            moveCursor(m_savedMain.x, m_savedMain.y);
+            m_attributes = m_savedMain.attributes;
+            m_foreground = m_savedMain.foreground;
+            m_background = m_savedMain.background;
+        }
+    }
+
+    m_scrollTop = 0;
+    m_scrollBottom = m_grid->rows - 1;
+    markDirty(0, m_grid->rows - 1);
+}
+
+void PtyScreen::selectGraphicRendition(const PtyVtParams &params)
+{
+    if (params.count == 0)
+    {
+        m_attributes = 0;
+        m_foreground = DefaultColor;
+        m_background = DefaultColor;
+        return;
+    }
+
+    for (int i = 0; i < params.count; i++)
+    {
+        int value = params.value(i, 0);
+        switch (value)
+        {
+        case 0:
+            m_attributes = 0;
+            m_foreground = DefaultColor;
+            m_background = DefaultColor;
+            break;
+        case 1: m_attributes |= Bold; break;
+        case 2: m_attributes |= Dim; break;
+        case 3: m_attributes |= Italic; break;
+        case 4: m_attributes |= Underline; break;
+        case 5: m_attributes |= Blink; break;
+        case 7: m_attributes |= Inverse; break;
+        case 8: m_attributes |= Hidden; break;
+        case 9: m_attributes |= Strike; break;
+        case 22: m_attributes &= ~(Bold | Dim); break;
+        case 23: m_attributes &= ~Italic; break;
+        case 24: m_attributes &= ~Underline; break;
+        case 25: m_attributes &= ~Blink; break;
+        case 27: m_attributes &= ~Inverse; break;
+        case 28: m_attributes &= ~Hidden; break;
+        case 29: m_attributes &= ~Strike; break;
+        case 39: m_foreground = DefaultColor; break;
+        case 49: m_background = DefaultColor; break;
+        case 38:
+        case 48:
+        {
+            //extended color: 38;5;n / 38;2;r;g;b or the same with ':' (38:2::r:g:b)
+            quint32 color = DefaultColor;
+            int sub = i + 1;
+            bool colonForm = (sub < params.count && params.subParam[sub]);
+            int last = sub;
+            if (colonForm)
+                while (last + 1 < params.count && params.subParam[last + 1])
+                    last++;
+
+            int mode = params.value(sub, 0);
+            if (mode == 5)
+            {
+                color = PaletteColor | (params.value(sub + 1, 0) & 0xff);
+                if (!colonForm)
+                    last = sub + 1;
+            }
+            else if (mode == 2)
+            {
+                int first = (colonForm && last - sub >= 4) ? last - 2 : sub + 1;
+                color = TrueColor | ((params.value(first, 0) & 0xff) << 16)
+                        | ((params.value(first + 1, 0) & 0xff) << 8) | (params.value(first + 2, 0) & 0xff);
+                if (!colonForm)
+                    last = sub + 3;
+            }
+
+            if (value == 38)
+                m_foreground = color;
+            else
+                m_background = color;
+            i = last;
+            break;
+        }
+        default:
+            if (value >= 30 && value <= 37)
+                m_foreground = PaletteColor | (value - 30);
+            else if (value >= 40 && value <= 47)
+                m_background = PaletteColor | (value - 40);
+            else if (value >= 90 && value <= 97)
+                m_foreground = PaletteColor | (value - 90 + 8);
+            else if (value >= 100 && value <= 107)
+                m_background = PaletteColor | (value - 100 + 8);
+            break;
+        }
+    }
+}
+
+void PtyScreen::setMode(char prefix, const PtyVtParams &params, bool enabled)
+{
+    if (prefix != '?')
+        return;
+
+    for (int i = 0; i < params.count; i++)
+    {
+        switch (params.value(i, 0))
+        {
+        case 7:
+            m_autoWrap = enabled;
+            break;
+        case 25:
+            m_cursorVisible = enabled;
+            markDirty(m_y);
+            break;
+        case 47:
+        case 1047:
+            setAlternateScreen(enabled, false);
+            break;
+        case 1049:
+            setAlternateScreen(enabled, true);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void PtyScreen::pushScrollback(const PtyScreenLine &line)
+{
+    m_scrollback->append(line);
+}
+
+PtyScreenLine PtyScreen::lineAt(int row, bool trim) const
+{
+    int cols = m_grid->cols;
+    int index = cellIndex(row, 0);
+    bool wrapped = m_grid->wrapped[m_grid->rowMap[row]];
+
+    //wrapped rows are full, others lose never written cells at the end
+    int size = cols;
+    if (trim && !wrapped)
+    {
+        while (size > 0 && m_grid->codepoints[index + size - 1] == 0
+               && m_grid->background[index + size - 1] == DefaultColor)
+            size--;
+    }
+
+    PtyScreenLine line;
+    line.codepoints = m_grid->codepoints.mid(index, size);
+    line.attributes = m_grid->attributes.mid(index, size);
+    line.foreground = m_grid->foreground.mid(index, size);
+    line.background = m_grid->background.mid(index, size);
+    line.wrapped = wrapped;
+    return line;
+}
+
+void PtyScreen::reflow(int cols, int rows)
+{
+    //main screen rows are joined into logical lines (rows linked by 'wrapped') and wrapped
+    //again for the new width; the cursor keeps its place in its logical line;
+    //history is not rewritten as a whole: only the last 'rows' lines of it (to fill the screen
+    //when it gets wider) and lines continued in them are taken back
+    Grid *active = m_grid;
+    m_grid = &m_main;
+
+    QList<PtyScreenLine> history;
+    for (int size = m_scrollback->size(); size > 0; size--)
+    {
+        if (history.size() >= rows && !m_scrollback->line(size - 1).wrapped)
+            break;
+        history.prepend(m_scrollback->takeLast());
+    }
+
+    bool onMain = (active == &m_main);
+    int cursorRowAbs = history.size() + (onMain ? m_y : m_savedMain.y);
+    int cursorCol = onMain ? m_x : m_savedMain.x;
+
+    QList<PtyScreenLine> logical;
+    int cursorLine = 0;
+    int cursorOffset = 0;
+    PtyScreenLine current;
+    int total = history.size() + m_main.rows;
+    for (int i = 0; i < total; i++)
+    {
+        PtyScreenLine row = (i < history.size()) ? history.at(i) : lineAt(i - history.size(), true);
+        if (i == cursorRowAbs)
+        {
+            cursorLine = logical.size();
+            cursorOffset = current.size() + cursorCol;
+        }
+
+        current.codepoints += row.codepoints;
+        current.attributes += row.attributes;
+        current.foreground += row.foreground;
+        current.background += row.background;
+        if (!row.wrapped)
+        {
+            logical.append(current);
+            current = PtyScreenLine();
+        }
+    }
+    if (current.size() > 0)
+        logical.append(current);
+
+    //empty lines below the cursor would push useful lines to scrollback
+    while (logical.size() > cursorLine + 1 && logical.last().size() == 0)
+        logical.removeLast();
+
+    QList<PtyScreenLine> wrappedRows;
+    int cursorRowNew = 0;
+    int cursorColNew = 0;
+    for (int l = 0; l < logical.size(); l++)
+    {
+        const PtyScreenLine &source = logical.at(l);
+        int firstRow = wrappedRows.size();
+        PtyScreenLine row;
+        for (int i = 0; i < source.size(); i++)
+        {
+            bool wide = (source.attributes[i] & WideChar) != 0;
+            if (row.size() == cols || (wide && row.size() == cols - 1))
+            {
+                row.wrapped = true;
+                wrappedRows.append(row);
+                row = PtyScreenLine();
+            }
+
+            row.codepoints.append(source.codepoints[i]);
+            row.attributes.append(source.attributes[i]);
+            row.foreground.append(source.foreground[i]);
+            row.background.append(source.background[i]);
+        }
+        wrappedRows.append(row);
+
+        if (l == cursorLine)
+        {
+            int needRows = cursorOffset / cols + 1;
+            while (wrappedRows.size() - firstRow < needRows)
+            {
+                wrappedRows.last().wrapped = true;
+                wrappedRows.append(PtyScreenLine());
+            }
+            cursorRowNew = firstRow + cursorOffset / cols;
+            cursorColNew = cursorOffset % cols;
+        }
+    }
+
+    int screenTop = qMax(0, wrappedRows.size() - rows);
+    screenTop = qMin(screenTop, cursorRowNew);
+
+    for (int i = 0; i < screenTop; i++)
+        m_scrollback->append(wrappedRows.at(i));
+
+    m_main.init(cols, rows);
+    for (int r = 0; r < rows && screenTop + r < wrappedRows.size(); r++)
+    {
+        const PtyScreenLine &row = wrappedRows.at(screenTop + r);
+        int index = r * cols;
+        for (int i = 0; i < row.size(); i++)
+        {
+            m_main.codepoints[index + i] = row.codepoints[i];
+            m_main.attributes[index + i] = row.attributes[i];
+            m_main.foreground[index + i] = row.foreground[i];
+            m_main.background[index + i] = row.background[i];
+        }
+        m_main.wrapped[r] = row.wrapped;
+    }
+
+    int x = qMin(cursorColNew, cols - 1);
+    int y = qBound(0, cursorRowNew - screenTop, rows - 1);
+    if (onMain)
+    {
+        m_x = x;
+        m_y = y;
+        m_pendingWrap = false;
+    }
+    else
+    {
+        m_savedMain.x = x;
+        m_savedMain.y = y;
+    }
+
+    m_grid = active;
+}
+
+void PtyScreen::resizeAlternate(int cols, int rows)
+{
+    Grid old = m_alternate;
+    m_alternate.init(cols, rows);
+    for (int r = 0; r < qMin(rows, old.rows); r++)
+    {
+        int from = old.rowMap[r] * old.cols;
+        int to = r * cols;
+        for (int c = 0; c < qMin(cols, old.cols); c++)
+        {
+            m_alternate.codepoints[to + c] = old.codepoints[from + c];
+            m_alternate.attributes[to + c] = old.attributes[from + c];
+            m_alternate.foreground[to + c] = old.foreground[from + c];
+            m_alternate.background[to + c] = old.background[from + c];
+        }
+    }
+
+    if (m_grid == &m_alternate)
+    {
+        m_x = qMin(m_x, cols - 1);
+        m_y = qMin(m_y, rows - 1);
+        m_pendingWrap = false;
+    }
+}
@@ -0,0 +1,199 @@
+#ifndef PTYSCREEN_H
+#define PTYSCREEN_H
+
+#include "iptyprocess.h"
+#include "ptyvtparser.h"
+#include <QMutex>
+#include <QVector>
+#include <QList>
+#include <QString>
+
+#define PTY_SCREEN_DEFAULT_SCROLLBACK 10000
+
+class PtyScrollback;
+
+//one cell of PtyScreen
+struct PtyScreenCell
+{
+    uint codepoint; //0 - never written
+    quint16 attributes;
+    quint32 foreground;
+    quint32 background;
+};
+
+//one row of cells in structure-of-arrays form
+struct PtyScreenLine
+{
+    QVector<uint> codepoints;
+    QVector<quint16> attributes;
+    QVector<quint32> foreground;
+    QVector<quint32> background;
+    bool wrapped; //continues on the next row
+
+    PtyScreenLine() : wrapped(false) { }
+    int size() const { return codepoints.size(); }
+};
+
+//headless terminal screen of a session: cell grid, alternate screen and scrollback,
+//kept up to date from the output stream (attach with IPtyProcess::addStreamObserver(),
+//resize() comes from IPtyProcess::resize() then, with reflow of wrapped lines on the screen);
+//grid is structure-of-arrays (codepoints, attributes, colors in separate arrays) with
+//row indirection, so scrolling moves row indexes instead of cells;
+//every row has a generation: renderers ask for rows changed since the generation they saw
+//all methods are thread safe
+class PtyScreen : public IPtyStreamObserver, private PtyVtHandler
+{
+public:
+    enum Attribute
+    {
+        Bold = 0x1,
+        Dim = 0x2,
+        Italic = 0x4,
+        Underline = 0x8,
+        Blink = 0x10,
+        Inverse = 0x20,
+        Hidden = 0x40,
+        Strike = 0x80,
+        WideChar = 0x100, //first cell of a double width character
+        WideTail = 0x200  //second cell of it, codepoint is 0
+    };
+
+    //color is 0 for default, PaletteColor | index or TrueColor | 0xRRGGBB
+    enum ColorType
+    {
+        DefaultColor = 0,
+        PaletteColor = 0x01000000,
+        TrueColor = 0x02000000,
+        ColorTypeMask = 0xff000000
+    };
+
+    PtyScreen(qint16 cols, qint16 rows);
+    virtual ~PtyScreen();
+
+    void feed(const char *data, qint64 size);
+    void resize(qint16 cols, qint16 rows);
+    void reset();
+
+    virtual void ptyOutput(const char *data, qint64 size) { feed(data, size); }
+    virtual void ptyResized(qint16 cols, qint16 rows) { resize(cols, rows); }
+
+    int columns() const;
+    int rows() const;
+    int cursorColumn() const;
+    int cursorRow() const;
+    bool isCursorVisible() const;
+    bool isAlternateScreen() const;
+    QString title() const;
+
+    PtyScreenCell cell(int row, int column) const;
+    PtyScreenLine line(int row) const;
+    QString rowText(int row) const;
+
+    //generation grows with every change; rows changed after 'sinceGeneration'
+    quint64 generation() const;
+    QList<int> dirtyRows(quint64 sinceGeneration) const;
+
+    //compressed copy of both screens, cursor, modes and title (scrollback is not included);
+    //empty while the output stops inside an escape sequence, there is nothing to cut then;
+    //restoreState() replaces the screen with it and clears the scrollback
+    QByteArray saveState() const;
+    bool restoreState(const QByteArray &state);
+
+    //lines scrolled off the top of the main screen, 0 is the oldest;
+    //kept in compressed PtyScrollback, scrollback() gives access to its byte budgets
+    PtyScrollback *scrollback() const { return m_scrollback; }
+    void setScrollbackLimit(int lines);
+    int scrollbackLimit() const;
+    int scrollbackSize() const;
+    PtyScreenLine scrollbackLine(int index) const;
+    QString scrollbackText(int index) const;
+
+    static int characterWidth(uint codepoint);
+    static QString lineText(const PtyScreenLine &line);
+
+private:
+    Q_DISABLE_COPY(PtyScreen)
+
+    struct Grid
+    {
+        int cols;
+        int rows;
+        QVector<uint> codepoints;
+        QVector<quint16> attributes;
+        QVector<quint32> foreground;
+        QVector<quint32> background;
+        QVector<int> rowMap; //visible row -> row in arrays
+        QVector<bool> wrapped; //by row in arrays
+
+        void init(int columns, int rowCount);
+    };
+
+    struct SavedCursor
+    {
+        int x;
+        int y;
+        quint16 attributes;
+        quint32 foreground;
+        quint32 background;
+    };
+
+    //PtyVtHandler
+    virtual void vtPrint(const char *text, int size);
+    virtual void vtPrintCodepoint(uint codepoint);
+    virtual void vtExecute(char control);
+    virtual void vtCsi(char prefix, const PtyVtParams &params, const char *intermediates, int intermediateCount, char final);
+    virtual void vtEsc(const char *intermediates, int intermediateCount, char final);
+    virtual void vtOsc(const QByteArray &data);
+
+    //all below are called with m_mutex locked
+    void resetLocked();
+    int cellIndex(int row, int col) const { return m_grid->rowMap[row] * m_grid->cols + col; }
+    void markDirty(int row);
+    void markDirty(int fromRow, int toRow);
+    void clearCells(int row, int fromCol, int toCol);
+    void clearRows(int fromRow, int toRow);
+    void putCell(uint codepoint, quint16 extraAttributes);
+    void wrapIfPending();
+    void lineFeed();
+    void reverseIndex();
+    void scrollUp(int top, int bottom, int count);
+    void scrollDown(int top, int bottom, int count);
+    void moveCursor(int x, int y);
+    void setAlternateScreen(bool enabled, bool saveCursor);
+    void selectGraphicRendition(const PtyVtParams &params);
+    void setMode(char prefix, const PtyVtParams &params, bool enabled);
+    void pushScrollback(const PtyScreenLine &line);
+    PtyScreenLine lineAt(int row, bool trim) const;
+    void reflow(int cols, int rows);
+    void resizeAlternate(int cols, int rows);
+
+private:
+    mutable QMutex m_mutex;
+    PtyVtParser m_parser;
+
+    Grid m_main;
+    Grid m_alternate;
+    Grid *m_grid;
+
+    int m_x;
+    int m_y;
+    bool m_pendingWrap;
+    quint16 m_attributes;
+    quint32 m_foreground;
+    quint32 m_background;
+    SavedCursor m_saved;
+    SavedCursor m_savedMain; //cursor saved by mode 1049
+
+    int m_scrollTop;
+    int m_scrollBottom;
+    bool m_autoWrap;
+    bool m_cursorVisible;
+    QString m_title;
+
+    quint64 m_generation;
+    QVector<quint64> m_rowGeneration; //by visible row
+
+    PtyScrollback *m_scrollback;
+};
+
+#endif // PTYSCREEN_H
@@ -0,0 +1,424 @@
+#include "ptyscreenstream.h"
+
+#define DEFAULT_COLS 80
+#define DEFAULT_ROWS 24
+
+namespace {
+
+void appendUtf8(QByteArray &out, uint codepoint)
+{
+    if (codepoint < 0x80)
+    {
+        out.append(static_cast<char>(codepoint));
+    }
+    else if (codepoint < 0x800)
+    {
+        out.append(static_cast<char>(0xc0 | (codepoint >> 6)));
+        out.append(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    }
+    else if (codepoint < 0x10000)
+    {
+        out.append(static_cast<char>(0xe0 | (codepoint >> 12)));
+        out.append(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
+        out.append(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    }
+    else
+    {
+        out.append(static_cast<char>(0xf0 | (codepoint >> 18)));
+        out.append(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f)));
+        out.append(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
+        out.append(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    }
+}
+
+//'base' is 30 for foreground, 40 for background
+void appendColor(QByteArray &out, quint32 color, int base)
+{
+    quint32 type = color & PtyScreen::ColorTypeMask;
+    if (type == PtyScreen::PaletteColor)
+    {
+        int index = color & 0xff;
+        if (index < 8)
+            out.append(';').append(QByteArray::number(base + index));
+        else if (index < 16)
+            out.append(';').append(QByteArray::number(base + 60 + index - 8));
+        else
+            out.append(';').append(QByteArray::number(base + 8)).append(";5;").append(QByteArray::number(index));
+    }
+    else if (type == PtyScreen::TrueColor)
+    {
+        out.append(';').append(QByteArray::number(base + 8)).append(";2;")
+           .append(QByteArray::number((color >> 16) & 0xff)).append(';')
+           .append(QByteArray::number((color >> 8) & 0xff)).append(';')
+           .append(QByteArray::number(color & 0xff));
+    }
+}
+
+void appendRendition(QByteArray &out, quint16 attributes, quint32 foreground, quint32 background)
+{
+    static const struct { quint16 attribute; char code; } codes[] = {
+        { PtyScreen::Bold, '1' }, { PtyScreen::Dim, '2' }, { PtyScreen::Italic, '3' },
+        { PtyScreen::Underline, '4' }, { PtyScreen::Blink, '5' }, { PtyScreen::Inverse, '7' },
+        { PtyScreen::Hidden, '8' }, { PtyScreen::Strike, '9' }
+    };
+
+    out.append("\x1b[0");
+    for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++)
+    {
+        if (attributes & codes[i].attribute)
+            out.append(';').append(codes[i].code);
+    }
+    appendColor(out, foreground, 30);
+    appendColor(out, background, 40);
+    out.append('m');
+}
+
+}
+
+PtyScreenStream::PtyScreenStream(IPtyProcess *pty, QObject *parent)
+    : QObject(parent)
+    , m_pty(pty)
+    , m_screen(0)
+    , m_changeQueued(false)
+    , m_readsPty(false)
+    , m_nextViewer(1)
+    , m_maxPendingBytes(PTY_SCREEN_STREAM_DEFAULT_MAX_PENDING)
+    , m_snapshotInterval(PTY_SCREEN_STREAM_DEFAULT_SNAPSHOT_INTERVAL)
+    , m_updatesSent(0)
+    , m_snapshotsSent(0)
+    , m_bytesSent(0)
+{
+    QPair<qint16, qint16> size = pty ? pty->size() : QPair<qint16, qint16>(0, 0);
+    m_screen = new PtyScreen(size.first > 0 ? size.first : DEFAULT_COLS, size.second > 0 ? size.second : DEFAULT_ROWS);
+
+    m_clock.start();
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &PtyScreenStream::sendUpdates);
+
+    if (m_pty)
+        m_pty->addStreamObserver(this);
+    setReadsPty(true);
+}
+
+PtyScreenStream::~PtyScreenStream()
+{
+    if (m_pty)
+    {
+        m_pty->removeStreamObserver(this);
+        if (m_pty->notifier())
+            disconnect(m_pty->notifier(), 0, this, 0);
+    }
+    delete m_screen;
+}
+
+void PtyScreenStream::setReadsPty(bool enabled)
+{
+    if (!m_pty || enabled == m_readsPty)
+        return;
+
+    m_readsPty = enabled;
+    if (enabled)
+        connect(m_pty->notifier(), &QIODevice::readyRead, this, &PtyScreenStream::onReadyRead);
+    else
+        disconnect(m_pty->notifier(), &QIODevice::readyRead, this, &PtyScreenStream::onReadyRead);
+}
+
+int PtyScreenStream::addViewer(int intervalMsec)
+{
+    Viewer viewer;
+    viewer.interval = qMax(intervalMsec, 0);
+    viewer.lastUpdate = -1;
+    viewer.lastSnapshot = -1;
+    viewer.generation = 0;
+    viewer.cols = 0;
+    viewer.rows = 0;
+    viewer.cursorColumn = -1;
+    viewer.cursorRow = -1;
+    viewer.cursorVisible = false;
+    viewer.needsSnapshot = true;
+    viewer.skipped = false;
+    viewer.pending = 0;
+
+    int id = m_nextViewer++;
+    m_viewers.insert(id, viewer);
+    scheduleUpdates();
+    return id;
+}
+
+void PtyScreenStream::removeViewer(int viewer)
+{
+    m_viewers.remove(viewer);
+}
+
+void PtyScreenStream::requestSnapshot(int viewer)
+{
+    if (!m_viewers.contains(viewer))
+        return;
+
+    m_viewers[viewer].needsSnapshot = true;
+    scheduleUpdates();
+}
+
+qint64 PtyScreenStream::pendingBytes(int viewer) const
+{
+    return m_viewers.value(viewer).pending;
+}
+
+void PtyScreenStream::viewerWritten(int viewer, qint64 bytes)
+{
+    QHash<int, Viewer>::iterator it = m_viewers.find(viewer);
+    if (it == m_viewers.end())
+        return;
+
+    //written bytes include frame headers;
+    //blocked viewer may have missed changes, it recovers with a snapshot
+    if (m_maxPendingBytes > 0 && it->pending > m_maxPendingBytes)
+        it->skipped = true;
+    it->pending = qMax<qint64>(it->pending - bytes, 0);
+    if (it->skipped && it->pending <= m_maxPendingBytes / 2)
+        scheduleUpdates();
+}
+
+void PtyScreenStream::ptyOutput(const char *data, qint64 size)
+{
+    m_screen->feed(data, size);
+
+    //one queued call for any number of reads
+    if (!m_changeQueued.exchange(true))
+        QMetaObject::invokeMethod(this, "onScreenChanged", Qt::QueuedConnection);
+}
+
+void PtyScreenStream::ptyResized(qint16 cols, qint16 rows)
+{
+    m_screen->resize(cols, rows);
+    if (!m_changeQueued.exchange(true))
+        QMetaObject::invokeMethod(this, "onScreenChanged", Qt::QueuedConnection);
+}
+
+void PtyScreenStream::onScreenChanged()
+{
+    m_changeQueued = false;
+    scheduleUpdates();
+}
+
+void PtyScreenStream::onReadyRead()
+{
+    //screen got the output already as observer
+    if (!m_pty)
+        return;
+
+    PtySpan spans[2];
+    int count;
+    while ((count = m_pty->peek(spans)) > 0)
+    {
+        qint64 size = 0;
+        for (int i = 0; i < count; i++)
+            size += spans[i].size;
+        m_pty->consume(size);
+    }
+}
+
+void PtyScreenStream::scheduleUpdates()
+{
+    //earliest time a viewer may get its next update
+    qint64 now = m_clock.elapsed();
+    qint64 due = -1;
+    for (QHash<int, Viewer>::const_iterator it = m_viewers.constBegin(); it != m_viewers.constEnd(); ++it)
+    {
+        const Viewer &viewer = it.value();
+        if (m_maxPendingBytes > 0 && viewer.pending > m_maxPendingBytes)
+            continue; //viewerWritten() brings it back
+
+        qint64 next = viewer.lastUpdate < 0 ? now : viewer.lastUpdate + viewer.interval;
+        if (viewer.skipped && viewer.lastSnapshot >= 0)
+            next = qMax(next, viewer.lastSnapshot + m_snapshotInterval);
+        if (due < 0 || next < due)
+            due = next;
+    }
+
+    if (due < 0)
+        return;
+
+    int delay = static_cast<int>(qMax<qint64>(due - now, 0));
+    if (!m_timer.isActive() || m_timer.remainingTime() > delay)
+        m_timer.start(delay);
+}
+
+void PtyScreenStream::sendUpdates()
+{
+    //rows are encoded once for all viewers updated now
+    QHash<int, QByteArray> rowCache;
+    qint64 now = m_clock.elapsed();
+    bool waiting = false;
+
+    QList<int> ids = m_viewers.keys();
+    for (int i = 0; i < ids.size(); i++)
+    {
+        QHash<int, Viewer>::iterator it = m_viewers.find(ids.at(i));
+        if (it == m_viewers.end())
+            continue; //removed by a slot of update()
+        Viewer &viewer = it.value();
+
+        if (m_maxPendingBytes > 0 && viewer.pending > m_maxPendingBytes)
+        {
+            viewer.skipped = true;
+            continue;
+        }
+        if (viewer.lastUpdate >= 0 && now < viewer.lastUpdate + viewer.interval)
+        {
+            waiting = true;
+            continue;
+        }
+        if (viewer.skipped && viewer.lastSnapshot >= 0 && now < viewer.lastSnapshot + m_snapshotInterval)
+        {
+            waiting = true;
+            continue;
+        }
+
+        QByteArray data = encodeUpdate(viewer, rowCache);
+        if (data.isEmpty())
+            continue;
+
+        viewer.lastUpdate = now;
+        viewer.pending += data.size();
+        m_updatesSent++;
+        m_bytesSent += data.size();
+        emit update(ids.at(i), data);
+    }
+
+    if (waiting)
+        scheduleUpdates();
+}
+
+QByteArray PtyScreenStream::encodeUpdate(Viewer &viewer, QHash<int, QByteArray> &rowCache)
+{
+    //generation first: rows changed while we read them go to the next update
+    quint64 generation = m_screen->generation();
+    int cols = m_screen->columns();
+    int rows = m_screen->rows();
+    int cursorColumn = m_screen->cursorColumn();
+    int cursorRow = m_screen->cursorRow();
+    bool cursorVisible = m_screen->isCursorVisible();
+
+    bool resized = cols != viewer.cols || rows != viewer.rows;
+    bool cursorMoved = cursorColumn != viewer.cursorColumn || cursorRow != viewer.cursorRow
+            || cursorVisible != viewer.cursorVisible;
+    QList<int> dirty;
+    if (!viewer.needsSnapshot && !viewer.skipped && !resized)
+    {
+        if (generation == viewer.generation && !cursorMoved)
+            return QByteArray();
+        dirty = m_screen->dirtyRows(viewer.generation);
+    }
+
+    //most of the screen changed: snapshot is not bigger and easier for viewers
+    bool full = viewer.needsSnapshot || viewer.skipped || resized || dirty.size() > rows / 2;
+
+    QByteArray out;
+    if (full)
+    {
+        out = snapshot(m_screen);
+        m_snapshotsSent++;
+        viewer.lastSnapshot = m_clock.elapsed();
+    }
+    else
+    {
+        for (int i = 0; i < dirty.size(); i++)
+        {
+            int row = dirty.at(i);
+            QHash<int, QByteArray>::const_iterator cached = rowCache.constFind(row);
+            if (cached == rowCache.constEnd())
+            {
+                QByteArray encoded;
+                appendRow(encoded, m_screen->line(row), row);
+                cached = rowCache.insert(row, encoded);
+            }
+            out.append(cached.value());
+        }
+        appendCursor(out, cursorColumn, cursorRow, cursorVisible);
+    }
+
+    viewer.generation = generation;
+    viewer.cols = cols;
+    viewer.rows = rows;
+    viewer.cursorColumn = cursorColumn;
+    viewer.cursorRow = cursorRow;
+    viewer.cursorVisible = cursorVisible;
+    viewer.needsSnapshot = false;
+    viewer.skipped = false;
+    return out;
+}
+
+QByteArray PtyScreenStream::snapshot(const PtyScreen *screen)
+{
+    int rows = screen->rows();
+    QByteArray out("\x1b[8;");
+    out.append(QByteArray::number(rows)).append(';').append(QByteArray::number(screen->columns())).append('t');
+    out.append("\x1b[0m\x1b[H\x1b[2J");
+    for (int row = 0; row < rows; row++)
+    {
+        PtyScreenLine line = screen->line(row);
+        bool empty = true;
+        for (int i = 0; i < line.size() && empty; i++)
+            empty = line.codepoints[i] == 0 && line.background[i] == PtyScreen::DefaultColor;
+        if (!empty)
+            appendRow(out, line, row);
+    }
+    appendCursor(out, screen->cursorColumn(), screen->cursorRow(), screen->isCursorVisible());
+    return out;
+}
+
+void PtyScreenStream::appendRow(QByteArray &out, const PtyScreenLine &line, int row)
+{
+    //cells up to the last one which differs from the erased ones, the rest is erased by EL
+    int size = line.size();
+    while (size > 0 && (line.codepoints[size - 1] == 0 || line.codepoints[size - 1] == ' ')
+           && line.attributes[size - 1] == 0 && line.background[size - 1] == PtyScreen::DefaultColor)
+        size--;
+
+    out.append("\x1b[").append(QByteArray::number(row + 1)).append(";1H");
+
+    bool plain = true;
+    quint16 attributes = 0;
+    quint32 foreground = PtyScreen::DefaultColor;
+    quint32 background = PtyScreen::DefaultColor;
+    for (int i = 0; i < size; i++)
+    {
+        //second cell of a wide character is drawn by the first one; halves left alone
+        //after the other one was overwritten are drawn as spaces to keep the columns
+        bool wideHead = (line.attributes[i] & PtyScreen::WideChar)
+                && i + 1 < line.size() && (line.attributes[i + 1] & PtyScreen::WideTail);
+        bool wideTail = (line.attributes[i] & PtyScreen::WideTail)
+                && i > 0 && (line.attributes[i - 1] & PtyScreen::WideChar);
+        if (wideTail)
+            continue;
+
+        quint16 cellAttributes = line.attributes[i] & ~(PtyScreen::WideChar | PtyScreen::WideTail);
+        if (cellAttributes != attributes || line.foreground[i] != foreground || line.background[i] != background)
+        {
+            attributes = cellAttributes;
+            foreground = line.foreground[i];
+            background = line.background[i];
+            appendRendition(out, attributes, foreground, background);
+            plain = attributes == 0 && foreground == PtyScreen::DefaultColor && background == PtyScreen::DefaultColor;
+        }
+
+        uint codepoint = line.codepoints[i];
+        if (codepoint == 0 || ((line.attributes[i] & PtyScreen::WideChar) && !wideHead))
+            codepoint = ' ';
+        appendUtf8(out, codepoint);
+    }
+
+    if (!plain)
+        out.append("\x1b[0m");
+    //after the last column cursor stays on it (pending wrap), EL would erase that cell
+    if (size < line.size())
+        out.append("\x1b[K");
+}
+
+void PtyScreenStream::appendCursor(QByteArray &out, int column, int row, bool visible)
+{
+    out.append("\x1b[").append(QByteArray::number(row + 1)).append(';')
+       .append(QByteArray::number(column + 1)).append('H');
+    out.append(visible ? "\x1b[?25h" : "\x1b[?25l");
+}
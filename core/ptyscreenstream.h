@@ -0,0 +1,117 @@
+#ifndef PTYSCREENSTREAM_H
+#define PTYSCREENSTREAM_H
+
+#include "iptyprocess.h"
+#include "ptyscreen.h"
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <atomic>
+
+#define PTY_SCREEN_STREAM_DEFAULT_INTERVAL 33 //msecs, ~30 updates per second
+#define PTY_SCREEN_STREAM_DEFAULT_SNAPSHOT_INTERVAL 1000
+#define PTY_SCREEN_STREAM_DEFAULT_MAX_PENDING (64 * 1024)
+
+//screen-diff relay for remote viewers: output of the pty goes to a server-side PtyScreen,
+//viewers get only rows changed since the last update they saw, so traffic follows visible
+//change instead of output volume (full screen redraws of top & co cost one screen per update);
+//updates are plain VT sequences (cursor position, SGR, text, erase to end of line),
+//any terminal emulator (xterm.js...) renders them as is; a snapshot clears the screen and draws
+//all rows, it starts with "CSI 8 ; rows ; cols t" so viewers can follow size changes;
+//per viewer: updates no more often than its interval, while more than 'maxPendingBytes' of its
+//updates are not written by the transport (viewerWritten()) it gets nothing, then a snapshot,
+//snapshots of slow viewers are limited to one per snapshot interval;
+//the stream takes (consumes) the output of the pty, like PtyRelay, unless something else
+//reads it (setReadsPty(false)): the screen gets the output as a stream observer either way;
+//not thread safe, use from the thread of the pty
+class PtyScreenStream : public QObject, public IPtyStreamObserver
+{
+    Q_OBJECT
+public:
+    explicit PtyScreenStream(IPtyProcess *pty, QObject *parent = 0);
+    ~PtyScreenStream();
+
+    PtyScreen *screen() const { return m_screen; }
+
+    //output is consumed from the pty by the stream (default), or left to its other reader (PtySessionManager...)
+    void setReadsPty(bool enabled);
+    bool readsPty() const { return m_readsPty; }
+
+    //new viewer gets a snapshot first; returns its id
+    int addViewer(int intervalMsec = PTY_SCREEN_STREAM_DEFAULT_INTERVAL);
+    void removeViewer(int viewer);
+    int viewerCount() const { return m_viewers.size(); }
+    //next update of the viewer is a snapshot (e.g. client lost its state)
+    void requestSnapshot(int viewer);
+
+    //0 disables slow viewer handling
+    void setMaxPendingBytes(qint64 bytes) { m_maxPendingBytes = qMax<qint64>(bytes, 0); }
+    qint64 maxPendingBytes() const { return m_maxPendingBytes; }
+    void setSnapshotInterval(int msecs) { m_snapshotInterval = qMax(msecs, 0); }
+    int snapshotInterval() const { return m_snapshotInterval; }
+    qint64 pendingBytes(int viewer) const;
+
+    qint64 updatesSent() const { return m_updatesSent; }
+    qint64 snapshotsSent() const { return m_snapshotsSent; }
+    qint64 bytesSent() const { return m_bytesSent; }
+
+    //whole screen as VT sequences
+    static QByteArray snapshot(const PtyScreen *screen);
+
+    //IPtyStreamObserver, called on the thread which reads the pty
+    virtual void ptyOutput(const char *data, qint64 size);
+    virtual void ptyResized(qint16 cols, qint16 rows);
+
+public slots:
+    //transport wrote 'bytes' of the viewer's updates (frame headers included)
+    void viewerWritten(int viewer, qint64 bytes);
+
+signals:
+    void update(int viewer, const QByteArray &data);
+
+private slots:
+    void onScreenChanged();
+    void onReadyRead();
+    void sendUpdates();
+
+private:
+    struct Viewer
+    {
+        int interval;
+        qint64 lastUpdate; //msecs of m_clock, -1 - never
+        qint64 lastSnapshot;
+        quint64 generation; //of the screen in the last update
+        int cols;
+        int rows;
+        int cursorColumn;
+        int cursorRow;
+        bool cursorVisible;
+        bool needsSnapshot;
+        bool skipped; //was slow, recovers with a rate-limited snapshot
+        qint64 pending;
+    };
+
+    void scheduleUpdates();
+    QByteArray encodeUpdate(Viewer &viewer, QHash<int, QByteArray> &rowCache);
+    static void appendRow(QByteArray &out, const PtyScreenLine &line, int row);
+    static void appendCursor(QByteArray &out, int column, int row, bool visible);
+
+private:
+    QPointer<IPtyProcess> m_pty;
+    PtyScreen *m_screen;
+    std::atomic<bool> m_changeQueued;
+    bool m_readsPty;
+    QHash<int, Viewer> m_viewers;
+    int m_nextViewer;
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_maxPendingBytes;
+    int m_snapshotInterval;
+    qint64 m_updatesSent;
+    qint64 m_snapshotsSent;
+    qint64 m_bytesSent;
+};
+
+#endif // PTYSCREENSTREAM_H
@@ -0,0 +1,768 @@
+#include "ptyscrollback.h"
+#include <QMutexLocker>
+
+//registry of all stores for the global budget
+static QMutex g_scrollbackRegistryMutex;
+static QList<PtyScrollback *> g_scrollbackStores;
+static std::atomic<qint64> g_scrollbackGlobalBytes(0);
+static std::atomic<qint64> g_scrollbackGlobalMaxBytes(0);
+static std::atomic<qint64> g_scrollbackTick(0);
+
+static inline void writeVarint(QByteArray &out, quint32 value)
+{
+    while (value >= 0x80)
+    {
+        out.append(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+}
+
+static inline quint32 readVarint(const char *&data, const char *end)
+{
+    quint32 value = 0;
+    int shift = 0;
+    while (data < end && shift < 32)
+    {
+        uchar byte = static_cast<uchar>(*data++);
+        value |= static_cast<quint32>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+        shift += 7;
+    }
+    return value;
+}
+
+PtyScrollback::PtyScrollback()
+    : m_lines(0)
+    , m_firstLine(0)
+    , m_bytes(0)
+    , m_uncompressedBytes(0)
+    , m_maxLines(-1)
+    , m_maxBytes(0)
+    , m_compression(true)
+    , m_lastAccess(0)
+    , m_spillMap(0)
+    , m_spillMapSize(0)
+    , m_spillFirstLine(0)
+    , m_cachedBlockLine(-1)
+{
+    Block open;
+    open.firstLine = 0;
+    open.lines = 0;
+    open.rawSize = 0;
+    open.compressed = false;
+    m_blocks.append(open);
+
+    //style 0 is the default one
+    m_styles.append(StyleKey(0, 0));
+    m_styleIds.insert(StyleKey(0, 0), 0);
+    addUsage(styleTableUsage());
+
+    QMutexLocker locker(&g_scrollbackRegistryMutex);
+    g_scrollbackStores.append(this);
+}
+
+PtyScrollback::~PtyScrollback()
+{
+    {
+        QMutexLocker locker(&g_scrollbackRegistryMutex);
+        g_scrollbackStores.removeAll(this);
+    }
+
+    g_scrollbackGlobalBytes -= m_bytes;
+
+    if (m_spillFile.isOpen())
+    {
+        m_spillFile.close();
+        m_spillFile.remove();
+    }
+}
+
+void PtyScrollback::append(const PtyScreenLine &line)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        touch();
+
+        if (m_maxLines == 0 && !m_spillFile.isOpen())
+            return;
+
+        Block &open = m_blocks.last();
+        qint64 before = open.memoryUsage() + styleTableUsage();
+
+        open.offsets.append(open.rawSize);
+        encodeLine(line, open.data);
+        m_uncompressedBytes += open.data.size() - open.rawSize;
+        open.rawSize = open.data.size();
+        open.lines++;
+        m_lines++;
+
+        addUsage(open.memoryUsage() + styleTableUsage() - before);
+
+        if (open.rawSize >= PTY_SCROLLBACK_BLOCK_SIZE || open.lineCount() >= PTY_SCROLLBACK_BLOCK_LINES)
+            sealOpenBlock();
+
+        enforceLimits();
+    }
+
+    enforceGlobalLimit();
+}
+
+PtyScreenLine PtyScrollback::takeLast()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_lines == 0 && !loadLastSpilledBlock())
+        return PtyScreenLine();
+
+    touch();
+
+    if (m_blocks.last().lineCount() == 0)
+    {
+        //open block is empty: reopen the previous sealed one
+        addUsage(-m_blocks.last().memoryUsage());
+        m_blocks.removeLast();
+
+        Block &block = m_blocks.last();
+        qint64 before = block.memoryUsage();
+        if (block.compressed)
+        {
+            block.data = qUncompress(block.data);
+            block.compressed = false;
+        }
+        indexLines(block.data, block.offsets);
+        addUsage(block.memoryUsage() - before);
+
+        if (m_cachedBlockLine == block.firstLine)
+        {
+            m_cachedBlockLine = -1;
+            m_cache.clear();
+            m_cacheOffsets.clear();
+        }
+    }
+
+    Block &open = m_blocks.last();
+    qint64 before = open.memoryUsage();
+    int start = open.offsets.last();
+    PtyScreenLine line = decodeLine(open.data.constData() + start, open.rawSize - start);
+
+    open.data.truncate(start);
+    open.offsets.removeLast();
+    m_uncompressedBytes -= open.rawSize - start;
+    open.rawSize = start;
+    open.lines--;
+    m_lines--;
+    addUsage(open.memoryUsage() - before);
+
+    return line;
+}
+
+void PtyScrollback::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    clearSpill();
+    dropLines(m_lines);
+    m_cachedBlockLine = -1;
+    m_cache.clear();
+    m_cacheOffsets.clear();
+}
+
+int PtyScrollback::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    qint64 spilled = m_spilled.isEmpty() ? 0 : m_firstLine - m_spillFirstLine;
+    return static_cast<int>(spilled + m_lines);
+}
+
+PtyScreenLine PtyScrollback::line(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    qint64 first = m_spilled.isEmpty() ? m_firstLine : m_spillFirstLine;
+    qint64 lineNumber = first + index;
+    if (index < 0 || lineNumber >= m_firstLine + m_lines)
+        return PtyScreenLine();
+
+    touch();
+
+    const QVector<int> *offsets = 0;
+    const QByteArray *raw;
+    int lineInBlock;
+    if (lineNumber < m_firstLine)
+    {
+        int spillIndex = findSpilledBlock(lineNumber);
+        raw = &rawSpilledBlock(spillIndex, offsets);
+        lineInBlock = static_cast<int>(lineNumber - m_spilled.at(spillIndex).firstLine);
+    }
+    else
+    {
+        int blockIndex = findBlock(lineNumber);
+        raw = &rawBlock(blockIndex, offsets);
+        lineInBlock = static_cast<int>(lineNumber - m_blocks.at(blockIndex).firstLine);
+    }
+
+    int start = offsets->at(lineInBlock);
+    int end = (lineInBlock + 1 < offsets->size()) ? offsets->at(lineInBlock + 1) : raw->size();
+    return decodeLine(raw->constData() + start, end - start);
+}
+
+qint64 PtyScrollback::firstLineNumber() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_spilled.isEmpty() ? m_firstLine : m_spillFirstLine;
+}
+
+bool PtyScrollback::setSpillFile(const QString &fileName)
+{
+    QMutexLocker locker(&m_mutex);
+    clearSpill();
+    if (m_spillFile.isOpen())
+    {
+        m_spillFile.close();
+        m_spillFile.remove();
+    }
+
+    if (!fileName.isEmpty())
+    {
+        //unbuffered: blocks must be in the file before they are mapped
+        m_spillFile.setFileName(fileName);
+        if (!m_spillFile.open(QIODevice::ReadWrite | QIODevice::Truncate | QIODevice::Unbuffered))
+            return false;
+    }
+
+    enforceLimits();
+    return true;
+}
+
+QString PtyScrollback::spillFileName() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_spillFile.isOpen() ? m_spillFile.fileName() : QString();
+}
+
+qint64 PtyScrollback::spillFileSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_spillFile.isOpen() ? m_spillFile.size() : 0;
+}
+
+int PtyScrollback::spilledLines() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_spilled.isEmpty() ? 0 : static_cast<int>(m_firstLine - m_spillFirstLine);
+}
+
+void PtyScrollback::setMaxLines(int lines)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxLines = lines;
+    enforceLimits();
+}
+
+int PtyScrollback::maxLines() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maxLines;
+}
+
+void PtyScrollback::setMaxBytes(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxBytes = bytes;
+    enforceLimits();
+}
+
+qint64 PtyScrollback::maxBytes() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maxBytes;
+}
+
+void PtyScrollback::setCompressionEnabled(bool enabled)
+{
+    QMutexLocker locker(&m_mutex);
+    m_compression = enabled;
+}
+
+bool PtyScrollback::isCompressionEnabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_compression;
+}
+
+qint64 PtyScrollback::memoryUsage() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_bytes;
+}
+
+qint64 PtyScrollback::uncompressedSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_uncompressedBytes;
+}
+
+void PtyScrollback::setGlobalMaxBytes(qint64 bytes)
+{
+    g_scrollbackGlobalMaxBytes = bytes;
+    enforceGlobalLimit();
+}
+
+qint64 PtyScrollback::globalMaxBytes()
+{
+    return g_scrollbackGlobalMaxBytes;
+}
+
+qint64 PtyScrollback::globalMemoryUsage()
+{
+    return g_scrollbackGlobalBytes;
+}
+
+void PtyScrollback::encodeLine(const PtyScreenLine &line, QByteArray &out)
+{
+    //line: encoded size, cell count, wrapped flag, style runs (length, style id), codepoints;
+    //size prefix lets blocks be indexed without decoding
+    int size = line.size();
+    m_encoded.clear();
+    writeVarint(m_encoded, static_cast<quint32>(size));
+    m_encoded.append(line.wrapped ? '\1' : '\0');
+
+    QByteArray runs;
+    int runCount = 0;
+    int i = 0;
+    while (i < size)
+    {
+        int start = i;
+        quint16 attributes = line.attributes[i];
+        quint32 foreground = line.foreground[i];
+        quint32 background = line.background[i];
+        while (i < size && line.attributes[i] == attributes && line.foreground[i] == foreground
+               && line.background[i] == background)
+            i++;
+
+        StyleKey key(attributes, (static_cast<quint64>(foreground) << 32) | background);
+        QHash<StyleKey, int>::const_iterator it = m_styleIds.constFind(key);
+        int id;
+        if (it != m_styleIds.constEnd())
+            id = it.value();
+        else
+        {
+            id = m_styles.size();
+            m_styles.append(key);
+            m_styleIds.insert(key, id);
+        }
+
+        writeVarint(runs, static_cast<quint32>(i - start));
+        writeVarint(runs, static_cast<quint32>(id));
+        runCount++;
+    }
+
+    writeVarint(m_encoded, static_cast<quint32>(runCount));
+    m_encoded.append(runs);
+
+    for (i = 0; i < size; i++)
+        writeVarint(m_encoded, line.codepoints[i]);
+
+    writeVarint(out, static_cast<quint32>(m_encoded.size()));
+    out.append(m_encoded);
+}
+
+PtyScreenLine PtyScrollback::decodeLine(const char *data, int size) const
+{
+    const char *end = data + size;
+    PtyScreenLine line;
+
+    readVarint(data, end); //encoded size
+    int cells = static_cast<int>(readVarint(data, end));
+    line.wrapped = (data < end && *data++ != 0);
+    line.codepoints.resize(cells);
+    line.attributes.resize(cells);
+    line.foreground.resize(cells);
+    line.background.resize(cells);
+
+    int runCount = static_cast<int>(readVarint(data, end));
+    int cell = 0;
+    for (int r = 0; r < runCount; r++)
+    {
+        int length = static_cast<int>(readVarint(data, end));
+        int id = static_cast<int>(readVarint(data, end));
+        const StyleKey &style = m_styles.at(qBound(0, id, m_styles.size() - 1));
+        for (int i = 0; i < length && cell < cells; i++, cell++)
+        {
+            line.attributes[cell] = static_cast<quint16>(style.first);
+            line.foreground[cell] = static_cast<quint32>(style.second >> 32);
+            line.background[cell] = static_cast<quint32>(style.second);
+        }
+    }
+
+    for (int i = 0; i < cells; i++)
+        line.codepoints[i] = readVarint(data, end);
+
+    return line;
+}
+
+const QByteArray &PtyScrollback::rawBlock(int blockIndex, const QVector<int> *&offsets) const
+{
+    const Block &block = m_blocks.at(blockIndex);
+    if (blockIndex == m_blocks.size() - 1)
+    {
+        offsets = &block.offsets;
+        return block.data;
+    }
+
+    if (m_cachedBlockLine != block.firstLine)
+    {
+        m_cache = block.compressed ? qUncompress(block.data) : block.data;
+        indexLines(m_cache, m_cacheOffsets);
+        m_cachedBlockLine = block.firstLine;
+    }
+    offsets = &m_cacheOffsets;
+    return m_cache;
+}
+
+const QByteArray &PtyScrollback::rawSpilledBlock(int spillIndex, const QVector<int> *&offsets) const
+{
+    const SpilledBlock &block = m_spilled.at(spillIndex);
+    if (m_cachedBlockLine != block.firstLine)
+    {
+        const uchar *data = mapSpill(block.offset, block.size);
+        if (!data)
+            m_cache.clear();
+        else if (block.compressed)
+            m_cache = qUncompress(data, block.size);
+        else
+            m_cache = QByteArray(reinterpret_cast<const char *>(data), block.size);
+        indexLines(m_cache, m_cacheOffsets);
+        m_cachedBlockLine = block.firstLine;
+    }
+
+    //damaged file: no lines instead of reading past the data
+    while (m_cacheOffsets.size() < block.lines)
+        m_cacheOffsets.append(m_cache.size());
+
+    offsets = &m_cacheOffsets;
+    return m_cache;
+}
+
+const uchar *PtyScrollback::mapSpill(qint64 offset, int size) const
+{
+    //file only grows while mapped, so the map is extended lazily when a block is past its end
+    if (offset + size > m_spillMapSize)
+    {
+        if (m_spillMap)
+            m_spillFile.unmap(m_spillMap);
+        m_spillMapSize = m_spillFile.size();
+        m_spillMap = m_spillFile.map(0, m_spillMapSize);
+        if (!m_spillMap)
+        {
+            m_spillMapSize = 0;
+            return 0;
+        }
+    }
+    return m_spillMap + offset;
+}
+
+void PtyScrollback::indexLines(const QByteArray &raw, QVector<int> &offsets)
+{
+    offsets.clear();
+    const char *begin = raw.constData();
+    const char *end = begin + raw.size();
+    const char *data = begin;
+    while (data < end)
+    {
+        offsets.append(static_cast<int>(data - begin));
+        quint32 size = readVarint(data, end);
+        data += size;
+    }
+}
+
+int PtyScrollback::findSpilledBlock(qint64 lineNumber) const
+{
+    int low = 0;
+    int high = m_spilled.size() - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (m_spilled.at(middle).firstLine <= lineNumber)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+int PtyScrollback::findBlock(qint64 lineNumber) const
+{
+    int low = 0;
+    int high = m_blocks.size() - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (m_blocks.at(middle).firstLine <= lineNumber)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+void PtyScrollback::sealOpenBlock()
+{
+    Block &open = m_blocks.last();
+    qint64 before = open.memoryUsage();
+
+    if (m_compression)
+    {
+        QByteArray compressed = qCompress(open.data);
+        if (compressed.size() < open.data.size())
+        {
+            open.data = compressed;
+            open.compressed = true;
+        }
+    }
+    open.data.squeeze();
+    open.offsets = QVector<int>();
+    addUsage(open.memoryUsage() - before);
+
+    Block next;
+    next.firstLine = open.firstLine + open.lineCount();
+    next.lines = 0;
+    next.rawSize = 0;
+    next.compressed = false;
+    m_blocks.append(next);
+    addUsage(next.memoryUsage());
+}
+
+void PtyScrollback::dropLines(qint64 count)
+{
+    count = qMin(count, m_lines);
+    m_firstLine += count;
+    m_lines -= count;
+
+    //blocks with no retained lines go away, the open one is emptied
+    while (m_blocks.size() > 1 && m_blocks.at(1).firstLine <= m_firstLine)
+    {
+        const Block &block = m_blocks.first();
+        m_uncompressedBytes -= block.rawSize;
+        addUsage(-block.memoryUsage());
+        if (m_cachedBlockLine == block.firstLine)
+        {
+            m_cachedBlockLine = -1;
+            m_cache.clear();
+            m_cacheOffsets.clear();
+        }
+        m_blocks.removeFirst();
+    }
+
+    if (m_lines == 0)
+    {
+        Block &open = m_blocks.last();
+        addUsage(-open.memoryUsage());
+        m_uncompressedBytes -= open.rawSize;
+        open.data = QByteArray();
+        open.offsets = QVector<int>();
+        open.lines = 0;
+        open.rawSize = 0;
+        open.firstLine = m_firstLine;
+        addUsage(open.memoryUsage());
+
+        //nothing references styles anymore
+        if (!m_spilled.isEmpty())
+            return;
+        qint64 before = styleTableUsage();
+        m_styles.resize(1);
+        m_styleIds.clear();
+        m_styleIds.insert(StyleKey(0, 0), 0);
+        addUsage(styleTableUsage() - before);
+    }
+}
+
+bool PtyScrollback::dropOldestBlock()
+{
+    if (m_spillFile.isOpen())
+        return spillOldestBlock();
+
+    if (m_lines == 0)
+        return false;
+
+    qint64 end = (m_blocks.size() > 1) ? m_blocks.at(1).firstLine : m_firstLine + m_lines;
+    dropLines(end - m_firstLine);
+    return true;
+}
+
+bool PtyScrollback::canDropBlock() const
+{
+    //spilling store keeps its open block in memory
+    if (m_spillFile.isOpen())
+        return m_blocks.size() > 1;
+    return m_lines > 0;
+}
+
+bool PtyScrollback::spillOldestBlock()
+{
+    //the open block stays in memory until it is full
+    if (m_blocks.size() == 1)
+        return false;
+
+    const Block &block = m_blocks.first();
+    SpilledBlock spilled;
+    spilled.firstLine = block.firstLine;
+    spilled.offset = m_spillFile.size();
+    spilled.size = block.data.size();
+    spilled.lines = block.lineCount();
+    spilled.compressed = block.compressed;
+
+    if (!m_spillFile.seek(spilled.offset) || m_spillFile.write(block.data) != block.data.size())
+    {
+        //disk full or similar: spilled lines and the block are lost like without a spill file,
+        //the index can't have a hole
+        clearSpill();
+        dropLines(m_blocks.at(1).firstLine - m_firstLine);
+        return true;
+    }
+
+    if (m_spilled.isEmpty())
+        m_spillFirstLine = m_firstLine;
+    m_spilled.append(spilled);
+
+    qint64 next = m_blocks.at(1).firstLine;
+    m_lines -= next - m_firstLine;
+    m_firstLine = next;
+    m_uncompressedBytes -= block.rawSize;
+    addUsage(-block.memoryUsage());
+    m_blocks.removeFirst();
+    return true;
+}
+
+bool PtyScrollback::loadLastSpilledBlock()
+{
+    if (m_spilled.isEmpty())
+        return false;
+
+    SpilledBlock spilled = m_spilled.last();
+    const uchar *data = mapSpill(spilled.offset, spilled.size);
+    if (!data)
+        return false;
+
+    QByteArray raw;
+    if (spilled.compressed)
+        raw = qUncompress(data, spilled.size);
+    else
+        raw = QByteArray(reinterpret_cast<const char *>(data), spilled.size);
+
+    //the block becomes the open one again, the file is cut before it
+    Block &open = m_blocks.last();
+    addUsage(-open.memoryUsage());
+    open.firstLine = spilled.firstLine;
+    open.data = raw;
+    indexLines(open.data, open.offsets);
+    open.lines = open.offsets.size();
+    open.rawSize = open.data.size();
+    open.compressed = false;
+    addUsage(open.memoryUsage());
+    m_uncompressedBytes += open.rawSize;
+
+    m_spilled.removeLast();
+    qint64 first = m_spilled.isEmpty() ? qMax(m_spillFirstLine, spilled.firstLine) : spilled.firstLine;
+    m_lines = open.firstLine + open.lines - first;
+    m_firstLine = first;
+
+    if (m_cachedBlockLine == spilled.firstLine)
+    {
+        m_cachedBlockLine = -1;
+        m_cache.clear();
+        m_cacheOffsets.clear();
+    }
+
+    if (m_spillMap)
+        m_spillFile.unmap(m_spillMap);
+    m_spillMap = 0;
+    m_spillMapSize = 0;
+    m_spillFile.resize(spilled.offset);
+    return m_lines > 0;
+}
+
+void PtyScrollback::clearSpill()
+{
+    if (!m_spillFile.isOpen())
+        return;
+
+    //lines before the memory ones are gone, like dropped by limits
+    m_spilled.clear();
+    if (m_spillMap)
+        m_spillFile.unmap(m_spillMap);
+    m_spillMap = 0;
+    m_spillMapSize = 0;
+    m_spillFile.resize(0);
+    m_cachedBlockLine = -1;
+    m_cache.clear();
+    m_cacheOffsets.clear();
+}
+
+void PtyScrollback::enforceLimits()
+{
+    if (m_spillFile.isOpen())
+    {
+        while (((m_maxLines >= 0 && m_lines > m_maxLines) || (m_maxBytes > 0 && m_bytes > m_maxBytes))
+               && spillOldestBlock())
+        {
+        }
+        return;
+    }
+
+    if (m_maxLines >= 0 && m_lines > m_maxLines)
+        dropLines(m_lines - m_maxLines);
+
+    while (m_maxBytes > 0 && m_bytes > m_maxBytes && dropOldestBlock())
+    {
+    }
+}
+
+void PtyScrollback::touch() const
+{
+    m_lastAccess = ++g_scrollbackTick;
+}
+
+void PtyScrollback::addUsage(qint64 delta)
+{
+    m_bytes += delta;
+    g_scrollbackGlobalBytes += delta;
+}
+
+qint64 PtyScrollback::styleTableUsage() const
+{
+    //vector of styles plus approximate hash node size
+    return m_styles.capacity() * sizeof(StyleKey) + m_styleIds.size() * (sizeof(StyleKey) + 3 * sizeof(void *));
+}
+
+void PtyScrollback::enforceGlobalLimit()
+{
+    qint64 maxBytes = g_scrollbackGlobalMaxBytes;
+    if (maxBytes <= 0 || g_scrollbackGlobalBytes <= maxBytes)
+        return;
+
+    //stores lock the registry only without own lock held, so registry -> store order is safe
+    QMutexLocker registryLocker(&g_scrollbackRegistryMutex);
+    while (g_scrollbackGlobalBytes > maxBytes)
+    {
+        //least recently used store with something to drop
+        PtyScrollback *victim = 0;
+        qint64 oldest = 0;
+        foreach (PtyScrollback *store, g_scrollbackStores)
+        {
+            QMutexLocker locker(&store->m_mutex);
+            if (store->canDropBlock() && (!victim || store->m_lastAccess < oldest))
+            {
+                victim = store;
+                oldest = store->m_lastAccess;
+            }
+        }
+
+        if (!victim)
+            return;
+
+        //a pass which freed nothing would repeat forever
+        QMutexLocker locker(&victim->m_mutex);
+        if (!victim->dropOldestBlock())
+            return;
+    }
+}
@@ -0,0 +1,148 @@
+#ifndef PTYSCROLLBACK_H
+#define PTYSCROLLBACK_H
+
+#include "ptyscreen.h"
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
+#include <QList>
+#include <QVector>
+#include <QMutex>
+#include <QFile>
+#include <atomic>
+
+#define PTY_SCROLLBACK_BLOCK_SIZE (16 * 1024)
+#define PTY_SCROLLBACK_BLOCK_LINES 256
+
+//scrollback lines of one session, stored compactly:
+//lines are encoded into fixed-size blocks (codepoints as varints, attributes as runs of
+//interned styles, so identical attribute/color combinations are stored once per store),
+//full blocks are sealed and compressed (zlib via qCompress), only the open block is raw
+//and indexed, a sealed block is decompressed and indexed on read (one block is cached);
+//memory is bounded per store (line and byte limits, oldest blocks go first) and globally
+//for all stores of the process (blocks of the least recently used store go first);
+//with a spill file set, blocks over the limits are appended to the file instead of being
+//dropped and read back through a memory map, found by binary search in the block index
+//all methods are thread safe
+class PtyScrollback
+{
+public:
+    PtyScrollback();
+    ~PtyScrollback();
+
+    void append(const PtyScreenLine &line);
+    //removes and returns the newest line (used by reflow)
+    PtyScreenLine takeLast();
+    void clear();
+
+    //index 0 is the oldest retained line, in memory or in the spill file
+    int size() const;
+    PtyScreenLine line(int index) const;
+    //count of lines dropped by limits since creation, absolute number of line(0)
+    qint64 firstLineNumber() const;
+
+    //per-store append-only file for blocks over the limits, removed with the store;
+    //limits are applied by whole blocks then; empty name stops spilling and drops spilled lines
+    bool setSpillFile(const QString &fileName);
+    QString spillFileName() const;
+    qint64 spillFileSize() const;
+    int spilledLines() const;
+
+    void setMaxLines(int lines);
+    int maxLines() const;
+    void setMaxBytes(qint64 bytes);
+    qint64 maxBytes() const;
+    void setCompressionEnabled(bool enabled);
+    bool isCompressionEnabled() const;
+
+    //bytes held by blocks, line index and style table
+    qint64 memoryUsage() const;
+    //bytes of encoded lines before compression
+    qint64 uncompressedSize() const;
+
+    //budget for all stores of the process, 0 means unlimited
+    static void setGlobalMaxBytes(qint64 bytes);
+    static qint64 globalMaxBytes();
+    static qint64 globalMemoryUsage();
+
+private:
+    Q_DISABLE_COPY(PtyScrollback)
+
+    struct Block
+    {
+        qint64 firstLine; //absolute line number
+        QByteArray data; //compressed when 'compressed'
+        QVector<int> offsets; //start of each line in the raw data, only for the open block
+        int lines;
+        int rawSize;
+        bool compressed;
+
+        int lineCount() const { return lines; }
+        qint64 memoryUsage() const { return data.capacity() + offsets.capacity() * sizeof(int); }
+    };
+
+    struct SpilledBlock
+    {
+        qint64 firstLine;
+        qint64 offset; //in the spill file
+        int size;
+        int lines;
+        bool compressed;
+    };
+
+    typedef QPair<quint32, quint64> StyleKey; //attributes, foreground << 32 | background
+
+    //all below are called with m_mutex locked
+    void encodeLine(const PtyScreenLine &line, QByteArray &out);
+    PtyScreenLine decodeLine(const char *data, int size) const;
+    const QByteArray &rawBlock(int blockIndex, const QVector<int> *&offsets) const;
+    const QByteArray &rawSpilledBlock(int spillIndex, const QVector<int> *&offsets) const;
+    const uchar *mapSpill(qint64 offset, int size) const;
+    static void indexLines(const QByteArray &raw, QVector<int> &offsets);
+    int findBlock(qint64 lineNumber) const;
+    int findSpilledBlock(qint64 lineNumber) const;
+    void sealOpenBlock();
+    void dropLines(qint64 count);
+    bool dropOldestBlock();
+    bool canDropBlock() const; //dropOldestBlock() would free something
+    bool spillOldestBlock();
+    bool loadLastSpilledBlock();
+    void clearSpill();
+    void enforceLimits();
+    void touch() const;
+    void addUsage(qint64 delta);
+    qint64 styleTableUsage() const;
+
+    //global budget enforcement, called with no locks held
+    static void enforceGlobalLimit();
+
+private:
+    mutable QMutex m_mutex;
+    QList<Block> m_blocks; //last one is open for appends, never compressed
+    qint64 m_lines; //retained lines
+    qint64 m_firstLine;
+    qint64 m_bytes;
+    qint64 m_uncompressedBytes;
+    int m_maxLines;
+    qint64 m_maxBytes;
+    bool m_compression;
+    mutable std::atomic<qint64> m_lastAccess; //LRU tick of the last append or read
+
+    QHash<StyleKey, int> m_styleIds;
+    QVector<StyleKey> m_styles;
+    QByteArray m_encoded; //line being encoded
+
+    //blocks pushed out of memory by the limits, mapped back on read
+    mutable QFile m_spillFile;
+    mutable uchar *m_spillMap;
+    mutable qint64 m_spillMapSize;
+    QVector<SpilledBlock> m_spilled;
+    qint64 m_spillFirstLine; //first retained line in the file, the first spilled block may start earlier
+
+    //decompressed copy of the last read compressed block, by its first line
+    mutable qint64 m_cachedBlockLine;
+    mutable QByteArray m_cache;
+    mutable QVector<int> m_cacheOffsets;
+};
+
+#endif // PTYSCROLLBACK_H
@@ -0,0 +1,258 @@
+#include "ptysessionmanager.h"
+#include "ptyscreen.h"
+#include "ptyscreenstream.h"
+#include <QTimer>
+#include <QUuid>
+#ifdef Q_OS_UNIX
+#include <QProcess>
+#else
+#include <QLocalSocket>
+#endif
+
+#define DEFAULT_COLS 80
+#define DEFAULT_ROWS 24
+
+namespace {
+
+//output goes to the screen from readAll(), in step with output(), only resizes come from here
+class ScreenResizer : public IPtyStreamObserver
+{
+public:
+    explicit ScreenResizer(PtyScreen *screen) : m_screen(screen) { }
+    virtual void ptyOutput(const char *data, qint64 size) { Q_UNUSED(data); Q_UNUSED(size); }
+    virtual void ptyResized(qint16 cols, qint16 rows) { m_screen->resize(cols, rows); }
+
+private:
+    PtyScreen *m_screen;
+};
+
+}
+
+PtySessionManager::PtySessionManager(ReplayMode mode, QObject *parent)
+    : QObject(parent)
+    , m_mode(mode)
+    , m_tailBytes(PTY_SESSION_MANAGER_DEFAULT_TAIL)
+    , m_detachedTimeout(0)
+{
+
+}
+
+PtySessionManager::~PtySessionManager()
+{
+    QStringList ids = m_sessions.keys();
+    for (int i = 0; i < ids.size(); i++)
+    {
+        Session *session = m_sessions.take(ids.at(i));
+        session->pty->disconnect(this);
+        session->pty->notifier()->disconnect(this);
+        session->pty->kill();
+        delete session->pty;
+        delete session->resizer;
+        delete session->tail;
+        delete session->screen;
+        delete session;
+    }
+}
+
+QString PtySessionManager::addSession(IPtyProcess *pty, const QString &id)
+{
+    QString sessionId = id.isEmpty() ? QUuid::createUuid().toString().mid(1, 36) : id; //without braces
+    if (!pty || m_sessions.contains(sessionId))
+        return QString();
+
+    Session *session = new Session();
+    session->id = sessionId;
+    session->pty = pty;
+    session->tail = 0;
+    session->tailTruncated = false;
+    session->screen = 0;
+    session->resizer = 0;
+    session->attached = false;
+    session->expiry = 0;
+
+    if (m_mode == ReplayTail)
+    {
+        session->tail = new PtyRingBuffer(m_tailBytes);
+    }
+    else
+    {
+        QPair<qint16, qint16> size = pty->size();
+        session->screen = new PtyScreen(size.first > 0 ? size.first : DEFAULT_COLS, size.second > 0 ? size.second : DEFAULT_ROWS);
+        session->screen->setScrollbackLimit(0);
+        session->resizer = new ScreenResizer(session->screen);
+        pty->addStreamObserver(session->resizer);
+    }
+
+    if (m_detachedTimeout > 0)
+    {
+        session->expiry = new QTimer(this);
+        session->expiry->setSingleShot(true);
+        connect(session->expiry, &QTimer::timeout, this, [this, sessionId]() { killSession(sessionId); });
+        session->expiry->start(m_detachedTimeout);
+    }
+
+    m_sessions.insert(sessionId, session);
+
+    connect(pty->notifier(), &QIODevice::readyRead, this, [this, session]() { readOutput(session); });
+#ifdef Q_OS_UNIX
+    QProcess *process = qobject_cast<QProcess *>(pty->notifier());
+    if (process)
+        connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                this, [this, sessionId]() { finishSession(sessionId); });
+    else
+        connect(pty->notifier(), &QIODevice::readChannelFinished, this, [this, sessionId]() { finishSession(sessionId); });
+#else
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(pty->notifier());
+    if (socket)
+        connect(socket, &QLocalSocket::disconnected, this, [this, sessionId]() { finishSession(sessionId); });
+#endif
+
+    //output which came before we were connected
+    readOutput(session);
+    return sessionId;
+}
+
+IPtyProcess *PtySessionManager::session(const QString &id) const
+{
+    Session *session = m_sessions.value(id);
+    return session ? session->pty : 0;
+}
+
+bool PtySessionManager::attach(const QString &id, QByteArray *replay)
+{
+    Session *session = m_sessions.value(id);
+    if (!session)
+        return false;
+
+    //take everything read so far, so the replay ends exactly where output() starts
+    readOutput(session);
+    if (replay)
+        *replay = this->replay(session);
+
+    //reading may be paused for the previous client (setAttachedPaused()), the new one has nothing pending yet
+    if (session->pty->isReadingPaused())
+        session->pty->resumeReading();
+    session->attached = true;
+    if (session->expiry)
+        session->expiry->stop();
+    return true;
+}
+
+void PtySessionManager::detach(const QString &id)
+{
+    Session *session = m_sessions.value(id);
+    if (!session || !session->attached)
+        return;
+
+    session->attached = false;
+    //nobody slows the shell down any more
+    if (session->pty->isReadingPaused())
+        session->pty->resumeReading();
+    if (session->expiry)
+        session->expiry->start(m_detachedTimeout);
+}
+
+bool PtySessionManager::isAttached(const QString &id) const
+{
+    Session *session = m_sessions.value(id);
+    return session && session->attached;
+}
+
+void PtySessionManager::setAttachedPaused(const QString &id, bool paused)
+{
+    //detached session is always read
+    Session *session = m_sessions.value(id);
+    if (!session || !session->attached || paused == session->pty->isReadingPaused())
+        return;
+
+    if (paused)
+        session->pty->pauseReading();
+    else
+        session->pty->resumeReading();
+}
+
+void PtySessionManager::killSession(const QString &id)
+{
+    Session *session = m_sessions.value(id);
+    if (!session)
+        return;
+
+    session->pty->kill();
+    finishSession(id);
+}
+
+void PtySessionManager::readOutput(Session *session)
+{
+    QByteArray data = session->pty->readAll();
+    if (data.isEmpty())
+        return;
+
+    if (session->tail)
+        appendTail(session, data);
+    if (session->screen)
+        session->screen->feed(data.constData(), data.size());
+
+    if (session->attached)
+        emit output(session->id, data);
+}
+
+void PtySessionManager::appendTail(Session *session, const QByteArray &data)
+{
+    //keeps the newest bytes: oldest ones make room
+    PtyRingBuffer *tail = session->tail;
+    const char *bytes = data.constData();
+    qint64 size = data.size();
+    if (size > tail->capacity())
+    {
+        bytes += size - tail->capacity();
+        size = tail->capacity();
+    }
+    if (size > tail->freeSpace())
+    {
+        tail->consume(size - tail->freeSpace());
+        session->tailTruncated = true;
+    }
+    tail->write(bytes, size);
+}
+
+QByteArray PtySessionManager::replay(const Session *session) const
+{
+    if (session->screen)
+        return PtyScreenStream::snapshot(session->screen);
+
+    PtySpan spans[2];
+    int count = session->tail->peek(spans);
+    QByteArray result;
+    result.reserve(static_cast<int>(session->tail->size()));
+    for (int i = 0; i < count; i++)
+        result.append(spans[i].data, static_cast<int>(spans[i].size));
+
+    //cut tail starts in the middle of a line (or an escape sequence): start with the next one
+    if (session->tailTruncated)
+    {
+        int newLine = result.indexOf('\n');
+        result.remove(0, newLine + 1);
+    }
+    return result;
+}
+
+void PtySessionManager::finishSession(const QString &id)
+{
+    Session *session = m_sessions.take(id);
+    if (!session)
+        return;
+
+    //called from signals of the pty, it goes when they return
+    session->pty->notifier()->disconnect(this);
+    if (session->resizer)
+        session->pty->removeStreamObserver(session->resizer);
+    session->pty->deleteLater();
+    if (session->expiry)
+        session->expiry->deleteLater();
+    delete session->resizer;
+    delete session->tail;
+    delete session->screen;
+    delete session;
+
+    emit sessionFinished(id);
+}
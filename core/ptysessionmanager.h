@@ -0,0 +1,93 @@
+#ifndef PTYSESSIONMANAGER_H
+#define PTYSESSIONMANAGER_H
+
+#include "iptyprocess.h"
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+
+#define PTY_SESSION_MANAGER_DEFAULT_TAIL (256 * 1024)
+
+class PtyScreen;
+class QTimer;
+
+//keeps sessions alive across client disconnects (tmux-like detach/reattach):
+//sessions are keyed by id, the manager owns their ptys and takes their output all the time:
+//attached session passes it on with output() (a slow client may pause it), detached one keeps reading (the shell never
+//blocks on a full pty) into a bounded replay state, so memory per detached session is fixed:
+//ReplayTail - last 'tailBytes' of the output in a ring, ReplayScreen - PtyScreen of the session;
+//attach() returns what the client needs to show the session: the tail or a screen snapshot
+//(PtyScreenStream::snapshot()), built in O(state) time;
+//detached sessions may be killed after a timeout; finished sessions are removed
+//not thread safe, use from the thread the ptys live in
+class PtySessionManager : public QObject
+{
+    Q_OBJECT
+public:
+    enum ReplayMode
+    {
+        ReplayTail,
+        ReplayScreen
+    };
+
+    explicit PtySessionManager(ReplayMode mode = ReplayScreen, QObject *parent = 0);
+    //kills all sessions
+    ~PtySessionManager();
+
+    ReplayMode replayMode() const { return m_mode; }
+    //for sessions added after the call, rounded up to a power of two
+    void setTailBytes(qint64 bytes) { m_tailBytes = qMax<qint64>(bytes, 1); }
+    qint64 tailBytes() const { return m_tailBytes; }
+    //msecs a session may stay detached before it is killed, 0 - forever
+    void setDetachedTimeout(int msecs) { m_detachedTimeout = qMax(msecs, 0); }
+    int detachedTimeout() const { return m_detachedTimeout; }
+
+    //takes ownership of a started pty, session starts detached; 'id' is generated when empty,
+    //returns the id or empty string if it is taken
+    QString addSession(IPtyProcess *pty, const QString &id = QString());
+    IPtyProcess *session(const QString &id) const;
+    bool contains(const QString &id) const { return m_sessions.contains(id); }
+    QStringList sessionIds() const { return m_sessions.keys(); }
+    int sessionCount() const { return m_sessions.size(); }
+
+    //output goes to output() from now on, 'replay' gets the state to show first;
+    //attaching an attached session takes it over from the previous client
+    bool attach(const QString &id, QByteArray *replay);
+    void detach(const QString &id);
+    bool isAttached(const QString &id) const;
+    //flow control of a slow client (PtyRelay::throttled()): reading of an attached session
+    //is paused, so the shell blocks on the full pty; detach() and attach() resume it
+    void setAttachedPaused(const QString &id, bool paused);
+    void killSession(const QString &id);
+
+signals:
+    void output(const QString &id, const QByteArray &data);
+    //shell exited or the session was killed, its pty is deleted later
+    void sessionFinished(const QString &id);
+
+private:
+    struct Session
+    {
+        QString id;
+        IPtyProcess *pty;
+        PtyRingBuffer *tail; //ReplayTail
+        bool tailTruncated; //oldest output was dropped
+        PtyScreen *screen; //ReplayScreen
+        IPtyStreamObserver *resizer; //resizes the screen with the pty
+        bool attached;
+        QTimer *expiry;
+    };
+
+    void readOutput(Session *session);
+    void appendTail(Session *session, const QByteArray &data);
+    QByteArray replay(const Session *session) const;
+    void finishSession(const QString &id);
+
+private:
+    ReplayMode m_mode;
+    qint64 m_tailBytes;
+    int m_detachedTimeout;
+    QHash<QString, Session *> m_sessions;
+};
+
+#endif // PTYSESSIONMANAGER_H
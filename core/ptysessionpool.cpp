@@ -0,0 +1,260 @@
+#include "ptysessionpool.h"
+#include "ptyqt.h"
+
+#ifdef Q_OS_UNIX
+#include <QProcess>
+#else
+#include <QLocalSocket>
+#endif
+
+PtySessionPool::PtySessionPool(IPtyProcess::PtyType ptyType, QObject *parent)
+    : QObject(parent)
+    , m_ptyType(ptyType)
+    , m_refillScheduled(false)
+    , m_retryDelay(0)
+    , m_starting(0)
+    , m_startingBucket(0)
+    , m_hitCount(0)
+    , m_missCount(0)
+    , m_startFailureCount(0)
+{
+    m_retryTimer.setSingleShot(true);
+    connect(&m_retryTimer, &QTimer::timeout, this, &PtySessionPool::refill);
+}
+
+PtySessionPool::~PtySessionPool()
+{
+    clear();
+    delete m_starting;
+    qDeleteAll(m_buckets);
+}
+
+void PtySessionPool::setWarmCount(const QString &shellPath, const QString &workingDirectory, qint16 cols, qint16 rows, int count)
+{
+    QString key = makeKey(shellPath, workingDirectory, cols, rows);
+    Bucket *bucket = m_buckets.value(key);
+    if (bucket == 0)
+    {
+        if (count <= 0)
+            return;
+
+        bucket = new Bucket();
+        bucket->shellPath = shellPath;
+        bucket->workingDirectory = workingDirectory;
+        bucket->cols = cols;
+        bucket->rows = rows;
+        m_buckets.insert(key, bucket);
+    }
+
+    bucket->target = qMax(count, 0);
+    while (bucket->idle.size() > bucket->target)
+        delete bucket->idle.takeLast();
+
+    scheduleRefill();
+}
+
+int PtySessionPool::warmCount(const QString &shellPath, const QString &workingDirectory, qint16 cols, qint16 rows) const
+{
+    Bucket *bucket = m_buckets.value(makeKey(shellPath, workingDirectory, cols, rows));
+    return bucket ? bucket->idle.size() : 0;
+}
+
+IPtyProcess *PtySessionPool::acquire(const QString &shellPath, const QString &workingDirectory, qint16 cols, qint16 rows)
+{
+    Bucket *bucket = m_buckets.value(makeKey(shellPath, workingDirectory, cols, rows));
+    while (bucket && !bucket->idle.isEmpty())
+    {
+        IPtyProcess *pty = bucket->idle.takeFirst();
+        scheduleRefill();
+
+        //exit of the shell may be not delivered yet
+        if (!isAlive(pty))
+        {
+            delete pty;
+            continue;
+        }
+
+        m_hitCount++;
+        pty->notifier()->disconnect(this);
+        return pty;
+    }
+
+    //miss: start it right here, as without the pool; the bucket is warmed up again
+    m_missCount++;
+    if (bucket)
+        scheduleRefill();
+
+    Bucket tmp;
+    tmp.shellPath = shellPath;
+    tmp.workingDirectory = workingDirectory;
+    tmp.cols = cols;
+    tmp.rows = rows;
+    tmp.target = 0;
+
+    IPtyProcess *pty = createPty(&tmp);
+    if (pty && !pty->startProcess(shellPath, QStringList(), cols, rows))
+    {
+        m_startFailureCount++;
+        m_lastError = pty->lastError();
+        delete pty;
+        return 0;
+    }
+    return pty;
+}
+
+void PtySessionPool::clear()
+{
+    foreach (Bucket *bucket, m_buckets)
+    {
+        qDeleteAll(bucket->idle);
+        bucket->idle.clear();
+    }
+}
+
+void PtySessionPool::refill()
+{
+    m_refillScheduled = false;
+
+    //one start at a time: the next one is scheduled when it ends
+    if (m_starting)
+        return;
+
+    foreach (Bucket *bucket, m_buckets)
+    {
+        if (bucket->idle.size() >= bucket->target)
+            continue;
+
+        IPtyProcess *pty = createPty(bucket);
+        if (pty == 0)
+        {
+            scheduleRetry();
+            return;
+        }
+
+        m_starting = pty;
+        m_startingBucket = bucket;
+        connect(pty, &IPtyProcess::started, this, &PtySessionPool::onStarted);
+        connect(pty, &IPtyProcess::errorOccurred, this, &PtySessionPool::onStartFailed);
+        pty->startProcessAsync(bucket->shellPath, QStringList(), bucket->cols, bucket->rows);
+        return;
+    }
+}
+
+void PtySessionPool::onStarted()
+{
+    IPtyProcess *pty = m_starting;
+    Bucket *bucket = m_startingBucket;
+    m_starting = 0;
+    m_startingBucket = 0;
+
+    pty->disconnect(this);
+    m_retryDelay = 0;
+    if (bucket->idle.size() >= bucket->target)
+    {
+        //warm count was lowered meanwhile
+        pty->deleteLater();
+        return;
+    }
+
+    watchExit(pty);
+    bucket->idle.append(pty);
+    emit refilled(bucket->idle.size());
+    scheduleRefill();
+}
+
+void PtySessionPool::onStartFailed(const QString &error)
+{
+    IPtyProcess *pty = m_starting;
+    m_starting = 0;
+    m_startingBucket = 0;
+
+    m_startFailureCount++;
+    m_lastError = error;
+    pty->disconnect(this);
+    pty->deleteLater();
+
+    //don't spin on a broken shell
+    scheduleRetry();
+}
+
+QString PtySessionPool::makeKey(const QString &shellPath, const QString &workingDirectory, qint16 cols, qint16 rows)
+{
+    return QString("%1\n%2\n%3x%4").arg(shellPath).arg(workingDirectory).arg(cols).arg(rows);
+}
+
+IPtyProcess *PtySessionPool::createPty(const Bucket *bucket)
+{
+    IPtyProcess *pty = PtyQt::createPtyProcess(m_ptyType);
+    if (pty == 0)
+    {
+        m_startFailureCount++;
+        m_lastError = QString("PtySessionPool Error: pty type %1 is not available").arg(m_ptyType);
+        return 0;
+    }
+
+    if (!bucket->workingDirectory.isEmpty())
+        pty->setWorkingDirectory(bucket->workingDirectory);
+    return pty;
+}
+
+void PtySessionPool::scheduleRefill()
+{
+    //pending retry does the refill
+    if (m_refillScheduled || m_retryTimer.isActive())
+        return;
+
+    m_refillScheduled = true;
+    QMetaObject::invokeMethod(this, "refill", Qt::QueuedConnection);
+}
+
+void PtySessionPool::scheduleRetry()
+{
+    m_retryDelay = m_retryDelay > 0 ? qMin(m_retryDelay * 2, PTY_SESSION_POOL_MAX_RETRY_MSEC)
+                                    : PTY_SESSION_POOL_MIN_RETRY_MSEC;
+    m_retryTimer.start(m_retryDelay);
+}
+
+void PtySessionPool::watchExit(IPtyProcess *pty)
+{
+    //same exit signals as PtySessionManager uses
+#ifdef Q_OS_UNIX
+    QProcess *process = qobject_cast<QProcess *>(pty->notifier());
+    if (process)
+        connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                this, [this, pty]() { onIdleExited(pty); });
+    else
+        connect(pty->notifier(), &QIODevice::readChannelFinished, this, [this, pty]() { onIdleExited(pty); });
+#else
+    QLocalSocket *socket = qobject_cast<QLocalSocket *>(pty->notifier());
+    if (socket)
+        connect(socket, &QLocalSocket::disconnected, this, [this, pty]() { onIdleExited(pty); });
+#endif
+}
+
+void PtySessionPool::onIdleExited(IPtyProcess *pty)
+{
+    foreach (Bucket *bucket, m_buckets)
+    {
+        if (bucket->idle.removeOne(pty))
+        {
+            //called from a signal of the pty
+            pty->notifier()->disconnect(this);
+            pty->deleteLater();
+            scheduleRefill();
+            return;
+        }
+    }
+}
+
+bool PtySessionPool::isAlive(IPtyProcess *pty)
+{
+    if (pty->pid() <= 0)
+        return false;
+
+#ifdef Q_OS_UNIX
+    QProcess *process = qobject_cast<QProcess *>(pty->notifier());
+    if (process && process->state() == QProcess::NotRunning)
+        return false;
+#endif
+    return true;
+}
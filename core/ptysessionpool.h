@@ -0,0 +1,85 @@
+#ifndef PTYSESSIONPOOL_H
+#define PTYSESSIONPOOL_H
+
+#include "iptyprocess.h"
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QTimer>
+
+#define PTY_SESSION_POOL_MIN_RETRY_MSEC 250
+#define PTY_SESSION_POOL_MAX_RETRY_MSEC (30 * 1000)
+
+//keeps started ptys warm, so a new session doesn't wait for shell startup (rc files etc.)
+//ptys are grouped by (shell, working directory, size): backends start shells with their own
+//environment, so it is no part of the key; acquire() takes a warm one in O(1) or starts a new one on miss,
+//taken ptys are replaced in the background by startProcessAsync(), one start at a time;
+//failed starts are retried with a growing delay; warm shells which exit are dropped
+//output of a warm shell (e.g. prompt) is buffered: call readAll() right after acquire()
+//not thread safe, use from the thread the pool lives in
+class PtySessionPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PtySessionPool(IPtyProcess::PtyType ptyType = IPtyProcess::AutoPty, QObject *parent = 0);
+    ~PtySessionPool();
+
+    //keep 'count' ptys of this kind warm (0 - stop keeping and release idle ones)
+    void setWarmCount(const QString &shellPath, const QString &workingDirectory, qint16 cols, qint16 rows, int count);
+    int warmCount(const QString &shellPath, const QString &workingDirectory, qint16 cols, qint16 rows) const;
+
+    //started pty owned by caller, 0 (and lastError()) if it could not be started
+    IPtyProcess *acquire(const QString &shellPath, const QString &workingDirectory, qint16 cols, qint16 rows);
+
+    //kill all idle ptys
+    void clear();
+
+    quint64 hitCount() const { return m_hitCount; }
+    quint64 missCount() const { return m_missCount; }
+    quint64 startFailureCount() const { return m_startFailureCount; }
+    QString lastError() const { return m_lastError; }
+
+signals:
+    //background refill has started a new warm pty
+    void refilled(int warmCount);
+
+private slots:
+    void refill();
+    void onStarted();
+    void onStartFailed(const QString &error);
+
+private:
+    struct Bucket
+    {
+        QString shellPath;
+        QString workingDirectory;
+        qint16 cols;
+        qint16 rows;
+        int target;
+        QList<IPtyProcess *> idle;
+    };
+
+    static QString makeKey(const QString &shellPath, const QString &workingDirectory, qint16 cols, qint16 rows);
+    IPtyProcess *createPty(const Bucket *bucket);
+    void scheduleRefill();
+    void scheduleRetry(); //refill after a failed start, with backoff
+    void watchExit(IPtyProcess *pty);
+    void onIdleExited(IPtyProcess *pty);
+    static bool isAlive(IPtyProcess *pty);
+
+private:
+    IPtyProcess::PtyType m_ptyType;
+    QHash<QString, Bucket *> m_buckets;
+    bool m_refillScheduled;
+    QTimer m_retryTimer;
+    int m_retryDelay; //msecs, 0 - last start succeeded
+    IPtyProcess *m_starting; //background start in progress, one at a time
+    Bucket *m_startingBucket;
+    quint64 m_hitCount;
+    quint64 m_missCount;
+    quint64 m_startFailureCount;
+    QString m_lastError;
+};
+
+#endif // PTYSESSIONPOOL_H
@@ -0,0 +1,477 @@
+#include "ptyspawner.h"
+#include <QVector>
+
+#include <termios.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef Q_OS_LINUX
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+bool PtySpawner::openPty(int *master, int *slave, QString *slaveName, QString *error)
+{
+    *master = -1;
+    *slave = -1;
+    slaveName->clear();
+
+    int rc = 0;
+
+    int masterFd = ::posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterFd <= 0)
+    {
+        *error = QString("UnixPty Error: unable to open master -> %1").arg(strerror(errno));
+        return false;
+    }
+
+    QString name = ptsname(masterFd);
+    if (name.isEmpty())
+    {
+        *error = QString("UnixPty Error: unable to get slave name -> %1").arg(strerror(errno));
+        ::close(masterFd);
+        return false;
+    }
+
+    rc = grantpt(masterFd);
+    if (rc != 0)
+    {
+        *error = QString("UnixPty Error: unable to change perms for slave -> %1").arg(strerror(errno));
+        ::close(masterFd);
+        return false;
+    }
+
+    rc = unlockpt(masterFd);
+    if (rc != 0)
+    {
+        *error = QString("UnixPty Error: unable to unlock slave -> %1").arg(strerror(errno));
+        ::close(masterFd);
+        return false;
+    }
+
+    int slaveFd = ::open(name.toLatin1().data(), O_RDWR | O_NOCTTY);
+    if (slaveFd < 0)
+    {
+        *error = QString("UnixPty Error: unable to open slave -> %1").arg(strerror(errno));
+        ::close(masterFd);
+        return false;
+    }
+
+    //from here both handles are owned by caller, it closes them on error
+    *master = masterFd;
+    *slave = slaveFd;
+    *slaveName = name;
+
+    rc = fcntl(masterFd, F_SETFD, FD_CLOEXEC);
+    if (rc == -1)
+    {
+        *error = QString("UnixPty Error: unable to set flags for master -> %1").arg(strerror(errno));
+        return false;
+    }
+
+    rc = fcntl(masterFd, F_SETFL, fcntl(masterFd, F_GETFL) | O_NONBLOCK);
+    if (rc == -1)
+    {
+        *error = QString("UnixPty Error: unable to set non-blocking mode for master -> %1").arg(strerror(errno));
+        return false;
+    }
+
+    rc = fcntl(slaveFd, F_SETFD, FD_CLOEXEC);
+    if (rc == -1)
+    {
+        *error = QString("UnixPty Error: unable to set flags for slave -> %1").arg(strerror(errno));
+        return false;
+    }
+
+    struct ::termios ttmode;
+    rc = tcgetattr(masterFd, &ttmode);
+    if (rc != 0)
+    {
+        *error = QString("UnixPty Error: termios fail -> %1").arg(strerror(errno));
+        return false;
+    }
+
+    ttmode.c_iflag = ICRNL | IXON | IXANY | IMAXBEL | BRKINT;
+#if defined(IUTF8)
+    ttmode.c_iflag |= IUTF8;
+#endif
+
+    ttmode.c_oflag = OPOST | ONLCR;
+    ttmode.c_cflag = CREAD | CS8 | HUPCL;
+    ttmode.c_lflag = ICANON | ISIG | IEXTEN | ECHO | ECHOE | ECHOK | ECHOKE | ECHOCTL;
+
+    ttmode.c_cc[VEOF] = 4;
+    ttmode.c_cc[VEOL] = -1;
+    ttmode.c_cc[VEOL2] = -1;
+    ttmode.c_cc[VERASE] = 0x7f;
+    ttmode.c_cc[VWERASE] = 23;
+    ttmode.c_cc[VKILL] = 21;
+    ttmode.c_cc[VREPRINT] = 18;
+    ttmode.c_cc[VINTR] = 3;
+    ttmode.c_cc[VQUIT] = 0x1c;
+    ttmode.c_cc[VSUSP] = 26;
+    ttmode.c_cc[VSTART] = 17;
+    ttmode.c_cc[VSTOP] = 19;
+    ttmode.c_cc[VLNEXT] = 22;
+    ttmode.c_cc[VDISCARD] = 15;
+    ttmode.c_cc[VMIN] = 1;
+    ttmode.c_cc[VTIME] = 0;
+
+#if (__APPLE__)
+    ttmode.c_cc[VDSUSP] = 25;
+    ttmode.c_cc[VSTATUS] = 20;
+#endif
+
+    cfsetispeed(&ttmode, B38400);
+    cfsetospeed(&ttmode, B38400);
+
+    rc = tcsetattr(masterFd, TCSANOW, &ttmode);
+    if (rc != 0)
+    {
+        *error = QString("UnixPty Error: unabble to set associated params -> %1").arg(strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+QStringList PtySpawner::defaultEnvironment()
+{
+    QStringList defaultVars;
+
+    defaultVars.append("TERM=xterm-256color");
+    defaultVars.append("ITERM_PROFILE=Default");
+    defaultVars.append("XPC_FLAGS=0x0");
+    defaultVars.append("XPC_SERVICE_NAME=0");
+    defaultVars.append("LANG=en_US.UTF-8");
+    defaultVars.append("LC_ALL=en_US.UTF-8");
+    defaultVars.append("LC_CTYPE=UTF-8");
+    defaultVars.append("COMMAND_MODE=unix2003");
+    defaultVars.append("COLORTERM=truecolor");
+
+    return defaultVars;
+}
+
+//all the child needs, prepared before fork/clone:
+//between fork and exec only async-signal-safe calls are allowed
+struct PtySpawnArgs
+{
+    const char *path;
+    const char *cwd;
+    char **argv;
+    char **envp;
+    int slave;
+    sigset_t parentMask;
+    volatile int errorCode; //written by vfork-like child, it shares our memory
+};
+
+//child side of fork/vfork: session leader with slave as controlling tty and stdio
+static void execChild(PtySpawnArgs *args, int errorFd)
+{
+    //reset what we could inherit from parent
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigprocmask(SIG_SETMASK, &signals, 0);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    setsid();
+    ioctl(args->slave, TIOCSCTTY, 0);
+
+    dup2(args->slave, STDIN_FILENO);
+    dup2(args->slave, STDOUT_FILENO);
+    dup2(args->slave, STDERR_FILENO);
+    if (args->slave > STDERR_FILENO)
+        ::close(args->slave);
+
+    if (args->cwd[0] != 0)
+    {
+        int rc = chdir(args->cwd);
+        Q_UNUSED(rc)
+    }
+
+    execve(args->path, args->argv, args->envp);
+
+    int errorCode = errno;
+    args->errorCode = errorCode;
+    if (errorFd >= 0)
+    {
+        ssize_t rc = ::write(errorFd, &errorCode, sizeof(errorCode));
+        Q_UNUSED(rc)
+    }
+    _exit(127);
+}
+
+static qint64 spawnFork(PtySpawnArgs *args, QString *error)
+{
+    //exec errors are reported by the child through close-on-exec pipe
+    int errorPipe[2];
+    if (::pipe(errorPipe) != 0)
+    {
+        *error = QString("UnixPty Error: unable to create pipe -> %1").arg(strerror(errno));
+        return -1;
+    }
+    fcntl(errorPipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(errorPipe[1], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = ::fork();
+    if (pid < 0)
+    {
+        *error = QString("UnixPty Error: unable to fork -> %1").arg(strerror(errno));
+        ::close(errorPipe[0]);
+        ::close(errorPipe[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        ::close(errorPipe[0]);
+        execChild(args, errorPipe[1]);
+    }
+
+    ::close(errorPipe[1]);
+
+    int errorCode = 0;
+    ssize_t len = 0;
+    do
+    {
+        len = ::read(errorPipe[0], &errorCode, sizeof(errorCode));
+    } while (len < 0 && errno == EINTR);
+    ::close(errorPipe[0]);
+
+    if (len == sizeof(errorCode))
+    {
+        *error = QString("UnixPty Error: unable to start shell -> %1").arg(strerror(errorCode));
+        waitpid(pid, 0, 0);
+        return -1;
+    }
+
+    return pid;
+}
+
+#ifdef Q_OS_LINUX
+static int cloneChild(void *data)
+{
+    PtySpawnArgs *args = static_cast<PtySpawnArgs *>(data);
+
+    //child shares our memory: handlers of the parent must never run here
+    for (int sig = 1; sig < NSIG; sig++)
+    {
+        struct sigaction action;
+        if (sigaction(sig, 0, &action) == 0 && action.sa_handler != SIG_IGN && action.sa_handler != SIG_DFL)
+        {
+            action.sa_handler = SIG_DFL;
+            sigaction(sig, &action, 0);
+        }
+    }
+
+    execChild(args, -1);
+    return 0;
+}
+
+static qint64 spawnVFork(PtySpawnArgs *args, QString *error)
+{
+    //CLONE_VM | CLONE_VFORK: no copy of our page tables however big we are,
+    //we are suspended until the child calls execve() or exits;
+    //child runs on its own small stack, all signals are blocked meanwhile
+    const size_t stackSize = 64 * 1024;
+    void *stack = mmap(0, stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED)
+    {
+        *error = QString("UnixPty Error: unable to allocate stack -> %1").arg(strerror(errno));
+        return -1;
+    }
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &args->parentMask);
+
+    args->errorCode = 0;
+    //stack grows down on all platforms we build for
+    pid_t pid = clone(cloneChild, static_cast<char *>(stack) + stackSize, CLONE_VM | CLONE_VFORK | SIGCHLD, args);
+    int cloneErrno = errno;
+
+    pthread_sigmask(SIG_SETMASK, &args->parentMask, 0);
+    munmap(stack, stackSize);
+
+    if (pid < 0)
+    {
+        *error = QString("UnixPty Error: unable to clone -> %1").arg(strerror(cloneErrno));
+        return -1;
+    }
+
+    if (args->errorCode != 0)
+    {
+        *error = QString("UnixPty Error: unable to start shell -> %1").arg(strerror(args->errorCode));
+        waitpid(pid, 0, 0);
+        return -1;
+    }
+
+    return pid;
+}
+#endif
+
+//__GLIBC_PREREQ exists on glibc only, it can't share one #if with the check for it
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 29) && defined(POSIX_SPAWN_SETSID)
+#define PTYQT_NATIVE_POSIX_SPAWN
+#endif
+#endif
+
+#ifdef PTYQT_NATIVE_POSIX_SPAWN
+static qint64 spawnPosix(PtySpawnArgs *args, QString *error)
+{
+    //session leader opens the slave without O_NOCTTY: it becomes controlling tty,
+    //so no code of ours runs in the child at all
+    char slaveName[256];
+    if (ttyname_r(args->slave, slaveName, sizeof(slaveName)) != 0)
+    {
+        *error = QString("UnixPty Error: unable to get slave name -> %1").arg(strerror(errno));
+        return -1;
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    sigaddset(&signals, SIGCHLD);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, slaveName, O_RDWR, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDERR_FILENO);
+    if (args->cwd[0] != 0)
+        posix_spawn_file_actions_addchdir_np(&actions, args->cwd);
+
+    pid_t pid = 0;
+    int rc = posix_spawn(&pid, args->path, &actions, &attr, args->argv, args->envp);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (rc != 0)
+    {
+        *error = QString("UnixPty Error: unable to start shell -> %1").arg(strerror(rc));
+        return -1;
+    }
+
+    return pid;
+}
+#endif
+
+qint64 PtySpawner::spawn(const QString &shellPath, const QStringList &environment,
+                         const QString &workingDirectory, int slave, QString *error, Engine engine)
+{
+    QByteArray path = shellPath.toLocal8Bit();
+    QByteArray cwd = workingDirectory.toLocal8Bit();
+
+    QList<QByteArray> envData;
+    foreach (const QString &line, environment)
+        envData.append(line.toLocal8Bit());
+
+    QVector<char *> envp;
+    for (int i = 0; i < envData.size(); i++)
+        envp.append(envData[i].data());
+    envp.append(0);
+
+    char *argv[] = { path.data(), 0 };
+
+    PtySpawnArgs args;
+    args.path = path.constData();
+    args.cwd = cwd.constData();
+    args.argv = argv;
+    args.envp = envp.data();
+    args.slave = slave;
+    args.errorCode = 0;
+
+    switch (engine)
+    {
+    case PosixSpawnEngine:
+#ifdef PTYQT_NATIVE_POSIX_SPAWN
+        return spawnPosix(&args, error);
+#endif
+        //fall through: no setsid/chdir support in posix_spawn of this libc
+    case VForkEngine:
+#ifdef Q_OS_LINUX
+        return spawnVFork(&args, error);
+#endif
+        //fall through: vfork is deprecated or unsafe elsewhere
+    case QProcessEngine:
+    case ForkEngine:
+    default:
+        break;
+    }
+
+    return spawnFork(&args, error);
+}
+
+//true if 'pid' exited within 'timeoutMsec' and was reaped
+static bool reap(pid_t pid, int timeoutMsec)
+{
+    if (waitpid(pid, 0, WNOHANG) == pid)
+        return true;
+
+#if defined(Q_OS_LINUX) && defined(SYS_pidfd_open)
+    //pidfd gets readable when the child exits: sleep in poll() instead of polling waitpid()
+    int pidFd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (pidFd >= 0)
+    {
+        struct pollfd pfd;
+        pfd.fd = pidFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int rc;
+        do
+        {
+            rc = ::poll(&pfd, 1, timeoutMsec);
+        } while (rc < 0 && errno == EINTR);
+        ::close(pidFd);
+        return rc > 0 && waitpid(pid, 0, WNOHANG) == pid;
+    }
+#endif
+
+    //older kernels
+    for (int i = 0; i < timeoutMsec / 10; i++)
+    {
+        usleep(10 * 1000);
+        if (waitpid(pid, 0, WNOHANG) == pid)
+            return true;
+    }
+    return false;
+}
+
+bool PtySpawner::terminate(qint64 pid, int timeoutMsec)
+{
+    if (pid <= 0)
+        return false;
+
+    //give the shell time to handle SIGHUP/SIGTERM before force kill
+    pid_t childPid = static_cast<pid_t>(pid);
+    ::kill(childPid, SIGTERM);
+
+    bool finished = reap(childPid, timeoutMsec);
+
+    if (!finished)
+    {
+        ::kill(childPid, SIGKILL);
+        finished = (waitpid(childPid, 0, 0) == childPid);
+    }
+
+    return finished;
+}
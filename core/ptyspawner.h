@@ -0,0 +1,36 @@
+#ifndef PTYSPAWNER_H
+#define PTYSPAWNER_H
+
+#include <QString>
+#include <QStringList>
+
+//low level helpers shared by unix pty backends
+class PtySpawner
+{
+public:
+    enum Engine
+    {
+        QProcessEngine = 0,   //QProcess + setupChildProcess() in UnixPtyProcess, spawn() uses fork for it
+        ForkEngine = 1,       //fork + execve, copies page tables of the whole parent
+        VForkEngine = 2,      //clone(CLONE_VM | CLONE_VFORK) on Linux, cost doesn't depend on parent RSS
+        PosixSpawnEngine = 3  //posix_spawn with setsid, no code of ours in the child; falls back to VForkEngine
+    };
+
+    //open master/slave pair with our default termios, master is non-blocking,
+    //both handles are close-on-exec; on error nothing is left open
+    static bool openPty(int *master, int *slave, QString *slaveName, QString *error);
+
+    //variables which every unix shell gets
+    static QStringList defaultEnvironment();
+
+    //start 'shellPath' as session leader with 'slave' as controlling tty and stdio,
+    //returns pid of the child or -1 (and 'error') if exec failed
+    static qint64 spawn(const QString &shellPath, const QStringList &environment,
+                        const QString &workingDirectory, int slave, QString *error,
+                        Engine engine = ForkEngine);
+
+    //SIGTERM, wait up to 'timeoutMsec' for exit, then SIGKILL; reaps the child
+    static bool terminate(qint64 pid, int timeoutMsec);
+};
+
+#endif // PTYSPAWNER_H
@@ -0,0 +1,91 @@
+#include "ptystats.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <QList>
+
+//registry of live counters and the sum of destroyed ones, for PtyStats::global()
+static QMutex g_statsRegistryMutex;
+static QList<const PtyStats *> g_statsRegistry;
+static PtyStatsSnapshot g_statsFinished;
+
+static void accumulate(PtyStatsSnapshot &total, const PtyStatsSnapshot &stats)
+{
+    total.bytesRead += stats.bytesRead;
+    total.bytesWritten += stats.bytesWritten;
+    total.readCalls += stats.readCalls;
+    total.wakeups += stats.wakeups;
+    total.readyReadEmitted += stats.readyReadEmitted;
+    total.maxBufferedBytes = qMax(total.maxBufferedBytes, stats.maxBufferedBytes);
+    total.bufferedBytesTotal += stats.bufferedBytesTotal;
+    total.writeStalls += stats.writeStalls;
+    total.spawnTimeUsec += stats.spawnTimeUsec;
+    total.sessions += stats.sessions;
+}
+
+PtyStatsSnapshot::PtyStatsSnapshot()
+    : bytesRead(0)
+    , bytesWritten(0)
+    , readCalls(0)
+    , wakeups(0)
+    , readyReadEmitted(0)
+    , maxBufferedBytes(0)
+    , bufferedBytesTotal(0)
+    , writeStalls(0)
+    , spawnTimeUsec(0)
+    , sessions(0)
+{
+
+}
+
+QString PtyStatsSnapshot::toString() const
+{
+    return QString("Sessions: %1, BytesRead: %2, BytesWritten: %3, ReadCalls: %4, Wakeups: %5, ReadyRead: %6, "
+                   "MaxBuffered: %7, AvgBuffered: %8, WriteStalls: %9, SpawnTimeUsec: %10")
+            .arg(sessions).arg(bytesRead).arg(bytesWritten).arg(readCalls).arg(wakeups).arg(readyReadEmitted)
+            .arg(maxBufferedBytes).arg(averageBufferedBytes()).arg(writeStalls).arg(spawnTimeUsec);
+}
+
+PtyStats::PtyStats()
+    : m_maxBufferedBytes(0)
+    , m_spawnTimeUsec(0)
+{
+    for (int i = 0; i < CounterCount; i++)
+        m_counters[i].store(0, std::memory_order_relaxed);
+
+    QMutexLocker locker(&g_statsRegistryMutex);
+    g_statsRegistry.append(this);
+}
+
+PtyStats::~PtyStats()
+{
+    PtyStatsSnapshot stats = snapshot();
+
+    QMutexLocker locker(&g_statsRegistryMutex);
+    g_statsRegistry.removeOne(this);
+    accumulate(g_statsFinished, stats);
+}
+
+PtyStatsSnapshot PtyStats::snapshot() const
+{
+    PtyStatsSnapshot stats;
+    stats.bytesRead = m_counters[BytesRead].load(std::memory_order_relaxed);
+    stats.bytesWritten = m_counters[BytesWritten].load(std::memory_order_relaxed);
+    stats.readCalls = m_counters[ReadCalls].load(std::memory_order_relaxed);
+    stats.wakeups = m_counters[Wakeups].load(std::memory_order_relaxed);
+    stats.readyReadEmitted = m_counters[ReadyReadEmitted].load(std::memory_order_relaxed);
+    stats.bufferedBytesTotal = m_counters[BufferedBytesTotal].load(std::memory_order_relaxed);
+    stats.writeStalls = m_counters[WriteStalls].load(std::memory_order_relaxed);
+    stats.maxBufferedBytes = m_maxBufferedBytes.load(std::memory_order_relaxed);
+    stats.spawnTimeUsec = m_spawnTimeUsec.load(std::memory_order_relaxed);
+    stats.sessions = 1;
+    return stats;
+}
+
+PtyStatsSnapshot PtyStats::global()
+{
+    QMutexLocker locker(&g_statsRegistryMutex);
+    PtyStatsSnapshot total = g_statsFinished;
+    for (int i = 0; i < g_statsRegistry.size(); i++)
+        accumulate(total, g_statsRegistry.at(i)->snapshot());
+    return total;
+}
@@ -0,0 +1,78 @@
+#ifndef PTYSTATS_H
+#define PTYSTATS_H
+
+#include <QString>
+#include <atomic>
+
+//counters of one session at some moment (IPtyProcess::stats()) or sum of all sessions (PtyStats::global()),
+//backends fill the ones they can measure
+struct PtyStatsSnapshot
+{
+    qint64 bytesRead; //output taken from the pty
+    qint64 bytesWritten; //input accepted by write()
+    qint64 readCalls; //read syscalls on the master, including the ones which got EAGAIN
+    qint64 wakeups; //times the event loop woke up to read
+    qint64 readyReadEmitted;
+    qint64 maxBufferedBytes; //output waiting for readAll() when readyRead was emitted
+    qint64 bufferedBytesTotal; //sum of those, for the average
+    qint64 writeStalls; //write() found the pty input queue full and queued data
+    qint64 spawnTimeUsec; //startProcess() or startProcessAsync() until started(), sum for global()
+    int sessions; //1 for a session, count of live and destroyed pty objects for global()
+
+    PtyStatsSnapshot();
+    qint64 averageBufferedBytes() const { return readyReadEmitted > 0 ? bufferedBytesTotal / readyReadEmitted : 0; }
+    QString toString() const;
+};
+
+//per-session performance counters, updated on the read/write paths of the backends:
+//relaxed atomics, no locks, each counter is a plain atomic add for the thread which owns the path;
+//global() sums all live sessions and the ones already destroyed
+class PtyStats
+{
+public:
+    enum Counter
+    {
+        BytesRead,
+        BytesWritten,
+        ReadCalls,
+        Wakeups,
+        ReadyReadEmitted,
+        BufferedBytesTotal,
+        WriteStalls,
+        CounterCount
+    };
+
+    PtyStats();
+    ~PtyStats();
+
+    void add(Counter counter, qint64 value = 1)
+    {
+        m_counters[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    //readyRead with 'buffered' bytes waiting for the consumer
+    void addReadyRead(qint64 buffered)
+    {
+        m_counters[ReadyReadEmitted].fetch_add(1, std::memory_order_relaxed);
+        m_counters[BufferedBytesTotal].fetch_add(buffered, std::memory_order_relaxed);
+        qint64 max = m_maxBufferedBytes.load(std::memory_order_relaxed);
+        while (buffered > max && !m_maxBufferedBytes.compare_exchange_weak(max, buffered, std::memory_order_relaxed))
+            ;
+    }
+
+    void setSpawnTime(qint64 usec) { m_spawnTimeUsec.store(usec, std::memory_order_relaxed); }
+
+    PtyStatsSnapshot snapshot() const;
+
+    static PtyStatsSnapshot global();
+
+private:
+    PtyStats(const PtyStats &);
+    PtyStats &operator=(const PtyStats &);
+
+    std::atomic<qint64> m_counters[CounterCount];
+    std::atomic<qint64> m_maxBufferedBytes;
+    std::atomic<qint64> m_spawnTimeUsec;
+};
+
+#endif // PTYSTATS_H
@@ -0,0 +1,271 @@
+#include "ptytracer.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <QList>
+#include <QVector>
+#include <QFile>
+#include <QCoreApplication>
+#include <chrono>
+
+#define DURATION_INSTANT -1
+
+std::atomic<bool> PtyTracer::s_enabled(false);
+
+namespace {
+
+//fields are relaxed atomics: exporter reads rings while their threads keep writing
+struct TraceSlot
+{
+    std::atomic<const char *> name;
+    std::atomic<const char *> argName;
+    std::atomic<qint64> timestamp;
+    std::atomic<qint64> duration;
+    std::atomic<qint64> session;
+    std::atomic<qint64> arg;
+    std::atomic<const char *> arg2Name;
+    std::atomic<qint64> arg2;
+};
+
+struct TraceEvent
+{
+    const char *name;
+    const char *argName;
+    qint64 timestamp;
+    qint64 duration;
+    qint64 session;
+    qint64 arg;
+    const char *arg2Name;
+    qint64 arg2;
+};
+
+//ring of one thread, single writer; owned by the registry and reused after the thread exits
+struct TraceRing
+{
+    explicit TraceRing(int size)
+        : events(new TraceSlot[size])
+        , size(size)
+        , written(0)
+        , cleared(0)
+        , inUse(true)
+        , id(0)
+    {
+        for (int i = 0; i < size; i++)
+            events[i].name.store(0, std::memory_order_relaxed);
+    }
+    ~TraceRing() { delete [] events; }
+
+    TraceSlot *events;
+    int size;
+    std::atomic<quint64> written;
+    std::atomic<quint64> cleared; //events before it were dropped by clear()
+    bool inUse; //under the registry lock
+    int id; //tid in the trace
+};
+
+QMutex g_traceRegistryMutex;
+QList<TraceRing *> g_traceRings;
+std::atomic<int> g_traceEventsPerThread(PTY_TRACER_DEFAULT_EVENTS_PER_THREAD);
+
+//returns the ring to the registry when the thread exits
+struct TraceRingHolder
+{
+    TraceRingHolder() : ring(0) { }
+    ~TraceRingHolder()
+    {
+        if (!ring)
+            return;
+        QMutexLocker locker(&g_traceRegistryMutex);
+        ring->inUse = false;
+    }
+
+    TraceRing *ring;
+};
+
+TraceRing *currentRing()
+{
+    static thread_local TraceRingHolder holder;
+    if (holder.ring)
+        return holder.ring;
+
+    //first event of this thread: take a free ring (its old events stay until overwritten) or a new one
+    QMutexLocker locker(&g_traceRegistryMutex);
+    for (int i = 0; i < g_traceRings.size(); i++)
+    {
+        if (!g_traceRings.at(i)->inUse)
+        {
+            holder.ring = g_traceRings.at(i);
+            holder.ring->inUse = true;
+            return holder.ring;
+        }
+    }
+
+    holder.ring = new TraceRing(g_traceEventsPerThread.load(std::memory_order_relaxed));
+    holder.ring->id = g_traceRings.size() + 1;
+    g_traceRings.append(holder.ring);
+    return holder.ring;
+}
+
+//events which are not overwritten while we copy them
+QVector<TraceEvent> readRing(TraceRing *ring)
+{
+    QVector<TraceEvent> events;
+    quint64 end = ring->written.load(std::memory_order_acquire);
+    quint64 begin = end > static_cast<quint64>(ring->size) ? end - ring->size : 0;
+    begin = qMax(begin, ring->cleared.load(std::memory_order_relaxed));
+    events.reserve(static_cast<int>(end - begin));
+    for (quint64 i = begin; i < end; i++)
+    {
+        TraceSlot &slot = ring->events[i % ring->size];
+        TraceEvent event;
+        event.name = slot.name.load(std::memory_order_relaxed);
+        event.argName = slot.argName.load(std::memory_order_relaxed);
+        event.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+        event.duration = slot.duration.load(std::memory_order_relaxed);
+        event.session = slot.session.load(std::memory_order_relaxed);
+        event.arg = slot.arg.load(std::memory_order_relaxed);
+        event.arg2Name = slot.arg2Name.load(std::memory_order_relaxed);
+        event.arg2 = slot.arg2.load(std::memory_order_relaxed);
+        events.append(event);
+    }
+
+    //slots the writer reached meanwhile may hold newer events, drop them
+    std::atomic_thread_fence(std::memory_order_acquire);
+    quint64 now = ring->written.load(std::memory_order_relaxed);
+    if (now > begin + ring->size)
+    {
+        int overwritten = static_cast<int>(qMin<quint64>(now - begin - ring->size, end - begin));
+        events.remove(0, overwritten);
+    }
+    return events;
+}
+
+QByteArray microseconds(qint64 nsecs)
+{
+    //integer math keeps full precision of big monotonic timestamps
+    QByteArray result = QByteArray::number(nsecs / 1000);
+    int fraction = static_cast<int>(nsecs % 1000);
+    if (fraction != 0)
+        result.append('.').append(QByteArray::number(fraction).rightJustified(3, '0'));
+    return result;
+}
+
+}
+
+void PtyTracer::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void PtyTracer::setEventsPerThread(int events)
+{
+    g_traceEventsPerThread.store(qMax(events, 16), std::memory_order_relaxed);
+}
+
+int PtyTracer::eventsPerThread()
+{
+    return g_traceEventsPerThread.load(std::memory_order_relaxed);
+}
+
+qint64 PtyTracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PtyTracer::instant(const char *name, qint64 session, const char *argName, qint64 arg,
+                        const char *arg2Name, qint64 arg2)
+{
+    record(name, now(), DURATION_INSTANT, session, argName, arg, arg2Name, arg2);
+}
+
+void PtyTracer::complete(const char *name, qint64 start, qint64 session, const char *argName, qint64 arg,
+                         const char *arg2Name, qint64 arg2)
+{
+    record(name, start, now() - start, session, argName, arg, arg2Name, arg2);
+}
+
+void PtyTracer::record(const char *name, qint64 timestamp, qint64 duration, qint64 session,
+                       const char *argName, qint64 arg, const char *arg2Name, qint64 arg2)
+{
+    TraceRing *ring = currentRing();
+    quint64 index = ring->written.load(std::memory_order_relaxed);
+    TraceSlot &slot = ring->events[index % ring->size];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.argName.store(argName, std::memory_order_relaxed);
+    slot.timestamp.store(timestamp, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    slot.session.store(session, std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.arg2Name.store(arg2Name, std::memory_order_relaxed);
+    slot.arg2.store(arg2, std::memory_order_relaxed);
+    ring->written.store(index + 1, std::memory_order_release);
+}
+
+QByteArray PtyTracer::toChromeTrace()
+{
+    QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray out("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+
+    QMutexLocker locker(&g_traceRegistryMutex);
+    for (int r = 0; r < g_traceRings.size(); r++)
+    {
+        TraceRing *ring = g_traceRings.at(r);
+        QVector<TraceEvent> events = readRing(ring);
+        if (events.isEmpty())
+            continue;
+
+        QByteArray tid = QByteArray::number(ring->id);
+        out.append(first ? "\n" : ",\n");
+        first = false;
+        out.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + tid
+                   + ",\"args\":{\"name\":\"ptyqt " + tid + "\"}}");
+
+        for (int i = 0; i < events.size(); i++)
+        {
+            const TraceEvent &event = events.at(i);
+            out.append(",\n{\"name\":\"");
+            out.append(event.name);
+            out.append("\",\"cat\":\"ptyqt\",\"ph\":\"");
+            out.append(event.duration == DURATION_INSTANT ? "i\",\"s\":\"t" : "X");
+            out.append("\",\"ts\":" + microseconds(event.timestamp));
+            if (event.duration != DURATION_INSTANT)
+                out.append(",\"dur\":" + microseconds(event.duration));
+            out.append(",\"pid\":" + pid + ",\"tid\":" + tid);
+            out.append(",\"args\":{\"session\":" + QByteArray::number(event.session));
+            if (event.argName)
+            {
+                out.append(",\"");
+                out.append(event.argName);
+                out.append("\":" + QByteArray::number(event.arg));
+            }
+            if (event.arg2Name)
+            {
+                out.append(",\"");
+                out.append(event.arg2Name);
+                out.append("\":" + QByteArray::number(event.arg2));
+            }
+            out.append("}}");
+        }
+    }
+    out.append("\n]}\n");
+    return out;
+}
+
+bool PtyTracer::writeChromeTrace(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QByteArray trace = toChromeTrace();
+    return file.write(trace) == trace.size();
+}
+
+void PtyTracer::clear()
+{
+    //drops what is recorded so far: exporter reads only the events after the mark
+    QMutexLocker locker(&g_traceRegistryMutex);
+    for (int i = 0; i < g_traceRings.size(); i++)
+        g_traceRings.at(i)->cleared.store(g_traceRings.at(i)->written.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
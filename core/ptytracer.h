@@ -0,0 +1,49 @@
+#ifndef PTYTRACER_H
+#define PTYTRACER_H
+
+#include <QByteArray>
+#include <QString>
+#include <atomic>
+
+#define PTY_TRACER_DEFAULT_EVENTS_PER_THREAD 16384
+
+//low-overhead tracing of pty activity: backends put static tracepoints (spawn, read, write,
+//resize, kill, readyRead) into a per-thread ring of fixed-size events, no locks and no allocations
+//on the hot path, oldest events are overwritten; export as Chrome trace-event JSON
+//(chrome://tracing, ui.perfetto.dev), timestamps are from the monotonic clock (CLOCK_MONOTONIC on Linux)
+//like most tracers use, so the trace lines up with other traces of the machine;
+//enabled for all sessions with setEnabled() or for one with IPtyProcess::toggleTrace(), at runtime
+class PtyTracer
+{
+public:
+    static void setEnabled(bool enabled);
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    //ring size of threads which record their first event after this call
+    static void setEventsPerThread(int events);
+    static int eventsPerThread();
+
+    //nanoseconds of the trace clock
+    static qint64 now();
+
+    //names must be string literals (they are stored as pointers);
+    //'session' is the pid of the shell, args are values shown with their names (bytes, cols...)
+    static void instant(const char *name, qint64 session, const char *argName = 0, qint64 arg = 0,
+                        const char *arg2Name = 0, qint64 arg2 = 0);
+    //event which started at 'start' (from now()) and ends now
+    static void complete(const char *name, qint64 start, qint64 session, const char *argName = 0, qint64 arg = 0,
+                         const char *arg2Name = 0, qint64 arg2 = 0);
+
+    //events of all threads, oldest first within a thread
+    static QByteArray toChromeTrace();
+    static bool writeChromeTrace(const QString &fileName);
+    static void clear();
+
+private:
+    static void record(const char *name, qint64 timestamp, qint64 duration, qint64 session,
+                       const char *argName, qint64 arg, const char *arg2Name, qint64 arg2);
+
+    static std::atomic<bool> s_enabled;
+};
+
+#endif // PTYTRACER_H
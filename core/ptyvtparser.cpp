@@ -0,0 +1,480 @@
+#include "ptyvtparser.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PTYQT_VT_SSE2
+#include <emmintrin.h>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PTYQT_VT_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define PTYQT_VT_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define MAX_PARAM_VALUE 99999
+#define DEFAULT_MAX_STRING_SIZE (64 * 1024)
+#define REPLACEMENT_CHARACTER 0xfffd
+
+static inline int countTrailingZeros(quint32 value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(value);
+#endif
+}
+
+static qint64 scanPrintableScalar(const char *data, qint64 size)
+{
+    qint64 i = 0;
+    while (i < size && static_cast<uchar>(data[i]) >= 0x20 && static_cast<uchar>(data[i]) < 0x7f)
+        i++;
+    return i;
+}
+
+#ifdef PTYQT_VT_SSE2
+static qint64 scanPrintableSse2(const char *data, qint64 size)
+{
+    //signed compare: bytes >= 0x80 are negative, so one range check covers them too
+    const __m128i low = _mm_set1_epi8(0x1f);
+    const __m128i high = _mm_set1_epi8(0x7f);
+
+    qint64 i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, high));
+        int mask = _mm_movemask_epi8(printable);
+        if (mask != 0xffff)
+            return i + countTrailingZeros(~static_cast<quint32>(mask));
+    }
+
+    return i + scanPrintableScalar(data + i, size - i);
+}
+#endif
+
+#ifdef PTYQT_VT_AVX2
+__attribute__((target("avx2")))
+static qint64 scanPrintableAvx2(const char *data, qint64 size)
+{
+    const __m256i low = _mm256_set1_epi8(0x1f);
+    const __m256i high = _mm256_set1_epi8(0x7f);
+
+    qint64 i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(v, low), _mm256_cmpgt_epi8(high, v));
+        quint32 mask = static_cast<quint32>(_mm256_movemask_epi8(printable));
+        if (mask != 0xffffffffu)
+            return i + countTrailingZeros(~mask);
+    }
+
+    return i + scanPrintableSse2(data + i, size - i);
+}
+
+static bool hasAvx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+#ifdef PTYQT_VT_NEON
+static qint64 scanPrintableNeon(const char *data, qint64 size)
+{
+    const uint8x16_t low = vdupq_n_u8(0x20);
+    const uint8x16_t high = vdupq_n_u8(0x7f);
+
+    qint64 i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(data + i));
+        uint8x16_t printable = vandq_u8(vcgeq_u8(v, low), vcltq_u8(v, high));
+        if (vminvq_u8(printable) != 0xff)
+            return i + scanPrintableScalar(data + i, 16);
+    }
+
+    return i + scanPrintableScalar(data + i, size - i);
+}
+#endif
+
+qint64 PtyVtParser::scanPrintable(const char *data, qint64 size)
+{
+#if defined(PTYQT_VT_AVX2)
+    if (hasAvx2())
+        return scanPrintableAvx2(data, size);
+    return scanPrintableSse2(data, size);
+#elif defined(PTYQT_VT_SSE2)
+    return scanPrintableSse2(data, size);
+#elif defined(PTYQT_VT_NEON)
+    return scanPrintableNeon(data, size);
+#else
+    return scanPrintableScalar(data, size);
+#endif
+}
+
+PtyVtParser::PtyVtParser(PtyVtHandler *handler)
+    : m_handler(handler)
+    , m_maxStringSize(DEFAULT_MAX_STRING_SIZE)
+{
+    reset();
+}
+
+void PtyVtParser::reset()
+{
+    m_state = Ground;
+    m_codepoint = 0;
+    m_utf8Pending = 0;
+    m_utf8Min = 0;
+    m_dcsFinal = 0;
+    clearSequence();
+}
+
+void PtyVtParser::feed(const char *data, qint64 size)
+{
+    const char *end = data + size;
+    const char *p = data;
+    while (p < end)
+    {
+        //fast path: plain text goes out in runs, no per-byte state machine
+        if (m_state == Ground && m_utf8Pending == 0)
+        {
+            qint64 run = scanPrintable(p, end - p);
+            while (run > 0)
+            {
+                int chunk = static_cast<int>(qMin<qint64>(run, 0x40000000));
+                m_handler->vtPrint(p, chunk);
+                p += chunk;
+                run -= chunk;
+            }
+            if (p == end)
+                break;
+        }
+
+        uchar c = static_cast<uchar>(*p++);
+
+        if (m_utf8Pending > 0)
+        {
+            if ((c & 0xc0) == 0x80 && m_state == Ground)
+            {
+                utf8(c);
+                continue;
+            }
+
+            //broken sequence: replace it and handle this byte as usual
+            m_utf8Pending = 0;
+            m_handler->vtPrintCodepoint(REPLACEMENT_CHARACTER);
+        }
+
+        //transitions from anywhere
+        if (c == 0x18 || c == 0x1a)
+        {
+            m_handler->vtExecute(static_cast<char>(c));
+            toGround();
+            continue;
+        }
+        if (c == 0x1b)
+        {
+            if (m_state == OscString)
+                dispatchOsc();
+            else if (m_state == DcsPassthrough)
+                dispatchDcs();
+
+            //ESC '\' (ST) which ends strings comes to vtEsc as well
+            clearSequence();
+            m_state = Escape;
+            continue;
+        }
+
+        switch (m_state)
+        {
+        case Ground:
+            if (c < 0x20)
+                m_handler->vtExecute(static_cast<char>(c));
+            else if (c >= 0x80)
+                utf8(c);
+            //0x7f is ignored
+            break;
+
+        case Escape:
+            if (c < 0x20)
+                m_handler->vtExecute(static_cast<char>(c));
+            else if (c < 0x30)
+            {
+                collect(static_cast<char>(c));
+                m_state = EscapeIntermediate;
+            }
+            else if (c == '[')
+                m_state = CsiEntry;
+            else if (c == ']')
+            {
+                m_string.clear();
+                m_state = OscString;
+            }
+            else if (c == 'P')
+                m_state = DcsEntry;
+            else if (c == 'X' || c == '^' || c == '_')
+                m_state = SosPmApcString;
+            else if (c < 0x7f)
+            {
+                m_handler->vtEsc(m_intermediates, m_intermediateCount, static_cast<char>(c));
+                toGround();
+            }
+            else if (c >= 0x80)
+                toGround();
+            break;
+
+        case EscapeIntermediate:
+            if (c < 0x20)
+                m_handler->vtExecute(static_cast<char>(c));
+            else if (c < 0x30)
+                collect(static_cast<char>(c));
+            else if (c < 0x7f)
+            {
+                if (!m_intermediateOverflow)
+                    m_handler->vtEsc(m_intermediates, m_intermediateCount, static_cast<char>(c));
+                toGround();
+            }
+            else if (c >= 0x80)
+                toGround();
+            break;
+
+        case CsiEntry:
+        case CsiParam:
+            if (c < 0x20)
+                m_handler->vtExecute(static_cast<char>(c));
+            else if (c < 0x30)
+            {
+                collect(static_cast<char>(c));
+                m_state = CsiIntermediate;
+            }
+            else if (c <= 0x3b)
+            {
+                param(static_cast<char>(c));
+                m_state = CsiParam;
+            }
+            else if (c < 0x40)
+            {
+                //private marker is valid only right after CSI
+                if (m_state == CsiEntry)
+                {
+                    m_prefix = static_cast<char>(c);
+                    m_state = CsiParam;
+                }
+                else
+                    m_state = CsiIgnore;
+            }
+            else if (c < 0x7f)
+            {
+                if (m_paramStarted || m_params.count > 0)
+                    finishParam();
+                if (!m_intermediateOverflow)
+                    m_handler->vtCsi(m_prefix, m_params, m_intermediates, m_intermediateCount, static_cast<char>(c));
+                toGround();
+            }
+            else if (c >= 0x80)
+                m_state = CsiIgnore;
+            break;
+
+        case CsiIntermediate:
+            if (c < 0x20)
+                m_handler->vtExecute(static_cast<char>(c));
+            else if (c < 0x30)
+                collect(static_cast<char>(c));
+            else if (c < 0x40)
+                m_state = CsiIgnore;
+            else if (c < 0x7f)
+            {
+                if (m_paramStarted || m_params.count > 0)
+                    finishParam();
+                if (!m_intermediateOverflow)
+                    m_handler->vtCsi(m_prefix, m_params, m_intermediates, m_intermediateCount, static_cast<char>(c));
+                toGround();
+            }
+            break;
+
+        case CsiIgnore:
+            if (c < 0x20)
+                m_handler->vtExecute(static_cast<char>(c));
+            else if (c >= 0x40 && c < 0x7f)
+                toGround();
+            break;
+
+        case OscString:
+            if (c == 0x07)
+            {
+                dispatchOsc();
+                toGround();
+            }
+            else if (c >= 0x20 && m_string.size() < m_maxStringSize)
+                m_string.append(static_cast<char>(c));
+            break;
+
+        case DcsEntry:
+        case DcsParam:
+            if (c < 0x20)
+                break;
+            else if (c < 0x30)
+            {
+                collect(static_cast<char>(c));
+                m_state = DcsIntermediate;
+            }
+            else if (c <= 0x3b)
+            {
+                param(static_cast<char>(c));
+                m_state = DcsParam;
+            }
+            else if (c < 0x40)
+            {
+                if (m_state == DcsEntry)
+                {
+                    m_prefix = static_cast<char>(c);
+                    m_state = DcsParam;
+                }
+                else
+                    m_state = DcsIgnore;
+            }
+            else if (c < 0x7f)
+            {
+                if (m_paramStarted || m_params.count > 0)
+                    finishParam();
+                m_dcsFinal = static_cast<char>(c);
+                m_string.clear();
+                m_state = DcsPassthrough;
+            }
+            break;
+
+        case DcsIntermediate:
+            if (c < 0x20)
+                break;
+            else if (c < 0x30)
+                collect(static_cast<char>(c));
+            else if (c < 0x40)
+                m_state = DcsIgnore;
+            else if (c < 0x7f)
+            {
+                if (m_paramStarted || m_params.count > 0)
+                    finishParam();
+                m_dcsFinal = static_cast<char>(c);
+                m_string.clear();
+                m_state = DcsPassthrough;
+            }
+            break;
+
+        case DcsPassthrough:
+            if (c != 0x7f && m_string.size() < m_maxStringSize)
+                m_string.append(static_cast<char>(c));
+            break;
+
+        case DcsIgnore:
+        case SosPmApcString:
+            //everything up to ST is dropped
+            break;
+        }
+    }
+}
+
+void PtyVtParser::clearSequence()
+{
+    m_prefix = 0;
+    m_intermediateCount = 0;
+    m_intermediateOverflow = false;
+    m_params.count = 0;
+    m_currentParam = 0;
+    m_paramStarted = false;
+    m_nextSubParam = false;
+}
+
+void PtyVtParser::collect(char c)
+{
+    if (m_intermediateCount < PTY_VT_MAX_INTERMEDIATES)
+        m_intermediates[m_intermediateCount++] = c;
+    else
+        m_intermediateOverflow = true;
+}
+
+void PtyVtParser::param(char c)
+{
+    if (c == ';' || c == ':')
+    {
+        finishParam();
+        m_nextSubParam = (c == ':');
+        return;
+    }
+
+    m_paramStarted = true;
+    m_currentParam = qMin(m_currentParam * 10 + (c - '0'), MAX_PARAM_VALUE);
+}
+
+void PtyVtParser::finishParam()
+{
+    if (m_params.count < PTY_VT_MAX_PARAMS)
+    {
+        m_params.values[m_params.count] = m_paramStarted ? m_currentParam : -1;
+        m_params.subParam[m_params.count] = m_nextSubParam;
+        m_params.count++;
+    }
+
+    m_currentParam = 0;
+    m_paramStarted = false;
+    m_nextSubParam = false;
+}
+
+void PtyVtParser::utf8(uchar c)
+{
+    if (m_utf8Pending == 0)
+    {
+        if (c >= 0xc2 && c <= 0xdf)
+        {
+            m_codepoint = c & 0x1f;
+            m_utf8Pending = 1;
+            m_utf8Min = 0x80;
+        }
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+            m_codepoint = c & 0x0f;
+            m_utf8Pending = 2;
+            m_utf8Min = 0x800;
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+            m_codepoint = c & 0x07;
+            m_utf8Pending = 3;
+            m_utf8Min = 0x10000;
+        }
+        else
+            m_handler->vtPrintCodepoint(REPLACEMENT_CHARACTER);
+        return;
+    }
+
+    m_codepoint = (m_codepoint << 6) | (c & 0x3f);
+    if (--m_utf8Pending > 0)
+        return;
+
+    //overlong forms, surrogates and out of range values are invalid
+    if (m_codepoint < m_utf8Min || m_codepoint > 0x10ffff || (m_codepoint >= 0xd800 && m_codepoint <= 0xdfff))
+        m_handler->vtPrintCodepoint(REPLACEMENT_CHARACTER);
+    else
+        m_handler->vtPrintCodepoint(m_codepoint);
+}
+
+void PtyVtParser::dispatchOsc()
+{
+    m_handler->vtOsc(m_string);
+    m_string.clear();
+}
+
+void PtyVtParser::dispatchDcs()
+{
+    if (!m_intermediateOverflow)
+        m_handler->vtDcs(m_prefix, m_params, m_intermediates, m_intermediateCount, m_dcsFinal, m_string);
+    m_string.clear();
+}
@@ -0,0 +1,121 @@
+#ifndef PTYVTPARSER_H
+#define PTYVTPARSER_H
+
+#include "iptyprocess.h"
+#include <QByteArray>
+
+#define PTY_VT_MAX_PARAMS 32
+#define PTY_VT_MAX_INTERMEDIATES 2
+
+//numeric parameters of CSI/DCS, -1 is "default" (omitted) parameter
+struct PtyVtParams
+{
+    int count;
+    int values[PTY_VT_MAX_PARAMS];
+    bool subParam[PTY_VT_MAX_PARAMS]; //value was separated by ':' from the previous one
+
+    int value(int index, int defaultValue) const
+    {
+        if (index >= count || values[index] < 0)
+            return defaultValue;
+        return values[index];
+    }
+};
+
+//events of PtyVtParser, all handlers are optional
+class PtyVtHandler
+{
+public:
+    virtual ~PtyVtHandler() { }
+
+    //run of printable ASCII (0x20..0x7e), the bulk of usual output
+    virtual void vtPrint(const char *text, int size) { Q_UNUSED(text); Q_UNUSED(size); }
+    //one decoded non-ASCII character (invalid UTF-8 gives U+FFFD)
+    virtual void vtPrintCodepoint(uint codepoint) { Q_UNUSED(codepoint); }
+    //C0 control: BEL, BS, HT, LF, CR...
+    virtual void vtExecute(char control) { Q_UNUSED(control); }
+    //prefix is private marker ('?', '>', '<', '=') or 0
+    virtual void vtCsi(char prefix, const PtyVtParams &params, const char *intermediates, int intermediateCount, char final)
+    { Q_UNUSED(prefix); Q_UNUSED(params); Q_UNUSED(intermediates); Q_UNUSED(intermediateCount); Q_UNUSED(final); }
+    virtual void vtEsc(const char *intermediates, int intermediateCount, char final)
+    { Q_UNUSED(intermediates); Q_UNUSED(intermediateCount); Q_UNUSED(final); }
+    //payload between 'ESC ]' and BEL/ST, e.g. "0;title"
+    virtual void vtOsc(const QByteArray &data) { Q_UNUSED(data); }
+    virtual void vtDcs(char prefix, const PtyVtParams &params, const char *intermediates, int intermediateCount, char final,
+                       const QByteArray &data)
+    { Q_UNUSED(prefix); Q_UNUSED(params); Q_UNUSED(intermediates); Q_UNUSED(intermediateCount); Q_UNUSED(final); Q_UNUSED(data); }
+};
+
+//streaming VT500/xterm parser (DEC ANSI state machine) with UTF-8 decoding,
+//runs of printable ASCII are found with SSE2/AVX2/NEON (scalar elsewhere) and reported in one piece;
+//attach to IPtyProcess with addStreamObserver(), or feed() it directly
+//state is kept between feeds, so sequences may be split anywhere; not thread safe
+class PtyVtParser : public IPtyStreamObserver
+{
+public:
+    explicit PtyVtParser(PtyVtHandler *handler);
+
+    void feed(const char *data, qint64 size);
+    void reset();
+    //true between sequences and characters: the stream may be cut here without losing state
+    bool isGround() const { return m_state == Ground && m_utf8Pending == 0; }
+
+    //OSC/DCS payloads longer than this are cut (default 64K)
+    void setMaxStringSize(int maxSize) { m_maxStringSize = maxSize; }
+
+    virtual void ptyOutput(const char *data, qint64 size) { feed(data, size); }
+
+    //length of the leading run of printable ASCII in 'data'
+    static qint64 scanPrintable(const char *data, qint64 size);
+
+private:
+    enum State
+    {
+        Ground,
+        Escape,
+        EscapeIntermediate,
+        CsiEntry,
+        CsiParam,
+        CsiIntermediate,
+        CsiIgnore,
+        OscString,
+        DcsEntry,
+        DcsParam,
+        DcsIntermediate,
+        DcsPassthrough,
+        DcsIgnore,
+        SosPmApcString
+    };
+
+    void clearSequence();
+    void collect(char c);
+    void param(char c);
+    void finishParam();
+    void utf8(uchar c);
+    void dispatchOsc();
+    void dispatchDcs();
+    void toGround() { m_state = Ground; }
+
+private:
+    PtyVtHandler *m_handler;
+    State m_state;
+
+    char m_prefix;
+    char m_intermediates[PTY_VT_MAX_INTERMEDIATES];
+    int m_intermediateCount;
+    bool m_intermediateOverflow;
+    PtyVtParams m_params;
+    int m_currentParam;
+    bool m_paramStarted;
+    bool m_nextSubParam;
+
+    char m_dcsFinal;
+    QByteArray m_string;
+    int m_maxStringSize;
+
+    uint m_codepoint;
+    int m_utf8Pending;
+    uint m_utf8Min;
+};
+
+#endif // PTYVTPARSER_H
@@ -0,0 +1,82 @@
+#include "ptywritequeue.h"
+
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define MAX_WRITE_IOVECS 16
+
+PtyWriteQueue::PtyWriteQueue()
+    : m_headOffset(0)
+    , m_size(0)
+{
+}
+
+void PtyWriteQueue::append(const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+
+    m_chunks.append(data);
+    m_size += data.size();
+}
+
+void PtyWriteQueue::clear()
+{
+    m_chunks.clear();
+    m_headOffset = 0;
+    m_size = 0;
+}
+
+qint64 PtyWriteQueue::writeTo(int fd)
+{
+    qint64 total = 0;
+    while (!m_chunks.isEmpty())
+    {
+        struct iovec iov[MAX_WRITE_IOVECS];
+        int count = qMin(m_chunks.size(), MAX_WRITE_IOVECS);
+        qint64 requested = 0;
+        for (int i = 0; i < count; i++)
+        {
+            int offset = (i == 0) ? m_headOffset : 0;
+            iov[i].iov_base = const_cast<char *>(m_chunks.at(i).constData()) + offset;
+            iov[i].iov_len = static_cast<size_t>(m_chunks.at(i).size() - offset);
+            requested += iov[i].iov_len;
+        }
+
+        ssize_t written = ::writev(fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return total > 0 ? total : -1;
+        }
+
+        total += written;
+        m_size -= written;
+
+        //drop fully written chunks
+        qint64 left = written;
+        while (left > 0)
+        {
+            qint64 chunkLeft = m_chunks.first().size() - m_headOffset;
+            if (left < chunkLeft)
+            {
+                m_headOffset += static_cast<int>(left);
+                break;
+            }
+
+            left -= chunkLeft;
+            m_chunks.removeFirst();
+            m_headOffset = 0;
+        }
+
+        //pty input queue is full, wait for the next writable notification
+        if (written < requested)
+            break;
+    }
+
+    return total;
+}
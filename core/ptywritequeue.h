@@ -0,0 +1,30 @@
+#ifndef PTYWRITEQUEUE_H
+#define PTYWRITEQUEUE_H
+
+#include <QByteArray>
+#include <QList>
+
+//outbound queue of a pty master fd: keeps implicitly shared chunks as they were
+//passed to write() and flushes them with writev() when the fd has room
+class PtyWriteQueue
+{
+public:
+    PtyWriteQueue();
+
+    void append(const QByteArray &data);
+    void clear();
+
+    qint64 size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    //write as much as non-blocking 'fd' accepts,
+    //returns count of written bytes or -1 on error other than EAGAIN
+    qint64 writeTo(int fd);
+
+private:
+    QList<QByteArray> m_chunks;
+    int m_headOffset; //bytes of the first chunk already written
+    qint64 m_size;
+};
+
+#endif // PTYWRITEQUEUE_H
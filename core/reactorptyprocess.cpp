@@ -0,0 +1,494 @@
+#include "reactorptyprocess.h"
+#include "ptyspawner.h"
+#include <QFileInfo>
+#include <QFile>
+#include <QThread>
+#include <QMutexLocker>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QElapsedTimer>
+
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+//per-session buffer is small: reactor is made for thousands of sessions
+#define REACTOR_READ_BUFFER_SIZE (64 * 1024)
+#define KILL_TIMEOUT_MSEC 1000
+
+void ReactorPtyNotifier::emitReadyRead()
+{
+    //one queued signal is enough for any count of reads done before consumer woke up
+    if (m_readyReadQueued.exchange(true))
+        return;
+
+    QMetaObject::invokeMethod(this, "onReadyRead", Qt::QueuedConnection);
+}
+
+void ReactorPtyNotifier::emitReadChannelFinished()
+{
+    QMetaObject::invokeMethod(this, "onReadChannelFinished", Qt::QueuedConnection);
+}
+
+void ReactorPtyNotifier::onReadyRead()
+{
+    m_readyReadQueued = false;
+    emit readyRead();
+}
+
+void ReactorPtyNotifier::onReadChannelFinished()
+{
+    emit readChannelFinished();
+}
+
+//startProcessAsync() of reactor backend: whole start is plain syscalls, so it runs on QThreadPool
+class ReactorPtyStartTask : public QRunnable
+{
+public:
+    ReactorPtyStartTask(ReactorPtyProcess *process, const QString &shellPath, const QStringList &environment,
+                        qint16 cols, qint16 rows)
+        : m_process(process)
+        , m_shellPath(shellPath)
+        , m_environment(environment)
+        , m_cols(cols)
+        , m_rows(rows)
+    {  }
+
+    void run()
+    {
+        //observers hear about the size from onAsyncStartFinished(), on the owner thread
+        bool ok = m_process->startSession(m_shellPath, m_environment, m_cols, m_rows);
+
+        //owner waits for the end of the start before it is destroyed, so it is alive here
+        QMetaObject::invokeMethod(m_process, "onAsyncStartFinished", Qt::QueuedConnection, Q_ARG(bool, ok));
+
+        QMutexLocker locker(&m_process->m_startMutex);
+        m_process->m_starting = false;
+        m_process->m_startCondition.wakeAll();
+    }
+
+private:
+    ReactorPtyProcess *m_process;
+    QString m_shellPath;
+    QStringList m_environment;
+    qint16 m_cols;
+    qint16 m_rows;
+};
+
+ReactorPtyProcess::ReactorPtyProcess(PtyReactor *reactor)
+    : IPtyProcess()
+    , m_reactor(reactor)
+    , m_sessionId(0)
+    , m_handleMaster(-1)
+    , m_closed(false)
+    , m_bytesToWrite(0)
+    , m_spawnEngine(PtySpawner::PosixSpawnEngine)
+    , m_starting(false)
+    , m_readBuffer(REACTOR_READ_BUFFER_SIZE)
+{
+    m_workingDirectory = QStandardPaths::writableLocation(QStandardPaths::HomeLocation);
+    m_notifier.open(QIODevice::ReadOnly);
+}
+
+ReactorPtyProcess::~ReactorPtyProcess()
+{
+    waitForAsyncStart();
+    kill();
+}
+
+bool ReactorPtyProcess::startProcess(const QString &shellPath, QStringList environment, qint16 cols, qint16 rows)
+{
+    if (!startSession(shellPath, environment, cols, rows))
+        return false;
+
+    notifyResized(cols, rows);
+    return true;
+}
+
+bool ReactorPtyProcess::startSession(const QString &shellPath, const QStringList &environment, qint16 cols, qint16 rows)
+{
+    if (m_sessionId != 0)
+        return false;
+
+    QElapsedTimer spawnTimer;
+    spawnTimer.start();
+
+    if (m_reactor == 0)
+        m_reactor = PtyReactor::instance();
+
+    if (!isAvailable())
+    {
+        m_lastError = QString("ReactorPty Error: reactor unavailable -> %1").arg(m_reactor->lastError());
+        return false;
+    }
+
+    QFileInfo fi(shellPath);
+    if (fi.isRelative() || !QFile::exists(shellPath))
+    {
+        m_lastError = QString("ReactorPty Error: shell file path must be absolute");
+        return false;
+    }
+
+    m_shellPath = shellPath;
+    m_size = QPair<qint16, qint16>(cols, rows);
+    m_closed = false;
+
+    int slave = -1;
+    if (!PtySpawner::openPty(&m_handleMaster, &slave, &m_handleSlaveName, &m_lastError))
+    {
+        if (slave >= 0)
+            ::close(slave);
+        kill();
+        return false;
+    }
+
+    //set size before spawn, so shell starts with the right one
+    setWindowSize(cols, rows);
+
+    Q_UNUSED(environment);
+    m_pid = PtySpawner::spawn(m_shellPath, PtySpawner::defaultEnvironment(), m_workingDirectory, slave, &m_lastError, m_spawnEngine);
+
+    //we don't keep the slave: master gets EOF/EIO as soon as the shell is gone
+    ::close(slave);
+
+    if (m_pid <= 0)
+    {
+        m_pid = 0;
+        kill();
+        return false;
+    }
+
+    PtyReactor::Callbacks callbacks;
+    callbacks.onData = [this](const char *data, qint64 size) { onData(data, size); };
+    callbacks.onWritable = [this]() { onWritable(); };
+    callbacks.onClosed = [this]() { onClosed(); };
+
+    m_sessionId = m_reactor->registerFd(m_handleMaster, callbacks);
+    if (m_sessionId == 0)
+    {
+        m_lastError = m_reactor->lastError();
+        kill();
+        return false;
+    }
+
+    if (isReadingPaused())
+        m_reactor->setReadEnabled(m_sessionId, false);
+
+    m_stats.setSpawnTime(spawnTimer.nsecsElapsed() / 1000);
+    return true;
+}
+
+void ReactorPtyProcess::startProcessAsync(const QString &shellPath, const QStringList &environment, qint16 cols, qint16 rows)
+{
+    QMutexLocker locker(&m_startMutex);
+    if (m_starting || m_sessionId != 0)
+    {
+        m_lastError = QString("ReactorPty Error: process is already running");
+        QMetaObject::invokeMethod(this, "errorOccurred", Qt::QueuedConnection, Q_ARG(QString, m_lastError));
+        return;
+    }
+    m_starting = true;
+    locker.unlock();
+
+    //don't touch the object until started() or errorOccurred()
+    QThreadPool::globalInstance()->start(new ReactorPtyStartTask(this, shellPath, environment, cols, rows));
+}
+
+void ReactorPtyProcess::onAsyncStartFinished(bool ok)
+{
+    if (ok)
+    {
+        notifyResized(m_size.first, m_size.second);
+        emit started();
+    }
+    else
+        emit errorOccurred(m_lastError);
+}
+
+void ReactorPtyProcess::waitForAsyncStart()
+{
+    QMutexLocker locker(&m_startMutex);
+    while (m_starting)
+        m_startCondition.wait(&m_startMutex);
+}
+
+bool ReactorPtyProcess::resize(qint16 cols, qint16 rows)
+{
+    bool res = setWindowSize(cols, rows);
+
+    if (res)
+    {
+        m_size = QPair<qint16, qint16>(cols, rows);
+        notifyResized(cols, rows);
+    }
+
+    return res;
+}
+
+bool ReactorPtyProcess::kill()
+{
+    //startProcess() itself calls kill() on errors, on the setup thread
+    if (QThread::currentThread() == thread())
+        waitForAsyncStart();
+
+    if (m_sessionId != 0)
+    {
+        m_reactor->unregisterFd(m_sessionId);
+        m_sessionId = 0;
+    }
+
+    m_handleSlaveName = QString();
+    QMutexLocker writeLocker(&m_writeMutex);
+    if (m_handleMaster >= 0)
+    {
+        ::close(m_handleMaster);
+        m_handleMaster = -1;
+    }
+    m_writeQueue.clear();
+    m_bytesToWrite = 0;
+    writeLocker.unlock();
+
+    if (m_pid <= 0)
+        return false;
+
+    //closed master hung the session up, the shell got SIGHUP and exits on it (SIGTERM alone
+    //is ignored by interactive shells), so this only reaps it; terminate() sleeps until the exit
+    bool finished = PtySpawner::terminate(m_pid, KILL_TIMEOUT_MSEC);
+    m_pid = 0;
+    return finished;
+}
+
+bool ReactorPtyProcess::setWindowSize(qint16 cols, qint16 rows)
+{
+    struct winsize winp;
+    winp.ws_col = cols;
+    winp.ws_row = rows;
+    winp.ws_xpixel = 0;
+    winp.ws_ypixel = 0;
+
+    return ioctl(m_handleMaster, TIOCSWINSZ, &winp) != -1;
+}
+
+void ReactorPtyProcess::setSpawnEngine(PtySpawner::Engine engine)
+{
+    m_spawnEngine = engine;
+}
+
+PtySpawner::Engine ReactorPtyProcess::spawnEngine() const
+{
+    return m_spawnEngine;
+}
+
+IPtyProcess::PtyType ReactorPtyProcess::type() const
+{
+    return IPtyProcess::ReactorPty;
+}
+
+QString ReactorPtyProcess::dumpDebugInfo()
+{
+    return QString("PID: %1, Master: %2, Session: %3, Type: %4, Cols: %5, Rows: %6, IsRunning: %7, Shell: %8, SlaveName: %9, %10")
+            .arg(m_pid).arg(m_handleMaster).arg(m_sessionId).arg(type())
+            .arg(m_size.first).arg(m_size.second).arg(m_sessionId != 0 && !m_closed)
+            .arg(m_shellPath).arg(m_handleSlaveName).arg(stats().toString());
+}
+
+QIODevice *ReactorPtyProcess::notifier()
+{
+    return &m_notifier;
+}
+
+QByteArray ReactorPtyProcess::readAll()
+{
+    QMutexLocker locker(&m_readMutex);
+    QByteArray result = m_readBuffer.readAll();
+    if (!m_readOverflow.isEmpty())
+    {
+        result.append(m_readOverflow);
+        m_readOverflow.clear();
+    }
+    bool resume = !isReadBlocked();
+    locker.unlock();
+
+    if (resume && m_sessionId != 0)
+        m_reactor->setReadEnabled(m_sessionId, true);
+
+    return result;
+}
+
+qint64 ReactorPtyProcess::write(const QByteArray &byteArray)
+{
+    QMutexLocker locker(&m_writeMutex);
+    if (m_handleMaster < 0)
+        return -1;
+
+    bool wasEmpty = m_writeQueue.isEmpty();
+    m_writeQueue.append(byteArray);
+
+    qint64 written = 0;
+    if (wasEmpty)
+        written = qMax<qint64>(m_writeQueue.writeTo(m_handleMaster), 0);
+
+    //rest is written by reactor when the pty input queue has room again
+    if (!m_writeQueue.isEmpty())
+    {
+        if (wasEmpty)
+            m_stats.add(PtyStats::WriteStalls);
+        m_reactor->setWriteEnabled(m_sessionId, true);
+    }
+    m_bytesToWrite = m_writeQueue.size();
+    m_stats.add(PtyStats::BytesWritten, byteArray.size());
+
+    //under the write lock, so observers see input in the order it was queued
+    notifyInput(byteArray.constData(), byteArray.size());
+    locker.unlock();
+
+    reportWriteProgress(written);
+    return byteArray.size();
+}
+
+qint64 ReactorPtyProcess::bytesToWrite() const
+{
+    return m_bytesToWrite;
+}
+
+bool ReactorPtyProcess::isAvailable()
+{
+    return m_reactor != 0 && m_reactor->isRunning();
+}
+
+void ReactorPtyProcess::moveToThread(QThread *targetThread)
+{
+    m_notifier.moveToThread(targetThread);
+}
+
+int ReactorPtyProcess::peek(PtySpan spans[2])
+{
+    //reactor writes only to free space of the ring, so views stay valid until consume()
+    QMutexLocker locker(&m_readMutex);
+    return m_readBuffer.peek(spans);
+}
+
+void ReactorPtyProcess::consume(qint64 size)
+{
+    QMutexLocker locker(&m_readMutex);
+    m_readBuffer.consume(size);
+    refillFromOverflow();
+    bool resume = !isReadBlocked();
+    locker.unlock();
+
+    if (resume && m_sessionId != 0)
+        m_reactor->setReadEnabled(m_sessionId, true);
+}
+
+void ReactorPtyProcess::setReadBufferLimit(qint64 bytes)
+{
+    QMutexLocker locker(&m_readMutex);
+    IPtyProcess::setReadBufferLimit(bytes);
+    bool enabled = !isReadBlocked();
+    locker.unlock();
+
+    if (m_sessionId != 0)
+        m_reactor->setReadEnabled(m_sessionId, enabled);
+}
+
+void ReactorPtyProcess::pauseReading()
+{
+    QMutexLocker locker(&m_readMutex);
+    IPtyProcess::pauseReading();
+    locker.unlock();
+
+    if (m_sessionId != 0)
+        m_reactor->setReadEnabled(m_sessionId, false);
+}
+
+void ReactorPtyProcess::resumeReading()
+{
+    QMutexLocker locker(&m_readMutex);
+    IPtyProcess::resumeReading();
+    bool resume = !isReadBlocked();
+    locker.unlock();
+
+    if (resume && m_sessionId != 0)
+        m_reactor->setReadEnabled(m_sessionId, true);
+}
+
+void ReactorPtyProcess::setDataCallback(const PtyReactor::DataCallback &callback)
+{
+    QMutexLocker locker(&m_readMutex);
+    m_dataCallback = callback;
+}
+
+void ReactorPtyProcess::onData(const char *data, qint64 size)
+{
+    //one read() of a reactor worker per call
+    m_stats.add(PtyStats::ReadCalls);
+    m_stats.add(PtyStats::BytesRead, size);
+    notifyOutput(data, size);
+
+    QMutexLocker locker(&m_readMutex);
+    if (m_dataCallback)
+    {
+        m_dataCallback(data, size);
+        return;
+    }
+
+    qint64 written = m_readBuffer.write(data, size);
+    if (written < size)
+    {
+        //keep the tail of this read and stop reading until consumer drains the buffer
+        m_readOverflow.append(data + written, static_cast<int>(size - written));
+    }
+    if (isReadBlocked())
+        m_reactor->setReadEnabled(m_sessionId, false);
+    locker.unlock();
+
+    m_notifier.emitReadyRead();
+}
+
+void ReactorPtyProcess::onWritable()
+{
+    QMutexLocker locker(&m_writeMutex);
+    qint64 written = m_writeQueue.writeTo(m_handleMaster);
+    if (written < 0)
+    {
+        //shell is gone, nobody will read the rest
+        m_writeQueue.clear();
+        written = 0;
+    }
+
+    if (m_writeQueue.isEmpty())
+        m_reactor->setWriteEnabled(m_sessionId, false);
+    m_bytesToWrite = m_writeQueue.size();
+    locker.unlock();
+
+    //write signals are emitted from the thread of this object
+    QMetaObject::invokeMethod(this, "onWriteProgress", Qt::QueuedConnection, Q_ARG(qint64, written));
+}
+
+void ReactorPtyProcess::onWriteProgress(qint64 written)
+{
+    reportWriteProgress(written);
+}
+
+void ReactorPtyProcess::onClosed()
+{
+    m_closed = true;
+    m_notifier.emitReadChannelFinished();
+}
+
+bool ReactorPtyProcess::isReadBlocked() const
+{
+    qint64 buffered = m_readBuffer.size() + m_readOverflow.size();
+    return m_readingPaused || !m_readOverflow.isEmpty()
+            || (m_readBufferLimit > 0 && buffered >= m_readBufferLimit);
+}
+
+void ReactorPtyProcess::refillFromOverflow()
+{
+    if (m_readOverflow.isEmpty())
+        return;
+
+    qint64 written = m_readBuffer.write(m_readOverflow.constData(), m_readOverflow.size());
+    m_readOverflow.remove(0, static_cast<int>(written));
+}
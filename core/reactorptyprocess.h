@@ -0,0 +1,117 @@
+#ifndef REACTORPTYPROCESS_H
+#define REACTORPTYPROCESS_H
+
+#include "iptyprocess.h"
+#include "ptyreactor.h"
+#include "ptyringbuffer.h"
+#include "ptywritequeue.h"
+#include "ptyspawner.h"
+#include <QIODevice>
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+
+//readyRead emitter for reactor sessions: reactor delivers data on worker threads,
+//signal is emitted from the thread of this object
+class ReactorPtyNotifier : public QIODevice
+{
+    friend class ReactorPtyProcess;
+    Q_OBJECT
+public:
+    ReactorPtyNotifier()
+        : m_readyReadQueued(false)
+    {  }
+
+    //just empty realization, we need only 'readyRead' signal of this class
+    qint64 readData(char *data, qint64 maxlen) { Q_UNUSED(data); Q_UNUSED(maxlen); return 0; }
+    qint64 writeData(const char *data, qint64 len) { Q_UNUSED(data); Q_UNUSED(len); return 0; }
+    bool isSequential() const { return true; }
+
+    void emitReadyRead();
+    void emitReadChannelFinished();
+
+private slots:
+    void onReadyRead();
+    void onReadChannelFinished();
+
+private:
+    std::atomic<bool> m_readyReadQueued;
+};
+
+//unix pty served by PtyReactor: no QProcess and no QSocketNotifier per session
+class ReactorPtyProcess : public IPtyProcess
+{
+    friend class ReactorPtyStartTask;
+    Q_OBJECT
+public:
+    explicit ReactorPtyProcess(PtyReactor *reactor = 0); //0 -> PtyReactor::instance()
+    virtual ~ReactorPtyProcess();
+
+    virtual bool startProcess(const QString &shellPath, QStringList environment, qint16 cols, qint16 rows);
+    virtual void startProcessAsync(const QString &shellPath, const QStringList &environment, qint16 cols, qint16 rows);
+    virtual bool resize(qint16 cols, qint16 rows);
+    virtual bool kill();
+    virtual PtyType type() const;
+    virtual QString dumpDebugInfo();
+    virtual QIODevice *notifier();
+    virtual QByteArray readAll();
+    virtual qint64 write(const QByteArray &byteArray);
+    virtual qint64 bytesToWrite() const;
+    virtual bool isAvailable();
+    virtual void moveToThread(QThread *targetThread);
+    virtual int peek(PtySpan spans[2]);
+    virtual void consume(qint64 size);
+    virtual void setReadBufferLimit(qint64 bytes);
+    virtual void pauseReading();
+    virtual void resumeReading();
+
+    //how the shell is started, PosixSpawnEngine by default
+    void setSpawnEngine(PtySpawner::Engine engine);
+    PtySpawner::Engine spawnEngine() const;
+
+    //deliver output straight from reactor worker threads, bypassing the read buffer and readyRead
+    void setDataCallback(const PtyReactor::DataCallback &callback);
+
+    //id of the session in the reactor (setSessionMaxBytesPerTurn()...), 0 if not started
+    quint64 sessionId() const { return m_sessionId; }
+
+private slots:
+    void onWriteProgress(qint64 written);
+    void onAsyncStartFinished(bool ok);
+
+private:
+    //startProcess() without notifications, safe to run off the owner thread
+    bool startSession(const QString &shellPath, const QStringList &environment, qint16 cols, qint16 rows);
+    bool setWindowSize(qint16 cols, qint16 rows); //raw TIOCSWINSZ, no observers
+    void onData(const char *data, qint64 size);
+    void onWritable();
+    void onClosed();
+    void waitForAsyncStart();
+    bool isReadBlocked() const; //under m_readMutex
+    void refillFromOverflow();
+
+private:
+    PtyReactor *m_reactor;
+    quint64 m_sessionId;
+    int m_handleMaster;
+    QString m_handleSlaveName;
+    std::atomic<bool> m_closed;
+    std::atomic<qint64> m_bytesToWrite;
+    PtySpawner::Engine m_spawnEngine;
+
+    QMutex m_startMutex;
+    QWaitCondition m_startCondition;
+    bool m_starting;
+
+    QMutex m_readMutex;
+    PtyRingBuffer m_readBuffer;
+    QByteArray m_readOverflow;
+    PtyReactor::DataCallback m_dataCallback;
+
+    QMutex m_writeMutex;
+    PtyWriteQueue m_writeQueue;
+
+    ReactorPtyNotifier m_notifier;
+};
+
+#endif // REACTORPTYPROCESS_H
@@ -5,27 +5,55 @@
 #include <QDir>
 #endif // QT_VERSION >= 5.0.0
 
-#include <termios.h>
 #include <errno.h>
 #if !defined(Q_OS_ANDROID) && !defined(Q_OS_FREEBSD)
 #include <utmpx.h>
 #endif
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <QFileInfo>
 #include <QCoreApplication>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QWaitCondition>
+
+#define MIN_READ_CHUNK_SIZE 4096
+#define MAX_READ_CHUNK_SIZE (64 * 1024) //usual size of kernel pty buffer
+#define DEFAULT_MAX_BYTES_PER_WAKEUP (256 * 1024)
+#define KILL_TIMEOUT_MSEC 1000
+#define REAP_INTERVAL_MSEC 100
 
 UnixPtyProcess::UnixPtyProcess()
     : IPtyProcess()
     , m_readMasterNotify(0)
+    , m_writeMasterNotify(0)
+    , m_coalesceTimer(0)
+    , m_readChunkSize(MIN_READ_CHUNK_SIZE)
+    , m_maxBytesPerWakeup(DEFAULT_MAX_BYTES_PER_WAKEUP)
+    , m_readEof(false)
+    , m_pendingOutput(0)
+    , m_echoPending(false)
+    , m_spawnEngine(PtySpawner::QProcessEngine)
+    , m_childExited(false)
+    , m_asyncShellStart(false)
+    , m_writeTime(0)
+    , m_readyTime(0)
+    , m_emitTime(0)
 {
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
-    m_shellProcess.setWorkingDirectory(QStandardPaths::writableLocation(QStandardPaths::HomeLocation));
+    setWorkingDirectory(QStandardPaths::writableLocation(QStandardPaths::HomeLocation));
 #else
-    m_shellProcess.setWorkingDirectory(QDir::homePath());
+    setWorkingDirectory(QDir::homePath());
 #endif // QT_VERSION >= 5.0.0
+
+    QObject::connect(&m_shellProcess, SIGNAL(started()), this, SLOT(onShellStarted()));
+    QObject::connect(&m_shellProcess, SIGNAL(error(QProcess::ProcessError)), this, SLOT(onShellError(QProcess::ProcessError)));
 }
 
 UnixPtyProcess::~UnixPtyProcess()
@@ -33,218 +61,529 @@ UnixPtyProcess::~UnixPtyProcess()
     kill();
 }
 
-bool UnixPtyProcess::startProcess(const QString &shellPath, QStringList environment, qint16 cols, qint16 rows)
+//pty setup and spawn of startProcessAsync(), done on QThreadPool
+struct UnixPtyStartJob
 {
-    if (!isAvailable())
+    UnixPtyStartJob()
+        : cols(0), rows(0), engine(PtySpawner::QProcessEngine)
+        , master(-1), slave(-1), pid(0), ok(false), done(false)
+    {  }
+
+    void run()
     {
-        m_lastError = QString("UnixPty Error: unavailable");
-        return false;
+        ok = PtySpawner::openPty(&master, &slave, &slaveName, &error);
+        if (ok)
+        {
+            //set size before spawn, so shell starts with the right one
+            struct winsize winp;
+            winp.ws_col = cols;
+            winp.ws_row = rows;
+            winp.ws_xpixel = 0;
+            winp.ws_ypixel = 0;
+            ioctl(master, TIOCSWINSZ, &winp);
+        }
+
+        //QProcess lives in the thread of its owner, it is started there
+        if (ok && engine != PtySpawner::QProcessEngine)
+        {
+            pid = PtySpawner::spawn(shellPath, environment, workingDirectory, slave, &error, engine);
+            ::close(slave);
+            slave = -1;
+            ok = (pid > 0);
+        }
     }
 
-    if (m_shellProcess.state() == QProcess::Running)
-        return false;
+    void wait()
+    {
+        QMutexLocker locker(&mutex);
+        while (!done)
+            condition.wait(&mutex);
+    }
 
-    QFileInfo fi(shellPath);
-    if (fi.isRelative() || !QFile::exists(shellPath))
+    //release what the owner didn't take
+    void discard()
     {
-        //todo add auto-find executable in PATH env var
-        m_lastError = QString("UnixPty Error: shell file path must be absolute");
-        return false;
+        if (slave >= 0)
+            ::close(slave);
+        if (master >= 0)
+            ::close(master);
+        if (pid > 0)
+            PtySpawner::terminate(pid, KILL_TIMEOUT_MSEC);
+        slave = master = -1;
+        pid = 0;
     }
 
-    m_shellPath = shellPath;
-    m_size = QPair<qint16, qint16>(cols, rows);
+    QString shellPath;
+    QStringList environment;
+    QString workingDirectory;
+    qint16 cols;
+    qint16 rows;
+    PtySpawner::Engine engine;
+
+    int master;
+    int slave;
+    QString slaveName;
+    qint64 pid;
+    QString error;
+    bool ok;
+
+    QMutex mutex;
+    QWaitCondition condition;
+    bool done;
+};
+
+class UnixPtyStartTask : public QRunnable
+{
+public:
+    UnixPtyStartTask(UnixPtyProcess *process, const QSharedPointer<UnixPtyStartJob> &job)
+        : m_process(process)
+        , m_job(job)
+    {  }
+
+    void run()
+    {
+        m_job->run();
+
+        //owner waits for 'done' before it is destroyed, so it is alive here
+        QMetaObject::invokeMethod(m_process, "onStartJobFinished", Qt::QueuedConnection);
 
-    int rc = 0;
+        QMutexLocker locker(&m_job->mutex);
+        m_job->done = true;
+        m_job->condition.wakeAll();
+    }
+
+private:
+    UnixPtyProcess *m_process;
+    QSharedPointer<UnixPtyStartJob> m_job;
+};
 
-    m_shellProcess.m_handleMaster = ::posix_openpt(O_RDWR | O_NOCTTY);
-    if (m_shellProcess.m_handleMaster <= 0)
+bool UnixPtyProcess::startProcess(const QString &shellPath, QStringList environment, qint16 cols, qint16 rows)
+{
+    m_spawnTimer.start();
+    if (!prepareStart(shellPath, cols, rows))
+        return false;
+
+    if (!PtySpawner::openPty(&m_shellProcess.m_handleMaster, &m_shellProcess.m_handleSlave,
+                             &m_shellProcess.m_handleSlaveName, &m_lastError))
     {
-        m_lastError = QString("UnixPty Error: unable to open master -> %1").arg(strerror(errno));
         kill();
         return false;
     }
 
-    m_shellProcess.m_handleSlaveName = ptsname(m_shellProcess.m_handleMaster);
-    if ( m_shellProcess.m_handleSlaveName.isEmpty())
+    setupNotifiers();
+
+    QStringList defaultVars = PtySpawner::defaultEnvironment();
+
+    Q_UNUSED(environment);
+    if (m_spawnEngine != PtySpawner::QProcessEngine)
     {
-        m_lastError = QString("UnixPty Error: unable to get slave name -> %1").arg(strerror(errno));
-        kill();
-        return false;
+        //set size before spawn, so shell starts with the right one
+        resize(cols, rows);
+
+        m_pid = PtySpawner::spawn(m_shellPath, defaultVars, m_workingDirectory,
+                                  m_shellProcess.m_handleSlave, &m_lastError, m_spawnEngine);
+
+        //without our copy of the slave the master gets EOF/EIO as soon as the shell is gone
+        ::close(m_shellProcess.m_handleSlave);
+        m_shellProcess.m_handleSlave = -1;
+
+        if (m_pid <= 0)
+        {
+            m_pid = 0;
+            kill();
+            return false;
+        }
+
+        spawnFinished();
+        return true;
     }
 
-    rc = grantpt(m_shellProcess.m_handleMaster);
-    if (rc != 0)
+    startShellProcess(defaultVars);
+    m_shellProcess.waitForStarted();
+
+    #if (QT_VERSION >= QT_VERSION_CHECK(5, 3, 0))
+    m_pid = m_shellProcess.processId();
+#else
+    m_pid = m_shellProcess.pid();
+#endif // QT_VERSION >= 5.3.0
+
+    resize(cols, rows);
+
+    spawnFinished();
+    return true;
+}
+
+void UnixPtyProcess::startProcessAsync(const QString &shellPath, const QStringList &environment, qint16 cols, qint16 rows)
+{
+    m_spawnTimer.start();
+    if (!prepareStart(shellPath, cols, rows))
     {
-        m_lastError = QString("UnixPty Error: unable to change perms for slave -> %1").arg(strerror(errno));
-        kill();
-        return false;
+        QMetaObject::invokeMethod(this, "errorOccurred", Qt::QueuedConnection, Q_ARG(QString, m_lastError));
+        return;
     }
 
-    rc = unlockpt(m_shellProcess.m_handleMaster);
-    if (rc != 0)
+    Q_UNUSED(environment);
+    m_startJob = QSharedPointer<UnixPtyStartJob>(new UnixPtyStartJob());
+    m_startJob->shellPath = m_shellPath;
+    m_startJob->environment = PtySpawner::defaultEnvironment();
+    m_startJob->workingDirectory = m_workingDirectory;
+    m_startJob->cols = cols;
+    m_startJob->rows = rows;
+    m_startJob->engine = m_spawnEngine;
+
+    QThreadPool::globalInstance()->start(new UnixPtyStartTask(this, m_startJob));
+}
+
+void UnixPtyProcess::onStartJobFinished()
+{
+    //killed while starting: kill() has released everything
+    QSharedPointer<UnixPtyStartJob> job = m_startJob;
+    if (!job)
+        return;
+
+    job->wait();
+    m_startJob.clear();
+
+    if (!job->ok)
     {
-        m_lastError = QString("UnixPty Error: unable to unlock slave -> %1").arg(strerror(errno));
-        kill();
-        return false;
+        m_lastError = job->error;
+        job->discard();
+        emit errorOccurred(m_lastError);
+        return;
     }
 
-    m_shellProcess.m_handleSlave = ::open(m_shellProcess.m_handleSlaveName.toLatin1().data(), O_RDWR | O_NOCTTY);
-    if (m_shellProcess.m_handleSlave < 0)
+    m_shellProcess.m_handleMaster = job->master;
+    m_shellProcess.m_handleSlave = job->slave;
+    m_shellProcess.m_handleSlaveName = job->slaveName;
+    m_pid = job->pid;
+    job->master = job->slave = -1;
+    job->pid = 0;
+
+    setupNotifiers();
+
+    if (m_spawnEngine != PtySpawner::QProcessEngine)
     {
-        m_lastError = QString("UnixPty Error: unable to open slave -> %1").arg(strerror(errno));
-        kill();
-        return false;
+        spawnFinished();
+        emit started();
+        return;
     }
 
-    rc = fcntl(m_shellProcess.m_handleMaster, F_SETFD, FD_CLOEXEC);
-    if (rc == -1)
+    //QProcess forks here, but we don't wait for it
+    m_asyncShellStart = true;
+    startShellProcess(job->environment);
+}
+
+void UnixPtyProcess::onShellStarted()
+{
+    if (!m_asyncShellStart)
+        return;
+
+    m_asyncShellStart = false;
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 3, 0))
+    m_pid = m_shellProcess.processId();
+#else
+    m_pid = m_shellProcess.pid();
+#endif // QT_VERSION >= 5.3.0
+    spawnFinished();
+    emit started();
+}
+
+void UnixPtyProcess::onShellError(QProcess::ProcessError error)
+{
+    if (!m_asyncShellStart || error != QProcess::FailedToStart)
+        return;
+
+    m_asyncShellStart = false;
+    m_lastError = QString("UnixPty Error: unable to start shell -> %1").arg(m_shellProcess.errorString());
+    kill();
+    emit errorOccurred(m_lastError);
+}
+
+bool UnixPtyProcess::prepareStart(const QString &shellPath, qint16 cols, qint16 rows)
+{
+    if (!isAvailable())
     {
-        m_lastError = QString("UnixPty Error: unable to set flags for master -> %1").arg(strerror(errno));
-        kill();
+        m_lastError = QString("UnixPty Error: unavailable");
         return false;
     }
 
-    rc = fcntl(m_shellProcess.m_handleSlave, F_SETFD, FD_CLOEXEC);
-    if (rc == -1)
+    if (isRunning() || m_startJob || m_asyncShellStart)
     {
-        m_lastError = QString("UnixPty Error: unable to set flags for slave -> %1").arg(strerror(errno));
-        kill();
+        m_lastError = QString("UnixPty Error: process is already running");
         return false;
     }
 
-    struct ::termios ttmode;
-    rc = tcgetattr(m_shellProcess.m_handleMaster, &ttmode);
-    if (rc != 0)
+    QFileInfo fi(shellPath);
+    if (fi.isRelative() || !QFile::exists(shellPath))
     {
-        m_lastError = QString("UnixPty Error: termios fail -> %1").arg(strerror(errno));
-        kill();
+        //todo add auto-find executable in PATH env var
+        m_lastError = QString("UnixPty Error: shell file path must be absolute");
         return false;
     }
 
-    ttmode.c_iflag = ICRNL | IXON | IXANY | IMAXBEL | BRKINT;
-#if defined(IUTF8)
-    ttmode.c_iflag |= IUTF8;
-#endif
-
-    ttmode.c_oflag = OPOST | ONLCR;
-    ttmode.c_cflag = CREAD | CS8 | HUPCL;
-    ttmode.c_lflag = ICANON | ISIG | IEXTEN | ECHO | ECHOE | ECHOK | ECHOKE | ECHOCTL;
-
-    ttmode.c_cc[VEOF] = 4;
-    ttmode.c_cc[VEOL] = -1;
-    ttmode.c_cc[VEOL2] = -1;
-    ttmode.c_cc[VERASE] = 0x7f;
-    ttmode.c_cc[VWERASE] = 23;
-    ttmode.c_cc[VKILL] = 21;
-    ttmode.c_cc[VREPRINT] = 18;
-    ttmode.c_cc[VINTR] = 3;
-    ttmode.c_cc[VQUIT] = 0x1c;
-    ttmode.c_cc[VSUSP] = 26;
-    ttmode.c_cc[VSTART] = 17;
-    ttmode.c_cc[VSTOP] = 19;
-    ttmode.c_cc[VLNEXT] = 22;
-    ttmode.c_cc[VDISCARD] = 15;
-    ttmode.c_cc[VMIN] = 1;
-    ttmode.c_cc[VTIME] = 0;
-
-#if (__APPLE__)
-    ttmode.c_cc[VDSUSP] = 25;
-    ttmode.c_cc[VSTATUS] = 20;
-#endif
+    m_shellPath = shellPath;
+    m_size = QPair<qint16, qint16>(cols, rows);
+    m_readChunkSize = MIN_READ_CHUNK_SIZE;
+    m_readEof = false;
+    m_pendingOutput = 0;
+    m_echoPending = false;
+    m_childExited = false;
+    m_writeTime = m_readyTime = m_emitTime = 0;
+    return true;
+}
 
-    cfsetispeed(&ttmode, B38400);
-    cfsetospeed(&ttmode, B38400);
+void UnixPtyProcess::setupNotifiers()
+{
+    m_readMasterNotify = new QSocketNotifier(m_shellProcess.m_handleMaster, QSocketNotifier::Read, &m_shellProcess);
+    m_readMasterNotify->setEnabled(!m_readingPaused);
+    m_readMasterNotify->moveToThread(m_shellProcess.thread());
+    //direct connection: read on the thread of the shell process, even if 'this' lives in another one
+    QObject::connect(m_readMasterNotify, SIGNAL(activated(int)), this, SLOT(onSocketActivated(int)), Qt::DirectConnection);
+
+    m_writeMasterNotify = new QSocketNotifier(m_shellProcess.m_handleMaster, QSocketNotifier::Write, &m_shellProcess);
+    m_writeMasterNotify->setEnabled(false);
+    m_writeMasterNotify->moveToThread(m_shellProcess.thread());
+    QObject::connect(m_writeMasterNotify, SIGNAL(activated(int)), this, SLOT(onWriteActivated(int)), Qt::DirectConnection);
+
+    m_coalesceTimer = new QTimer(&m_shellProcess);
+    m_coalesceTimer->setSingleShot(true);
+    m_coalesceTimer->setTimerType(Qt::PreciseTimer);
+    QObject::connect(m_coalesceTimer, SIGNAL(timeout()), this, SLOT(flushOutput()), Qt::DirectConnection);
+}
 
-    rc = tcsetattr(m_shellProcess.m_handleMaster, TCSANOW, &ttmode);
-    if (rc != 0)
+void UnixPtyProcess::startShellProcess(const QStringList &environment)
+{
+    QProcessEnvironment envFormat;
+    foreach (QString line, environment)
     {
-        m_lastError = QString("UnixPty Error: unabble to set associated params -> %1").arg(strerror(errno));
-        kill();
-        return false;
+        envFormat.insert(line.split("=").first(), line.split("=").last());
     }
+    m_shellProcess.setProcessEnvironment(envFormat);
+    m_shellProcess.setReadChannel(QProcess::StandardOutput);
+    m_shellProcess.start(m_shellPath, QStringList());
+}
 
-    m_readMasterNotify = new QSocketNotifier(m_shellProcess.m_handleMaster, QSocketNotifier::Read, &m_shellProcess);
-    m_readMasterNotify->setEnabled(true);
-    m_readMasterNotify->moveToThread(m_shellProcess.thread());
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 0, 0))
-    QObject::connect(m_readMasterNotify, &QSocketNotifier::activated, [this](int socket)
+void UnixPtyProcess::onSocketActivated(int socket)
+{
+    Q_UNUSED(socket)
+
+    m_stats.add(PtyStats::Wakeups);
+    if (PtyLatency::isEnabled() && m_readyTime == 0)
+        m_readyTime = PtyLatency::now();
+    readFromMaster();
+}
+
+void UnixPtyProcess::readFromMaster()
+{
+    qint64 traceStart = isTracing() ? PtyTracer::now() : 0;
+
+    //master fd is non-blocking: drain it until EAGAIN, straight into free space of the ring,
+    //growing read size while the kernel keeps filling our requests,
+    //but never take more than m_maxBytesPerWakeup in one go, so heavy-output shells can't
+    //starve the event loop (level-triggered notifier fires again for the rest)
+    qint64 total = 0;
+    while (total < m_maxBytesPerWakeup)
     {
-        Q_UNUSED(socket)
+        qint64 room = readRoom();
+        if (room <= 0)
+            break;
+
+        PtyWritableSpan spans[2];
+        int count = m_shellReadBuffer.reserve(spans);
+        if (count == 0)
+            break;
+
+        qint64 wanted = qMin(qMin(m_readChunkSize, m_maxBytesPerWakeup - total), room);
+        struct iovec iov[2];
+        int iovCount = 0;
+        qint64 left = wanted;
+        for (int i = 0; i < count && left > 0; i++)
+        {
+            qint64 chunk = qMin(spans[i].size, left);
+            iov[i].iov_base = spans[i].data;
+            iov[i].iov_len = static_cast<size_t>(chunk);
+            left -= chunk;
+            iovCount++;
+        }
+        wanted -= left;
 
-        QByteArray buffer;
-        int size = 1025;
-        int readSize = 1024;
-        QByteArray data;
-        do
+        ssize_t len = ::readv(m_shellProcess.m_handleMaster, iov, iovCount);
+        m_stats.add(PtyStats::ReadCalls);
+        if (len < 0)
         {
-            char nativeBuffer[size];
-            int len = ::read(m_shellProcess.m_handleMaster, nativeBuffer, readSize);
-            data = QByteArray(nativeBuffer, len);
-            buffer.append(data);
-        } while (data.size() == readSize); //last data block always < readSize
-
-        m_shellReadBuffer.append(buffer);
-        m_shellProcess.emitReadyRead();
-    });
-#else
-    QObject::connect(m_readMasterNotify, SIGNAL(activated(int)), this, SLOT(onSocketActivated(int)));
-#endif
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            //EIO: all slave handles are closed, nothing more to read
+            m_readEof = true;
+            break;
+        }
+        if (len == 0)
+        {
+            m_readEof = true;
+            break;
+        }
 
-    QStringList defaultVars;
+        //observers see the data in place, before consumers can take it
+        qint64 rest = len;
+        for (int i = 0; i < iovCount && rest > 0; i++)
+        {
+            qint64 chunk = qMin<qint64>(static_cast<qint64>(iov[i].iov_len), rest);
+            notifyOutput(static_cast<const char *>(iov[i].iov_base), chunk);
+            rest -= chunk;
+        }
 
-    defaultVars.append("TERM=xterm-256color");
-    defaultVars.append("ITERM_PROFILE=Default");
-    defaultVars.append("XPC_FLAGS=0x0");
-    defaultVars.append("XPC_SERVICE_NAME=0");
-    defaultVars.append("LANG=en_US.UTF-8");
-    defaultVars.append("LC_ALL=en_US.UTF-8");
-    defaultVars.append("LC_CTYPE=UTF-8");
-    defaultVars.append("COMMAND_MODE=unix2003");
-    defaultVars.append("COLORTERM=truecolor");
+        m_shellReadBuffer.commit(len);
+        total += len;
 
-    Q_UNUSED(environment);
-    QProcessEnvironment envFormat;
-    foreach (QString line, defaultVars)
+        if (len == wanted)
+            m_readChunkSize = qMin<qint64>(m_readChunkSize * 2, MAX_READ_CHUNK_SIZE);
+        else if (len < wanted / 4)
+            m_readChunkSize = qMax<qint64>(m_readChunkSize / 2, MIN_READ_CHUNK_SIZE);
+    }
+
+    if (traceStart != 0)
+        PtyTracer::complete("read", traceStart, m_pid, "bytes", total);
+
+    //consumer is too slow: leave the rest in the kernel until it drains our buffer,
+    //on EOF level-triggered notifier would fire forever
+    if (readRoom() <= 0 || m_readEof)
+        m_readMasterNotify->setEnabled(false);
+
+    if (total > 0)
     {
-        envFormat.insert(line.split("=").first(), line.split("=").last());
+        m_stats.add(PtyStats::BytesRead, total);
+        if (m_writeTime != 0)
+        {
+            PtyLatency::record(PtyLatency::WriteToOutput, PtyLatency::now() - m_writeTime);
+            m_writeTime = 0;
+        }
+        scheduleReadyRead(total);
     }
-    m_shellProcess.setProcessEnvironment(envFormat);
-    m_shellProcess.setReadChannel(QProcess::StandardOutput);
-    m_shellProcess.start(m_shellPath, QStringList());
-    m_shellProcess.waitForStarted();
+    else if (m_pendingOutput == 0)
+        m_readyTime = 0; //spurious wakeup, nothing waits for readyRead
 
-    #if (QT_VERSION >= QT_VERSION_CHECK(5, 3, 0))
-    m_pid = m_shellProcess.processId();
-#else
-    m_pid = m_shellProcess.pid();
-#endif // QT_VERSION >= 5.3.0
+    //QProcess reports the exit of its child by itself
+    if (m_readEof && m_spawnEngine != PtySpawner::QProcessEngine)
+        reapChild();
+}
 
-    resize(cols, rows);
+void UnixPtyProcess::reapChild()
+{
+    if (m_pid <= 0 || m_childExited)
+        return;
 
-    return true;
+    int status = 0;
+    pid_t pid = waitpid(static_cast<pid_t>(m_pid), &status, WNOHANG);
+    if (pid == 0)
+    {
+        //shell closed the pty but is still running
+        QTimer::singleShot(REAP_INTERVAL_MSEC, this, SLOT(reapChild()));
+        return;
+    }
+
+    m_childExited = true;
+    if (pid < 0)
+        return;
+
+    if (WIFEXITED(status))
+        m_shellProcess.emitFinished(WEXITSTATUS(status), QProcess::NormalExit);
+    else
+        m_shellProcess.emitFinished(-1, QProcess::CrashExit);
 }
 
-#if (QT_VERSION < QT_VERSION_CHECK(5, 0, 0))
-void UnixPtyProcess::onSocketActivated(int socket)
+void UnixPtyProcess::scheduleReadyRead(qint64 newBytes)
 {
-    Q_UNUSED(socket)
+    m_pendingOutput += newBytes;
 
-    QByteArray buffer;
-    int readSize = 1024;
-    QByteArray data;
-    do
+    //flush right away: no coalescing, answer to user input (interactive echo),
+    //enough data collected or no more room to collect it
+    if (!isOutputCoalescing() || m_echoPending
+            || (m_coalesceBytes > 0 && m_pendingOutput >= m_coalesceBytes)
+            || readRoom() <= 0 || m_readEof)
     {
-        char nativeBuffer[1025];
-        int len = ::read(m_shellProcess.m_handleMaster, nativeBuffer, readSize);
-        data = QByteArray(nativeBuffer, len);
-        buffer.append(data);
-    } while (data.size() == readSize); //last data block always < readSize
+        flushOutput();
+        return;
+    }
 
-    m_shellReadBuffer.append(buffer);
+    //QTimer has millisecond resolution, so delay is rounded up,
+    //zero delay collects reads of one event loop iteration
+    if (!m_coalesceTimer->isActive())
+        m_coalesceTimer->start((m_coalesceDelayUsec + 999) / 1000);
+}
+
+void UnixPtyProcess::flushOutput()
+{
+    if (m_coalesceTimer)
+        m_coalesceTimer->stop();
+    m_echoPending = false;
+
+    if (m_pendingOutput == 0)
+        return;
+
+    m_pendingOutput = 0;
+    m_stats.addReadyRead(m_shellReadBuffer.size());
+    if (m_readyTime != 0)
+    {
+        qint64 now = PtyLatency::now();
+        PtyLatency::record(PtyLatency::ReadyToEmit, now - m_readyTime);
+        m_readyTime = 0;
+        if (m_emitTime == 0)
+            m_emitTime = now;
+    }
+    if (isTracing())
+        PtyTracer::instant("readyRead", m_pid, "buffered", m_shellReadBuffer.size());
     m_shellProcess.emitReadyRead();
 }
-#endif // QT_VERSION < 5.0.0
+
+void UnixPtyProcess::setOutputCoalescing(qint64 maxBytes, int maxDelayUsec)
+{
+    IPtyProcess::setOutputCoalescing(maxBytes, maxDelayUsec);
+
+    //don't hold data collected with previous settings
+    if (!isOutputCoalescing())
+        flushOutput();
+}
+
+void UnixPtyProcess::resumeAfterDrain()
+{
+    if (m_readMasterNotify && !m_readMasterNotify->isEnabled() && !m_readingPaused && readRoom() > 0 && !m_readEof)
+        m_readMasterNotify->setEnabled(true);
+}
+
+qint64 UnixPtyProcess::readRoom() const
+{
+    qint64 room = m_shellReadBuffer.freeSpace();
+    if (m_readBufferLimit > 0)
+        room = qMin(room, m_readBufferLimit - m_shellReadBuffer.size());
+    return room;
+}
+
+void UnixPtyProcess::setReadBufferLimit(qint64 bytes)
+{
+    IPtyProcess::setReadBufferLimit(bytes);
+
+    if (m_readMasterNotify && readRoom() <= 0)
+        m_readMasterNotify->setEnabled(false);
+    resumeAfterDrain();
+}
+
+void UnixPtyProcess::pauseReading()
+{
+    IPtyProcess::pauseReading();
+
+    //kernel keeps the output, child blocks on write when the pty buffer is full
+    if (m_readMasterNotify)
+        m_readMasterNotify->setEnabled(false);
+}
+
+void UnixPtyProcess::resumeReading()
+{
+    IPtyProcess::resumeReading();
+    resumeAfterDrain();
+}
 
 bool UnixPtyProcess::resize(qint16 cols, qint16 rows)
 {
@@ -254,11 +593,16 @@ bool UnixPtyProcess::resize(qint16 cols, qint16 rows)
     winp.ws_xpixel = 0;
     winp.ws_ypixel = 0;
 
-    bool res =  ( (ioctl(m_shellProcess.m_handleMaster, TIOCSWINSZ, &winp) != -1) && (ioctl(m_shellProcess.m_handleSlave, TIOCSWINSZ, &winp) != -1) );
+    //slave is kept only by QProcess engine
+    bool res =  ( (ioctl(m_shellProcess.m_handleMaster, TIOCSWINSZ, &winp) != -1)
+                  && (m_shellProcess.m_handleSlave < 0 || ioctl(m_shellProcess.m_handleSlave, TIOCSWINSZ, &winp) != -1) );
 
     if (res)
     {
         m_size = QPair<qint16, qint16>(cols, rows);
+        notifyResized(cols, rows);
+        if (isTracing())
+            PtyTracer::instant("resize", m_pid, "cols", cols, "rows", rows);
     }
 
     return res;
@@ -266,6 +610,27 @@ bool UnixPtyProcess::resize(qint16 cols, qint16 rows)
 
 bool UnixPtyProcess::kill()
 {
+    if (!isTracing())
+        return killProcess();
+
+    qint64 pid = m_pid;
+    qint64 traceStart = PtyTracer::now();
+    bool res = killProcess();
+    PtyTracer::complete("kill", traceStart, pid);
+    return res;
+}
+
+bool UnixPtyProcess::killProcess()
+{
+    if (m_startJob)
+    {
+        //setup thread may still use the job, wait for it (openpt + spawn, short)
+        m_startJob->wait();
+        m_startJob->discard();
+        m_startJob.clear();
+    }
+    m_asyncShellStart = false;
+
     m_shellProcess.m_handleSlaveName = QString();
     if (m_shellProcess.m_handleSlave >= 0)
     {
@@ -278,24 +643,85 @@ bool UnixPtyProcess::kill()
         m_shellProcess.m_handleMaster = -1;
     }
 
+    if (!isRunning())
+    {
+        releaseNotifiers();
+        return false;
+    }
+
+    releaseNotifiers();
+
+    if (m_spawnEngine != PtySpawner::QProcessEngine)
+    {
+        //shell got SIGHUP when we closed the master
+        bool finished = PtySpawner::terminate(m_pid, KILL_TIMEOUT_MSEC);
+        m_childExited = true;
+        m_pid = 0;
+        return finished;
+    }
+
+    m_shellProcess.terminate();
+    m_shellProcess.waitForFinished(KILL_TIMEOUT_MSEC);
+
     if (m_shellProcess.state() == QProcess::Running)
     {
+        QProcess::startDetached( QString("kill -9 %1").arg( pid() ) );
+        m_shellProcess.kill();
+        m_shellProcess.waitForFinished(KILL_TIMEOUT_MSEC);
+    }
+
+    return (m_shellProcess.state() == QProcess::NotRunning);
+}
+
+void UnixPtyProcess::releaseNotifiers()
+{
+    if (m_readMasterNotify)
+    {
+        m_readMasterNotify->setEnabled(false);
         m_readMasterNotify->disconnect();
         m_readMasterNotify->deleteLater();
+        m_readMasterNotify = 0;
+    }
 
-        m_shellProcess.terminate();
-        m_shellProcess.waitForFinished(1000);
-
-        if (m_shellProcess.state() == QProcess::Running)
-        {
-            QProcess::startDetached( QString("kill -9 %1").arg( pid() ) );
-            m_shellProcess.kill();
-            m_shellProcess.waitForFinished(1000);
-        }
+    if (m_writeMasterNotify)
+    {
+        m_writeMasterNotify->setEnabled(false);
+        m_writeMasterNotify->disconnect();
+        m_writeMasterNotify->deleteLater();
+        m_writeMasterNotify = 0;
+    }
+    m_writeQueue.clear();
 
-        return (m_shellProcess.state() == QProcess::NotRunning);
+    if (m_coalesceTimer)
+    {
+        m_coalesceTimer->stop();
+        m_coalesceTimer->deleteLater();
+        m_coalesceTimer = 0;
     }
-    return false;
+}
+
+bool UnixPtyProcess::isRunning() const
+{
+    if (m_spawnEngine == PtySpawner::QProcessEngine)
+        return m_shellProcess.state() == QProcess::Running;
+
+    return m_pid > 0 && !m_childExited;
+}
+
+void UnixPtyProcess::setWorkingDirectory(const QString &workingDirectory)
+{
+    IPtyProcess::setWorkingDirectory(workingDirectory);
+    m_shellProcess.setWorkingDirectory(workingDirectory);
+}
+
+void UnixPtyProcess::setSpawnEngine(PtySpawner::Engine engine)
+{
+    m_spawnEngine = engine;
+}
+
+PtySpawner::Engine UnixPtyProcess::spawnEngine() const
+{
+    return m_spawnEngine;
 }
 
 IPtyProcess::PtyType UnixPtyProcess::type() const
@@ -305,14 +731,10 @@ IPtyProcess::PtyType UnixPtyProcess::type() const
 
 QString UnixPtyProcess::dumpDebugInfo()
 {
-#ifdef PTYQT_DEBUG
-    return QString("PID: %1, In: %2, Out: %3, Type: %4, Cols: %5, Rows: %6, IsRunning: %7, Shell: %8, SlaveName: %9")
+    return QString("PID: %1, In: %2, Out: %3, Type: %4, Cols: %5, Rows: %6, IsRunning: %7, Shell: %8, SlaveName: %9, %10")
             .arg(m_pid).arg(m_shellProcess.m_handleMaster).arg(m_shellProcess.m_handleSlave).arg(type())
-            .arg(m_size.first).arg(m_size.second).arg(m_shellProcess.state() == QProcess::Running)
-            .arg(m_shellPath).arg(m_shellProcess.m_handleSlaveName);
-#else
-    return QString("Nothing...");
-#endif
+            .arg(m_size.first).arg(m_size.second).arg(isRunning())
+            .arg(m_shellPath).arg(m_shellProcess.m_handleSlaveName).arg(stats().toString());
 }
 
 QIODevice *UnixPtyProcess::notifier()
@@ -322,19 +744,119 @@ QIODevice *UnixPtyProcess::notifier()
 
 QByteArray UnixPtyProcess::readAll()
 {
-    QByteArray tmpBuffer =  m_shellReadBuffer;
-    m_shellReadBuffer.clear();
+    recordEmitToRead();
+    QByteArray tmpBuffer = m_shellReadBuffer.readAll();
+    resumeAfterDrain();
     return tmpBuffer;
 }
 
+int UnixPtyProcess::peek(PtySpan spans[2])
+{
+    return m_shellReadBuffer.peek(spans);
+}
+
+void UnixPtyProcess::consume(qint64 size)
+{
+    recordEmitToRead();
+    m_shellReadBuffer.consume(size);
+    resumeAfterDrain();
+}
+
 qint64 UnixPtyProcess::write(const QByteArray &byteArray)
 {
-    int result = ::write(m_shellProcess.m_handleMaster, byteArray.constData(), byteArray.size());
-    Q_UNUSED(result)
+    if (m_shellProcess.m_handleMaster < 0 || !m_writeMasterNotify)
+        return -1;
 
+    qint64 traceStart = isTracing() ? PtyTracer::now() : 0;
+
+    //next output is most likely echo of this input, deliver it without delay
+    m_echoPending = true;
+    if (PtyLatency::isEnabled() && m_writeTime == 0)
+        m_writeTime = PtyLatency::now();
+
+    //keep the order: while anything is queued, new data goes behind it
+    bool wasEmpty = m_writeQueue.isEmpty();
+    m_writeQueue.append(byteArray);
+
+    qint64 written = 0;
+    if (wasEmpty)
+    {
+        written = m_writeQueue.writeTo(m_shellProcess.m_handleMaster);
+        if (written < 0)
+        {
+            m_writeQueue.clear();
+            m_lastError = QString("UnixPty Error: unable to write to master -> %1").arg(strerror(errno));
+            return -1;
+        }
+    }
+
+    //pty input queue is full, rest goes when the master is writable again
+    if (!m_writeQueue.isEmpty())
+    {
+        if (wasEmpty)
+            m_stats.add(PtyStats::WriteStalls);
+        m_writeMasterNotify->setEnabled(true);
+    }
+
+    m_stats.add(PtyStats::BytesWritten, byteArray.size());
+    notifyInput(byteArray.constData(), byteArray.size());
+    reportWriteProgress(written);
+    if (traceStart != 0)
+        PtyTracer::complete("write", traceStart, m_pid, "bytes", byteArray.size());
     return byteArray.size();
 }
 
+qint64 UnixPtyProcess::bytesToWrite() const
+{
+    return m_writeQueue.size();
+}
+
+void UnixPtyProcess::onWriteActivated(int socket)
+{
+    Q_UNUSED(socket);
+
+    qint64 written = m_writeQueue.writeTo(m_shellProcess.m_handleMaster);
+    if (written < 0)
+    {
+        //shell is gone, nobody will read the rest
+        m_lastError = QString("UnixPty Error: unable to write to master -> %1").arg(strerror(errno));
+        m_writeQueue.clear();
+        written = 0;
+    }
+
+    if (m_writeQueue.isEmpty())
+        m_writeMasterNotify->setEnabled(false);
+
+    reportWriteProgress(written);
+}
+
+void UnixPtyProcess::spawnFinished()
+{
+    qint64 elapsed = m_spawnTimer.nsecsElapsed();
+    m_stats.setSpawnTime(elapsed / 1000);
+    if (isTracing())
+        PtyTracer::complete("spawn", PtyTracer::now() - elapsed, m_pid);
+}
+
+void UnixPtyProcess::recordEmitToRead()
+{
+    if (m_emitTime == 0)
+        return;
+
+    PtyLatency::record(PtyLatency::EmitToRead, PtyLatency::now() - m_emitTime);
+    m_emitTime = 0;
+}
+
+void UnixPtyProcess::setMaxBytesPerWakeup(qint64 maxBytes)
+{
+    m_maxBytesPerWakeup = qMax<qint64>(maxBytes, MIN_READ_CHUNK_SIZE);
+}
+
+qint64 UnixPtyProcess::maxBytesPerWakeup() const
+{
+    return m_maxBytesPerWakeup;
+}
+
 bool UnixPtyProcess::isAvailable()
 {
 	//todo check something more if required
@@ -2,8 +2,16 @@
 #define UNIXPTYPROCESS_H
 
 #include "iptyprocess.h"
+#include "ptyringbuffer.h"
+#include "ptywritequeue.h"
+#include "ptyspawner.h"
+#include "ptylatency.h"
+#include "ptytracer.h"
 #include <QProcess>
 #include <QSocketNotifier>
+#include <QTimer>
+#include <QSharedPointer>
+#include <QElapsedTimer>
 
 
 // support for build with MUSL on Alpine Linux
@@ -30,6 +38,12 @@ public:
         emit readyRead();
     }
 
+    //exit of a shell started without QProcess, keeps QProcess::finished() usable for all engines
+    void emitFinished(int exitCode, QProcess::ExitStatus exitStatus)
+    {
+        emit finished(exitCode, exitStatus);
+    }
+
 protected:
     virtual void setupChildProcess();
 
@@ -38,6 +52,8 @@ private:
     QString m_handleSlaveName;
 };
 
+struct UnixPtyStartJob;
+
 class UnixPtyProcess : public IPtyProcess
 {
     Q_OBJECT
@@ -46,6 +62,9 @@ public:
     virtual ~UnixPtyProcess();
 
     virtual bool startProcess(const QString &shellPath, QStringList environment, qint16 cols, qint16 rows);
+    //openpt/grantpt/termios and spawn are done on QThreadPool,
+    //QProcessEngine starts QProcess on our thread without waiting for it
+    virtual void startProcessAsync(const QString &shellPath, const QStringList &environment, qint16 cols, qint16 rows);
     virtual bool resize(qint16 cols, qint16 rows);
     virtual bool kill();
     virtual PtyType type() const;
@@ -53,16 +72,79 @@ public:
     virtual QIODevice *notifier();
     virtual QByteArray readAll();
     virtual qint64 write(const QByteArray &byteArray);
+    virtual qint64 bytesToWrite() const;
     virtual bool isAvailable();
     void moveToThread(QThread *targetThread);
+    virtual int peek(PtySpan spans[2]);
+    virtual void consume(qint64 size);
+
+    //upper limit of bytes taken from the master fd per one notifier wakeup
+    void setMaxBytesPerWakeup(qint64 maxBytes);
+    qint64 maxBytesPerWakeup() const;
+
+    virtual void setOutputCoalescing(qint64 maxBytes, int maxDelayUsec);
+    virtual void setWorkingDirectory(const QString &workingDirectory);
+
+    //how the shell is started, QProcessEngine by default;
+    //other engines don't fork the whole address space of our process and don't block on QProcess
+    void setSpawnEngine(PtySpawner::Engine engine);
+    PtySpawner::Engine spawnEngine() const;
+    virtual void setReadBufferLimit(qint64 bytes);
+    virtual void pauseReading();
+    virtual void resumeReading();
+
+    //master fd of the pty, -1 if not started; for passing the pty to another process (ptyqt-hostd),
+    //keep reading paused while someone else reads it
+    int masterHandle() const { return m_shellProcess.m_handleMaster; }
+
+public slots:
+    virtual void flushOutput();
 
 private slots:
     void onSocketActivated(int socket);
+    void onWriteActivated(int socket);
+    void reapChild();
+    void onStartJobFinished();
+    void onShellStarted();
+    void onShellError(QProcess::ProcessError error);
+
+private:
+    void readFromMaster();
+    void resumeAfterDrain();
+    qint64 readRoom() const;
+    bool prepareStart(const QString &shellPath, qint16 cols, qint16 rows);
+    void setupNotifiers();
+    void startShellProcess(const QStringList &environment);
+    void releaseNotifiers();
+    bool isRunning() const;
+    void scheduleReadyRead(qint64 newBytes);
+    void recordEmitToRead();
+    bool killProcess();
+    void spawnFinished();
+    bool isTracing() const { return m_trace || PtyTracer::isEnabled(); }
 
 private:
     ShellProcess m_shellProcess;
     QSocketNotifier *m_readMasterNotify;
-    QByteArray m_shellReadBuffer;
+    QSocketNotifier *m_writeMasterNotify;
+    PtyWriteQueue m_writeQueue;
+    QTimer *m_coalesceTimer;
+    PtyRingBuffer m_shellReadBuffer;
+    qint64 m_readChunkSize;
+    qint64 m_maxBytesPerWakeup;
+    bool m_readEof;
+    qint64 m_pendingOutput;
+    bool m_echoPending;
+    PtySpawner::Engine m_spawnEngine;
+    bool m_childExited;
+    QSharedPointer<UnixPtyStartJob> m_startJob;
+    bool m_asyncShellStart;
+    QElapsedTimer m_spawnTimer;
+
+    //PtyLatency timestamps, 0 - nothing to measure
+    qint64 m_writeTime;
+    qint64 m_readyTime;
+    qint64 m_emitTime;
 
 };
 
@@ -21,6 +21,7 @@ WinPtyProcess::WinPtyProcess()
     , m_innerHandle(nullptr)
     , m_inSocket(nullptr)
     , m_outSocket(nullptr)
+    , m_observedBytes(0)
 {
 
 }
@@ -140,6 +141,10 @@ bool WinPtyProcess::startProcess(const QString &shellPath, QStringList environme
         return false;
     }
 
+    //connected before any consumer, so observers see output before it is read
+    m_observedBytes = 0;
+    connect(m_outSocket, &QIODevice::readyRead, m_outSocket, [this]() { observeOutput(); });
+
     return true;
 }
 
@@ -155,6 +160,7 @@ bool WinPtyProcess::resize(qint16 cols, qint16 rows)
     if (res)
     {
         m_size = QPair<qint16, qint16>(cols, rows);
+        notifyResized(cols, rows);
     }
 
     return res;
@@ -215,12 +221,17 @@ QIODevice *WinPtyProcess::notifier()
 
 QByteArray WinPtyProcess::readAll()
 {
+    observeOutput();
+    m_observedBytes = 0;
     return m_outSocket->readAll();
 }
 
 qint64 WinPtyProcess::write(const QByteArray &byteArray)
 {
-    return m_inSocket->write(byteArray);
+    qint64 written = m_inSocket->write(byteArray);
+    if (written > 0)
+        notifyInput(byteArray.constData(), written);
+    return written;
 }
 
 bool WinPtyProcess::isAvailable()
@@ -243,6 +254,21 @@ bool WinPtyProcess::isAvailable()
     return QFile::exists(path);
 }
 
+void WinPtyProcess::observeOutput()
+{
+    //output waits in the socket buffer: pass on the part observers haven't seen yet
+    qint64 available = m_outSocket->bytesAvailable();
+    if (available <= m_observedBytes)
+        return;
+
+    if (hasStreamObservers())
+    {
+        QByteArray data = m_outSocket->peek(available);
+        notifyOutput(data.constData() + m_observedBytes, data.size() - m_observedBytes);
+    }
+    m_observedBytes = available;
+}
+
 void WinPtyProcess::moveToThread(QThread *targetThread)
 {
     m_inSocket->moveToThread(targetThread);
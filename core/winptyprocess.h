@@ -22,6 +22,9 @@ public:
     bool isAvailable();
     void moveToThread(QThread *targetThread);
 
+private:
+    void observeOutput();
+
 private:
     winpty_t *m_ptyHandler;
     HANDLE m_innerHandle;
@@ -29,6 +32,7 @@ private:
     QString m_conOutName;
     QLocalSocket *m_inSocket;
     QLocalSocket *m_outSocket;
+    qint64 m_observedBytes; //head of the socket buffer already passed to notifyOutput()
 };
 
 #endif // WINPTYPROCESS_H
@@ -2,7 +2,11 @@
 #include <QWebSocketServer>
 #include <QWebSocket>
 #include "ptyqt.h"
+#include "ptyrelay.h"
+#include "ptyscreenstream.h"
+#include "ptysessionmanager.h"
 #include <QTimer>
+#include <QUrlQuery>
 #include <QProcessEnvironment>
 #include <QSysInfo>
 
@@ -11,106 +15,175 @@
 #define COLS 87
 #define ROWS 26
 
+//flow control: output not yet sent to a slow client stays in the kernel pty buffer,
+//the manager stops reading an attached session while its websocket is behind
+#define MAX_PTY_BUFFERED (64 * 1024)
+#define MAX_WS_PENDING (256 * 1024)
+
+//output goes in binary frames of up to 64KB, collected for up to 2ms
+#define FRAME_SIZE (64 * 1024)
+#define FRAME_DELAY_USEC 2000
+
+//shell of a closed page keeps running for 10 minutes, reconnect reattaches it
+#define DETACHED_TIMEOUT_MSEC (10 * 60 * 1000)
+
 int main(int argc, char *argv[])
 {
     QCoreApplication app(argc, argv);
 
+    //--screen-diff: send changed rows of a server-side screen instead of the raw output
+    bool screenDiff = app.arguments().contains("--screen-diff");
+
     //start WebSockets server for receive connections from xterm.js
     QWebSocketServer wsServer("TestServer", QWebSocketServer::NonSecureMode);
     if (!wsServer.listen(QHostAddress::Any, PORT))
         return 1;
 
-    QMap<QWebSocket *, IPtyProcess *> sessions;
+    //sessions outlive connections: disconnect detaches, client reconnects with ?session=<id>
+    PtySessionManager sessions(PtySessionManager::ReplayScreen);
+    sessions.setDetachedTimeout(DETACHED_TIMEOUT_MSEC);
+    QHash<QString, QWebSocket *> clients;
 
-    //create new session on new connection
-    QObject::connect(&wsServer, &QWebSocketServer::newConnection, [&wsServer, &sessions]()
+    //shell exited or detached session expired
+    QObject::connect(&sessions, &PtySessionManager::sessionFinished, [&clients](const QString &id)
+    {
+        QWebSocket *wSocket = clients.take(id);
+        if (wSocket)
+            wSocket->close();
+    });
+
+    //create new session or reattach existing one on new connection
+    QObject::connect(&wsServer, &QWebSocketServer::newConnection, [&wsServer, &sessions, &clients, screenDiff]()
     {
         //handle new connection
         QWebSocket *wSocket = wsServer.nextPendingConnection();
 
-        //use cmd.exe or bash, depends on target platform
-        IPtyProcess::PtyType ptyType = IPtyProcess::WinPty;
-        qint32 buildNumber = QSysInfo::kernelVersion().split(".").last().toInt();
-        if (buildNumber >= CONPTY_MINIMAL_WINDOWS_VERSION)
+        QString id = QUrlQuery(wSocket->requestUrl()).queryItemValue("session");
+        if (!sessions.contains(id))
         {
-            qDebug() << "Use ConPty instead of WinPty";
-            ptyType = IPtyProcess::ConPty;
-        }
-
-        //force select WinPty
-        ptyType = IPtyProcess::WinPty;
-
-        QString shellPath = "c:\\Windows\\system32\\cmd.exe";
-        //shellPath = "C:\\Program\ Files\\Git\\bin\\bash.exe";
+            //use cmd.exe or bash, depends on target platform
+            IPtyProcess::PtyType ptyType = IPtyProcess::WinPty;
+            qint32 buildNumber = QSysInfo::kernelVersion().split(".").last().toInt();
+            if (buildNumber >= CONPTY_MINIMAL_WINDOWS_VERSION)
+            {
+                qDebug() << "Use ConPty instead of WinPty";
+                ptyType = IPtyProcess::ConPty;
+            }
+
+            //force select WinPty
+            ptyType = IPtyProcess::WinPty;
+
+            QString shellPath = "c:\\Windows\\system32\\cmd.exe";
+            //shellPath = "C:\\Program\ Files\\Git\\bin\\bash.exe";
 #ifdef Q_OS_UNIX
-        shellPath = "/bin/sh";
-        ptyType = IPtyProcess::UnixPty;
+            shellPath = "/bin/sh";
+            ptyType = IPtyProcess::UnixPty;
 #endif
 
-        //create new Pty instance
-        IPtyProcess *pty = PtyQt::createPtyProcess(ptyType);
-
-        qDebug() << "New connection" << wSocket->peerAddress() << wSocket->peerPort() << pty->pid();
+            //create new Pty instance
+            IPtyProcess *pty = PtyQt::createPtyProcess(ptyType);
 
-        //start Pty process ()
-        pty->startProcess(shellPath, QProcessEnvironment::systemEnvironment().toStringList(), COLS, ROWS);
+            //start Pty process ()
+            pty->startProcess(shellPath, QProcessEnvironment::systemEnvironment().toStringList(), COLS, ROWS);
 
-        if (!pty->lastError().isEmpty())
-        {
-            qDebug() << pty->lastError();
-            delete pty;
-            return;
+            if (!pty->lastError().isEmpty())
+            {
+                qDebug() << pty->lastError();
+                delete pty;
+                wSocket->close();
+                wSocket->deleteLater();
+                return;
+            }
+
+            //output read ahead of a paused session is bounded, the rest waits in the kernel,
+            //so the shell is throttled by the full pty buffer until the client catches up
+            pty->setReadBufferLimit(MAX_PTY_BUFFERED);
+
+            //slow clients get nothing until they catch up, then a snapshot;
+            //screen belongs to the session, so a reattached client gets it whole;
+            //the manager reads the session, the stream only watches its output
+            if (screenDiff)
+            {
+                PtyScreenStream *stream = new PtyScreenStream(pty, pty);
+                stream->setReadsPty(false);
+            }
+
+            id = sessions.addSession(pty);
         }
 
-        //connect read channel from Pty process to write channel on websocket
-        QObject::connect(pty->notifier(), &QIODevice::readyRead, [wSocket, pty]()
-        {
-            QByteArray data = pty->readAll();
-            //qDebug() << "< " << data;
-            wSocket->sendTextMessage(data);
-        });
+        IPtyProcess *pty = sessions.session(id);
+        qDebug() << "New connection" << wSocket->peerAddress() << wSocket->peerPort() << pty->pid() << id;
+
+        //session is taken over from the previous client
+        QWebSocket *previous = clients.value(id);
+        clients.insert(id, wSocket);
+        if (previous)
+            previous->close();
+
+        QByteArray replay;
+        sessions.attach(id, &replay);
+        wSocket->sendTextMessage(id);
 
-        //connect read channel of Websocket to write channel of Pty process
-        QObject::connect(wSocket, &QWebSocket::textMessageReceived, [wSocket, pty](const QString &message)
+        if (screenDiff)
         {
-            //qDebug() << "> " << message.size() << message.at(0) << message << message.toUtf8() << QString::fromUtf8(message.toUtf8());
-            pty->write(message.toUtf8());
-        });
+            PtyScreenStream *stream = pty->findChild<PtyScreenStream *>();
+            int viewer = stream->addViewer();
+            QObject::connect(stream, &PtyScreenStream::update, wSocket, [wSocket, viewer](int updated, const QByteArray &data)
+            {
+                if (updated == viewer)
+                    wSocket->sendBinaryMessage(data);
+            });
+            QObject::connect(wSocket, &QWebSocket::bytesWritten, stream, [stream, viewer](qint64 bytes)
+            {
+                stream->viewerWritten(viewer, bytes);
+            });
+            QObject::connect(wSocket, &QWebSocket::destroyed, stream, [stream, viewer]()
+            {
+                stream->removeViewer(viewer);
+            });
+            QObject::connect(wSocket, &QWebSocket::binaryMessageReceived, stream, [pty](const QByteArray &data)
+            {
+                pty->write(data);
+            });
+        }
+        else
+        {
+            //relay output of the session to the websocket in binary frames and input back to the pty
+            if (!replay.isEmpty())
+                wSocket->sendBinaryMessage(replay);
+
+            PtyRelay *relay = new PtyRelay(pty, wSocket);
+            relay->setReadsPty(false);
+            relay->setFrameLimits(FRAME_SIZE, FRAME_DELAY_USEC);
+            relay->setMaxPendingBytes(MAX_WS_PENDING);
+            relay->attachWebSocket(wSocket);
+            QObject::connect(relay, &PtyRelay::throttled, &sessions, [&sessions, id](bool paused)
+            {
+                sessions.setAttachedPaused(id, paused);
+            });
+            QObject::connect(&sessions, &PtySessionManager::output, relay, [relay, id](const QString &session, const QByteArray &data)
+            {
+                if (session == id)
+                    relay->relayOutput(data);
+            });
+        }
 
-        //for example handle disconnections, process crashes and stuff like that...
-        auto endSessionHandler = [wSocket, &sessions]()
+        //page closed or network lost: the shell keeps running detached
+        QObject::connect(wSocket, &QWebSocket::disconnected, &sessions, [wSocket, id, &sessions, &clients]()
         {
-            IPtyProcess *pty = sessions.value(wSocket);
-            if (pty == 0)
-                return; //because can be called twice
+            qDebug() << "Detach" << wSocket << id;
 
-            sessions.remove(wSocket);
+            //stop relaying before the session is detached
+            qDeleteAll(wSocket->findChildren<PtyRelay *>());
 
-            qDebug() << "wSockMn" << wSocket << pty;
+            if (clients.value(id) == wSocket)
+            {
+                clients.remove(id);
+                sessions.detach(id);
+            }
 
-            if (wSocket->isValid())
-                wSocket->close();
             wSocket->deleteLater();
-
-            pty->kill();
-            delete pty;
-        };
-
-        QObject::connect(wSocket, &QWebSocket::disconnected, endSessionHandler);
-
-#ifdef Q_OS_UNIX
-        QProcess *shellProcess = qobject_cast<QProcess *>(pty->notifier());
-        QObject::connect(shellProcess, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
-                         [endSessionHandler](int, QProcess::ExitStatus ) { endSessionHandler(); });
-#else
-        QLocalSocket *localSocket = qobject_cast<QLocalSocket *>(pty->notifier());
-        QObject::connect(localSocket, &QLocalSocket::disconnected, endSessionHandler);
-#endif
-
-        //add connection to list of active connections
-        sessions.insert(wSocket, pty);
-
-        qDebug() << pty->size();
+        });
     });
 
     //stop eventloop if needed
@@ -119,15 +192,6 @@ int main(int argc, char *argv[])
     //exec eventloop
     bool res = app.exec();
 
-    QMapIterator<QWebSocket *, IPtyProcess *> it(sessions);
-    while (it.hasNext())
-    {
-        it.next();
-
-        it.key()->deleteLater();
-        delete it.value();
-    }
-    sessions.clear();
-
+    //sessions kills the shells when it goes out of scope
     return res;
 }
@@ -0,0 +1,27 @@
+#include <QCoreApplication>
+#include <QStringList>
+#include <stdio.h>
+#include "ptyhostserver.h"
+
+//ptyqt-hostd [--socket <path>]
+//keeps shells of HostPty sessions alive while their clients restart,
+//default socket is PtyHostProtocol::defaultSocketPath()
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QString socketPath = PtyHostProtocol::defaultSocketPath();
+    QStringList args = app.arguments();
+    int index = args.indexOf("--socket");
+    if (index > 0 && index + 1 < args.size())
+        socketPath = args.at(index + 1);
+
+    PtyHostServer server;
+    if (!server.listen(socketPath))
+    {
+        fprintf(stderr, "%s\n", qPrintable(server.lastError()));
+        return 1;
+    }
+
+    return app.exec();
+}
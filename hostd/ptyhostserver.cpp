@@ -0,0 +1,271 @@
+#include "ptyhostserver.h"
+#include <QFile>
+#include <QProcess>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define MAX_PAYLOAD_SIZE (64 * 1024)
+#define PROBE_TIMEOUT_MSEC 1000
+
+PtyHostServer::PtyHostServer(QObject *parent)
+    : QObject(parent)
+    , m_nextId(1)
+{
+    connect(&m_server, &QLocalServer::newConnection, this, &PtyHostServer::onNewConnection);
+}
+
+PtyHostServer::~PtyHostServer()
+{
+    QList<Session *> sessions = m_sessions.values();
+    m_sessions.clear();
+    for (int i = 0; i < sessions.size(); i++)
+    {
+        sessions.at(i)->pty->notifier()->disconnect(this);
+        delete sessions.at(i)->pty;
+        delete sessions.at(i);
+    }
+}
+
+bool PtyHostServer::listen(const QString &socketPath)
+{
+    //socket file left by a dead daemon is removed, the one of a live daemon is not
+    QString error;
+    int probe = PtyHostProtocol::connectToHost(socketPath, PROBE_TIMEOUT_MSEC, &error);
+    if (probe >= 0)
+    {
+        ::close(probe);
+        m_lastError = QString("HostPty Error: daemon is already running on %1").arg(socketPath);
+        return false;
+    }
+    QLocalServer::removeServer(socketPath);
+
+    m_server.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!m_server.listen(socketPath))
+    {
+        m_lastError = QString("HostPty Error: unable to listen on %1 -> %2").arg(socketPath).arg(m_server.errorString());
+        return false;
+    }
+    return true;
+}
+
+void PtyHostServer::onNewConnection()
+{
+    while (QLocalSocket *socket = m_server.nextPendingConnection())
+    {
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() { onDisconnected(socket); });
+    }
+}
+
+void PtyHostServer::onReadyRead(QLocalSocket *socket)
+{
+    //requests come whole or in pieces, take the complete ones
+    while (socket->bytesAvailable() >= static_cast<qint64>(sizeof(PtyHostMessage)))
+    {
+        PtyHostMessage message;
+        socket->peek(reinterpret_cast<char *>(&message), sizeof(message));
+        if (message.size > MAX_PAYLOAD_SIZE)
+        {
+            socket->abort();
+            return;
+        }
+        if (socket->bytesAvailable() < static_cast<qint64>(sizeof(message) + message.size))
+            return;
+
+        socket->read(reinterpret_cast<char *>(&message), sizeof(message));
+        QByteArray payload = socket->read(message.size);
+        handleMessage(socket, message, payload);
+    }
+}
+
+void PtyHostServer::onDisconnected(QLocalSocket *socket)
+{
+    //client is gone (maybe restarting), the shell keeps running detached
+    Session *session = sessionOf(socket);
+    if (session)
+        session->client = 0;
+    socket->deleteLater();
+}
+
+void PtyHostServer::handleMessage(QLocalSocket *socket, const PtyHostMessage &message, const QByteArray &payload)
+{
+    switch (message.type)
+    {
+    case PtyHostMessage::Spawn:
+        spawn(socket, message, payload);
+        break;
+    case PtyHostMessage::Attach:
+        attach(socket, message);
+        break;
+    case PtyHostMessage::Kill:
+        killSession(socket, message);
+        break;
+    case PtyHostMessage::List:
+        list(socket);
+        break;
+    default:
+        sendError(socket, QString("unknown request %1").arg(message.type));
+        break;
+    }
+}
+
+void PtyHostServer::spawn(QLocalSocket *socket, const PtyHostMessage &message, const QByteArray &payload)
+{
+    if (sessionOf(socket))
+    {
+        sendError(socket, QString("connection has a session already"));
+        return;
+    }
+
+    QList<QByteArray> args = payload.split('\0');
+    QString shellPath = QFile::decodeName(args.value(0));
+    QString workingDirectory = QFile::decodeName(args.value(1));
+
+    //output is read by the client, we keep the pty and the child only
+    UnixPtyProcess *pty = new UnixPtyProcess();
+    if (!workingDirectory.isEmpty())
+        pty->setWorkingDirectory(workingDirectory);
+    pty->pauseReading();
+    if (!pty->startProcess(shellPath, QStringList(), static_cast<qint16>(message.arg1), static_cast<qint16>(message.arg2)))
+    {
+        sendError(socket, pty->lastError());
+        delete pty;
+        return;
+    }
+
+    Session *session = new Session();
+    session->id = m_nextId++;
+    session->pty = pty;
+    session->client = socket;
+    m_sessions.insert(session->id, session);
+
+    //QProcess engine: QProcess reports the exit, reading of the master is not needed for it
+    quint32 id = session->id;
+    QProcess *process = qobject_cast<QProcess *>(pty->notifier());
+    connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, id](int exitCode, QProcess::ExitStatus exitStatus) {
+        onFinished(id, exitStatus == QProcess::NormalExit ? exitCode : -1);
+    });
+
+    sendSession(socket, session);
+}
+
+void PtyHostServer::attach(QLocalSocket *socket, const PtyHostMessage &message)
+{
+    Session *session = m_sessions.value(message.session);
+    if (!session)
+    {
+        sendError(socket, QString("no session %1").arg(message.session));
+        return;
+    }
+    if (session->client || sessionOf(socket))
+    {
+        sendError(socket, QString("session %1 is attached").arg(message.session));
+        return;
+    }
+
+    session->client = socket;
+    sendSession(socket, session);
+}
+
+void PtyHostServer::killSession(QLocalSocket *socket, const PtyHostMessage &message)
+{
+    Session *session = sessionOf(socket);
+    if (!session || session->id != message.session)
+    {
+        sendError(socket, QString("session %1 is not attached here").arg(message.session));
+        return;
+    }
+
+    //client asked for it, no Exited event
+    session->pty->notifier()->disconnect(this);
+    session->pty->kill();
+    removeSession(session);
+
+    PtyHostMessage reply;
+    reply.type = PtyHostMessage::Ok;
+    reply.session = message.session;
+    PtyHostProtocol::send(socket->socketDescriptor(), reply);
+}
+
+void PtyHostServer::list(QLocalSocket *socket)
+{
+    QList<quint32> ids = m_sessions.keys();
+    QByteArray payload;
+    for (int i = 0; i < ids.size(); i++)
+    {
+        if (i > 0)
+            payload.append(',');
+        payload.append(QByteArray::number(ids.at(i)));
+    }
+
+    PtyHostMessage reply;
+    reply.type = PtyHostMessage::Ok;
+    PtyHostProtocol::send(socket->socketDescriptor(), reply, payload);
+}
+
+void PtyHostServer::onFinished(quint32 id, int exitCode)
+{
+    Session *session = m_sessions.value(id);
+    if (!session)
+        return;
+
+    if (session->client)
+    {
+        PtyHostMessage event;
+        event.type = PtyHostMessage::Exited;
+        event.session = id;
+        event.pid = session->pty->pid();
+        event.arg1 = exitCode;
+        PtyHostProtocol::send(session->client->socketDescriptor(), event);
+    }
+
+    //called from a signal of the pty
+    session->pty->notifier()->disconnect(this);
+    session->pty->deleteLater();
+    m_sessions.remove(id);
+    delete session;
+}
+
+void PtyHostServer::sendSession(QLocalSocket *socket, Session *session)
+{
+    //size may have been changed by clients, the pty knows it
+    struct winsize winp;
+    QPair<qint16, qint16> size = session->pty->size();
+    if (ioctl(session->pty->masterHandle(), TIOCGWINSZ, &winp) == 0)
+        size = QPair<qint16, qint16>(winp.ws_col, winp.ws_row);
+
+    PtyHostMessage reply;
+    reply.type = PtyHostMessage::Ok;
+    reply.session = session->id;
+    reply.pid = session->pty->pid();
+    reply.arg1 = size.first;
+    reply.arg2 = size.second;
+    if (!PtyHostProtocol::send(socket->socketDescriptor(), reply, QByteArray(), session->pty->masterHandle()))
+        session->client = 0;
+}
+
+void PtyHostServer::sendError(QLocalSocket *socket, const QString &error)
+{
+    PtyHostMessage reply;
+    reply.type = PtyHostMessage::Error;
+    PtyHostProtocol::send(socket->socketDescriptor(), reply, error.toUtf8());
+}
+
+PtyHostServer::Session *PtyHostServer::sessionOf(QLocalSocket *socket) const
+{
+    QHash<quint32, Session *>::const_iterator it = m_sessions.constBegin();
+    for (; it != m_sessions.constEnd(); ++it)
+    {
+        if (it.value()->client == socket)
+            return it.value();
+    }
+    return 0;
+}
+
+void PtyHostServer::removeSession(Session *session)
+{
+    m_sessions.remove(session->id);
+    session->pty->deleteLater();
+    delete session;
+}
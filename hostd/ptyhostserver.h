@@ -0,0 +1,58 @@
+#ifndef PTYHOSTSERVER_H
+#define PTYHOSTSERVER_H
+
+#include "unixptyprocess.h"
+#include "ptyhostprotocol.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHash>
+
+//ptyqt-hostd: owns UnixPty sessions and serves them to HostPtyProcess clients over a unix socket,
+//the client of a session gets its master fd and does all the reads and writes, we never touch
+//the output (reading stays paused); while nobody is attached the output waits in the kernel
+//pty buffer and the shell blocks once it is full, until a client attaches again
+class PtyHostServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PtyHostServer(QObject *parent = 0);
+    //kills all sessions
+    ~PtyHostServer();
+
+    //socket is accessible for our user only
+    bool listen(const QString &socketPath);
+    QString lastError() const { return m_lastError; }
+    int sessionCount() const { return m_sessions.size(); }
+
+private slots:
+    void onNewConnection();
+
+private:
+    struct Session
+    {
+        quint32 id;
+        UnixPtyProcess *pty;
+        QLocalSocket *client; //0 - detached
+    };
+
+    void onReadyRead(QLocalSocket *socket);
+    void onDisconnected(QLocalSocket *socket);
+    void handleMessage(QLocalSocket *socket, const PtyHostMessage &message, const QByteArray &payload);
+    void spawn(QLocalSocket *socket, const PtyHostMessage &message, const QByteArray &payload);
+    void attach(QLocalSocket *socket, const PtyHostMessage &message);
+    void killSession(QLocalSocket *socket, const PtyHostMessage &message);
+    void list(QLocalSocket *socket);
+    void onFinished(quint32 id, int exitCode);
+    void sendSession(QLocalSocket *socket, Session *session);
+    void sendError(QLocalSocket *socket, const QString &error);
+    Session *sessionOf(QLocalSocket *socket) const;
+    void removeSession(Session *session);
+
+private:
+    QLocalServer m_server;
+    QString m_lastError;
+    QHash<quint32, Session *> m_sessions;
+    quint32 m_nextId;
+};
+
+#endif // PTYHOSTSERVER_H
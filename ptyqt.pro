@@ -23,11 +23,39 @@ win32 {
     HEADERS += \
         core/ptyqt.h \
         core/iptyprocess.h \
+        core/ptyringbuffer.h \
+        core/ptystats.h \
+        core/ptylatency.h \
+        core/ptytracer.h \
+        core/ptyrelay.h \
+        core/ptyscreenstream.h \
+        core/ptybroadcaster.h \
+        core/ptysessionmanager.h \
+        core/ptysessionpool.h \
+        core/ptyvtparser.h \
+        core/ptyscreen.h \
+        core/ptyscrollback.h \
+        core/ptyrecorder.h \
+        core/ptyreplayer.h \
         core/winptyprocess.h \
         core/conptyprocess.h
 
     SOURCES += \
         core/ptyqt.cpp \
+        core/ptyringbuffer.cpp \
+        core/ptystats.cpp \
+        core/ptylatency.cpp \
+        core/ptytracer.cpp \
+        core/ptyrelay.cpp \
+        core/ptyscreenstream.cpp \
+        core/ptybroadcaster.cpp \
+        core/ptysessionmanager.cpp \
+        core/ptysessionpool.cpp \
+        core/ptyvtparser.cpp \
+        core/ptyscreen.cpp \
+        core/ptyscrollback.cpp \
+        core/ptyrecorder.cpp \
+        core/ptyreplayer.cpp \
         core/winptyprocess.cpp \
         core/conptyprocess.cpp
 
@@ -48,10 +76,50 @@ unix:!macx {
     HEADERS += \
         core/ptyqt.h \
         core/iptyprocess.h \
+        core/ptyringbuffer.h \
+        core/ptystats.h \
+        core/ptylatency.h \
+        core/ptytracer.h \
+        core/ptyrelay.h \
+        core/ptyscreenstream.h \
+        core/ptybroadcaster.h \
+        core/ptysessionmanager.h \
+        core/ptysessionpool.h \
+        core/ptyvtparser.h \
+        core/ptyscreen.h \
+        core/ptyscrollback.h \
+        core/ptyrecorder.h \
+        core/ptyreplayer.h \
+        core/ptyspawner.h \
+        core/ptywritequeue.h \
+        core/ptyhostprotocol.h \
+        core/hostptyprocess.h \
+        core/ptyreactor.h \
+        core/reactorptyprocess.h \
         core/unixptyprocess.h
 
     SOURCES += \
         core/ptyqt.cpp \
+        core/ptyringbuffer.cpp \
+        core/ptystats.cpp \
+        core/ptylatency.cpp \
+        core/ptytracer.cpp \
+        core/ptyrelay.cpp \
+        core/ptyscreenstream.cpp \
+        core/ptybroadcaster.cpp \
+        core/ptysessionmanager.cpp \
+        core/ptysessionpool.cpp \
+        core/ptyvtparser.cpp \
+        core/ptyscreen.cpp \
+        core/ptyscrollback.cpp \
+        core/ptyrecorder.cpp \
+        core/ptyreplayer.cpp \
+        core/ptyspawner.cpp \
+        core/ptywritequeue.cpp \
+        core/ptyhostprotocol.cpp \
+        core/hostptyprocess.cpp \
+        core/ptyreactor.cpp \
+        core/reactorptyprocess.cpp \
         core/unixptyprocess.cpp
 
     LIBS += -lpthread -ldl -static-libstdc++
@@ -61,10 +129,46 @@ macx {
     HEADERS += \
         core/ptyqt.h \
         core/iptyprocess.h \
+        core/ptyringbuffer.h \
+        core/ptystats.h \
+        core/ptylatency.h \
+        core/ptytracer.h \
+        core/ptyrelay.h \
+        core/ptyscreenstream.h \
+        core/ptybroadcaster.h \
+        core/ptysessionmanager.h \
+        core/ptysessionpool.h \
+        core/ptyvtparser.h \
+        core/ptyscreen.h \
+        core/ptyscrollback.h \
+        core/ptyrecorder.h \
+        core/ptyreplayer.h \
+        core/ptyspawner.h \
+        core/ptywritequeue.h \
+        core/ptyhostprotocol.h \
+        core/hostptyprocess.h \
         core/unixptyprocess.h
 
     SOURCES += \
         core/ptyqt.cpp \
+        core/ptyringbuffer.cpp \
+        core/ptystats.cpp \
+        core/ptylatency.cpp \
+        core/ptytracer.cpp \
+        core/ptyrelay.cpp \
+        core/ptyscreenstream.cpp \
+        core/ptybroadcaster.cpp \
+        core/ptysessionmanager.cpp \
+        core/ptysessionpool.cpp \
+        core/ptyvtparser.cpp \
+        core/ptyscreen.cpp \
+        core/ptyscrollback.cpp \
+        core/ptyrecorder.cpp \
+        core/ptyreplayer.cpp \
+        core/ptyspawner.cpp \
+        core/ptywritequeue.cpp \
+        core/ptyhostprotocol.cpp \
+        core/hostptyprocess.cpp \
         core/unixptyprocess.cpp
 
     LIBS += \
@@ -7,7 +7,37 @@
 #include <tlhelp32.h>
 #endif
 #include <string>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QDir>
+#include "ptysessionpool.h"
+#include "ptyvtparser.h"
+#include "ptyscreen.h"
+#include "ptyscrollback.h"
+#include "ptyrecorder.h"
+#include "ptyreplayer.h"
+#include "ptylatency.h"
+#include "ptytracer.h"
+#include "ptyrelay.h"
+#include "ptyscreenstream.h"
+#include "ptybroadcaster.h"
+#include "ptysessionmanager.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#ifdef Q_OS_UNIX
+#include "unixptyprocess.h"
+#include "hostptyprocess.h"
+#include "ptywritequeue.h"
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include "reactorptyprocess.h"
+#endif
 
 #ifdef Q_OS_WIN
 #ifndef _WINDEF_
@@ -106,11 +136,480 @@ QStringList getShells()
 }
 #endif
 
+//collects parser events in a short text form
+class VtLogHandler : public PtyVtHandler
+{
+public:
+    void vtPrint(const char *text, int size) { log.append(QByteArray(text, size)); }
+    void vtPrintCodepoint(uint codepoint) { log.append(QString("<U+%1>").arg(codepoint, 0, 16).toLatin1()); }
+    void vtExecute(char control) { log.append(QString("<%1>").arg(int(control)).toLatin1()); }
+    void vtCsi(char prefix, const PtyVtParams &params, const char *intermediates, int intermediateCount, char final)
+    {
+        Q_UNUSED(intermediates); Q_UNUSED(intermediateCount);
+        QStringList values;
+        for (int i = 0; i < params.count; i++)
+            values << QString::number(params.values[i]);
+        log.append(QString("<CSI%1%2%3>").arg(prefix ? QString(QChar(prefix)) : QString()).arg(values.join(",")).arg(QChar(final)).toLatin1());
+    }
+    void vtOsc(const QByteArray &data) { log.append("<OSC" + data + ">"); }
+
+    QByteArray log;
+};
+
+//cells and cursor of the screens match; a half of a wide character left alone after the other
+//half was overwritten counts as the space it is drawn as
+bool sameScreen(const PtyScreen &expected, const PtyScreen &actual)
+{
+    if (expected.rows() != actual.rows() || expected.columns() != actual.columns()
+            || expected.cursorRow() != actual.cursorRow() || expected.cursorColumn() != actual.cursorColumn()
+            || expected.isCursorVisible() != actual.isCursorVisible())
+        return false;
+
+    const quint16 wide = PtyScreen::WideChar | PtyScreen::WideTail;
+    for (int row = 0; row < expected.rows(); row++)
+    {
+        for (int column = 0; column < expected.columns(); column++)
+        {
+            PtyScreenCell cell = expected.cell(row, column);
+            bool pair = ((cell.attributes & PtyScreen::WideChar) && column + 1 < expected.columns()
+                         && (expected.cell(row, column + 1).attributes & PtyScreen::WideTail))
+                    || ((cell.attributes & PtyScreen::WideTail) && column > 0
+                        && (expected.cell(row, column - 1).attributes & PtyScreen::WideChar));
+            if (!pair && (cell.attributes & wide))
+            {
+                cell.codepoint = ' ';
+                cell.attributes &= ~wide;
+            }
+
+            PtyScreenCell other = actual.cell(row, column);
+            uint codepoint = cell.codepoint ? cell.codepoint : ' ';
+            uint otherCodepoint = other.codepoint ? other.codepoint : ' ';
+            if (codepoint != otherCodepoint || cell.attributes != other.attributes
+                    || cell.foreground != other.foreground || cell.background != other.background)
+                return false;
+        }
+    }
+    return true;
+}
+
+//QWebSocket API used by PtyBroadcaster::subscribeWebSocket(), without the WebSockets module
+class FakeWebSocket : public QObject
+{
+    Q_OBJECT
+public:
+    FakeWebSocket() : closed(false) { }
+
+    void sendBinaryMessage(const QByteArray &data) { messages.append(data); }
+    void close() { closed = true; emit disconnected(); }
+
+    QList<QByteArray> messages;
+    bool closed;
+
+signals:
+    void bytesWritten(qint64 bytes);
+    void disconnected();
+};
+
 class PtyQtTests : public QObject
 {
     Q_OBJECT
 private slots:
 
+    void ringBuffer()
+    {
+        //capacity is rounded up to page size
+        PtyRingBuffer buffer(100);
+        QVERIFY(buffer.capacity() >= 100);
+        QVERIFY(buffer.isEmpty());
+
+        QByteArray block(static_cast<int>(buffer.capacity() * 3 / 4), 'a');
+        QCOMPARE(buffer.write(block.constData(), block.size()), qint64(block.size()));
+        QCOMPARE(buffer.readAll(), block);
+
+        //write with wrap around the end of memory block
+        QCOMPARE(buffer.write(block.constData(), block.size()), qint64(block.size()));
+        QCOMPARE(buffer.read(block.data(), block.size() / 2), qint64(block.size() / 2));
+        QByteArray tail(static_cast<int>(buffer.capacity() / 2), 'b');
+        QCOMPARE(buffer.write(tail.constData(), tail.size()), qint64(tail.size()));
+
+        PtySpan spans[2];
+        QCOMPARE(buffer.peek(spans), 2);
+        QCOMPARE(spans[0].size + spans[1].size, buffer.size());
+        QCOMPARE(spans[1].data[spans[1].size - 1], 'b');
+
+        //no overflow when full
+        qint64 freeSpace = buffer.freeSpace();
+        QCOMPARE(buffer.write(block.constData(), block.size()), freeSpace);
+        QVERIFY(buffer.isFull());
+        buffer.consume(buffer.size());
+        QVERIFY(buffer.isEmpty());
+    }
+
+    void vtParser()
+    {
+        QByteArray input("ls\x1b[1;31mred\x1b[0m \xc3\xa9\x1b[?25h\x1b]0;title\x07\r\n");
+        QByteArray expected("ls<CSI1,31m>red<CSI0m> <U+e9><CSI?25h><OSC0;title><13><10>");
+
+        VtLogHandler whole;
+        PtyVtParser(&whole).feed(input.constData(), input.size());
+        QCOMPARE(whole.log, expected);
+
+        //sequences split between reads give the same events
+        for (int split = 1; split < input.size(); split++)
+        {
+            VtLogHandler handler;
+            PtyVtParser parser(&handler);
+            parser.feed(input.constData(), split);
+            parser.feed(input.constData() + split, input.size() - split);
+            QCOMPARE(handler.log, expected);
+        }
+
+        //vectorized scan stops exactly on the first non-printable byte
+        QByteArray text(1000, 'a');
+        text[517] = '\n';
+        QCOMPARE(PtyVtParser::scanPrintable(text.constData(), text.size()), qint64(517));
+        text[517] = 'a';
+        text[999] = '\x80';
+        QCOMPARE(PtyVtParser::scanPrintable(text.constData(), text.size()), qint64(999));
+    }
+
+    void screen()
+    {
+        PtyScreen screen(10, 3);
+        QByteArray input("abc\r\n\x1b[31mred\x1b[0m");
+        screen.feed(input.constData(), input.size());
+        QCOMPARE(screen.rowText(0), QString("abc"));
+        QCOMPARE(screen.rowText(1), QString("red"));
+        QCOMPARE(screen.cell(1, 0).foreground, quint32(PtyScreen::PaletteColor | 1));
+        QCOMPARE(screen.cell(1, 3).foreground, quint32(PtyScreen::DefaultColor));
+        QCOMPARE(screen.cursorColumn(), 3);
+        QCOMPARE(screen.cursorRow(), 1);
+
+        //only touched rows are reported
+        quint64 generation = screen.generation();
+        screen.feed("\x1b[1;1Hx", 7);
+        QCOMPARE(screen.dirtyRows(generation), QList<int>() << 0);
+        QCOMPARE(screen.rowText(0), QString("xbc"));
+
+        //rows leaving the top go to scrollback
+        screen.feed("\r\n\r\n\r\nlast", 10);
+        QCOMPARE(screen.scrollbackSize(), 1);
+        QCOMPARE(screen.scrollbackText(0), QString("xbc"));
+        QCOMPARE(screen.rowText(2), QString("last"));
+
+        //long line is wrapped and joined back on resize
+        screen.feed("\r\n0123456789abcde", 17);
+        QCOMPARE(screen.rowText(1), QString("0123456789"));
+        QCOMPARE(screen.rowText(2), QString("abcde"));
+        screen.resize(20, 3);
+        QCOMPARE(screen.rowText(2), QString("0123456789abcde"));
+        QCOMPARE(screen.cursorRow(), 2);
+        QCOMPARE(screen.cursorColumn(), 15);
+
+        //alternate screen doesn't touch the main one
+        screen.feed("\x1b[?1049h\x1b[H\x1b[2Jfull", 19);
+        QVERIFY(screen.isAlternateScreen());
+        QCOMPARE(screen.rowText(0), QString("full"));
+        screen.feed("\x1b[?1049l", 8);
+        QCOMPARE(screen.rowText(2), QString("0123456789abcde"));
+    }
+
+    void scrollback()
+    {
+        PtyScreen screen(40, 2);
+        for (int i = 0; i < 5000; i++)
+        {
+            QByteArray line = QString("\x1b[32mline\x1b[0m %1\r\n").arg(i).toLatin1();
+            screen.feed(line.constData(), line.size());
+        }
+
+        //sealed blocks are compressed, lines come back with their attributes
+        PtyScrollback *scrollback = screen.scrollback();
+        QCOMPARE(scrollback->size(), 4999);
+        QVERIFY(scrollback->memoryUsage() < scrollback->uncompressedSize() / 2);
+        QCOMPARE(screen.scrollbackText(1234), QString("line 1234"));
+        QCOMPARE(scrollback->line(1234).foreground.at(0), quint32(PtyScreen::PaletteColor | 2));
+        QCOMPARE(scrollback->line(1234).foreground.at(5), quint32(PtyScreen::DefaultColor));
+
+        //oldest blocks go first when over the byte budget
+        scrollback->setMaxBytes(scrollback->memoryUsage() / 2);
+        QVERIFY(scrollback->memoryUsage() <= scrollback->maxBytes());
+        QVERIFY(scrollback->firstLineNumber() > 0);
+        QCOMPARE(screen.scrollbackText(scrollback->size() - 1), QString("line 4998"));
+
+        //global budget takes from the least recently used store
+        PtyScrollback other;
+        other.append(scrollback->line(0));
+        screen.scrollbackText(0);
+        PtyScrollback::setGlobalMaxBytes(PtyScrollback::globalMemoryUsage() - 1);
+        QCOMPARE(other.size(), 0);
+        QVERIFY(scrollback->size() > 0);
+        PtyScrollback::setGlobalMaxBytes(0);
+    }
+
+    void scrollbackSpill()
+    {
+        PtyScreenLine line;
+        PtyScrollback scrollback;
+        scrollback.setMaxLines(0);
+        QString fileName = QDir::temp().filePath("ptyqt_tests_spill.bin");
+        QVERIFY(scrollback.setSpillFile(fileName));
+
+        //everything goes to the file, read back through the map
+        for (int i = 0; i < 100000; i++)
+        {
+            line.codepoints = QString::number(i).toUcs4();
+            line.attributes.fill(PtyScreen::Bold, line.codepoints.size());
+            line.foreground.fill(PtyScreen::DefaultColor, line.codepoints.size());
+            line.background.fill(PtyScreen::DefaultColor, line.codepoints.size());
+            scrollback.append(line);
+        }
+        QCOMPARE(scrollback.size(), 100000);
+        QVERIFY(scrollback.spilledLines() > 99000);
+        QVERIFY(scrollback.spillFileSize() > 0);
+        QCOMPARE(PtyScreen::lineText(scrollback.line(54321)), QString("54321"));
+        QCOMPARE(scrollback.line(54321).attributes.at(0), quint16(PtyScreen::Bold));
+
+        //newest lines come back from the file
+        QCOMPARE(PtyScreen::lineText(scrollback.takeLast()), QString("99999"));
+        QCOMPARE(scrollback.size(), 99999);
+
+        scrollback.setSpillFile(QString());
+        QVERIFY(!QFile::exists(fileName));
+        QVERIFY(scrollback.size() < 1000);
+    }
+
+    void recorder()
+    {
+        QString fileName = QDir::temp().filePath("ptyqt_tests.cast");
+        PtyRecorder recorder;
+        QVERIFY(recorder.start(fileName, 80, 24));
+        recorder.ptyOutput("$ \xe4\xb8", 4);
+        recorder.ptyOutput("\xad\r\n", 3);
+        recorder.ptyInput("ls\r", 3);
+        recorder.ptyResized(100, 30);
+        recorder.stop();
+        QCOMPARE(recorder.droppedBytes(), qint64(0));
+
+        //asciicast v2: header line, then events; split UTF-8 sequence goes to the next event
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QList<QByteArray> lines = file.readAll().trimmed().split('\n');
+        file.close();
+        file.remove();
+        QCOMPARE(lines.size(), 5);
+        QVERIFY(lines.at(0).startsWith("{\"version\": 2, \"width\": 80, \"height\": 24"));
+        QVERIFY(lines.at(1).endsWith(", \"o\", \"$ \"]"));
+        QVERIFY(lines.at(2).endsWith(", \"o\", \"\xe4\xb8\xad\\r\\n\"]"));
+        QVERIFY(lines.at(3).endsWith(", \"i\", \"ls\\r\"]"));
+        QVERIFY(lines.at(4).endsWith(", \"r\", \"100x30\"]"));
+    }
+
+    void replayer()
+    {
+        QString fileName = QDir::temp().filePath("ptyqt_tests.rec");
+        PtyRecorder recorder;
+        recorder.setKeyframeInterval(1);
+        QVERIFY(recorder.start(fileName, 80, 24, PtyRecorder::BinaryFormat));
+        recorder.ptyOutput("first\r\n", 7);
+        QThread::msleep(5);
+        recorder.ptyOutput("\x1b[1msecond\x1b[0m\r\n", 16);
+        QThread::msleep(5);
+        recorder.ptyResized(100, 30);
+        recorder.ptyOutput("third", 5);
+        recorder.stop();
+
+        PtyReplayer replayer;
+        QVERIFY(replayer.open(fileName));
+        QVERIFY(replayer.keyframeCount() > 0);
+        QVERIFY(replayer.duration() >= 10);
+
+        QVERIFY(replayer.seek(replayer.duration()));
+        QCOMPARE(replayer.screen()->columns(), 100);
+        QCOMPARE(replayer.screen()->rowText(0), QString("first"));
+        QCOMPARE(replayer.screen()->rowText(1), QString("second"));
+        QCOMPARE(replayer.screen()->rowText(2), QString("third"));
+        QVERIFY(replayer.screen()->cell(1, 0).attributes & PtyScreen::Bold);
+
+        //backwards, to before the resize
+        QVERIFY(replayer.seek(7));
+        QCOMPARE(replayer.screen()->columns(), 80);
+        QCOMPARE(replayer.screen()->rowText(2), QString());
+
+        replayer.close();
+        QFile::remove(fileName);
+    }
+
+    void latencyHistogram()
+    {
+        //exact below 16ns, then 16 buckets per power of two
+        QCOMPARE(PtyHistogramSnapshot::bucketIndex(15), 15);
+        QCOMPARE(PtyHistogramSnapshot::bucketUpperBound(PtyHistogramSnapshot::bucketIndex(1000)), quint64(1023));
+        QCOMPARE(PtyHistogramSnapshot::bucketIndex(quint64(1) << 60), PtyHistogramSnapshot::bucketCount() - 1);
+
+        PtyHistogram histogram;
+        for (int i = 1; i <= 1000; i++)
+            histogram.record(i * 1000);
+        PtyHistogramSnapshot snapshot = histogram.snapshot();
+        QCOMPARE(snapshot.count, quint64(1000));
+        QCOMPARE(snapshot.max, quint64(1000000));
+        QCOMPARE(snapshot.mean(), quint64(500500));
+        //bucket bounds are within 1/16 of the value
+        QVERIFY(snapshot.percentile(50) >= 500000 && snapshot.percentile(50) <= 500000 * 17 / 16);
+        QVERIFY(snapshot.percentile(99) >= 990000 && snapshot.percentile(99) <= 1000000);
+        histogram.reset();
+        QCOMPARE(histogram.snapshot().count, quint64(0));
+
+        PtyLatency::reset();
+        PtyLatency::record(PtyLatency::EmitToRead, 3000);
+        QByteArray text = PtyLatency::toPrometheus();
+        QVERIFY(text.contains("# TYPE ptyqt_emit_to_read_seconds histogram"));
+        QVERIFY(text.contains("ptyqt_emit_to_read_seconds_bucket{le=\"+Inf\"} 1"));
+        QVERIFY(text.contains("ptyqt_emit_to_read_seconds_count 1"));
+        QVERIFY(text.contains("ptyqt_write_to_output_seconds_count 0"));
+        PtyLatency::reset();
+    }
+
+    void tracer()
+    {
+        PtyTracer::clear();
+        qint64 start = PtyTracer::now();
+        PtyTracer::complete("write", start, 42, "bytes", 5);
+        PtyTracer::instant("resize", 42, "cols", 80, "rows", 24);
+
+        //other threads get their own rings
+        std::thread thread([]() { PtyTracer::instant("readyRead", 43, "buffered", 7); });
+        thread.join();
+
+        QJsonParseError error;
+        QJsonDocument document = QJsonDocument::fromJson(PtyTracer::toChromeTrace(), &error);
+        QCOMPARE(error.error, QJsonParseError::NoError);
+        QJsonArray events = document.object().value("traceEvents").toArray();
+
+        QStringList names;
+        QSet<int> threads;
+        for (int i = 0; i < events.size(); i++)
+        {
+            QJsonObject event = events.at(i).toObject();
+            if (event.value("ph").toString() == "M")
+                continue;
+            names.append(event.value("name").toString());
+            threads.insert(event.value("tid").toInt());
+            if (event.value("name").toString() == "write")
+            {
+                QCOMPARE(event.value("ph").toString(), QString("X"));
+                QVERIFY(event.value("ts").toDouble() >= start / 1000);
+                QCOMPARE(event.value("args").toObject().value("session").toInt(), 42);
+                QCOMPARE(event.value("args").toObject().value("bytes").toInt(), 5);
+            }
+            if (event.value("name").toString() == "resize")
+                QCOMPARE(event.value("args").toObject().value("rows").toInt(), 24);
+        }
+        QCOMPARE(names.count("write"), 1);
+        QCOMPARE(names.count("resize"), 1);
+        QCOMPARE(names.count("readyRead"), 1);
+        QCOMPARE(threads.size(), 2);
+
+        PtyTracer::clear();
+        QVERIFY(!PtyTracer::toChromeTrace().contains("\"write\""));
+    }
+
+    void screenStream()
+    {
+        //output is fed by hand, no pty needed
+        PtyScreenStream stream(0);
+        stream.setMaxPendingBytes(4096);
+        PtyScreen viewerScreen(80, 24);
+
+        QList<QByteArray> updates;
+        QEventLoop el;
+        QObject::connect(&stream, &PtyScreenStream::update, [&updates, &viewerScreen, &el](int, const QByteArray &data) {
+            updates.append(data);
+            viewerScreen.feed(data.constData(), data.size());
+            el.quit();
+        });
+        auto waitForUpdate = [&el]() {
+            QTimer::singleShot(5000, &el, &QEventLoop::quit);
+            el.exec();
+        };
+
+        QByteArray text("\x1b[1;31mhello\x1b[0m\r\nworld\r\n");
+        stream.ptyOutput(text.constData(), text.size());
+        int viewer = stream.addViewer(0);
+        waitForUpdate();
+        QCOMPARE(updates.size(), 1);
+        QCOMPARE(stream.snapshotsSent(), qint64(1));
+        QCOMPARE(viewerScreen.rowText(0), QString("hello"));
+        QCOMPARE(viewerScreen.cell(0, 0).attributes, quint16(PtyScreen::Bold));
+
+        //one changed row goes as a row, not as a screen
+        text = "\x1b[10;1Hchanged";
+        stream.ptyOutput(text.constData(), text.size());
+        waitForUpdate();
+        QCOMPARE(updates.size(), 2);
+        QCOMPARE(stream.snapshotsSent(), qint64(1));
+        QVERIFY(updates.last().size() < 40);
+        QCOMPARE(viewerScreen.rowText(9), QString("changed"));
+        QCOMPARE(viewerScreen.rowText(1), QString("world"));
+        QCOMPARE(viewerScreen.cursorColumn(), stream.screen()->cursorColumn());
+
+        //slow viewer gets nothing until the transport catches up, then a snapshot
+        stream.viewerWritten(viewer, stream.pendingBytes(viewer));
+        stream.setMaxPendingBytes(1);
+        text = "\x1b[11;1Hmore";
+        stream.ptyOutput(text.constData(), text.size());
+        waitForUpdate();
+        text = "\x1b[12;1Hlost";
+        stream.ptyOutput(text.constData(), text.size());
+        QTimer::singleShot(100, &el, &QEventLoop::quit);
+        el.exec();
+        QCOMPARE(updates.size(), 3);
+        stream.viewerWritten(viewer, stream.pendingBytes(viewer));
+        waitForUpdate();
+        QCOMPARE(updates.size(), 4);
+        QCOMPARE(stream.snapshotsSent(), qint64(2));
+        QCOMPARE(viewerScreen.rowText(11), QString("lost"));
+        QCOMPARE(stream.updatesSent(), qint64(updates.size()));
+    }
+
+    void screenStreamRoundTrip()
+    {
+        //random output with wide characters (and halves of them overwritten), SGR runs, erased
+        //and wrapped rows; after every update the viewer has to see the screen of the stream
+        static const char *pieces[] = {
+            "hello ", "\r\n", "\t", "\x1b[H", "\x1b[2J", "\x1b[5;10H", "\x1b[K", "\x1b[3;1H\x1b[4mund\x1b[24m",
+            "\x1b[1;31mred\x1b[0m ", "\x1b[44m  bg  \x1b[0m", "\x1b[7minv\x1b[27m", "\x1b[1;2;3;4;5;9mall\x1b[0m",
+            "\x1b[38;2;1;2;3mtc\x1b[0m", "\x1b[38;5;200mp\x1b[0m", "\x1b[92mbr\x1b[0m", "\x1b[41m\x1b[K\x1b[0m",
+            "\xe4\xb8\xad\xe6\x96\x87", "\xc3\xa9", "\x1b[5;11Hx",
+            "012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789"
+        };
+        const int pieceCount = sizeof(pieces) / sizeof(pieces[0]);
+        std::srand(20240611);
+
+        PtyScreenStream stream(0);
+        PtyScreen viewerScreen(80, 24);
+        int viewer = stream.addViewer(0);
+        QObject::connect(&stream, &PtyScreenStream::update, [&stream, &viewerScreen](int id, const QByteArray &data) {
+            viewerScreen.feed(data.constData(), data.size());
+            stream.viewerWritten(id, data.size());
+        });
+
+        for (int i = 0; i < 300; i++)
+        {
+            int count = 1 + std::rand() % 4;
+            for (int j = 0; j < count; j++)
+            {
+                const char *piece = pieces[std::rand() % pieceCount];
+                stream.ptyOutput(piece, static_cast<qint64>(strlen(piece)));
+            }
+            if (std::rand() % 10 == 0)
+                stream.requestSnapshot(viewer);
+
+            QTRY_VERIFY_WITH_TIMEOUT(sameScreen(*stream.screen(), viewerScreen), 1000);
+        }
+        QVERIFY(stream.updatesSent() > stream.snapshotsSent());
+    }
+
     //unix unit tests
 #ifdef Q_OS_UNIX
     void unixpty()
@@ -170,6 +669,856 @@ private slots:
         sleepByEventLoop(1);
         QVERIFY(unixPty->resize(240, 90));
     }
+
+    void writeQueue()
+    {
+        int fds[2];
+        QCOMPARE(::pipe(fds), 0);
+        ::fcntl(fds[1], F_SETFL, ::fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+#ifdef F_SETPIPE_SZ
+        ::fcntl(fds[1], F_SETPIPE_SZ, 4096);
+#endif
+
+        //more than the pipe holds: writev() takes a part, the rest stays queued in order
+        PtyWriteQueue queue;
+        QByteArray expected;
+        for (int i = 0; i < 64; i++)
+        {
+            QByteArray chunk(1000 + i, static_cast<char>('a' + i % 26));
+            queue.append(chunk);
+            expected.append(chunk);
+        }
+        queue.append(QByteArray());
+        QCOMPARE(queue.size(), qint64(expected.size()));
+
+        QByteArray received;
+        qint64 written = queue.writeTo(fds[1]);
+        QVERIFY(written > 0);
+        QVERIFY(written < expected.size());
+        QCOMPARE(queue.size(), expected.size() - written);
+
+        //partial writes may end inside a chunk, the next writev() continues from there
+        char buffer[1500];
+        while (!queue.isEmpty())
+        {
+            ssize_t len = ::read(fds[0], buffer, sizeof(buffer));
+            QVERIFY(len > 0);
+            received.append(buffer, static_cast<int>(len));
+            QVERIFY(queue.writeTo(fds[1]) >= 0);
+        }
+        ::close(fds[1]);
+
+        ssize_t len;
+        while ((len = ::read(fds[0], buffer, sizeof(buffer))) > 0)
+            received.append(buffer, static_cast<int>(len));
+        ::close(fds[0]);
+        QCOMPARE(received, expected);
+    }
+
+    void unixptyWriteQueue()
+    {
+        UnixPtyProcess unixPty;
+        QVERIFY(unixPty.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+
+        QByteArray output;
+        qint64 written = 0;
+        bool watermarkReached = false;
+        bool drained = false;
+        QEventLoop el;
+        QObject::connect(unixPty.notifier(), &QIODevice::readyRead, [&unixPty, &el, &output]() {
+            output.append(unixPty.readAll());
+            if (output.contains("ptyqt_second_2"))
+                el.quit();
+        });
+        QObject::connect(&unixPty, &IPtyProcess::bytesWritten, [&written](qint64 bytes) { written += bytes; });
+        QObject::connect(&unixPty, &IPtyProcess::writeHighWatermarkReached, [&watermarkReached]() { watermarkReached = true; });
+        QObject::connect(&unixPty, &IPtyProcess::writeBufferDrained, [&drained]() { drained = true; });
+        QTimer::singleShot(10000, &el, &QEventLoop::quit);
+
+        //write never blocks, short input goes to the pty input queue right away
+        unixPty.write("true\n");
+        QCOMPARE(unixPty.bytesToWrite(), qint64(0));
+
+        //sleeping shell doesn't read: its input queue fills up and the rest waits in ours
+        //(expressions in the commands keep their echo from matching)
+        unixPty.setWriteHighWatermark(1);
+        QByteArray input = "sleep 1\n";
+        QByteArray filler;
+        while (filler.size() < 256 * 1024)
+            filler.append("#" + QByteArray(62, 'x') + "\n");
+        input.append(filler);
+        unixPty.write("sleep 1\n");
+        unixPty.write(filler);
+        QVERIFY(unixPty.bytesToWrite() > 0);
+
+        QByteArray first = "echo ptyqt_first_$((0 + 1))\n";
+        QByteArray second = "echo ptyqt_second_$((1 + 1))\n";
+        input.append(first);
+        input.append(second);
+        unixPty.write(first);
+        unixPty.write(second);
+        el.exec();
+
+        //queued writes went in the order of write() calls and were all reported
+        QVERIFY(output.contains("ptyqt_first_1"));
+        QVERIFY(output.indexOf("ptyqt_first_1") < output.indexOf("ptyqt_second_2"));
+        QCOMPARE(unixPty.bytesToWrite(), qint64(0));
+        QCOMPARE(written, qint64(input.size()));
+        QVERIFY(watermarkReached);
+        QVERIFY(drained);
+    }
+
+    void unixptyReadBackpressure()
+    {
+        const qint64 limit = 4096;
+        UnixPtyProcess unixPty;
+        unixPty.setReadBufferLimit(limit);
+        QVERIFY(unixPty.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+
+        PtySpan spans[2];
+        auto buffered = [&unixPty, &spans]() -> qint64 {
+            int count = unixPty.peek(spans);
+            return (count > 0 ? spans[0].size : 0) + (count > 1 ? spans[1].size : 0);
+        };
+
+        //far more output than the limit: nobody reads, so the pty stops reading at the limit
+        unixPty.write("yes ptyqt_flood | head -n 20000; echo ptyqt_flood_$((40 + 2))\n");
+        sleepByEventLoop(1);
+        qint64 size = buffered();
+        QVERIFY(size > 0);
+        QVERIFY(size <= limit);
+
+        //room made by consume() is filled again
+        unixPty.consume(size);
+        QCOMPARE(buffered(), qint64(0));
+        sleepByEventLoop(1);
+        QVERIFY(buffered() > 0);
+        QVERIFY(buffered() <= limit);
+
+        //and readAll() lets the rest of the flood through, never over the limit
+        QByteArray output;
+        qint64 maxBuffered = 0;
+        QEventLoop el;
+        QObject::connect(unixPty.notifier(), &QIODevice::readyRead, [&unixPty, &el, &output, &maxBuffered, &buffered]() {
+            maxBuffered = qMax(maxBuffered, buffered());
+            output.append(unixPty.readAll());
+            if (output.contains("ptyqt_flood_42"))
+                el.quit();
+        });
+        QTimer::singleShot(10000, &el, &QEventLoop::quit);
+        output.append(unixPty.readAll());
+        el.exec();
+
+        QVERIFY(output.contains("ptyqt_flood_42"));
+        QVERIFY(output.count("ptyqt_flood\r\n") > 1000);
+        QVERIFY(maxBuffered <= limit);
+    }
+
+    void unixptyReadLoop()
+    {
+        const qint64 cap = 16 * 1024;
+        const qint64 flood = 1024 * 1024;
+        UnixPtyProcess unixPty;
+        unixPty.setMaxBytesPerWakeup(cap);
+        QCOMPARE(unixPty.maxBytesPerWakeup(), cap);
+        QVERIFY(unixPty.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+        sleepByEventLoop(1); //prompt
+        PtyStatsSnapshot before = unixPty.stats();
+
+        //readyRead per wakeup: each readAll() gets what one wakeup read
+        QByteArray output;
+        qint64 zeros = 0;
+        qint64 maxChunk = 0;
+        QEventLoop el;
+        QObject::connect(unixPty.notifier(), &QIODevice::readyRead, [&]() {
+            QByteArray data = unixPty.readAll();
+            maxChunk = qMax<qint64>(maxChunk, data.size());
+            zeros += data.count('\0');
+            output.append(data);
+            if (output.contains("ptyqt_flood_42"))
+                el.quit();
+        });
+        QTimer::singleShot(10000, &el, &QEventLoop::quit);
+        unixPty.write("head -c 1048576 /dev/zero; echo ptyqt_flood_$((40 + 2))\n");
+        el.exec();
+        QVERIFY(output.contains("ptyqt_flood_42"));
+        QCOMPARE(zeros, flood);
+
+        //reads grow to what the kernel gives, not a syscall per KB
+        PtyStatsSnapshot stats = unixPty.stats();
+        qint64 bytesRead = stats.bytesRead - before.bytesRead;
+        QVERIFY(bytesRead >= flood);
+        QVERIFY(stats.readCalls - before.readCalls < bytesRead / 1024);
+
+        //no wakeup takes more than the cap, the event loop gets back in between
+        QVERIFY(maxChunk <= cap);
+        QVERIFY(stats.maxBufferedBytes <= cap);
+        QVERIFY(stats.wakeups - before.wakeups >= flood / cap);
+
+        QVERIFY(unixPty.kill());
+    }
+
+    void unixptyCoalescing()
+    {
+        UnixPtyProcess unixPty;
+        QVERIFY(unixPty.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+
+        QByteArray output;
+        QByteArray marker;
+        int readyReads = 0;
+        QEventLoop el;
+        QObject::connect(unixPty.notifier(), &QIODevice::readyRead, [&]() {
+            readyReads++;
+            output.append(unixPty.readAll());
+            if (!marker.isEmpty() && output.contains(marker))
+                el.quit();
+        });
+        QTimer guard;
+        guard.setSingleShot(true);
+        QObject::connect(&guard, &QTimer::timeout, &el, &QEventLoop::quit);
+        QElapsedTimer elapsed;
+        auto run = [&](const QByteArray &command, const QByteArray &until) {
+            output.clear();
+            readyReads = 0;
+            marker = until;
+            elapsed.start();
+            guard.start(10000);
+            unixPty.write(command);
+            el.exec();
+            marker.clear();
+            return output.contains(until);
+        };
+        sleepByEventLoop(1); //prompt
+
+        //same paced output: readyRead per line, then one for all of them
+        QByteArray ticks("for i in 1 2 3 4 5 6 7 8; do echo tick_$i; sleep 0.02; done; echo ptyqt_ticks_$((40 + 2))\n");
+        QVERIFY(run(ticks, "ptyqt_ticks_42"));
+        int plain = readyReads;
+        QVERIFY(plain >= 8);
+        unixPty.setOutputCoalescing(64 * 1024, 500 * 1000);
+        QVERIFY(run(ticks, "ptyqt_ticks_42"));
+        QVERIFY(readyReads <= 3);
+        QVERIFY(readyReads < plain);
+
+        //echo of input is not held for the delay
+        unixPty.setOutputCoalescing(64 * 1024, 10 * 1000 * 1000);
+        QVERIFY(run("echo ptyqt_echo\n", "ptyqt_echo"));
+        QVERIFY(elapsed.elapsed() < 1000);
+
+        //byte threshold flushes before the delay
+        unixPty.setOutputCoalescing(64, 10 * 1000 * 1000);
+        QVERIFY(run("sleep 0.1; printf '%0100d ptyqt_bytes_%d\\n' 0 42\n", "ptyqt_bytes_42"));
+        QVERIFY(elapsed.elapsed() < 5000);
+
+        //small output waits for the timer
+        unixPty.setOutputCoalescing(64 * 1024, 300 * 1000);
+        QVERIFY(run("sleep 0.1; echo ptyqt_timer_$((40 + 2))\n", "ptyqt_timer_42"));
+        QVERIFY(elapsed.elapsed() >= 300);
+
+        //turning coalescing off flushes held output at once
+        unixPty.setOutputCoalescing(64 * 1024, 10 * 1000 * 1000);
+        unixPty.write("sleep 0.1; echo ptyqt_held_$((40 + 2))\n");
+        output.clear();
+        sleepByEventLoop(1);
+        QVERIFY(!output.contains("ptyqt_held_42"));
+        unixPty.setOutputCoalescing(0, 0);
+        QVERIFY(output.contains("ptyqt_held_42"));
+
+        QVERIFY(unixPty.kill());
+    }
+
+    void unixptySpawnEngines()
+    {
+        QString shellPath = "/bin/sh";
+
+        QList<PtySpawner::Engine> engines;
+        engines << PtySpawner::ForkEngine << PtySpawner::VForkEngine << PtySpawner::PosixSpawnEngine;
+        foreach (PtySpawner::Engine engine, engines)
+        {
+            UnixPtyProcess unixPty;
+            unixPty.setSpawnEngine(engine);
+            bool startResult = unixPty.startProcess(shellPath, QProcessEnvironment::systemEnvironment().toStringList(), 200, 80);
+            if (!startResult)
+                qDebug() << engine << unixPty.lastError();
+            QVERIFY(startResult);
+            QVERIFY(unixPty.pid() != 0);
+
+            //shell has controlling tty and exit is reported like QProcess does
+            QByteArray output;
+            int exitCode = -1;
+            QEventLoop el;
+            QProcess *shellProcess = qobject_cast<QProcess *>(unixPty.notifier());
+            QObject::connect(shellProcess, &QIODevice::readyRead, [&unixPty, &output]() {
+                output.append(unixPty.readAll());
+            });
+            QObject::connect(shellProcess, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+                             [&el, &exitCode](int code, QProcess::ExitStatus) { exitCode = code; el.quit(); });
+            QTimer::singleShot(5000, &el, &QEventLoop::quit);
+            //stdin is the pty slave, and /dev/tty opens only for a process with a controlling tty
+            unixPty.write("tty && : < /dev/tty && echo ptyqt_spawn_$((40 + 2)) && exit 3\n");
+            el.exec();
+
+            QVERIFY(output.contains("ptyqt_spawn_42"));
+#ifdef Q_OS_MAC
+            QVERIFY(output.contains("/dev/ttys"));
+#else
+            QVERIFY(output.contains("/dev/pts/"));
+#endif
+            QCOMPARE(exitCode, 3);
+        }
+    }
+
+    void unixptyAsyncStart()
+    {
+        QString shellPath = "/bin/sh";
+
+        QList<PtySpawner::Engine> engines;
+        engines << PtySpawner::QProcessEngine << PtySpawner::PosixSpawnEngine;
+        foreach (PtySpawner::Engine engine, engines)
+        {
+            UnixPtyProcess unixPty;
+            unixPty.setSpawnEngine(engine);
+
+            bool started = false;
+            QString error;
+            QEventLoop el;
+            QObject::connect(&unixPty, &IPtyProcess::started, [&el, &started]() { started = true; el.quit(); });
+            QObject::connect(&unixPty, &IPtyProcess::errorOccurred, [&el, &error](const QString &e) { error = e; el.quit(); });
+            QTimer::singleShot(5000, &el, &QEventLoop::quit);
+
+            //returns at once, no pid before started()
+            unixPty.startProcessAsync(shellPath, QProcessEnvironment::systemEnvironment().toStringList(), 200, 80);
+            QCOMPARE(unixPty.pid(), qint64(0));
+            el.exec();
+
+            QVERIFY2(started, qPrintable(error));
+            QVERIFY(unixPty.pid() != 0);
+            QVERIFY(unixPty.kill());
+        }
+
+        //errors are reported by signal too
+        UnixPtyProcess badPty;
+        QString error;
+        QEventLoop el;
+        QObject::connect(&badPty, &IPtyProcess::errorOccurred, [&el, &error](const QString &e) { error = e; el.quit(); });
+        badPty.startProcessAsync("relative/shell", QStringList(), 200, 80);
+        el.exec();
+        QVERIFY(!error.isEmpty());
+    }
+
+    void sessionPool()
+    {
+        QString shellPath = "/bin/sh";
+        QString cwd = QDir::tempPath();
+
+        PtySessionPool pool(IPtyProcess::UnixPty);
+        QEventLoop el;
+        QObject::connect(&pool, &PtySessionPool::refilled, &el, &QEventLoop::quit);
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        pool.setWarmCount(shellPath, cwd, 200, 80, 1);
+        el.exec();
+        QCOMPARE(pool.warmCount(shellPath, cwd, 200, 80), 1);
+
+        //warm one is taken and replaced in background, another size is a miss
+        QScopedPointer<IPtyProcess> warm(pool.acquire(shellPath, cwd, 200, 80));
+        QVERIFY(!warm.isNull());
+        QCOMPARE(warm->size().first, qint16(200));
+        QScopedPointer<IPtyProcess> cold(pool.acquire(shellPath, cwd, 100, 40));
+        QVERIFY(!cold.isNull());
+        QCOMPARE(pool.hitCount(), quint64(1));
+        QCOMPARE(pool.missCount(), quint64(1));
+
+        el.exec();
+        QCOMPARE(pool.warmCount(shellPath, cwd, 200, 80), 1);
+
+        //failed start is retried later: the shell shows up after the first attempt
+        QString lateShell = QDir::temp().filePath(QString("ptyqt-late-shell-%1").arg(QCoreApplication::applicationPid()));
+        QFile::remove(lateShell);
+        pool.setWarmCount(lateShell, cwd, 200, 80, 1);
+        QTRY_COMPARE_WITH_TIMEOUT(pool.startFailureCount(), quint64(1), 5000);
+        QVERIFY(QFile::link(shellPath, lateShell));
+        QTRY_COMPARE_WITH_TIMEOUT(pool.warmCount(lateShell, cwd, 200, 80), 1, 5000);
+        QCOMPARE(pool.startFailureCount(), quint64(1));
+        pool.clear();
+        QFile::remove(lateShell);
+    }
+
+    void unixptyStats()
+    {
+        PtyStatsSnapshot before = PtyStats::global();
+        PtyLatency::reset();
+        PtyLatency::setEnabled(true);
+
+        UnixPtyProcess unixPty;
+        QVERIFY(unixPty.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+        QVERIFY(unixPty.stats().spawnTimeUsec > 0);
+
+        QByteArray output;
+        QEventLoop el;
+        QObject::connect(unixPty.notifier(), &QIODevice::readyRead, [&unixPty, &output, &el]() {
+            output.append(unixPty.readAll());
+            if (output.contains("ptyqt_stats_42"))
+                el.quit();
+        });
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        QByteArray command("echo ptyqt_stats_$((40 + 2))\n");
+        unixPty.write(command);
+        el.exec();
+        QVERIFY(output.contains("ptyqt_stats_42"));
+
+        PtyStatsSnapshot stats = unixPty.stats();
+        QCOMPARE(stats.sessions, 1);
+        QCOMPARE(stats.bytesWritten, qint64(command.size()));
+        QVERIFY(stats.bytesRead >= output.size());
+        QVERIFY(stats.readCalls >= stats.wakeups && stats.wakeups > 0);
+        QVERIFY(stats.readyReadEmitted > 0);
+        QVERIFY(stats.maxBufferedBytes > 0 && stats.averageBufferedBytes() <= stats.maxBufferedBytes);
+        QVERIFY(unixPty.dumpDebugInfo().contains("BytesRead"));
+
+        //echo of the command went through all measured stages
+        PtyLatency::setEnabled(false);
+        QVERIFY(PtyLatency::histogram(PtyLatency::WriteToOutput).count > 0);
+        QVERIFY(PtyLatency::histogram(PtyLatency::ReadyToEmit).count > 0);
+        QVERIFY(PtyLatency::histogram(PtyLatency::EmitToRead).count > 0);
+
+        //process-wide sum includes this session
+        PtyStatsSnapshot global = PtyStats::global();
+        QVERIFY(global.bytesRead >= before.bytesRead + stats.bytesRead);
+        QVERIFY(global.sessions >= before.sessions + 1);
+    }
+
+    void unixptyTrace()
+    {
+        PtyTracer::clear();
+
+        UnixPtyProcess unixPty;
+        QVERIFY(unixPty.toggleTrace());
+        QVERIFY(unixPty.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+
+        QByteArray output;
+        QEventLoop el;
+        QObject::connect(unixPty.notifier(), &QIODevice::readyRead, [&unixPty, &output, &el]() {
+            output.append(unixPty.readAll());
+            if (output.contains("ptyqt_trace_42"))
+                el.quit();
+        });
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        unixPty.write("echo ptyqt_trace_$((40 + 2))\n");
+        el.exec();
+        QVERIFY(output.contains("ptyqt_trace_42"));
+        QVERIFY(unixPty.resize(100, 40));
+        QVERIFY(unixPty.kill());
+
+        QByteArray trace = PtyTracer::toChromeTrace();
+        QVERIFY(trace.contains("\"spawn\""));
+        QVERIFY(trace.contains("\"read\""));
+        QVERIFY(trace.contains("\"write\""));
+        QVERIFY(trace.contains("\"resize\""));
+        QVERIFY(trace.contains("\"kill\""));
+        QVERIFY(trace.contains("\"readyRead\""));
+        PtyTracer::clear();
+    }
+
+    void unixptyRelay()
+    {
+        UnixPtyProcess unixPty;
+        QVERIFY(unixPty.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+
+        PtyRelay relay(&unixPty);
+        relay.setFrameLimits(16, 1000);
+
+        QByteArray output;
+        int frames = 0;
+        bool oversized = false;
+        QEventLoop el;
+        QObject::connect(&relay, &PtyRelay::frameReady, [&output, &frames, &oversized, &el](const QByteArray &frame) {
+            frames++;
+            oversized |= frame.size() > 16;
+            output.append(frame);
+            if (output.contains("ptyqt_relay_42"))
+                el.quit();
+        });
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        relay.writeInput("echo ptyqt_relay_$((40 + 2))\n");
+        el.exec();
+        QVERIFY(output.contains("ptyqt_relay_42"));
+        QVERIFY(!oversized);
+        QCOMPARE(relay.framesSent(), qint64(frames));
+        QCOMPARE(relay.bytesSent(), qint64(output.size()));
+
+        //nothing was written by the transport: next frame pauses reading until it catches up
+        QVERIFY(!unixPty.isReadingPaused());
+        relay.setMaxPendingBytes(relay.pendingBytes());
+        relay.writeInput("\n");
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        QObject::connect(&relay, &PtyRelay::frameReady, &el, &QEventLoop::quit);
+        el.exec();
+        QVERIFY(unixPty.isReadingPaused());
+        relay.framesWritten(relay.pendingBytes());
+        QCOMPARE(relay.pendingBytes(), qint64(0));
+        QVERIFY(!unixPty.isReadingPaused());
+
+        //relay which doesn't read the pty leaves its flow control to the reader
+        QList<bool> throttled;
+        QObject::connect(&relay, &PtyRelay::throttled, [&throttled](bool paused) { throttled.append(paused); });
+        relay.setReadsPty(false);
+        relay.setMaxPendingBytes(1);
+        relay.relayOutput("ptyqt_relay_output");
+        relay.flush();
+        QVERIFY(relay.pendingBytes() > 1);
+        QVERIFY(!unixPty.isReadingPaused());
+        QCOMPARE(throttled, QList<bool>() << true);
+        relay.framesWritten(relay.pendingBytes());
+        QCOMPARE(throttled, QList<bool>() << true << false);
+
+        //deleted relay resumes the pty it paused
+        PtyRelay *pausingRelay = new PtyRelay(&unixPty);
+        pausingRelay->setMaxPendingBytes(1);
+        QObject::connect(pausingRelay, &PtyRelay::frameReady, &el, &QEventLoop::quit);
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        pausingRelay->writeInput("\n");
+        el.exec();
+        QVERIFY(unixPty.isReadingPaused());
+        delete pausingRelay;
+        QVERIFY(!unixPty.isReadingPaused());
+
+        QVERIFY(unixPty.kill());
+    }
+
+    void unixptyBroadcast()
+    {
+        for (int policy = PtyBroadcaster::DropSlow; policy <= PtyBroadcaster::SnapshotSlow; policy++)
+        {
+            UnixPtyProcess unixPty;
+            QVERIFY(unixPty.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+
+            PtyBroadcaster broadcaster(&unixPty, static_cast<PtyBroadcaster::SlowPolicy>(policy));
+            broadcaster.setMaxBufferedBytes(4096);
+            broadcaster.setWindowBytes(1024);
+            int fast = broadcaster.subscribe();
+            int other = broadcaster.subscribe();
+            FakeWebSocket slowSocket;
+            int slow = broadcaster.subscribeWebSocket(&slowSocket); //never reports written bytes
+
+            QByteArray fastOutput;
+            QByteArray slowOutput;
+            QList<const char *> fastBuffers;
+            int sharedBuffers = 0;
+            int dropped = 0;
+            QEventLoop el;
+            QObject::connect(&broadcaster, &PtyBroadcaster::chunkReady,
+                             [&](int subscriber, const QByteArray &chunk) {
+                if (subscriber == fast)
+                {
+                    fastOutput.append(chunk);
+                    fastBuffers.append(chunk.constData());
+                    broadcaster.written(fast, chunk.size());
+                    if (fastOutput.contains("ptyqt_broadcast_42"))
+                        el.quit();
+                }
+                else if (subscriber == other)
+                {
+                    //same chunk, same buffer
+                    if (fastBuffers.contains(chunk.constData()))
+                        sharedBuffers++;
+                    broadcaster.written(other, chunk.size());
+                }
+                else
+                {
+                    slowOutput = chunk;
+                }
+            });
+            QObject::connect(&broadcaster, &PtyBroadcaster::subscriberDropped, [&dropped, slow](int subscriber) {
+                if (subscriber == slow)
+                    dropped++;
+            });
+
+            QTimer::singleShot(10000, &el, &QEventLoop::quit);
+            unixPty.write("i=0; while [ $i -lt 2000 ]; do echo line_$i; i=$((i+1)); done; echo ptyqt_broadcast_$((40 + 2))\n");
+            el.exec();
+            QVERIFY(fastOutput.contains("line_1999"));
+            QVERIFY(fastOutput.contains("ptyqt_broadcast_42"));
+            QVERIFY(sharedBuffers > 0);
+
+            //memory is bounded whatever the slow subscriber does
+            QVERIFY(broadcaster.bufferedBytes() <= 4096 + 64 * 1024);
+            if (policy == PtyBroadcaster::DropSlow)
+            {
+                QCOMPARE(dropped, 1);
+                QCOMPARE(broadcaster.subscriberCount(), 2);
+                QVERIFY(slowSocket.closed);
+            }
+            else
+            {
+                QCOMPARE(dropped, 0);
+                QCOMPARE(broadcaster.subscriberCount(), 3);
+                QVERIFY(!slowSocket.closed);
+                QVERIFY(broadcaster.lag(slow) <= 4096);
+
+                //skipped to the head: gets the screen as it is now once it catches up
+                broadcaster.written(slow, 1024 * 1024);
+                QCOMPARE(broadcaster.snapshotCount(), qint64(4));
+                QVERIFY(slowOutput.startsWith("\x1b[8;"));
+                QVERIFY(slowOutput.contains("ptyqt_broadcast_42"));
+            }
+
+            QVERIFY(unixPty.kill());
+        }
+    }
+
+    void unixptySessionManager()
+    {
+        for (int mode = PtySessionManager::ReplayTail; mode <= PtySessionManager::ReplayScreen; mode++)
+        {
+            PtySessionManager manager(static_cast<PtySessionManager::ReplayMode>(mode));
+            UnixPtyProcess *unixPty = new UnixPtyProcess();
+            QVERIFY(unixPty->startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+
+            //screen of the session only watches the output, the manager reads it
+            PtyScreenStream *stream = new PtyScreenStream(unixPty, unixPty);
+            stream->setReadsPty(false);
+
+            QString id = manager.addSession(unixPty);
+            QVERIFY(!id.isEmpty());
+            QVERIFY(manager.addSession(unixPty, id).isEmpty());
+            QCOMPARE(manager.session(id), static_cast<IPtyProcess *>(unixPty));
+
+            QByteArray output;
+            QEventLoop el;
+            QObject::connect(&manager, &PtySessionManager::output, [&output, &el, id](const QString &session, const QByteArray &data) {
+                if (session != id)
+                    return;
+                output.append(data);
+                if (output.contains("ptyqt_attached_42") || output.contains("ptyqt_reattached_42"))
+                    el.quit();
+            });
+
+            QByteArray replay;
+            QVERIFY(manager.attach(id, &replay));
+            QVERIFY(manager.isAttached(id));
+            QTimer::singleShot(5000, &el, &QEventLoop::quit);
+            unixPty->write("echo ptyqt_attached_$((40 + 2))\n");
+            el.exec();
+            QVERIFY(output.contains("ptyqt_attached_42"));
+            bool onScreen = false;
+            for (int row = 0; row < stream->screen()->rows(); row++)
+                onScreen |= stream->screen()->rowText(row).contains("ptyqt_attached_42");
+            QVERIFY(onScreen);
+
+            //client is gone, shell goes on: its output is kept for the replay only
+            manager.detach(id);
+            QVERIFY(!manager.isAttached(id));
+            output.clear();
+            QObject::connect(unixPty->notifier(), &QIODevice::readyRead, &el, [&manager, &replay, &el, id]() {
+                //manager took the output already
+                manager.attach(id, &replay);
+                if (replay.contains("ptyqt_detached_42"))
+                    el.quit();
+                else
+                    manager.detach(id);
+            });
+            QTimer::singleShot(5000, &el, &QEventLoop::quit);
+            unixPty->write("echo ptyqt_detached_$((40 + 2))\n");
+            el.exec();
+            unixPty->notifier()->disconnect(&el);
+            QVERIFY(manager.isAttached(id));
+            QVERIFY(replay.contains("ptyqt_attached_42"));
+            QVERIFY(replay.contains("ptyqt_detached_42"));
+            if (mode == PtySessionManager::ReplayScreen)
+                QVERIFY(replay.startsWith("\x1b[8;80;200t"));
+            QVERIFY(!output.contains("ptyqt_detached_42"));
+
+            //reattached client gets the output again
+            QTimer::singleShot(5000, &el, &QEventLoop::quit);
+            unixPty->write("echo ptyqt_reattached_$((40 + 2))\n");
+            el.exec();
+            QVERIFY(output.contains("ptyqt_reattached_42"));
+
+            //slow client pauses the attached session only, detach() resumes it
+            manager.setAttachedPaused(id, true);
+            QVERIFY(unixPty->isReadingPaused());
+            manager.detach(id);
+            QVERIFY(!unixPty->isReadingPaused());
+            manager.setAttachedPaused(id, true);
+            QVERIFY(!unixPty->isReadingPaused());
+
+            QStringList finished;
+            QObject::connect(&manager, &PtySessionManager::sessionFinished, [&finished, &el](const QString &session) {
+                finished.append(session);
+                el.quit();
+            });
+            manager.killSession(id);
+            QCOMPARE(finished, QStringList() << id);
+            QCOMPARE(manager.sessionCount(), 0);
+            QVERIFY(!manager.contains(id));
+
+            //detached session is killed after the timeout
+            manager.setDetachedTimeout(100);
+            unixPty = new UnixPtyProcess();
+            QVERIFY(unixPty->startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+            QString expiring = manager.addSession(unixPty, "expiring");
+            QCOMPARE(expiring, QString("expiring"));
+            QTimer::singleShot(5000, &el, &QEventLoop::quit);
+            el.exec();
+            QCOMPARE(finished, QStringList() << id << expiring);
+            QCOMPARE(manager.sessionCount(), 0);
+        }
+    }
+
+    void unixptyHost()
+    {
+#ifndef PTYQT_HOSTD_PATH
+        QSKIP("ptyqt-hostd is built by CMake only");
+#else
+        QString socketPath = QDir::temp().filePath(QString("ptyqt-hostd-test-%1").arg(QCoreApplication::applicationPid()));
+        QProcess hostd;
+        hostd.start(PTYQT_HOSTD_PATH, QStringList() << "--socket" << socketPath);
+        QVERIFY(hostd.waitForStarted());
+        for (int i = 0; i < 50 && !QFile::exists(socketPath); i++)
+            QThread::msleep(100);
+
+        qputenv("PTYQT_HOSTD_SOCKET", QFile::encodeName(socketPath));
+        QScopedPointer<IPtyProcess> pty(PtyQt::createPtyProcess(IPtyProcess::HostPty));
+        qunsetenv("PTYQT_HOSTD_SOCKET");
+        QCOMPARE(pty->type(), IPtyProcess::HostPty);
+        QVERIFY2(pty->startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80),
+                 qPrintable(pty->lastError()));
+        QVERIFY(pty->pid() > 0);
+
+        QByteArray output;
+        QEventLoop el;
+        auto waitFor = [&output, &el](IPtyProcess *process, const QByteArray &marker) {
+            QMetaObject::Connection connection = QObject::connect(process->notifier(), &QIODevice::readyRead, [&output, &el, process, marker]() {
+                output.append(process->readAll());
+                if (output.contains(marker))
+                    el.quit();
+            });
+            QTimer::singleShot(5000, &el, &QEventLoop::quit);
+            el.exec();
+            QObject::disconnect(connection);
+        };
+
+        pty->write("echo ptyqt_host_$((40 + 2))\n");
+        waitFor(pty.data(), "ptyqt_host_42");
+        QVERIFY(output.contains("ptyqt_host_42"));
+
+        //our process "restarts": the object goes, the shell stays in the daemon
+        quint32 id = static_cast<HostPtyProcess *>(pty.data())->sessionId();
+        qint64 pid = pty->pid();
+        QVERIFY(id != 0);
+        pty.reset();
+        QVERIFY(HostPtyProcess::sessionIds(socketPath).contains(id));
+
+        HostPtyProcess reattached(socketPath);
+        QVERIFY2(reattached.attach(id), qPrintable(reattached.lastError()));
+        QCOMPARE(reattached.pid(), pid);
+        QCOMPARE(reattached.size(), qMakePair(qint16(200), qint16(80)));
+        QVERIFY(!HostPtyProcess(socketPath).attach(id)); //one client per session
+
+        //resize goes to the pty right from the client
+        QVERIFY(reattached.resize(100, 40));
+        output.clear();
+        reattached.write("stty size; echo ptyqt_reattached_$((40 + 2))\n");
+        waitFor(&reattached, "ptyqt_reattached_42");
+        QVERIFY(output.contains("40 100"));
+
+        //exit code comes from the daemon
+        bool finished = false;
+        QObject::connect(reattached.notifier(), &QIODevice::readChannelFinished, [&finished, &el]() {
+            finished = true;
+            el.quit();
+        });
+        reattached.write("exit 3\n");
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        el.exec();
+        QVERIFY(finished);
+        QCOMPARE(reattached.exitCode(), 3);
+        QVERIFY(!HostPtyProcess::sessionIds(socketPath).contains(id));
+
+        HostPtyProcess killed(socketPath);
+        QVERIFY(killed.startProcess("/bin/sh", QProcessEnvironment::systemEnvironment().toStringList(), 200, 80));
+        QVERIFY(killed.kill());
+        QVERIFY(HostPtyProcess::sessionIds(socketPath).isEmpty());
+
+        hostd.terminate();
+        QVERIFY(hostd.waitForFinished());
+#endif
+    }
+#endif
+
+#ifdef Q_OS_LINUX
+    void reactorpty()
+    {
+        QString shellPath = "/bin/sh";
+
+        QScopedPointer<IPtyProcess> reactorPty(PtyQt::createPtyProcess(IPtyProcess::ReactorPty));
+        QCOMPARE(reactorPty->type(), IPtyProcess::ReactorPty);
+
+        bool startResult = reactorPty->startProcess(shellPath, QProcessEnvironment::systemEnvironment().toStringList(), 200, 80);
+        if (!startResult)
+            qDebug() << reactorPty->lastError();
+        QVERIFY(startResult);
+        QVERIFY(reactorPty->pid() != 0);
+
+        //data comes from reactor threads, readyRead - from our one
+        //(expression in the command keeps its echo from matching)
+        QByteArray output;
+        QEventLoop el;
+        auto connection = QObject::connect(reactorPty->notifier(), &QIODevice::readyRead, [&reactorPty, &el, &output]() {
+            output.append(reactorPty->readAll());
+            if (output.contains("ptyqt_reactor_42"))
+                el.quit();
+        });
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        reactorPty->write("echo ptyqt_reactor_$((40 + 2))\n");
+        el.exec();
+        reactorPty->notifier()->disconnect(connection);
+        QVERIFY(output.contains("ptyqt_reactor_42"));
+
+        QVERIFY(reactorPty->resize(240, 90));
+        QVERIFY(reactorPty->kill());
+    }
+
+    void reactorptyFairness()
+    {
+        QString shellPath = "/bin/sh";
+        QStringList environment = QProcessEnvironment::systemEnvironment().toStringList();
+
+        //one worker: the noisy session has to give it up between its turns
+        PtyReactor reactor(1);
+        QVERIFY(reactor.start());
+
+        ReactorPtyProcess noisy(&reactor);
+        QVERIFY(noisy.startProcess(shellPath, environment, 200, 80));
+        reactor.setSessionMaxBytesPerTurn(noisy.sessionId(), 1024);
+        qint64 noise = 0;
+        QObject::connect(noisy.notifier(), &QIODevice::readyRead, [&noisy, &noise]() {
+            noise += noisy.readAll().size();
+        });
+        noisy.write("yes ptyqt_noise\n");
+        QTRY_VERIFY_WITH_TIMEOUT(noise > 1024 * 1024, 10000);
+
+        //turn over the cap goes to the back of the queue, the interactive session still gets its echo
+        ReactorPtyProcess interactive(&reactor);
+        QVERIFY(interactive.startProcess(shellPath, environment, 200, 80));
+        QByteArray output;
+        QEventLoop el;
+        QObject::connect(interactive.notifier(), &QIODevice::readyRead, [&interactive, &el, &output]() {
+            output.append(interactive.readAll());
+            if (output.contains("ptyqt_fair_42"))
+                el.quit();
+        });
+        QTimer::singleShot(5000, &el, &QEventLoop::quit);
+        interactive.write("echo ptyqt_fair_$((40 + 2))\n");
+        el.exec();
+        QVERIFY(output.contains("ptyqt_fair_42"));
+        QVERIFY(reactor.requeueCount() > 0);
+        //nobody to steal from
+        QCOMPARE(reactor.stealCount(), quint64(0));
+
+        QVERIFY(interactive.kill());
+        QVERIFY(noisy.kill());
+    }
 #endif
 
     //windows unit tests